@@ -41,6 +41,7 @@ authd_cmd_handler authd_cmd_handlers[256] = {
 };
 
 authd_stat_handler authd_stat_handlers[256] = {
+	['C'] = report_dns_cache,
 	['D'] = enumerate_nameservers,
 };
 
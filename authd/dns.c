@@ -295,6 +295,17 @@ enumerate_nameservers(uint32_t rid, const char letter)
 	stats_result(rid, letter, "%s", buf);
 }
 
+void
+report_dns_cache(uint32_t rid, const char letter)
+{
+	struct dns_cache_stats stats;
+
+	get_dns_cache_stats(&stats);
+	stats_result(rid, letter, "%lu %lu %lu %lu %lu %lu",
+			stats.entries, stats.hits, stats.negative_hits,
+			stats.misses, stats.coalesced, stats.evictions);
+}
+
 void
 reload_nameservers(const char letter)
 {
@@ -56,6 +56,7 @@ extern void cancel_query(struct dns_query *query);
 
 extern void handle_resolve_dns(int parc, char *parv[]);
 extern void enumerate_nameservers(uint32_t rid, const char letter);
+extern void report_dns_cache(uint32_t rid, const char letter);
 extern void reload_nameservers(const char letter);
 
 #endif
@@ -61,6 +61,7 @@ rb_dlink_list auth_providers;
 static rb_dlink_list free_pids;
 static uint32_t allocated_pids;
 static struct ev_entry *timeout_ev;
+static struct rb_timer_heap provider_timeouts;	/* running providers by timeout */
 
 /* Set a provider's raw status */
 static inline void
@@ -75,6 +76,10 @@ set_provider_running(struct auth_client *auth, uint32_t provider)
 {
 	auth->providers_active++;
 	set_provider_status(auth, provider, PROVIDER_STATUS_RUNNING);
+
+	if(auth->data[provider].timeout > 0)
+		rb_timer_heap_add(&provider_timeouts, &auth->data[provider].timer,
+			auth->data[provider].timeout);
 }
 
 /* Provider is no longer operating on this auth client */
@@ -83,6 +88,21 @@ set_provider_done(struct auth_client *auth, uint32_t provider)
 {
 	set_provider_status(auth, provider, PROVIDER_STATUS_DONE);
 	auth->providers_active--;
+
+	rb_timer_heap_del(&provider_timeouts, &auth->data[provider].timer);
+}
+
+/* Set timeout value in absolute time (Unix timestamp)
+ * When the timeout lapses, the provider's timeout call will execute */
+void
+set_provider_timeout_absolute(struct auth_client *auth, uint32_t id, time_t timeout)
+{
+	auth->data[id].timeout = timeout;
+
+	if(timeout > 0 && is_provider_running(auth, id))
+		rb_timer_heap_add(&provider_timeouts, &auth->data[id].timer, timeout);
+	else
+		rb_timer_heap_del(&provider_timeouts, &auth->data[id].timer);
 }
 
 /* Initalise all providers */
@@ -133,6 +153,7 @@ destroy_providers(void)
 
 	rb_dictionary_destroy(auth_clients, NULL, NULL);
 	rb_event_delete(timeout_ev);
+	rb_timer_heap_free(&provider_timeouts);
 }
 
 /* Load a provider */
@@ -200,6 +221,9 @@ unload_provider(struct auth_provider *provider)
 void
 auth_client_free(struct auth_client *auth)
 {
+	for(uint32_t i = 0; i < allocated_pids; i++)
+		rb_timer_heap_del(&provider_timeouts, &auth->data[i].timer);
+
 	rb_dictionary_delete(auth_clients, RB_UINT_TO_POINTER(auth->cid));
 	rb_free(auth->data);
 	rb_free(auth);
@@ -338,6 +362,8 @@ start_auth(const char *cid, const char *l_ip, const char *l_port, const char *c_
 		struct auth_provider *provider = ptr->data;
 
 		auth->data[provider->id].provider = provider;
+		auth->data[provider->id].auth = auth;
+		auth->data[provider->id].timer.data = &auth->data[provider->id];
 
 		lrb_assert(provider->start != NULL);
 
@@ -403,30 +429,31 @@ handle_cancel_connection(int parc, char *parv[])
 	auth_client_unref(auth);
 }
 
+/* Only providers whose timeout has lapsed are looked at, in the order
+ * they lapsed, rather than every provider of every pending client. */
 static void
 provider_timeout_event(void *notused __unused)
 {
-	struct auth_client *auth;
-	rb_dictionary_iter iter;
+	struct rb_timer *timer;
 	const time_t curtime = rb_current_time();
 
-	RB_DICTIONARY_FOREACH(auth, &iter, auth_clients)
+	while((timer = rb_timer_heap_first(&provider_timeouts)) != NULL && timer->when < curtime)
 	{
-		rb_dlink_node *ptr;
+		struct auth_client_data *data = timer->data;
+		struct auth_client *auth = data->auth;
+		struct auth_provider *provider = data->provider;
 
-		auth_client_ref(auth);
+		rb_timer_heap_del(&provider_timeouts, timer);
 
-		RB_DLINK_FOREACH(ptr, auth_providers.head)
-		{
-			struct auth_provider *provider = ptr->data;
-			const time_t timeout = get_provider_timeout(auth, provider->id);
+		if(provider->timeout == NULL)
+			continue;
 
-			if(is_provider_running(auth, provider->id) && provider->timeout != NULL &&
-				timeout > 0 && timeout < curtime)
-			{
-				provider->timeout(auth);
-			}
-		}
+		auth_client_ref(auth);
+		provider->timeout(auth);
+
+		/* Not finished yet; try again next time round, as we used to */
+		if(is_provider_running(auth, provider->id) && data->timeout > 0 && timer->index == 0)
+			rb_timer_heap_add(&provider_timeouts, timer, curtime);
 
 		auth_client_unref(auth);
 	}
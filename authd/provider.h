@@ -37,7 +37,9 @@ typedef enum
 struct auth_client_data
 {
 	struct auth_provider *provider;	/* Pointer back */
+	struct auth_client *auth;	/* Client this belongs to */
 	time_t timeout;			/* Provider timeout */
+	struct rb_timer timer;		/* Queued while running with a timeout */
 	void *data;			/* Provider data */
 	provider_status_t status;	/* Provider status */
 };
@@ -122,6 +124,8 @@ void provider_done(struct auth_client *auth, uint32_t id);
 void accept_client(struct auth_client *auth);
 void reject_client(struct auth_client *auth, uint32_t id, const char *data, const char *fmt, ...);
 
+void set_provider_timeout_absolute(struct auth_client *auth, uint32_t id, time_t timeout);
+
 void handle_new_connection(int parc, char *parv[]);
 void handle_cancel_connection(int parc, char *parv[]);
 void auth_client_free(struct auth_client *auth);
@@ -225,15 +229,7 @@ set_provider_data(struct auth_client *auth, uint32_t id, void *data)
 static inline void
 set_provider_timeout_relative(struct auth_client *auth, uint32_t id, time_t timeout)
 {
-	auth->data[id].timeout = timeout + rb_current_time();
-}
-
-/* Set timeout value in absolute time (Unix timestamp)
- * When the timeout lapses, the provider's timeout call will execute */
-static inline void
-set_provider_timeout_absolute(struct auth_client *auth, uint32_t id, time_t timeout)
-{
-	auth->data[id].timeout = timeout;
+	set_provider_timeout_absolute(auth, id, timeout + rb_current_time());
 }
 
 /* Get the timeout value for the provider */
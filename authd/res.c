@@ -33,6 +33,8 @@
  */
 
 #include <rb_lib.h>
+#include <stdbool.h>
+#include "rb_dictionary.h"
 #include "setup.h"
 #include "res.h"
 #include "reslib.h"
@@ -42,9 +44,15 @@
 #endif
 
 static PF res_readreply;
+static PF run_cache_hits;
 
 #define MAXPACKET      1024	/* rfc sez 512 but we expand names so ... */
 #define AR_TTL         600	/* TTL in seconds for dns cache entries */
+#define AR_NEG_TTL     300	/* longest we remember that a name does not exist */
+#define AR_CACHE_SIZE  8192	/* most answers kept in the cache */
+#define AR_KEYLEN      (IRCD_RES_HOSTLEN + 8)
+#define AR_ID_HASH_SIZE 1024	/* buckets for looking up requests by id */
+#define AR_ID_HASH(id) ((unsigned int)(id) & (AR_ID_HASH_SIZE - 1))
 
 /* RFC 1104/1105 wasn't very helpful about what these fields
  * should be named, so for now, we'll just name them this way.
@@ -61,7 +69,8 @@ struct in_addr ipv4_addr;
 
 struct reslist
 {
-	rb_dlink_node node;
+	rb_dlink_node node;	/* in request_hash */
+	struct rb_timer timer;	/* in request_timeouts, at sentat + timeout */
 	int id;
 	time_t ttl;
 	char type;
@@ -73,15 +82,53 @@ struct reslist
 	int lastns;	/* index of last server sent to */
 	struct rb_sockaddr_storage addr;
 	char *name;
-	struct DNSQuery *query;	/* query callback for this request */
+	rb_dlink_list queries;	/* query callbacks waiting on this request */
+	char key[AR_KEYLEN];	/* type and name, see make_key() */
+};
+
+/*
+ * Answers are cached by query type and name, both positive and negative,
+ * for as long as their TTL allows.  The least recently used entry goes
+ * when the cache is full.
+ */
+struct cache_entry
+{
+	rb_dlink_node node;	/* in cache_lru, most recently used first */
+	char key[AR_KEYLEN];
+	time_t expires;
+	bool negative;
+	char *name;		/* PTR answer */
+	struct rb_sockaddr_storage addr;	/* A/AAAA answer */
+};
+
+/*
+ * A query answered from the cache.  Callers don't expect to be called
+ * back before gethost_* returns, so these are run from the event loop.
+ */
+struct cache_hit
+{
+	rb_dlink_node node;
+	struct DNSQuery *query;
+	int type;
+	bool negative;
+	char name[IRCD_RES_HOSTLEN + 1];
+	struct rb_sockaddr_storage addr;
 };
 
 static rb_fde_t *res_fd;
-static rb_dlink_list request_list = { NULL, NULL, 0 };
+static rb_dlink_list request_hash[AR_ID_HASH_SIZE];
+static struct rb_timer_heap request_timeouts;
 static int ns_failure_count[IRCD_MAXNS]; /* timeouts and invalid/failed replies */
 
+static rb_dictionary *pending_dict;	/* requests in flight, by key */
+static rb_dictionary *cache_dict;
+static rb_dlink_list cache_lru;
+static rb_dlink_list cache_hits;
+static rb_fde_t *cache_hit_rfd, *cache_hit_wfd;
+static struct dns_cache_stats cache_stats;
+
 static void rem_request(struct reslist *request);
-static struct reslist *make_request(struct DNSQuery *query);
+static struct reslist *make_request(struct DNSQuery *query, const char *key);
 static void gethost_byname_type_fqdn(const char *name, struct DNSQuery *query,
 		int type);
 static void do_query_name(struct DNSQuery *query, const char *name, struct reslist *request, int);
@@ -95,6 +142,7 @@ static int proc_answer(struct reslist *request, HEADER * header, char *, char *)
 static struct reslist *find_id(int id);
 static struct DNSReply *make_dnsreply(struct reslist *request);
 static uint16_t generate_random_id(void);
+static void cache_flush(void);
 
 /*
  * int
@@ -152,37 +200,27 @@ res_ourserver(const struct rb_sockaddr_storage *inp)
 }
 
 /*
- * timeout_query_list - Remove queries from the list which have been
- * there too long without being resolved.
+ * timeout_query_list - Resend queries which have been waiting too
+ * long for a reply.  Requests are kept in order of when they time out,
+ * so only the ones that have are looked at.
  */
-static time_t timeout_query_list(time_t now)
+static void timeout_query_list(time_t now)
 {
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	struct rb_timer *timer;
 	struct reslist *request;
-	time_t next_time = 0;
-	time_t timeout = 0;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request_list.head)
+	while ((timer = rb_timer_heap_first(&request_timeouts)) != NULL &&
+			timer->when <= now)
 	{
-		request = ptr->data;
-		timeout = request->sentat + request->timeout;
-
-		if (now >= timeout)
-		{
-			ns_failure_count[request->lastns]++;
-			request->sentat = now;
-			request->timeout += request->timeout;
-			resend_query(request);
-		}
+		request = timer->data;
 
-		if ((next_time == 0) || timeout < next_time)
-		{
-			next_time = timeout;
-		}
+		ns_failure_count[request->lastns]++;
+		request->sentat = now;
+		request->timeout += request->timeout;
+		rb_timer_heap_add(&request_timeouts, &request->timer,
+				request->sentat + request->timeout);
+		resend_query(request);
 	}
-
-	return (next_time > now) ? next_time : (now + AR_TTL);
 }
 
 /*
@@ -224,6 +262,13 @@ static void start_resolver(void)
  */
 void init_resolver(void)
 {
+	pending_dict = rb_dictionary_create("dns requests", rb_strcasecmp);
+	cache_dict = rb_dictionary_create("dns cache", rb_strcasecmp);
+	if (rb_pipe(&cache_hit_rfd, &cache_hit_wfd, "DNS cache pipe") < 0)
+		cache_hit_rfd = cache_hit_wfd = NULL;
+	else
+		rb_setselect(cache_hit_rfd, RB_SELECT_READ, run_cache_hits, NULL);
+
 	start_resolver();
 }
 
@@ -235,6 +280,7 @@ void restart_resolver(void)
 	rb_close(res_fd);
 	res_fd = NULL;
 	rb_event_delete(timeout_resolver_ev);	/* -ddosen */
+	cache_flush();
 	start_resolver();
 }
 
@@ -267,22 +313,53 @@ static void add_local_domain(char *hname, size_t size)
  */
 static void rem_request(struct reslist *request)
 {
-	rb_dlinkDelete(&request->node, &request_list);
+	rb_dlink_node *ptr, *next_ptr;
+
+	if (request->key[0] != '\0')
+		rb_dictionary_delete(pending_dict, request->key);
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request->queries.head)
+		rb_dlinkDestroy(ptr, &request->queries);
+	rb_timer_heap_del(&request_timeouts, &request->timer);
+	rb_dlinkDelete(&request->node, &request_hash[AR_ID_HASH(request->id)]);
 	rb_free(request->name);
 	rb_free(request);
 }
 
+/*
+ * answer_request - pass the result of a request to everyone waiting
+ * on it, and remove it.
+ */
+static void answer_request(struct reslist *request, struct DNSReply *reply)
+{
+	rb_dlink_node *ptr, *next_ptr;
+	struct DNSQuery *query;
+
+	/* anything the callbacks look up starts a request of its own */
+	rb_dictionary_delete(pending_dict, request->key);
+	request->key[0] = '\0';
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request->queries.head)
+	{
+		query = ptr->data;
+		rb_dlinkDestroy(ptr, &request->queries);
+		(*query->callback) (query->ptr, reply);
+	}
+	rem_request(request);
+}
+
 /*
  * make_request - Create a DNS request record for the server.
  */
-static struct reslist *make_request(struct DNSQuery *query)
+static struct reslist *make_request(struct DNSQuery *query, const char *key)
 {
 	struct reslist *request = rb_malloc(sizeof(struct reslist));
 
 	request->sentat = rb_current_time();
 	request->retries = 3;
 	request->timeout = 4;	/* start at 4 and exponential inc. */
-	request->query = query;
+	rb_dlinkAddAlloc(query, &request->queries);
+	rb_strlcpy(request->key, key, sizeof(request->key));
+	rb_dictionary_add(pending_dict, request->key, request);
 
 	/*
 	 * generate a unique id
@@ -295,7 +372,11 @@ static struct reslist *make_request(struct DNSQuery *query)
 	 */
 	request->id = generate_random_id();
 
-	rb_dlinkAdd(request, &request->node, &request_list);
+	rb_dlinkAdd(request, &request->node, &request_hash[AR_ID_HASH(request->id)]);
+
+	request->timer.data = request;
+	rb_timer_heap_add(&request_timeouts, &request->timer,
+			request->sentat + request->timeout);
 
 	return request;
 }
@@ -374,7 +455,7 @@ static struct reslist *find_id(int id)
 	rb_dlink_node *ptr;
 	struct reslist *request;
 
-	RB_DLINK_FOREACH(ptr, request_list.head)
+	RB_DLINK_FOREACH(ptr, request_hash[AR_ID_HASH(id)].head)
 	{
 		request = ptr->data;
 
@@ -400,6 +481,174 @@ generate_random_id(void)
 	return id;
 }
 
+static void make_key(char *buf, int type, const char *name)
+{
+	snprintf(buf, AR_KEYLEN, "%d %s", type, name);
+}
+
+static void cache_remove(struct cache_entry *entry)
+{
+	rb_dictionary_delete(cache_dict, entry->key);
+	rb_dlinkDelete(&entry->node, &cache_lru);
+	rb_free(entry->name);
+	rb_free(entry);
+}
+
+static void cache_flush(void)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, cache_lru.head)
+		cache_remove(ptr->data);
+}
+
+/*
+ * cache_add - remember the answer to a request for ttl seconds.
+ * A negative entry records that the name or record does not exist.
+ */
+static void cache_add(struct reslist *request, bool negative, time_t ttl)
+{
+	struct cache_entry *entry;
+
+	if (ttl <= 0 || request->key[0] == '\0')
+		return;
+
+	if ((entry = rb_dictionary_retrieve(cache_dict, request->key)) != NULL)
+		cache_remove(entry);
+	else if (rb_dlink_list_length(&cache_lru) >= AR_CACHE_SIZE)
+	{
+		cache_remove(cache_lru.tail->data);
+		cache_stats.evictions++;
+	}
+
+	entry = rb_malloc(sizeof(struct cache_entry));
+	rb_strlcpy(entry->key, request->key, sizeof(entry->key));
+	entry->expires = rb_current_time() + ttl;
+	entry->negative = negative;
+	if (!negative)
+	{
+		if (request->type == T_PTR)
+			entry->name = rb_strdup(request->name);
+		else
+			memcpy(&entry->addr, &request->addr, sizeof(entry->addr));
+	}
+
+	rb_dictionary_add(cache_dict, entry->key, entry);
+	rb_dlinkAdd(entry, &entry->node, &cache_lru);
+}
+
+/*
+ * answer_cached - queue a query to be answered from the cache.
+ * Returns false if there is no usable cache entry.
+ */
+static bool answer_cached(struct DNSQuery *query, const char *key, int type,
+			  const char *name, const struct rb_sockaddr_storage *addr)
+{
+	struct cache_entry *entry;
+	struct cache_hit *hit;
+
+	if (cache_hit_wfd == NULL)
+		return false;
+
+	if ((entry = rb_dictionary_retrieve(cache_dict, key)) == NULL)
+		return false;
+
+	if (entry->expires <= rb_current_time())
+	{
+		cache_remove(entry);
+		return false;
+	}
+
+	rb_dlinkMoveNode(&entry->node, &cache_lru, &cache_lru);
+
+	hit = rb_malloc(sizeof(struct cache_hit));
+	hit->query = query;
+	hit->type = type;
+	hit->negative = entry->negative;
+
+	if (entry->negative)
+		cache_stats.negative_hits++;
+	else
+	{
+		cache_stats.hits++;
+		if (type == T_PTR)
+		{
+			/* the family of the address decides the forward lookup */
+			rb_strlcpy(hit->name, entry->name, sizeof(hit->name));
+			memcpy(&hit->addr, addr, sizeof(hit->addr));
+		}
+		else
+		{
+			rb_strlcpy(hit->name, name, sizeof(hit->name));
+			memcpy(&hit->addr, &entry->addr, sizeof(hit->addr));
+		}
+	}
+
+	if (rb_dlink_list_length(&cache_hits) == 0)
+		rb_write(cache_hit_wfd, "x", 1);
+	rb_dlinkAddTail(hit, &hit->node, &cache_hits);
+
+	return true;
+}
+
+static void
+run_cache_hits(rb_fde_t *F, void *data)
+{
+	char buf[64];
+	rb_dlink_list hits = cache_hits;
+	rb_dlink_node *ptr, *next_ptr;
+	struct DNSReply reply;
+
+	while (rb_read(F, buf, sizeof(buf)) > 0)
+		;
+	rb_setselect(F, RB_SELECT_READ, run_cache_hits, NULL);
+
+	/* hits queued by the callbacks below wait for the next pass */
+	cache_hits.head = cache_hits.tail = NULL;
+	cache_hits.length = 0;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, hits.head)
+	{
+		struct cache_hit *hit = ptr->data;
+
+		if (hit->negative)
+			(*hit->query->callback) (hit->query->ptr, NULL);
+		else if (hit->type == T_PTR)
+			gethost_byname_type_fqdn(hit->name, hit->query,
+				GET_SS_FAMILY(&hit->addr) == AF_INET6 ? T_AAAA : T_A);
+		else
+		{
+			reply.h_name = hit->name;
+			memcpy(&reply.addr, &hit->addr, sizeof(reply.addr));
+			(*hit->query->callback) (hit->query->ptr, &reply);
+		}
+
+		rb_free(hit);
+	}
+}
+
+/*
+ * join_request - wait on a request already in flight for the same
+ * answer rather than sending another one.
+ */
+static bool join_request(struct DNSQuery *query, const char *key)
+{
+	struct reslist *request;
+
+	if ((request = rb_dictionary_retrieve(pending_dict, key)) == NULL)
+		return false;
+
+	rb_dlinkAddTailAlloc(query, &request->queries);
+	cache_stats.coalesced++;
+	return true;
+}
+
+void get_dns_cache_stats(struct dns_cache_stats *stats)
+{
+	*stats = cache_stats;
+	stats->entries = rb_dlink_list_length(&cache_lru);
+}
+
 /*
  * gethost_byname_type - get host address from name, adding domain if needed
  */
@@ -439,7 +688,14 @@ static void do_query_name(struct DNSQuery *query, const char *name, struct resli
 {
 	if (request == NULL)
 	{
-		request = make_request(query);
+		char key[AR_KEYLEN];
+
+		make_key(key, type, name);
+		if (answer_cached(query, key, type, name, NULL) || join_request(query, key))
+			return;
+
+		cache_stats.misses++;
+		request = make_request(query, key);
 		request->name = rb_strdup(name);
 	}
 
@@ -504,14 +760,25 @@ void build_rdns(char *buf, size_t size, const struct rb_sockaddr_storage *addr,
 static void do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 			    struct reslist *request)
 {
+	char rdns[IRCD_RES_HOSTLEN + 1];
+
+	build_rdns(rdns, sizeof rdns, addr, NULL);
+
 	if (request == NULL)
 	{
-		request = make_request(query);
+		char key[AR_KEYLEN];
+
+		make_key(key, T_PTR, rdns);
+		if (answer_cached(query, key, T_PTR, rdns, addr) || join_request(query, key))
+			return;
+
+		cache_stats.misses++;
+		request = make_request(query, key);
 		memcpy(&request->addr, addr, sizeof(struct rb_sockaddr_storage));
 		request->name = (char *)rb_malloc(IRCD_RES_HOSTLEN + 1);
 	}
 
-	build_rdns(request->queryname, sizeof request->queryname, addr, NULL);
+	rb_strlcpy(request->queryname, rdns, sizeof request->queryname);
 
 	request->type = T_PTR;
 	query_name(request);
@@ -545,8 +812,7 @@ static void resend_query(struct reslist *request)
 {
 	if (--request->retries <= 0)
 	{
-		(*request->query->callback) (request->query->ptr, NULL);
-		rem_request(request);
+		answer_request(request, NULL);
 		return;
 	}
 
@@ -564,6 +830,16 @@ static void resend_query(struct reslist *request)
 	}
 }
 
+static unsigned char *skip_name(unsigned char *current, char *eob)
+{
+	int n;
+
+	if ((char *)current >= eob ||
+			(n = irc_dn_skipname(current, (unsigned char *)eob)) < 0)
+		return NULL;
+	return current + n;
+}
+
 /*
  * check_question - check if the reply really belongs to the
  * name we queried (to guard against late replies from previous
@@ -587,6 +863,57 @@ static int check_question(struct reslist *request, HEADER * header, char *buf, c
 	return 1;
 }
 
+/*
+ * negative_ttl - how long a reply saying there is no such record may be
+ * cached: the lesser of the SOA record's TTL and its minimum field
+ * (RFC 2308).  Returns 0 if the reply carries no SOA record.
+ */
+static time_t negative_ttl(HEADER * header, char *buf, char *eob)
+{
+	unsigned char *current = (unsigned char *)buf + sizeof(HEADER);
+	unsigned char *rdata;
+	int records = header->ancount + header->nscount;
+	int type, rd_length, n;
+	time_t ttl, minimum;
+
+	for (n = header->qdcount; n > 0; n--)
+	{
+		if ((current = skip_name(current, eob)) == NULL)
+			return 0;
+		current += QFIXEDSZ;
+	}
+
+	while (records-- > 0)
+	{
+		if ((current = skip_name(current, eob)) == NULL ||
+				(char *)current + ANSWER_FIXED_SIZE > eob)
+			return 0;
+
+		type = irc_ns_get16(current);
+		ttl = irc_ns_get32(current + TYPE_SIZE + CLASS_SIZE);
+		rd_length = irc_ns_get16(current + TYPE_SIZE + CLASS_SIZE + TTL_SIZE);
+		current += ANSWER_FIXED_SIZE;
+		rdata = current;
+		current += rd_length;
+		if ((char *)current > eob)
+			return 0;
+
+		if (type != T_SOA)
+			continue;
+
+		/* mname, rname, then serial, refresh, retry, expire, minimum */
+		if ((rdata = skip_name(rdata, (char *)current)) == NULL ||
+				(rdata = skip_name(rdata, (char *)current)) == NULL ||
+				rdata + 20 > current)
+			return 0;
+
+		minimum = irc_ns_get32(rdata + 16);
+		return (minimum < ttl) ? minimum : ttl;
+	}
+
+	return 0;
+}
+
 /*
  * proc_answer - process name server reply
  */
@@ -597,9 +924,11 @@ static int proc_answer(struct reslist *request, HEADER * header, char *buf, char
 	int type;		/* answer type */
 	int n;			/* temp count */
 	int rd_length;
+	time_t ttl;
 	struct sockaddr_in *v4;	/* conversion */
 	struct sockaddr_in6 *v6;
 	current = (unsigned char *)buf + sizeof(HEADER);
+	request->ttl = AR_TTL;
 
 	for (; header->qdcount > 0; --header->qdcount)
 	{
@@ -651,7 +980,10 @@ static int proc_answer(struct reslist *request, HEADER * header, char *buf, char
 		(void) irc_ns_get16(current);
 		current += CLASS_SIZE;
 
-		request->ttl = irc_ns_get32(current);
+		/* an answer is only good as long as every record leading to it */
+		ttl = irc_ns_get32(current);
+		if (ttl < request->ttl)
+			request->ttl = ttl;
 		current += TTL_SIZE;
 
 		rd_length = irc_ns_get16(current);
@@ -730,6 +1062,9 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 	socklen_t len = sizeof(struct rb_sockaddr_storage);
 	struct rb_sockaddr_storage lsin;
 	int ns;
+	time_t ttl;
+	rb_dlink_node *ptr, *next_ptr;
+	struct DNSQuery *query;
 
 	rc = recvfrom(rb_get_fd(F), buf, sizeof(buf), 0, (struct sockaddr *)&lsin, &len);
 
@@ -797,13 +1132,16 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 			 * Either a fatal error was returned or no answer. Cancel the
 			 * request.
 			 */
-			if (NXDOMAIN == header->rcode)
+			if (NXDOMAIN == header->rcode || NO_ERRORS == header->rcode)
 			{
 				/* If the rcode is NXDOMAIN, treat it as a good response. */
-				ns_failure_count[ns] /= 4;
+				if (NXDOMAIN == header->rcode)
+					ns_failure_count[ns] /= 4;
+
+				ttl = negative_ttl(header, buf, buf + rc);
+				cache_add(request, true, (ttl < AR_NEG_TTL) ? ttl : AR_NEG_TTL);
 			}
-			(*request->query->callback) (request->query->ptr, NULL);
-			rem_request(request);
+			answer_request(request, NULL);
 		}
 		return 1;
 	}
@@ -828,14 +1166,24 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 				return 1;
 			}
 
+			if (request->name[0] != '\0')
+				cache_add(request, false, request->ttl);
+
 			/*
 			 * Lookup the 'authoritative' name that we were given for the
 			 * ip#.
 			 */
-			if (GET_SS_FAMILY(&request->addr) == AF_INET6)
-				gethost_byname_type_fqdn(request->name, request->query, T_AAAA);
-			else
-				gethost_byname_type_fqdn(request->name, request->query, T_A);
+			rb_dictionary_delete(pending_dict, request->key);
+			request->key[0] = '\0';
+			RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request->queries.head)
+			{
+				query = ptr->data;
+				rb_dlinkDestroy(ptr, &request->queries);
+				if (GET_SS_FAMILY(&request->addr) == AF_INET6)
+					gethost_byname_type_fqdn(request->name, query, T_AAAA);
+				else
+					gethost_byname_type_fqdn(request->name, query, T_A);
+			}
 			rem_request(request);
 		}
 		else
@@ -843,10 +1191,12 @@ static int res_read_single_reply(rb_fde_t *F, void *data)
 			/*
 			 * got a name and address response, client resolved
 			 */
+			if (GET_SS_FAMILY(&request->addr) != AF_UNSPEC)
+				cache_add(request, false, request->ttl);
+
 			reply = make_dnsreply(request);
-			(*request->query->callback) (request->query->ptr, reply);
+			answer_request(request, reply);
 			rb_free(reply);
-			rem_request(request);
 		}
 
 		ns_failure_count[ns] /= 4;
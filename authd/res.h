@@ -25,6 +25,16 @@ struct DNSQuery
   void (*callback)(void* vptr, struct DNSReply *reply); /* callback to call */
 };
 
+struct dns_cache_stats
+{
+  unsigned long entries;
+  unsigned long hits;
+  unsigned long negative_hits;
+  unsigned long misses;
+  unsigned long coalesced; /* joined a request already in flight */
+  unsigned long evictions;
+};
+
 extern struct rb_sockaddr_storage irc_nsaddr_list[];
 extern int irc_nscount;
 
@@ -32,6 +42,7 @@ extern void init_resolver(void);
 extern void restart_resolver(void);
 extern void gethost_byname_type(const char *, struct DNSQuery *, int);
 extern void gethost_byaddr(const struct rb_sockaddr_storage *, struct DNSQuery *);
+extern void get_dns_cache_stats(struct dns_cache_stats *);
 extern void build_rdns(char *, size_t, const struct rb_sockaddr_storage *, const char *);
 
 #endif
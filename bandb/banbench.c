@@ -0,0 +1,252 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  banbench.c: Measure ban database insert and load throughput.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * Runs the statements bandb does against a scratch database, both as
+ * formatted sql text the way bandb used to and through prepared
+ * statements the way it does now, and reports rows per second for
+ * inserting bans in batched transactions and for loading them back.
+ *
+ * The kline table of the database given is dropped, so never point this
+ * at a live one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stdinc.h"
+#include "rsdb.h"
+
+#define DEFAULT_ROWS 200000
+#define BATCH 1000	/* bandb's COMMIT_MAX */
+
+static char me[PATH_MAX];
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+db_error_cb(const char *errstr)
+{
+	fprintf(stderr, "* Error: %s\n", errstr);
+	exit(EXIT_FAILURE);
+}
+
+static void
+report(const char *what, int rows, double secs)
+{
+	fprintf(stdout, "%-28s %8d rows %8.3f s %10.0f rows/s\n",
+		what, rows, secs, secs > 0 ? rows / secs : 0.0);
+}
+
+static void
+make_ban(int i, char *mask1, size_t len1, char *mask2, size_t len2, char *curtime, size_t len3)
+{
+	snprintf(mask1, len1, "*user%d", i % 97);
+	snprintf(mask2, len2, "%d.%d.%d.0/24", 10 + i / 65536, i / 256 % 256, i % 256);
+	snprintf(curtime, len3, "%ld", (long)(1600000000 + i));
+}
+
+static void
+reset_table(void)
+{
+	rsdb_exec(NULL, "DROP TABLE IF EXISTS kline");
+	rsdb_exec(NULL,
+		  "CREATE TABLE kline (mask1 TEXT, mask2 TEXT, oper TEXT, time INTEGER, perm INTEGER, reason TEXT)");
+}
+
+static void
+insert_text(int rows)
+{
+	char mask1[32], mask2[32], curtime[32];
+	double start;
+	int i;
+
+	reset_table();
+	start = now();
+
+	for(i = 0; i < rows; i++)
+	{
+		if(i % BATCH == 0)
+			rsdb_transaction(RSDB_TRANS_START);
+
+		make_ban(i, mask1, sizeof(mask1), mask2, sizeof(mask2), curtime, sizeof(curtime));
+		rsdb_exec(NULL,
+			  "INSERT INTO kline (mask1, mask2, oper, time, perm, reason) VALUES('%Q', '%Q', '%Q', %s, %s, '%Q')",
+			  mask1, mask2, "bench!bench@bench{bench}", curtime, "0", "spam wave|benchmark");
+
+		if(i % BATCH == BATCH - 1 || i == rows - 1)
+			rsdb_transaction(RSDB_TRANS_END);
+	}
+
+	report("insert, sql text", rows, now() - start);
+}
+
+static void
+insert_prepared(int rows)
+{
+	char mask1[32], mask2[32], curtime[32];
+	const char *values[6] = {
+		mask1, mask2, "bench!bench@bench{bench}", curtime, "0", "spam wave|benchmark"
+	};
+	struct rsdb_stmt *stmt;
+	double start;
+	int i;
+
+	reset_table();
+	stmt = rsdb_prepare("INSERT INTO kline (mask1, mask2, oper, time, perm, reason) VALUES(?, ?, ?, ?, ?, ?)");
+	start = now();
+
+	for(i = 0; i < rows; i++)
+	{
+		if(i % BATCH == 0)
+			rsdb_transaction(RSDB_TRANS_START);
+
+		make_ban(i, mask1, sizeof(mask1), mask2, sizeof(mask2), curtime, sizeof(curtime));
+		rsdb_stmt_exec(stmt, 6, values);
+
+		if(i % BATCH == BATCH - 1 || i == rows - 1)
+			rsdb_transaction(RSDB_TRANS_END);
+	}
+
+	report("insert, prepared", rows, now() - start);
+	rsdb_stmt_free(stmt);
+}
+
+static void
+load_table(int rows)
+{
+	static char buf[512];
+	struct rsdb_table table;
+	double start;
+	int i, n = 0;
+
+	start = now();
+
+	rsdb_exec_fetch(&table, "SELECT mask1,mask2,oper,reason FROM kline WHERE 1");
+	for(i = 0; i < table.row_count; i++)
+	{
+		snprintf(buf, sizeof(buf), "K %s %s %s :%s", table.row[i][0],
+			table.row[i][1], table.row[i][2], table.row[i][3]);
+		n++;
+	}
+	rsdb_exec_fetch_end(&table);
+
+	report("load, whole table", n, now() - start);
+	if(n != rows)
+		fprintf(stderr, "* Error: expected %d rows, loaded %d\n", rows, n);
+}
+
+static void
+load_streamed(int rows)
+{
+	static char buf[512];
+	struct rsdb_stmt *stmt;
+	const char *row[4];
+	double start;
+	int n = 0;
+
+	stmt = rsdb_prepare("SELECT mask1,mask2,oper,reason FROM kline WHERE 1");
+	start = now();
+
+	while(rsdb_stmt_fetch(stmt, row, 4))
+	{
+		snprintf(buf, sizeof(buf), "K %s %s %s :%s", row[0], row[1], row[2], row[3]);
+		n++;
+	}
+
+	report("load, streamed", n, now() - start);
+	if(n != rows)
+		fprintf(stderr, "* Error: expected %d rows, loaded %d\n", rows, n);
+	rsdb_stmt_free(stmt);
+}
+
+static void
+print_help(int i_exit) __noreturn;
+
+static void
+print_help(int i_exit)
+{
+	fprintf(stderr, "Usage: %s [-n rows] [-r] <path>\n", me);
+	fprintf(stderr, "       -n : Number of bans to insert and load (default %d).\n", DEFAULT_ROWS);
+	fprintf(stderr, "       -r : Use a rollback journal instead of a write-ahead log.\n");
+	fprintf(stderr, "     path : A scratch database. Its kline table is dropped!\n");
+	exit(i_exit);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int rows = DEFAULT_ROWS;
+	bool rollback = false;
+	int opt;
+
+	rb_strlcpy(me, argv[0], sizeof(me));
+
+	while((opt = getopt(argc, argv, "hn:r")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h':
+			print_help(EXIT_SUCCESS);
+			break;
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		case 'r':
+			rollback = true;
+			break;
+		default:	/* '?' */
+			print_help(EXIT_FAILURE);
+		}
+	}
+
+	if(argv[optind] == NULL || rows <= 0)
+		print_help(EXIT_FAILURE);
+
+	/* rsdb_init() opens whatever this points at */
+	setenv("BANDB_DBPATH", argv[optind], 1);
+	if(rsdb_init(db_error_cb) == -1)
+		exit(EXIT_FAILURE);
+
+	if(rollback)
+	{
+		rsdb_exec(NULL, "PRAGMA journal_mode=DELETE");
+		rsdb_exec(NULL, "PRAGMA synchronous=FULL");
+	}
+	fprintf(stdout, "* %s journal, batches of %d\n",
+		rollback ? "rollback" : "write-ahead", BATCH);
+
+	insert_text(rows);
+	insert_prepared(rows);
+	load_table(rows);
+	load_streamed(rows);
+
+	rsdb_exec(NULL, "DROP TABLE kline");
+	rsdb_shutdown();
+	return 0;
+}
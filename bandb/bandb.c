@@ -37,6 +37,8 @@
 #define MAXPARA 10
 
 #define COMMIT_INTERVAL 3 /* seconds */
+#define COMMIT_MAX 1000 /* changes, commit early if a burst gets this big */
+#define LIST_FLUSH 1000 /* rows sent to the ircd between writes */
 
 typedef enum
 {
@@ -58,14 +60,51 @@ static const char *bandb_table[LAST_BANDB_TYPE] = {
 
 static rb_helper *bandb_helper;
 static int in_transaction;
+static int pending_changes;
+static struct ev_entry *commit_ev;
+
+static struct rsdb_stmt *insert_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *delete_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *list_stmt[LAST_BANDB_TYPE];
 
 static void check_schema(void);
+static void prepare_statements(void);
 
 static void
 bandb_commit(void *unused)
 {
+	commit_ev = NULL;
+
+	if(!in_transaction)
+		return;
+
 	rsdb_transaction(RSDB_TRANS_END);
 	in_transaction = 0;
+	pending_changes = 0;
+}
+
+/* changes are grouped into one transaction, committed after
+ * COMMIT_INTERVAL or as soon as COMMIT_MAX of them have built up
+ */
+static void
+bandb_change(struct rsdb_stmt *stmt, int parc, const char **parv)
+{
+	if(!in_transaction)
+	{
+		rsdb_transaction(RSDB_TRANS_START);
+		in_transaction = 1;
+		commit_ev = rb_event_addonce("bandb_commit", bandb_commit, NULL,
+				COMMIT_INTERVAL);
+	}
+
+	rsdb_stmt_exec(stmt, parc, parv);
+
+	if(++pending_changes >= COMMIT_MAX)
+	{
+		if(commit_ev != NULL)
+			rb_event_delete(commit_ev);
+		bandb_commit(NULL);
+	}
 }
 
 static void
@@ -77,6 +116,7 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	const char *curtime = NULL;
 	const char *reason = NULL;
 	const char *perm = NULL;
+	const char *values[6];
 	int para = 1;
 
 	if(type == BANDB_KLINE)
@@ -97,17 +137,14 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	perm = parv[para++];
 	reason = parv[para++];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	values[0] = mask1;
+	values[1] = mask2 ? mask2 : "";
+	values[2] = oper;
+	values[3] = curtime;
+	values[4] = perm;
+	values[5] = reason;
 
-	rsdb_exec(NULL,
-		  "INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES('%Q', '%Q', '%Q', %s, %s, '%Q')",
-		  bandb_table[type], mask1, mask2 ? mask2 : "", oper, curtime, perm, reason);
+	bandb_change(insert_stmt[type], 6, values);
 }
 
 static void
@@ -115,6 +152,7 @@ parse_unban(bandb_type type, char *parv[], int parc)
 {
 	const char *mask1 = NULL;
 	const char *mask2 = NULL;
+	const char *values[2];
 
 	if(type == BANDB_KLINE)
 	{
@@ -129,48 +167,41 @@ parse_unban(bandb_type type, char *parv[], int parc)
 	if(type == BANDB_KLINE)
 		mask2 = parv[2];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	values[0] = mask1;
+	values[1] = mask2 ? mask2 : "";
 
-	rsdb_exec(NULL, "DELETE FROM %s WHERE mask1='%Q' AND mask2='%Q'",
-		  bandb_table[type], mask1, mask2 ? mask2 : "");
+	bandb_change(delete_stmt[type], 2, values);
 }
 
+/* rows are streamed from the query straight to the ircd, rather than
+ * the whole table being read into memory first
+ */
 static void
 list_bans(void)
 {
 	static char buf[512];
-	struct rsdb_table table;
-	int i, j;
+	const char *row[4];
+	int i, rows = 0;
 
 	/* schedule a clear of anything already pending */
 	rb_helper_write_queue(bandb_helper, "C");
 
 	for(i = 0; i < LAST_BANDB_TYPE; i++)
 	{
-		rsdb_exec_fetch(&table, "SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
-				bandb_table[i]);
-
-		for(j = 0; j < table.row_count; j++)
+		while(rsdb_stmt_fetch(list_stmt[i], row, 4))
 		{
 			if(i == BANDB_KLINE)
 				snprintf(buf, sizeof(buf), "%c %s %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][1], table.row[j][2], table.row[j][3]);
+					    bandb_letter[i], row[0], row[1], row[2], row[3]);
 			else
 				snprintf(buf, sizeof(buf), "%c %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][2], table.row[j][3]);
+					    bandb_letter[i], row[0], row[2], row[3]);
 
 			rb_helper_write_queue(bandb_helper, "%s", buf);
-		}
 
-		rsdb_exec_fetch_end(&table);
+			if(++rows % LIST_FLUSH == 0)
+				rb_helper_write_flush(bandb_helper);
+		}
 	}
 
 	rb_helper_write(bandb_helper, "F");
@@ -309,6 +340,7 @@ main(int argc, char *argv[])
 	}
 	rsdb_init(db_error_cb);
 	check_schema();
+	prepare_statements();
 	rb_helper_loop(bandb_helper, 0);
 
 	return 0;
@@ -334,3 +366,19 @@ check_schema(void)
 				  bandb_table[i]);
 	}
 }
+
+static void
+prepare_statements(void)
+{
+	int i;
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+	{
+		insert_stmt[i] = rsdb_prepare("INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES(?, ?, ?, ?, ?, ?)",
+				bandb_table[i]);
+		delete_stmt[i] = rsdb_prepare("DELETE FROM %s WHERE mask1=? AND mask2=?",
+				bandb_table[i]);
+		list_stmt[i] = rsdb_prepare("SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
+				bandb_table[i]);
+	}
+}
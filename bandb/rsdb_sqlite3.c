@@ -35,6 +35,11 @@
 
 struct sqlite3 *rb_bandb;
 
+struct rsdb_stmt
+{
+	sqlite3_stmt *stmt;
+};
+
 rsdb_error_cb *error_cb;
 
 static void
@@ -82,6 +87,14 @@ rsdb_init(rsdb_error_cb * ecb)
 		mlog(errbuf);
 		return -1;
 	}
+
+	sqlite3_busy_timeout(rb_bandb, 2500);
+
+	/* with a write-ahead log, readers such as bantool don't hold up
+	 * the ircd's writes, and a commit only has to sync the log
+	 */
+	rsdb_exec(NULL, "PRAGMA journal_mode=WAL");
+	rsdb_exec(NULL, "PRAGMA synchronous=NORMAL");
 	return 0;
 }
 
@@ -261,3 +274,105 @@ rsdb_transaction(rsdb_transtype type)
 	else if(type == RSDB_TRANS_END)
 		rsdb_exec(NULL, "COMMIT TRANSACTION");
 }
+
+/* rsdb_prepare()
+ * compiles a statement once, so it can be run many times without
+ * building and parsing sql text each time.  the format is expanded like
+ * rsdb_exec()'s, values are left as '?' and bound by rsdb_stmt_exec().
+ */
+struct rsdb_stmt *
+rsdb_prepare(const char *format, ...)
+{
+	static char buf[BUFSIZE * 4];
+	struct rsdb_stmt *stmt;
+	va_list args;
+	unsigned int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+		return NULL;
+	}
+
+	stmt = rb_malloc(sizeof(struct rsdb_stmt));
+	if(sqlite3_prepare_v2(rb_bandb, buf, -1, &stmt->stmt, NULL) != SQLITE_OK)
+	{
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+		rb_free(stmt);
+		return NULL;
+	}
+
+	return stmt;
+}
+
+static int
+rsdb_step(struct rsdb_stmt *stmt)
+{
+	int ret = sqlite3_step(stmt->stmt);
+
+	if(ret != SQLITE_ROW && ret != SQLITE_DONE)
+	{
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+		sqlite3_reset(stmt->stmt);
+	}
+
+	return ret;
+}
+
+/* rsdb_stmt_exec()
+ * runs a prepared statement with its placeholders bound to parv
+ */
+void
+rsdb_stmt_exec(struct rsdb_stmt *stmt, int parc, const char **parv)
+{
+	int i;
+
+	for(i = 0; i < parc; i++)
+		sqlite3_bind_text(stmt->stmt, i + 1, parv[i], -1, SQLITE_STATIC);
+
+	while(rsdb_step(stmt) == SQLITE_ROW)
+		;
+
+	sqlite3_reset(stmt->stmt);
+	sqlite3_clear_bindings(stmt->stmt);
+}
+
+/* rsdb_stmt_fetch()
+ * steps a prepared query, filling row with the next result's columns,
+ * which stay valid until the next call.  returns 0 once the rows are
+ * exhausted, and the query can then be run again.
+ */
+int
+rsdb_stmt_fetch(struct rsdb_stmt *stmt, const char **row, int col_count)
+{
+	int i;
+
+	if(rsdb_step(stmt) != SQLITE_ROW)
+	{
+		sqlite3_reset(stmt->stmt);
+		return 0;
+	}
+
+	for(i = 0; i < col_count; i++)
+	{
+		row[i] = (const char *)sqlite3_column_text(stmt->stmt, i);
+		if(row[i] == NULL)
+			row[i] = "";
+	}
+
+	return 1;
+}
+
+void
+rsdb_stmt_free(struct rsdb_stmt *stmt)
+{
+	if(stmt == NULL)
+		return;
+
+	sqlite3_finalize(stmt->stmt);
+	rb_free(stmt);
+}
@@ -47,6 +47,13 @@ struct Mode
 	char forward[LOC_CHANNELLEN + 1];
 };
 
+/* open-addressed table of a ban list's entries, keyed on the mask */
+struct ban_hash
+{
+	struct Ban **table;
+	unsigned int bits;	/* table has 1 << bits slots */
+};
+
 /* channel structure */
 struct Channel
 {
@@ -61,12 +68,24 @@ struct Channel
 	rb_dlink_list members;	/* channel members */
 	rb_dlink_list locmembers;	/* local channel members */
 
+	struct membership **member_index;	/* members hashed by client, large channels only */
+	unsigned int member_index_size;	/* slots in member_index, a power of two */
+
 	rb_dlink_list invites;
 	rb_dlink_list banlist;
 	rb_dlink_list exceptlist;
 	rb_dlink_list invexlist;
 	rb_dlink_list quietlist;
 
+	struct ban_index *banlist_index;	/* compiled lists, large lists only */
+	struct ban_index *exceptlist_index;
+	struct ban_index *quietlist_index;
+
+	struct ban_hash banlist_hash;	/* masks hashed case-folded, large lists only */
+	struct ban_hash exceptlist_hash;
+	struct ban_hash invexlist_hash;
+	struct ban_hash quietlist_hash;
+
 	time_t first_received_message_time;	/* channel flood control */
 	int received_number_of_privmsgs;
 	int flood_noticed;
@@ -260,6 +279,12 @@ extern int is_quieted(struct Channel *chptr, struct Client *who,
 extern int can_join(struct Client *source_p, struct Channel *chptr,
 		    const char *key, const char **forward);
 
+struct ban_index;
+extern struct Ban *find_ban(struct Channel *chptr, rb_dlink_list *list,
+			    struct ban_index **idxp, struct Client *who,
+			    const struct matchset *ms, long mode_type);
+extern void free_ban_index(struct ban_index **idxp);
+
 extern struct membership *find_channel_membership(struct Channel *, struct Client *);
 extern const char *find_channel_status(struct membership *msptr, int combine);
 extern void add_user_to_channel(struct Channel *, struct Client *, int flags);
@@ -269,6 +294,11 @@ extern void invalidate_bancache_user(struct Client *);
 
 extern void free_channel_list(rb_dlink_list *);
 
+extern struct Ban *find_ban_id(struct Channel *chptr, rb_dlink_list *list, const char *banid);
+extern void add_ban_id(struct Channel *chptr, rb_dlink_list *list, struct Ban *banptr);
+extern void del_ban_id(struct Channel *chptr, rb_dlink_list *list, struct Ban *banptr);
+extern void clear_ban_hash(struct Channel *chptr, rb_dlink_list *list);
+
 extern bool check_channel_name(const char *name);
 
 extern void channel_member_names(struct Channel *chptr, struct Client *,
@@ -61,6 +61,7 @@ struct Server;
 struct LocalUser;
 struct PreClient;
 struct ListClient;
+struct server_burst;
 struct scache_entry;
 
 typedef int SSL_OPEN_CB(struct Client *, int status);
@@ -77,6 +78,7 @@ struct User
 
 	char *opername; /* name of operator{} block being used or tried (challenge) */
 	struct PrivilegeSet *privset;
+	struct who_entry *who_entry;	/* WHO index links, see hash.c */
 
 	char suser[NICKLEN+1];
 };
@@ -153,6 +155,39 @@ struct Client
 	char *certfp; /* client certificate fingerprint */
 };
 
+/* local persons are indexed by address, and by the start and end of
+ * their username and hosts, so a new K-line or D-line only has to look
+ * at the clients it could match.  see client.c
+ */
+#define BANCHECK_BITS		12
+#define BANCHECK_SIZE		(1 << BANCHECK_BITS)
+#define BANCHECK_FIELDS		3
+#define BANCHECK_PREFIXLEN	4
+#define BANCHECK_SUFFIXLEN	8
+
+struct ban_check_entry
+{
+	rb_dlink_node prefix[BANCHECK_FIELDS];
+	rb_dlink_node suffix[BANCHECK_FIELDS];
+	unsigned int prefix_bucket[BANCHECK_FIELDS];
+	unsigned int suffix_bucket[BANCHECK_FIELDS];
+	rb_patricia_node_t *ipnode[2];	/* own address, and any embedded IPv4 */
+	rb_dlink_node iplink[2];
+};
+
+/*
+ * what has been read from a connection but not parsed yet.  lines are
+ * parsed in place, see packet.c
+ */
+struct recvq
+{
+	char *buf;		/* ring of size bytes, NULL while nothing is queued */
+	unsigned int size;	/* 0 or a power of two */
+	unsigned int head;	/* offset of the oldest byte */
+	unsigned int len;	/* bytes queued */
+	unsigned int scanned;	/* bytes from head known not to end a line */
+};
+
 struct LocalUser
 {
 	rb_dlink_node tnode;	/* This is the node for the local list type the client is on */
@@ -176,9 +211,9 @@ struct LocalUser
 	time_t lasttime;	/* last time we parsed something */
 	time_t firsttime;	/* time client was created */
 
-	/* Send and receive linebuf queues .. */
+	/* Send linebuf queue and receive ring .. */
 	buf_head_t buf_sendq;
-	buf_head_t buf_recvq;
+	struct recvq recvq;
 
 	/*
 	 * we want to use unsigned int here so the sizes have a better chance of
@@ -258,6 +293,8 @@ struct LocalUser
 	unsigned int join_who_credits;
 
 	struct ListClient *safelist_data;
+	struct server_burst *burst;	/* netburst state, servers only */
+	struct ban_check_entry *ban_entry;	/* ban check index links, persons only */
 
 	char *mangledhost; /* non-NULL if host mangling module loaded and
 			      applicable to this client */
@@ -586,6 +623,12 @@ extern void check_banned_lines(void);
 extern void check_klines(void);
 extern void check_one_kline(struct ConfItem *kline);
 extern void check_dlines(void);
+extern void check_one_dline(struct ConfItem *dline);
+extern void start_ban_batch(void);
+extern void end_ban_batch(void);
+extern void add_to_ban_check_index(struct Client *client_p);
+extern void del_from_ban_check_index(struct Client *client_p);
+extern void update_ban_check_index(struct Client *client_p);
 extern void check_xlines(void);
 extern void resv_nick_fnc(const char *mask, const char *reason, int temp_time);
 
@@ -625,11 +668,13 @@ extern struct Server *make_server(struct Client *);
 extern void close_connection(struct Client *);
 extern void init_uid(void);
 extern char *generate_uid(void);
+extern void claim_uid(const char *id);
 
 void allocate_away(struct Client *);
 void free_away(struct Client *);
 
 uint32_t connid_get(struct Client *client_p);
+bool connid_claim(struct Client *client_p, uint32_t id);
 void connid_put(uint32_t id);
 void client_release_connids(struct Client *client_p);
 
@@ -90,6 +90,29 @@ extern void add_to_hostname_hash(const char *, struct Client *);
 extern void del_from_hostname_hash(const char *, struct Client *);
 extern rb_dlink_node *find_hostname(const char *);
 
+/* the WHO index keys every person on the first and last few
+ * characters of each field a WHO mask is matched against
+ */
+#define WHO_INDEX_BITS		14
+#define WHO_INDEX_SIZE		(1 << WHO_INDEX_BITS)
+#define WHO_INDEX_FIELDS	5
+#define WHO_INDEX_PREFIXLEN	4
+#define WHO_INDEX_SUFFIXLEN	10
+
+struct who_entry
+{
+	rb_dlink_node prefix[WHO_INDEX_FIELDS];
+	rb_dlink_node suffix[WHO_INDEX_FIELDS];
+	unsigned int prefix_bucket[WHO_INDEX_FIELDS];
+	unsigned int suffix_bucket[WHO_INDEX_FIELDS];
+};
+
+extern void add_to_who_index(struct Client *client_p);
+extern void del_from_who_index(struct Client *client_p);
+extern void update_who_index(struct Client *client_p);
+extern rb_dlink_list *find_who_prefix(const char *key);
+extern rb_dlink_list *find_who_suffix(const char *key);
+
 extern void add_to_resv_hash(const char *name, struct ConfItem *aconf);
 extern void del_from_resv_hash(const char *name, struct ConfItem *aconf);
 extern struct ConfItem *hash_find_resv(const char *name);
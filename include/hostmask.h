@@ -74,6 +74,8 @@ int match_ipv4(struct sockaddr *, struct sockaddr *, int);
 
 extern struct AddressRec *atable[ATABLE_SIZE];
 
+struct AddressBucket;
+
 struct AddressRec
 {
 	/* masktype: HM_HOST, HM_IPV4, HM_IPV6 -A1kmm */
@@ -108,6 +110,11 @@ struct AddressRec
 
 	/* The next record in this hash bucket. */
 	struct AddressRec *next;
+
+	/* The lookup index bucket holding this record, and the next,
+	 * lower precedence, record in it. */
+	struct AddressBucket *bucket;
+	struct AddressRec *bnext;
 };
 
 
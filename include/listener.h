@@ -34,6 +34,7 @@ struct Listener
 	rb_dlink_node lnode;	/* list node */
 	const char *name;	/* listener name */
 	rb_fde_t *F;		/* file descriptor */
+	uint32_t id;		/* how ssld refers to it */
 	int ref_count;		/* number of connection references */
 	int active;		/* current state of listener */
 	int ssl;		/* ssl listener */
@@ -47,8 +48,13 @@ extern void add_tcp_listener(int port, const char *vaddr_ip, int family, int ssl
 extern void add_sctp_listener(int port, const char *vaddr_ip1, const char *vaddr_ip2, int ssl);
 extern void close_listener(struct Listener *listener);
 extern void close_listeners(void);
+extern void mark_listeners_inactive(void);
 extern const char *get_listener_name(const struct Listener *listener);
 extern void show_ports(struct Client *client);
 extern void free_listener(struct Listener *);
+extern void listener_foreach(void (*func)(void *data, struct Listener *listener), void *data);
+extern struct Listener *adopt_listener(uint32_t id, int fd, uint8_t type, struct rb_sockaddr_storage *addr, int ssl, int defer_accept, bool sctp);
+extern struct Client *add_ssld_connection(uint32_t listener_id, rb_fde_t *F, struct sockaddr *addr, struct sockaddr *lai);
+extern void close_inactive_listeners(void);
 
 #endif /* INCLUDED_listener_h */
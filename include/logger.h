@@ -54,6 +54,8 @@ struct Client;
 extern void init_main_logfile(void);
 extern void open_logfiles(void);
 extern void close_logfiles(void);
+extern void set_log_flush_interval(int);
+extern void get_log_stats(unsigned long long *lines, unsigned long long *dropped);
 extern void ilog(ilogfile dest, const char *fmt, ...) AFP(2, 3);
 extern void idebug(const char *fmt, ...) AFP(1, 2);
 extern void inotice(const char *fmt, ...) AFP(1, 2);
@@ -25,8 +25,15 @@
 #ifndef INCLUDED_packet_h
 #define INCLUDED_packet_h
 
+struct recvq;
+
 extern PF read_packet;
 extern EVH flood_recalc;
 extern void flood_endgrace(struct Client *);
 
+extern void recvq_append(struct recvq *rq, const char *data, size_t len);
+extern void recvq_foreach(struct recvq *rq, void (*func)(const char *data, int len, int terminated, void *arg), void *arg);
+extern void recvq_clear(struct recvq *rq);
+extern void recvq_free(struct recvq *rq);
+
 #endif /* INCLUDED_packet_h */
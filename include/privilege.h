@@ -50,6 +50,36 @@ enum {
 };
 typedef unsigned int PrivilegeFlags;
 
+/*
+ * Privilege names are interned to small integers, and each set carries a
+ * bitset of the ids it grants.  The privileges the core checks itself
+ * have fixed ids, interned in this order before any other.
+ */
+typedef unsigned int PrivilegeId;
+
+enum {
+	PRIV_NONE = 0,			/* never granted */
+	PRIV_OPER_KILL,
+	PRIV_OPER_ROUTING,
+	PRIV_OPER_UNKLINE,
+	PRIV_SNOMASK_NICK_CHANGES,
+	PRIV_OPER_KLINE,
+	PRIV_OPER_XLINE,
+	PRIV_OPER_RESV,
+	PRIV_OPER_DIE,
+	PRIV_OPER_REHASH,
+	PRIV_OPER_HIDDEN_ADMIN,
+	PRIV_OPER_ADMIN,
+	PRIV_OPER_OPERWALL,
+	PRIV_OPER_SPY,
+	PRIV_OPER_HIDDEN,
+	PRIV_OPER_REMOTEBAN,
+	PRIV_OPER_MASS_NOTICE,
+	PRIV_OPER_GENERAL,
+	PRIV_AUSPEX_OPER,
+	PRIV_BUILTIN_COUNT
+};
+
 struct PrivilegeSet {
 	rb_dlink_node node;
 	size_t size;
@@ -58,6 +88,8 @@ struct PrivilegeSet {
 	char *priv_storage;
 	char *name;
 	struct PrivilegeSet *shadow;
+	uint32_t *bits;		/* indexed by PrivilegeId */
+	size_t bits_len;	/* in words */
 	PrivilegeFlags flags;
 	unsigned int status;	/* If CONF_ILLEGAL, delete when no refs */
 	int refs;
@@ -69,6 +101,15 @@ struct privset_diff {
 	const struct PrivilegeSet *removed;
 };
 
+PrivilegeId privilege_intern(const char *priv);
+PrivilegeId privilege_find(const char *priv);
+
+static inline bool
+privilegeset_has(const struct PrivilegeSet *set, PrivilegeId id)
+{
+	return id / 32 < set->bits_len && (set->bits[id / 32] & (1u << (id % 32))) != 0;
+}
+
 bool privilegeset_in_set(const struct PrivilegeSet *set, const char *priv);
 const char *const *privilegeset_privs(const struct PrivilegeSet *set);
 struct PrivilegeSet *privilegeset_set_new(const char *name, const char *privs, PrivilegeFlags flags);
@@ -241,6 +241,8 @@ struct config_file_entry
 	int use_propagated_bans;
 	int max_ratelimit_tokens;
 	int away_interval;
+	int io_event_budget;
+	int log_flush_interval;
 	int tls_ciphers_oper_only;
 	int oper_secure_only;
 
@@ -50,6 +50,8 @@ extern rb_dlink_list oper_conf_list;
 extern rb_dlink_list server_conf_list;
 extern rb_dlink_list xline_conf_list;
 extern rb_dlink_list resv_conf_list;
+extern unsigned long xline_conf_serial;
+extern unsigned long resv_conf_serial;
 extern rb_dlink_list nd_list;
 extern rb_dlink_list tgchange_list;
 
@@ -142,28 +144,30 @@ extern void cluster_generic(struct Client *, const char *, int cltype,
 #define IsOperConfEncrypted(x)	((x)->flags & OPER_ENCRYPTED)
 #define IsOperConfNeedSSL(x)	((x)->flags & OPER_NEEDSSL)
 
+#define HasPrivilegeId(x, y)	((x)->user != NULL && (x)->user->privset != NULL && privilegeset_has((x)->user->privset, (y)))
+#define MayHavePrivilegeId(x, y)	(HasPrivilegeId((x), (y)) || (IsOper((x)) && (x)->user != NULL && (x)->user->privset == NULL))
 #define HasPrivilege(x, y)	((x)->user != NULL && (x)->user->privset != NULL && privilegeset_in_set((x)->user->privset, (y)))
 #define MayHavePrivilege(x, y)	(HasPrivilege((x), (y)) || (IsOper((x)) && (x)->user != NULL && (x)->user->privset == NULL))
 
-#define IsOperKill(x)           (HasPrivilege((x), "oper:kill"))
-#define IsOperRemote(x)         (HasPrivilege((x), "oper:routing"))
-#define IsOperUnkline(x)        (HasPrivilege((x), "oper:unkline"))
-#define IsOperN(x)              (HasPrivilege((x), "snomask:nick_changes"))
-#define IsOperK(x)              (HasPrivilege((x), "oper:kline"))
-#define IsOperXline(x)          (HasPrivilege((x), "oper:xline"))
-#define IsOperResv(x)           (HasPrivilege((x), "oper:resv"))
-#define IsOperDie(x)            (HasPrivilege((x), "oper:die"))
-#define IsOperRehash(x)         (HasPrivilege((x), "oper:rehash"))
-#define IsOperHiddenAdmin(x)    (HasPrivilege((x), "oper:hidden_admin"))
-#define IsOperAdmin(x)          (HasPrivilege((x), "oper:admin") || HasPrivilege((x), "oper:hidden_admin"))
-#define IsOperOperwall(x)       (HasPrivilege((x), "oper:operwall"))
-#define IsOperSpy(x)            (HasPrivilege((x), "oper:spy"))
-#define IsOperInvis(x)          (HasPrivilege((x), "oper:hidden"))
-#define IsOperRemoteBan(x)      (HasPrivilege((x), "oper:remoteban"))
-#define IsOperMassNotice(x)     (HasPrivilege((x), "oper:mass_notice"))
-#define IsOperGeneral(x)        (MayHavePrivilege((x), "oper:general"))
-
-#define SeesOper(target, source)	(IsOper((target)) && ((!ConfigFileEntry.hide_opers && !HasPrivilege((target), "oper:hidden")) || HasPrivilege((source), "auspex:oper")))
+#define IsOperKill(x)           (HasPrivilegeId((x), PRIV_OPER_KILL))
+#define IsOperRemote(x)         (HasPrivilegeId((x), PRIV_OPER_ROUTING))
+#define IsOperUnkline(x)        (HasPrivilegeId((x), PRIV_OPER_UNKLINE))
+#define IsOperN(x)              (HasPrivilegeId((x), PRIV_SNOMASK_NICK_CHANGES))
+#define IsOperK(x)              (HasPrivilegeId((x), PRIV_OPER_KLINE))
+#define IsOperXline(x)          (HasPrivilegeId((x), PRIV_OPER_XLINE))
+#define IsOperResv(x)           (HasPrivilegeId((x), PRIV_OPER_RESV))
+#define IsOperDie(x)            (HasPrivilegeId((x), PRIV_OPER_DIE))
+#define IsOperRehash(x)         (HasPrivilegeId((x), PRIV_OPER_REHASH))
+#define IsOperHiddenAdmin(x)    (HasPrivilegeId((x), PRIV_OPER_HIDDEN_ADMIN))
+#define IsOperAdmin(x)          (HasPrivilegeId((x), PRIV_OPER_ADMIN) || HasPrivilegeId((x), PRIV_OPER_HIDDEN_ADMIN))
+#define IsOperOperwall(x)       (HasPrivilegeId((x), PRIV_OPER_OPERWALL))
+#define IsOperSpy(x)            (HasPrivilegeId((x), PRIV_OPER_SPY))
+#define IsOperInvis(x)          (HasPrivilegeId((x), PRIV_OPER_HIDDEN))
+#define IsOperRemoteBan(x)      (HasPrivilegeId((x), PRIV_OPER_REMOTEBAN))
+#define IsOperMassNotice(x)     (HasPrivilegeId((x), PRIV_OPER_MASS_NOTICE))
+#define IsOperGeneral(x)        (MayHavePrivilegeId((x), PRIV_OPER_GENERAL))
+
+#define SeesOper(target, source)	(IsOper((target)) && ((!ConfigFileEntry.hide_opers && !HasPrivilegeId((target), PRIV_OPER_HIDDEN)) || HasPrivilegeId((source), PRIV_AUSPEX_OPER)))
 
 extern struct oper_conf *make_oper_conf(void);
 extern void free_oper_conf(struct oper_conf *);
@@ -237,6 +241,12 @@ extern struct ConfItem *find_xline_mask(const char *);
 extern struct ConfItem *find_nick_resv(const char *name);
 extern struct ConfItem *find_nick_resv_mask(const char *name);
 
+/* maskindex.c */
+struct mask_index;
+extern struct ConfItem *find_mask_conf(rb_dlink_list *list, struct mask_index **idxp,
+		unsigned long serial, const char *name);
+extern void free_mask_index(struct mask_index **idxp);
+
 extern int valid_wild_card_simple(const char *);
 extern int clean_resv_nick(const char *);
 time_t valid_temp_time(const char *p);
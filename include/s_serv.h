@@ -139,6 +139,40 @@ extern int refresh_user_links;
 #define HUNTED_ISME     0	/* if this server should execute the command */
 #define HUNTED_PASS     1	/* if message passed onwards successfully */
 
+/*
+ * A netburst to a directly connected server is sent a few thousand lines
+ * at a time, whenever the link has room for more.  Anything else sent to
+ * the server meanwhile is held back until the burst is complete, so the
+ * other side still sees a burst followed by live traffic.
+ */
+enum burst_phase
+{
+	BURST_USERS,
+	BURST_CHANNELS,
+	BURST_DONE
+};
+
+struct server_burst
+{
+	rb_dlink_node node;		/* on the list of bursts in progress */
+	struct Client *client_p;
+	enum burst_phase phase;
+	bool sending;			/* burst output is being generated */
+	rb_dlink_node *next;		/* next client or channel to send */
+	rb_dlink_node *last;		/* newest client when the burst began */
+	buf_head_t held;		/* everything else sent meanwhile */
+	struct timeval start;
+	long duration;			/* in milliseconds, once done */
+	unsigned long users;
+	unsigned long channels;
+	unsigned long total_users;
+	unsigned long total_channels;
+	unsigned int passes;
+};
+
+#define IsBursting(x)	((x)->localClient->burst != NULL && \
+			 (x)->localClient->burst->phase != BURST_DONE)
+
 extern void init_builtin_capabs(void);
 
 extern int hunt_server(struct Client *client_pt,
@@ -153,4 +187,10 @@ extern int server_estab(struct Client *client_p);
 
 extern int serv_connect(struct server_conf *, struct Client *);
 
+extern void start_burst(struct Client *client_p);
+extern void continue_burst(struct Client *client_p);
+extern void free_server_burst(struct Client *client_p);
+extern void burst_forget_client(struct Client *target_p);
+extern void burst_forget_channel(struct Channel *chptr);
+
 #endif /* INCLUDED_s_serv_h */
@@ -69,6 +69,9 @@ struct ServerStatistics
 	unsigned int is_cib;    /* number of open client-initiated batches */
 	unsigned int is_cibl;   /* number of queued lines in open client-initiated batches */
 	unsigned int is_rrb;    /* number of open remote response batches */
+	unsigned int is_whoi;	/* global WHOs answered from the WHO index */
+	unsigned int is_whos;	/* global WHOs answered by a full scan */
+	unsigned long long int is_whoc;	/* clients examined by global WHOs */
 };
 
 extern struct ServerStatistics ServerStats;
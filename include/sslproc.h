@@ -25,12 +25,24 @@
 struct _ssl_ctl;
 typedef struct _ssl_ctl ssl_ctl_t;
 
+struct Listener;
+
 enum ssld_status {
 	SSLD_ACTIVE,
 	SSLD_SHUTDOWN,
 	SSLD_DEAD,
 };
 
+/* incoming TLS handshakes, as last reported by an ssld */
+struct ssld_handshakes
+{
+	unsigned long long full;
+	unsigned long long resumed;
+	unsigned long long failed;
+	unsigned int full_rate;		/* per minute, between the last two reports */
+	unsigned int resumed_rate;
+};
+
 void init_ssld(void);
 void restart_ssld(void);
 int start_ssldaemon(int count);
@@ -38,9 +50,15 @@ ssl_ctl_t *start_ssld_accept(rb_fde_t *sslF, rb_fde_t *plainF, uint32_t id);
 ssl_ctl_t *start_ssld_connect(rb_fde_t *sslF, rb_fde_t *plainF, uint32_t id);
 void start_zlib_session(void *data);
 void ssld_update_config(void);
+void ssld_add_listener(struct Listener *listener);
+void ssld_del_listener(struct Listener *listener);
 void ssld_decrement_clicount(ssl_ctl_t *ctl);
+void ssld_increment_clicount(ssl_ctl_t *ctl);
 int get_ssld_count(void);
-void ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version), void *data);
+void ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version, const struct ssld_handshakes *hs), void *data);
+void ssld_prepare_upgrade(void);
+void ssld_foreach_upgrade(void (*func)(void *data, ssl_ctl_t *ctl, int ctl_fd, int pipe_fd, pid_t pid, bool shutdown, const char *version), void *data);
+ssl_ctl_t *ssld_adopt(int ctl_fd, int pipe_fd, pid_t pid, bool shutdown, const char *version);
 
 #endif
 
@@ -0,0 +1,42 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  upgrade.h: Restart into a new binary without dropping clients.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef INCLUDED_upgrade_h
+#define INCLUDED_upgrade_h
+
+struct Client;
+
+/* the environment variable holding the state file descriptor */
+#define UPGRADE_ENV		"SOLANUM_UPGRADE_FD"
+
+/* bumped whenever the state file changes incompatibly */
+#define UPGRADE_VERSION		2
+
+extern void upgrade_server(struct Client *source_p);
+
+extern bool upgrade_save(FILE *fp);
+extern bool upgrade_restore_early(FILE *fp);
+extern int upgrade_restore(FILE *fp);
+
+extern bool upgrade_check(void);
+extern void upgrade_start(void);
+extern void upgrade_finish(void);
+
+#endif
@@ -36,23 +36,25 @@ struct Client;
   lets speed this up...
   also removed away information. *tough*
   - Dianora
+
+  entries live in a fixed ring and the longer strings are interned,
+  since many entries share a host, realname or account.
  */
 struct Whowas
 {
 	struct whowas_top *wtop;
 	rb_dlink_node wnode;		/* for the wtop linked list */
 	rb_dlink_node cnode;		/* node for online clients */
-	rb_dlink_node whowas_node;	/* node for the whowas linked list */
 	char name[NICKLEN + 1];
-	char username[USERLEN + 1];
-	char hostname[HOSTLEN + 1];
-	char sockhost[HOSTIPLEN + 1];
-	char realname[REALLEN + 1];
-	char suser[NICKLEN + 1];
-	unsigned char flags;
+	const char *username;
+	const char *hostname;
+	const char *sockhost;
+	const char *realname;
+	const char *suser;
 	const char *servername;
 	time_t logoff;
 	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
+	unsigned char flags;
 };
 
 /* Flags */
@@ -264,12 +264,14 @@ bandb_check_dline(struct ConfItem *aconf)
 }
 
 static int
-bandb_check_xline(struct ConfItem *aconf)
+bandb_check_xline(struct ConfItem *aconf, rb_radixtree *loaded)
 {
 	struct ConfItem *xconf;
 	/* XXX perhaps convert spaces to \s? -- jilles */
 
 	xconf = find_xline_mask(aconf->host);
+	if(xconf == NULL)
+		xconf = rb_radixtree_retrieve(loaded, aconf->host);
 	if(xconf != NULL && !(xconf->flags & CONF_FLAGS_TEMPORARY))
 		return 0;
 
@@ -294,12 +296,12 @@ bandb_check_resv_channel(struct ConfItem *aconf)
 }
 
 static int
-bandb_check_resv_nick(struct ConfItem *aconf)
+bandb_check_resv_nick(struct ConfItem *aconf, rb_radixtree *loaded)
 {
 	if(!clean_resv_nick(aconf->host))
 		return 0;
 
-	if(find_nick_resv(aconf->host))
+	if(find_nick_resv(aconf->host) || rb_radixtree_retrieve(loaded, aconf->host))
 		return 0;
 
 	return 1;
@@ -317,15 +319,31 @@ bandb_handle_clear(void)
 	}
 }
 
+/* bandb_handle_finish()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - the bans sent by bandb replace the ones from the
+ *		  last load.  X-lines and RESVs are only checked against
+ *		  the temporary ones that are kept and by exact mask against
+ *		  each other, and are put on their lists once at the end, so
+ *		  that a large load does not rebuild their indexes per ban.
+ */
 static void
 bandb_handle_finish(void)
 {
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_list xlines = { NULL, NULL, 0 };
+	rb_dlink_list resvs = { NULL, NULL, 0 };
+	rb_radixtree *loaded_xlines, *loaded_resvs;
 
 	clear_out_address_conf(AC_BANDB);
 	clear_s_newconf_bans();
 
+	loaded_xlines = rb_radixtree_create("bandb xlines", irccasecanon);
+	loaded_resvs = rb_radixtree_create("bandb resvs", irccasecanon);
+
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bandb_pending.head)
 	{
 		aconf = ptr->data;
@@ -351,8 +369,11 @@ bandb_handle_finish(void)
 			break;
 
 		case CONF_XLINE:
-			if(bandb_check_xline(aconf))
-				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+			if(bandb_check_xline(aconf, loaded_xlines))
+			{
+				rb_dlinkAddTailAlloc(aconf, &xlines);
+				rb_radixtree_add(loaded_xlines, aconf->host, aconf);
+			}
 			else
 				free_conf(aconf);
 
@@ -367,8 +388,11 @@ bandb_handle_finish(void)
 			break;
 
 		case CONF_RESV_NICK:
-			if(bandb_check_resv_nick(aconf))
-				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+			if(bandb_check_resv_nick(aconf, loaded_resvs))
+			{
+				rb_dlinkAddTailAlloc(aconf, &resvs);
+				rb_radixtree_add(loaded_resvs, aconf->host, aconf);
+			}
 			else
 				free_conf(aconf);
 
@@ -376,6 +400,23 @@ bandb_handle_finish(void)
 		}
 	}
 
+	/* in the order they would have been added one by one */
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, xlines.head)
+	{
+		rb_dlinkAddAlloc(ptr->data, &xline_conf_list);
+		rb_dlinkDestroy(ptr, &xlines);
+	}
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resvs.head)
+	{
+		rb_dlinkAddAlloc(ptr->data, &resv_conf_list);
+		rb_dlinkDestroy(ptr, &resvs);
+	}
+	xline_conf_serial++;
+	resv_conf_serial++;
+
+	rb_radixtree_destroy(loaded_xlines, NULL, NULL);
+	rb_radixtree_destroy(loaded_resvs, NULL, NULL);
+
 	check_banned_lines();
 }
 
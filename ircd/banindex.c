@@ -0,0 +1,467 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  banindex.c: Compiled per-channel ban list lookups.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * Large ban lists are compiled into an index so that checking a client
+ * does not have to match() every entry.  Each ban is filed under a key
+ * that any client it matches must have:
+ *
+ *   'h'  literal host part          *!*@host.example.com
+ *   'n'  literal nick part          nick!*@*
+ *   'u'  literal user part          *!user@*
+ *   's'  label-aligned literal tail *!*@*.example.com (under example.com)
+ *
+ * CIDR bans are additionally filed in a patricia tree per address family,
+ * and whatever is left (extbans, masks with no literal component) goes in
+ * a fallback list.  Keys only select candidates; every candidate is still
+ * checked with matches_mask() and match_extban(), so the result is the same
+ * as walking the list, including which ban's forward applies.
+ *
+ * The index is rebuilt whenever chptr->bants has moved on, which is bumped
+ * by every change to the ban, quiet and exception lists.
+ */
+
+#include "stdinc.h"
+#include "channel.h"
+#include "client.h"
+#include "hash.h"
+#include "match.h"
+#include "s_assert.h"
+
+/* lists shorter than this are walked directly */
+#define BAN_INDEX_MIN	16
+
+struct ban_entry
+{
+	struct Ban *banptr;
+	unsigned int pos;		/* position in the list, head is 0 */
+	struct ban_entry *next;		/* bucket or fallback chain */
+	struct ban_entry *cidr_next;	/* patricia node chain */
+};
+
+struct ban_index
+{
+	time_t bants;			/* chptr->bants this was built for */
+	unsigned int count;
+	struct ban_entry *entries;
+
+	struct ban_entry **buckets;
+	unsigned int bucket_mask;
+
+	rb_patricia_tree_t *cidr4;
+	rb_patricia_tree_t *cidr6;
+	unsigned char cidr4_len[33];	/* prefix lengths present */
+	unsigned char cidr6_len[129];
+
+	struct ban_entry *fallback;	/* in list order */
+};
+
+static inline int
+has_wild(const char *s, const char *end)
+{
+	for(; s < end; s++)
+		if(*s == '*' || *s == '?')
+			return 1;
+	return 0;
+}
+
+static inline unsigned int
+ban_key_hash(struct ban_index *idx, char type, const char *key, int len)
+{
+	return (fnv_hash_upper_len((const unsigned char *)key, 32, len) ^
+			((unsigned char)type * 0x9e3779b1U)) & idx->bucket_mask;
+}
+
+static void
+ban_index_add_key(struct ban_index *idx, struct ban_entry *entry,
+		char type, const char *key, int len)
+{
+	unsigned int hashv = ban_key_hash(idx, type, key, len);
+
+	entry->next = idx->buckets[hashv];
+	idx->buckets[hashv] = entry;
+}
+
+/* ban_index_add_cidr()
+ *
+ * input	- index, entry, host part of the ban
+ * output	- 1 if the ban was filed as a CIDR ban, else 0
+ * side effects - parses the host the same way match_cidr() does
+ */
+static int
+ban_index_add_cidr(struct ban_index *idx, struct ban_entry *entry, const char *host)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_tree_t **tree;
+	rb_patricia_node_t *pnode;
+	char buf[HOSTIPLEN + 5];
+	char *len;
+	int bits;
+
+	if(strlen(host) >= sizeof(buf))
+		return 0;
+
+	rb_strlcpy(buf, host, sizeof(buf));
+	len = strrchr(buf, '/');
+	if(len == NULL)
+		return 0;
+	*len++ = '\0';
+
+	bits = atoi(len);
+	if(bits <= 0 || bits > (strchr(buf, ':') ? 128 : 32))
+		return 0;
+
+	if(!rb_inet_pton_sock(buf, (struct sockaddr_storage *)&addr))
+		return 0;
+
+	if(GET_SS_FAMILY(&addr) == AF_INET6)
+	{
+		tree = &idx->cidr6;
+		idx->cidr6_len[bits] = 1;
+	}
+	else
+	{
+		tree = &idx->cidr4;
+		idx->cidr4_len[bits] = 1;
+	}
+
+	if(*tree == NULL)
+		*tree = rb_new_patricia(PATRICIA_BITS);
+
+	pnode = make_and_lookup_ip(*tree, (struct sockaddr *)&addr, bits);
+	if(pnode == NULL)
+		return 0;
+
+	entry->cidr_next = pnode->data;
+	pnode->data = entry;
+	return 1;
+}
+
+/* ban_index_add()
+ *
+ * input	- index, entry
+ * output	- 1 if the entry was filed under a key, 0 if it needs
+ *                to go on the fallback list
+ * side effects -
+ */
+static int
+ban_index_add(struct ban_index *idx, struct ban_entry *entry)
+{
+	const char *mask = entry->banptr->banstr;
+	const char *bang, *at, *host, *p;
+
+	/* forms are always nick!user@host, none of the parts can contain
+	 * '@' and nick and user can't contain '!'.  a literal run anchored
+	 * at the start, at the end, or between both separators therefore
+	 * fixes that part of any form the mask matches.
+	 */
+	if(*mask == '$' || (bang = strchr(mask, '!')) == NULL ||
+			(at = strrchr(mask, '@')) == NULL || at < bang)
+		return 0;
+
+	host = at + 1;
+
+	if(*host != '\0' && !has_wild(host, host + strlen(host)))
+	{
+		ban_index_add_cidr(idx, entry, host);
+		ban_index_add_key(idx, entry, 'h', host, strlen(host));
+		return 1;
+	}
+
+	if(bang > mask && !has_wild(mask, bang))
+	{
+		ban_index_add_key(idx, entry, 'n', mask, bang - mask);
+		return 1;
+	}
+
+	if(at > bang + 1 && !has_wild(bang + 1, at) &&
+			memchr(bang + 1, '!', at - bang - 1) == NULL)
+	{
+		ban_index_add_key(idx, entry, 'u', bang + 1, at - bang - 1);
+		return 1;
+	}
+
+	/* the host ends with the literal tail after the last wildcard,
+	 * so it also ends with whichever labels lie wholly inside it
+	 */
+	p = host + strlen(host);
+	while(p > host && p[-1] != '*' && p[-1] != '?')
+		p--;
+
+	if(*p != '.')
+		p = strchr(p, '.');
+	if(p != NULL && p[1] != '\0')
+	{
+		ban_index_add_key(idx, entry, 's', p + 1, strlen(p + 1));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ban_index_build()
+ *
+ * input	- ban list, current bants
+ * output	- compiled index for the list
+ * side effects -
+ */
+static struct ban_index *
+ban_index_build(rb_dlink_list *list, time_t bants)
+{
+	struct ban_index *idx;
+	struct ban_entry **fallback_tail;
+	rb_dlink_node *ptr;
+	unsigned int size = 16;
+	unsigned int pos = 0;
+
+	idx = rb_malloc(sizeof(struct ban_index));
+	idx->bants = bants;
+	idx->count = rb_dlink_list_length(list);
+	idx->entries = rb_malloc(sizeof(struct ban_entry) * idx->count);
+
+	while(size < idx->count * 2)
+		size <<= 1;
+	idx->buckets = rb_malloc(sizeof(struct ban_entry *) * size);
+	idx->bucket_mask = size - 1;
+
+	fallback_tail = &idx->fallback;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		struct ban_entry *entry = &idx->entries[pos];
+
+		entry->banptr = ptr->data;
+		entry->pos = pos++;
+
+		if(!ban_index_add(idx, entry))
+		{
+			*fallback_tail = entry;
+			fallback_tail = &entry->next;
+		}
+	}
+
+	return idx;
+}
+
+/* free_ban_index()
+ *
+ * input	- pointer to a list's index
+ * output	-
+ * side effects - index is freed and the pointer cleared
+ */
+void
+free_ban_index(struct ban_index **idxp)
+{
+	struct ban_index *idx = *idxp;
+
+	if(idx == NULL)
+		return;
+
+	if(idx->cidr4 != NULL)
+		rb_destroy_patricia(idx->cidr4, NULL);
+	if(idx->cidr6 != NULL)
+		rb_destroy_patricia(idx->cidr6, NULL);
+
+	rb_free(idx->buckets);
+	rb_free(idx->entries);
+	rb_free(idx);
+	*idxp = NULL;
+}
+
+static inline void
+ban_index_try(struct ban_entry *entry, struct ban_entry **best,
+		struct Channel *chptr, struct Client *who,
+		const struct matchset *ms, long mode_type)
+{
+	if(*best != NULL && (*best)->pos <= entry->pos)
+		return;
+
+	if(matches_mask(ms, entry->banptr->banstr) ||
+			match_extban(entry->banptr->banstr, who, chptr, mode_type))
+		*best = entry;
+}
+
+static void
+ban_index_try_key(struct ban_index *idx, struct ban_entry **best,
+		char type, const char *key, int len,
+		struct Channel *chptr, struct Client *who,
+		const struct matchset *ms, long mode_type)
+{
+	struct ban_entry *entry;
+
+	/* collisions just cost an extra match, so keys aren't compared */
+	for(entry = idx->buckets[ban_key_hash(idx, type, key, len)];
+			entry != NULL; entry = entry->next)
+		ban_index_try(entry, best, chptr, who, ms, mode_type);
+}
+
+static void
+ban_index_try_cidr(struct ban_index *idx, struct ban_entry **best,
+		const char *ip, struct Channel *chptr, struct Client *who,
+		const struct matchset *ms, long mode_type)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_tree_t *tree;
+	rb_patricia_node_t *pnode;
+	struct ban_entry *entry;
+	unsigned char *lens;
+	int bits, maxbits;
+
+	if(!rb_inet_pton_sock(ip, (struct sockaddr_storage *)&addr))
+		return;
+
+	if(GET_SS_FAMILY(&addr) == AF_INET6)
+	{
+		tree = idx->cidr6;
+		lens = idx->cidr6_len;
+		maxbits = 128;
+	}
+	else
+	{
+		tree = idx->cidr4;
+		lens = idx->cidr4_len;
+		maxbits = 32;
+	}
+
+	if(tree == NULL)
+		return;
+
+	for(bits = 1; bits <= maxbits; bits++)
+	{
+		if(!lens[bits])
+			continue;
+
+		pnode = rb_match_ip_exact(tree, (struct sockaddr *)&addr, bits);
+		if(pnode == NULL)
+			continue;
+
+		for(entry = pnode->data; entry != NULL; entry = entry->cidr_next)
+			ban_index_try(entry, best, chptr, who, ms, mode_type);
+	}
+}
+
+static void
+ban_index_try_host(struct ban_index *idx, struct ban_entry **best,
+		const char *form, int is_ip, struct Channel *chptr,
+		struct Client *who, const struct matchset *ms, long mode_type)
+{
+	const char *host, *p;
+
+	host = strrchr(form, '@');
+	if(host == NULL)
+		return;
+	host++;
+
+	ban_index_try_key(idx, best, 'h', host, strlen(host),
+			chptr, who, ms, mode_type);
+
+	for(p = strchr(host, '.'); p != NULL; p = strchr(p + 1, '.'))
+		ban_index_try_key(idx, best, 's', p + 1, strlen(p + 1),
+				chptr, who, ms, mode_type);
+
+	if(is_ip)
+		ban_index_try_cidr(idx, best, host, chptr, who, ms, mode_type);
+}
+
+/* ban_index_match()
+ *
+ * input	- index, channel, local client, client's matchset, mode type
+ * output	- first ban in list order matching the client, or NULL
+ * side effects -
+ */
+static struct Ban *
+ban_index_match(struct ban_index *idx, struct Channel *chptr,
+		struct Client *who, const struct matchset *ms, long mode_type)
+{
+	struct ban_entry *best = NULL;
+	struct ban_entry *entry;
+	const char *form = ms->host[0];
+	const char *bang, *at;
+	size_t i;
+
+	bang = strchr(form, '!');
+	at = strrchr(form, '@');
+	if(bang != NULL && at != NULL && at > bang)
+	{
+		ban_index_try_key(idx, &best, 'n', form, bang - form,
+				chptr, who, ms, mode_type);
+		ban_index_try_key(idx, &best, 'u', bang + 1, at - bang - 1,
+				chptr, who, ms, mode_type);
+	}
+
+	for(i = 0; i < ARRAY_SIZE(ms->host) && ms->host[i][0] != '\0'; i++)
+		ban_index_try_host(idx, &best, ms->host[i], 0,
+				chptr, who, ms, mode_type);
+
+	for(i = 0; i < ARRAY_SIZE(ms->ip) && ms->ip[i][0] != '\0'; i++)
+		ban_index_try_host(idx, &best, ms->ip[i], 1,
+				chptr, who, ms, mode_type);
+
+	for(entry = idx->fallback; entry != NULL; entry = entry->next)
+	{
+		if(best != NULL && best->pos < entry->pos)
+			break;
+		ban_index_try(entry, &best, chptr, who, ms, mode_type);
+	}
+
+	return best != NULL ? best->banptr : NULL;
+}
+
+/* find_ban()
+ *
+ * input	- channel, ban list, the list's index, local client,
+ *                client's matchset, mode type for extbans
+ * output	- first ban in the list matching the client, or NULL
+ * side effects - the index is built, rebuilt or freed to match the list
+ */
+struct Ban *
+find_ban(struct Channel *chptr, rb_dlink_list *list, struct ban_index **idxp,
+		struct Client *who, const struct matchset *ms, long mode_type)
+{
+	struct Ban *banptr;
+	rb_dlink_node *ptr;
+
+	if(rb_dlink_list_length(list) >= BAN_INDEX_MIN)
+	{
+		if(*idxp != NULL && ((*idxp)->bants != chptr->bants ||
+				(*idxp)->count != rb_dlink_list_length(list)))
+		{
+			/* the count check is a backstop for a missed bants++ */
+			s_assert((*idxp)->bants != chptr->bants);
+			free_ban_index(idxp);
+		}
+		if(*idxp == NULL)
+			*idxp = ban_index_build(list, chptr->bants);
+
+		return ban_index_match(*idxp, chptr, who, ms, mode_type);
+	}
+
+	free_ban_index(idxp);
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		banptr = ptr->data;
+		if(matches_mask(ms, banptr->banstr) ||
+				match_extban(banptr->banstr, who, chptr, mode_type))
+			return banptr;
+	}
+
+	return NULL;
+}
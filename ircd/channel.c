@@ -89,6 +89,7 @@ free_channel(struct Channel *chptr)
 {
 	rb_free(chptr->chname);
 	rb_free(chptr->mode_lock);
+	rb_free(chptr->member_index);
 	rb_bh_free(channel_heap, chptr);
 }
 
@@ -159,6 +160,145 @@ send_batched_channel_join(struct Channel *chptr, struct Client *client_p, const
 			client_p->name, client_p->username, client_p->host, client_p->user->away);
 }
 
+/* Channels with at least MEMBER_INDEX_MIN members also keep their
+ * memberships in an open-addressed hash table keyed on the client, so
+ * find_channel_membership() doesn't have to walk either list.  The
+ * table is kept at most half full and is dropped again once the channel
+ * shrinks below half the threshold.
+ */
+#define MEMBER_INDEX_MIN	64
+
+static inline unsigned int
+member_index_hash(struct Client *client_p, unsigned int size)
+{
+	uintptr_t v = (uintptr_t) client_p;
+
+	v ^= v >> 16;
+	v *= 0x45d9f3b;
+	v ^= v >> 16;
+	return (unsigned int) v & (size - 1);
+}
+
+static void
+member_index_build(struct Channel *chptr, unsigned int size)
+{
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+	unsigned int i;
+
+	rb_free(chptr->member_index);
+	chptr->member_index = rb_malloc(size * sizeof(struct membership *));
+	chptr->member_index_size = size;
+
+	RB_DLINK_FOREACH(ptr, chptr->members.head)
+	{
+		msptr = ptr->data;
+
+		i = member_index_hash(msptr->client_p, size);
+		while(chptr->member_index[i] != NULL)
+			i = (i + 1) & (size - 1);
+		chptr->member_index[i] = msptr;
+	}
+}
+
+/* member_index_add()
+ *
+ * input	- channel whose newest member (the head of members) was just added
+ * output	-
+ * side effects - member index is created, grown or updated as needed
+ */
+static void
+member_index_add(struct Channel *chptr)
+{
+	struct membership *msptr = chptr->members.head->data;
+	unsigned long count = rb_dlink_list_length(&chptr->members);
+	unsigned int size, i;
+
+	if(chptr->member_index == NULL)
+	{
+		if(count < MEMBER_INDEX_MIN)
+			return;
+
+		for(size = MEMBER_INDEX_MIN; size < count * 4; size <<= 1)
+			;
+		member_index_build(chptr, size);
+		return;
+	}
+
+	if(count * 2 > chptr->member_index_size)
+	{
+		member_index_build(chptr, chptr->member_index_size * 2);
+		return;
+	}
+
+	size = chptr->member_index_size;
+	i = member_index_hash(msptr->client_p, size);
+	while(chptr->member_index[i] != NULL)
+		i = (i + 1) & (size - 1);
+	chptr->member_index[i] = msptr;
+}
+
+/* member_index_del()
+ *
+ * input	- channel, membership that was just removed from members
+ * output	-
+ * side effects - membership is removed from the member index, which may
+ *                shrink or be freed
+ */
+static void
+member_index_del(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned long count = rb_dlink_list_length(&chptr->members);
+	unsigned int size, i, j, k;
+
+	if(chptr->member_index == NULL)
+		return;
+
+	if(count < MEMBER_INDEX_MIN / 2)
+	{
+		rb_free(chptr->member_index);
+		chptr->member_index = NULL;
+		chptr->member_index_size = 0;
+		return;
+	}
+
+	if(count * 8 < chptr->member_index_size)
+	{
+		member_index_build(chptr, chptr->member_index_size / 2);
+		return;
+	}
+
+	size = chptr->member_index_size;
+	i = member_index_hash(msptr->client_p, size);
+	while(chptr->member_index[i] != msptr)
+	{
+		s_assert(chptr->member_index[i] != NULL);
+		if(chptr->member_index[i] == NULL)
+			return;
+		i = (i + 1) & (size - 1);
+	}
+
+	/* close the gap by pulling back any later entries in the probe
+	 * sequence that would no longer be found past the empty slot
+	 */
+	j = i;
+	chptr->member_index[i] = NULL;
+	for(;;)
+	{
+		j = (j + 1) & (size - 1);
+		if(chptr->member_index[j] == NULL)
+			break;
+
+		k = member_index_hash(chptr->member_index[j]->client_p, size);
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		chptr->member_index[i] = chptr->member_index[j];
+		chptr->member_index[j] = NULL;
+		i = j;
+	}
+}
+
 /* find_channel_membership()
  *
  * input	- channel to find them in, client to find
@@ -170,10 +310,24 @@ find_channel_membership(struct Channel *chptr, struct Client *client_p)
 {
 	struct membership *msptr;
 	rb_dlink_node *ptr;
+	unsigned int i;
 
 	if(!IsClient(client_p))
 		return NULL;
 
+	if(chptr->member_index != NULL)
+	{
+		i = member_index_hash(client_p, chptr->member_index_size);
+		while((msptr = chptr->member_index[i]) != NULL)
+		{
+			if(msptr->client_p == client_p)
+				return msptr;
+			i = (i + 1) & (chptr->member_index_size - 1);
+		}
+
+		return NULL;
+	}
+
 	/* Pick the most efficient list to use to be nice to things like
 	 * CHANSERV which could be in a large number of channels
 	 */
@@ -263,6 +417,7 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 		rb_dlinkAddBefore(p, msptr, &msptr->usernode, &client_p->user->channel);
 
 	rb_dlinkAdd(msptr, &msptr->channode, &chptr->members);
+	member_index_add(chptr);
 
 	if(MyClient(client_p))
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
@@ -288,6 +443,7 @@ remove_user_from_channel(struct membership *msptr)
 
 	rb_dlinkDelete(&msptr->usernode, &client_p->user->channel);
 	rb_dlinkDelete(&msptr->channode, &chptr->members);
+	member_index_del(chptr, msptr);
 
 	if(client_p->servptr == &me)
 		rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -323,6 +479,7 @@ remove_user_from_channels(struct Client *client_p)
 		chptr = msptr->chptr;
 
 		rb_dlinkDelete(&msptr->channode, &chptr->members);
+		member_index_del(chptr, msptr);
 
 		if(client_p->servptr == &me)
 			rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -406,6 +563,221 @@ free_channel_list(rb_dlink_list * list)
 	list->length = 0;
 }
 
+/* Ban lists with at least BAN_HASH_MIN entries also keep them in an
+ * open-addressed table keyed on the case-folded mask, so adding, removing
+ * and finding a mask doesn't walk the list.  As with the member index,
+ * the table is kept at most half full and is dropped again once the list
+ * shrinks below half the threshold.
+ */
+#define BAN_HASH_MIN	16
+#define BAN_HASH_MINBITS	5
+
+static struct ban_hash *
+ban_hash_for(struct Channel *chptr, rb_dlink_list *list)
+{
+	if(list == &chptr->banlist)
+		return &chptr->banlist_hash;
+	if(list == &chptr->exceptlist)
+		return &chptr->exceptlist_hash;
+	if(list == &chptr->invexlist)
+		return &chptr->invexlist_hash;
+	if(list == &chptr->quietlist)
+		return &chptr->quietlist_hash;
+	return NULL;
+}
+
+static inline unsigned int
+ban_hash_slot(struct ban_hash *bh, const char *banid)
+{
+	return fnv_hash_upper((const unsigned char *)banid, bh->bits);
+}
+
+static void
+ban_hash_build(struct ban_hash *bh, rb_dlink_list *list, unsigned int bits)
+{
+	struct Ban *banptr;
+	rb_dlink_node *ptr;
+	unsigned int i, mask = (1U << bits) - 1;
+
+	rb_free(bh->table);
+	bh->table = rb_malloc((mask + 1) * sizeof(struct Ban *));
+	bh->bits = bits;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		banptr = ptr->data;
+
+		i = ban_hash_slot(bh, banptr->banstr);
+		while(bh->table[i] != NULL)
+			i = (i + 1) & mask;
+		bh->table[i] = banptr;
+	}
+}
+
+static void
+ban_hash_free(struct ban_hash *bh)
+{
+	rb_free(bh->table);
+	bh->table = NULL;
+	bh->bits = 0;
+}
+
+/* find_ban_id()
+ *
+ * input	- channel, list to search, mask to find
+ * output	- the entry whose mask matches banid case-insensitively, or NULL
+ * side effects -
+ */
+struct Ban *
+find_ban_id(struct Channel *chptr, rb_dlink_list *list, const char *banid)
+{
+	struct ban_hash *bh = ban_hash_for(chptr, list);
+	struct Ban *banptr;
+	rb_dlink_node *ptr;
+	unsigned int i;
+
+	if(bh != NULL && bh->table != NULL)
+	{
+		i = ban_hash_slot(bh, banid);
+		while((banptr = bh->table[i]) != NULL)
+		{
+			if(!irccmp(banptr->banstr, banid))
+				return banptr;
+			i = (i + 1) & ((1U << bh->bits) - 1);
+		}
+
+		return NULL;
+	}
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		banptr = ptr->data;
+		if(!irccmp(banptr->banstr, banid))
+			return banptr;
+	}
+
+	return NULL;
+}
+
+/* add_ban_id()
+ *
+ * input	- channel, list to add to, entry to add
+ * output	-
+ * side effects - entry is linked onto the head of the list and into its
+ *                table, which may be created or grown
+ */
+void
+add_ban_id(struct Channel *chptr, rb_dlink_list *list, struct Ban *banptr)
+{
+	struct ban_hash *bh = ban_hash_for(chptr, list);
+	unsigned long count;
+	unsigned int bits, i;
+
+	rb_dlinkAdd(banptr, &banptr->node, list);
+
+	if(bh == NULL)
+		return;
+
+	count = rb_dlink_list_length(list);
+	if(bh->table == NULL)
+	{
+		if(count < BAN_HASH_MIN)
+			return;
+
+		for(bits = BAN_HASH_MINBITS; (1UL << bits) < count * 4; bits++)
+			;
+		ban_hash_build(bh, list, bits);
+		return;
+	}
+
+	if(count * 2 > (1UL << bh->bits))
+	{
+		ban_hash_build(bh, list, bh->bits + 1);
+		return;
+	}
+
+	i = ban_hash_slot(bh, banptr->banstr);
+	while(bh->table[i] != NULL)
+		i = (i + 1) & ((1U << bh->bits) - 1);
+	bh->table[i] = banptr;
+}
+
+/* del_ban_id()
+ *
+ * input	- channel, list to remove from, entry to remove
+ * output	-
+ * side effects - entry is unlinked from the list and its table, which may
+ *                shrink or be freed.  the entry itself is not freed.
+ */
+void
+del_ban_id(struct Channel *chptr, rb_dlink_list *list, struct Ban *banptr)
+{
+	struct ban_hash *bh = ban_hash_for(chptr, list);
+	unsigned long count;
+	unsigned int mask, i, j, k;
+
+	rb_dlinkDelete(&banptr->node, list);
+
+	if(bh == NULL || bh->table == NULL)
+		return;
+
+	count = rb_dlink_list_length(list);
+	if(count < BAN_HASH_MIN / 2)
+	{
+		ban_hash_free(bh);
+		return;
+	}
+
+	if(count * 8 < (1UL << bh->bits) && bh->bits > BAN_HASH_MINBITS)
+	{
+		ban_hash_build(bh, list, bh->bits - 1);
+		return;
+	}
+
+	mask = (1U << bh->bits) - 1;
+	i = ban_hash_slot(bh, banptr->banstr);
+	while(bh->table[i] != banptr)
+	{
+		s_assert(bh->table[i] != NULL);
+		if(bh->table[i] == NULL)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	/* close the gap the same way member_index_del() does */
+	j = i;
+	bh->table[i] = NULL;
+	for(;;)
+	{
+		j = (j + 1) & mask;
+		if(bh->table[j] == NULL)
+			break;
+
+		k = ban_hash_slot(bh, bh->table[j]->banstr);
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		bh->table[i] = bh->table[j];
+		bh->table[j] = NULL;
+		i = j;
+	}
+}
+
+/* clear_ban_hash()
+ *
+ * input	- channel, list that has been or is about to be emptied
+ * output	-
+ * side effects - the list's table is freed
+ */
+void
+clear_ban_hash(struct Channel *chptr, rb_dlink_list *list)
+{
+	struct ban_hash *bh = ban_hash_for(chptr, list);
+
+	if(bh != NULL)
+		ban_hash_free(bh);
+}
+
 /* destroy_channel()
  *
  * input	- channel to destroy
@@ -423,6 +795,13 @@ destroy_channel(struct Channel *chptr)
 	}
 
 	/* free all bans/exceptions/denies */
+	free_ban_index(&chptr->banlist_index);
+	free_ban_index(&chptr->exceptlist_index);
+	free_ban_index(&chptr->quietlist_index);
+	clear_ban_hash(chptr, &chptr->banlist);
+	clear_ban_hash(chptr, &chptr->exceptlist);
+	clear_ban_hash(chptr, &chptr->invexlist);
+	clear_ban_hash(chptr, &chptr->quietlist);
 	free_channel_list(&chptr->banlist);
 	free_channel_list(&chptr->exceptlist);
 	free_channel_list(&chptr->invexlist);
@@ -431,6 +810,7 @@ destroy_channel(struct Channel *chptr)
 	/* Free the topic */
 	free_topic(chptr);
 
+	burst_forget_channel(chptr);
 	rb_dlinkDelete(&chptr->node, &global_channel_list);
 	del_from_channel_hash(chptr->chname, chptr);
 	free_channel(chptr);
@@ -566,6 +946,7 @@ del_invite(struct Channel *chptr, struct Client *who)
 /* is_banned_list()
  *
  * input	- channel to check bans for, ban list (banlist or quietlist),
+ *                the list's compiled index,
  *                user to check bans against, optional prebuilt buffers,
  *                optional forward channel pointer
  * output	- 1 if banned, else 0
@@ -573,13 +954,12 @@ del_invite(struct Channel *chptr, struct Client *who)
  */
 static int
 is_banned_list(struct Channel *chptr, rb_dlink_list *list,
-	       struct Client *who, struct membership *msptr,
-	       const struct matchset *ms, const char **forward)
+	       struct ban_index **idxp, struct Client *who,
+	       struct membership *msptr, const struct matchset *ms,
+	       const char **forward)
 {
 	struct matchset ms_;
-	rb_dlink_node *ptr;
 	struct Ban *actualBan = NULL;
-	struct Ban *actualExcept = NULL;
 
 	if (!MyClient(who))
 		return 0;
@@ -590,35 +970,22 @@ is_banned_list(struct Channel *chptr, rb_dlink_list *list,
 		ms = &ms_;
 	}
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		actualBan = ptr->data;
-		if (matches_mask(ms, actualBan->banstr))
-			break;
-		if (match_extban(actualBan->banstr, who, chptr, CHFL_BAN))
-			break;
-		actualBan = NULL;
-	}
+	actualBan = find_ban(chptr, list, idxp, who, ms, CHFL_BAN);
 
 	if ((actualBan != NULL) && ConfigChannel.use_except)
 	{
-		RB_DLINK_FOREACH(ptr, chptr->exceptlist.head)
+		/* theyre exempted.. */
+		if (find_ban(chptr, &chptr->exceptlist, &chptr->exceptlist_index,
+					who, ms, CHFL_EXCEPTION) != NULL)
 		{
-			actualExcept = ptr->data;
-
-			/* theyre exempted.. */
-			if (matches_mask(ms, actualExcept->banstr) ||
-					match_extban(actualExcept->banstr, who, chptr, CHFL_EXCEPTION))
+			/* cache the fact theyre not banned */
+			if(msptr != NULL)
 			{
-				/* cache the fact theyre not banned */
-				if(msptr != NULL)
-				{
-					msptr->bants = chptr->bants;
-					msptr->flags &= ~CHFL_BANNED;
-				}
-
-				return CHFL_EXCEPTION;
+				msptr->bants = chptr->bants;
+				msptr->flags &= ~CHFL_BANNED;
 			}
+
+			return CHFL_EXCEPTION;
 		}
 	}
 
@@ -670,7 +1037,8 @@ is_banned(struct Channel *chptr, struct Client *who, struct membership *msptr,
 
 	return chptr->last_checked_result;
 #else
-	return is_banned_list(chptr, &chptr->banlist, who, msptr, ms, forward);
+	return is_banned_list(chptr, &chptr->banlist, &chptr->banlist_index,
+			who, msptr, ms, forward);
 #endif
 }
 
@@ -699,7 +1067,8 @@ is_quieted(struct Channel *chptr, struct Client *who, struct membership *msptr,
 
 	return chptr->last_checked_result;
 #else
-	return is_banned_list(chptr, &chptr->quietlist, who, msptr, ms, NULL);
+	return is_banned_list(chptr, &chptr->quietlist, &chptr->quietlist_index,
+			who, msptr, ms, NULL);
 #endif
 }
 
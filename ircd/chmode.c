@@ -247,7 +247,6 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 	struct Ban *actualBan;
 	static char who[USERHOST_REPLYLEN];
 	char *realban = LOCAL_COPY(banid);
-	rb_dlink_node *ptr;
 
 	/* dont let local clients overflow the banlist */
 	if(MyClient(source_p))
@@ -261,12 +260,8 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 	}
 
 	/* don't let anyone set duplicate bans */
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		actualBan = ptr->data;
-		if(!irccmp(actualBan->banstr, realban))
-			return NULL;
-	}
+	if(find_ban_id(chptr, list, realban) != NULL)
+		return NULL;
 
 	if(IsPerson(source_p))
 		sprintf(who, "%s!%s@%s", source_p->name, source_p->username, source_p->host);
@@ -276,7 +271,7 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 	actualBan = allocate_ban(realban, who, forward);
 	actualBan->when = rb_current_time();
 
-	rb_dlinkAdd(actualBan, &actualBan->node, list);
+	add_ban_id(chptr, list, actualBan);
 
 	/* invalidate the can_send() cache */
 	if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
@@ -294,29 +289,21 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 struct Ban *
 del_id(struct Channel *chptr, const char *banid, rb_dlink_list * list, long mode_type)
 {
-	rb_dlink_node *ptr;
 	struct Ban *banptr;
 
 	if(EmptyString(banid))
 		return NULL;
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		banptr = ptr->data;
-
-		if(irccmp(banid, banptr->banstr) == 0)
-		{
-			rb_dlinkDelete(&banptr->node, list);
+	if((banptr = find_ban_id(chptr, list, banid)) == NULL)
+		return NULL;
 
-			/* invalidate the can_send() cache */
-			if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
-				chptr->bants++;
+	del_ban_id(chptr, list, banptr);
 
-			return banptr;
-		}
-	}
+	/* invalidate the can_send() cache */
+	if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
+		chptr->bants++;
 
-	return NULL;
+	return banptr;
 }
 
 /* check_string()
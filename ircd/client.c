@@ -76,6 +76,7 @@ static rb_bh *lclient_heap = NULL;
 static rb_bh *pclient_heap = NULL;
 static rb_bh *user_heap = NULL;
 static rb_bh *away_heap = NULL;
+static rb_bh *ban_entry_heap = NULL;
 static char current_uid[IDLEN];
 static uint32_t current_connid = 0;
 
@@ -95,6 +96,20 @@ struct abort_client
 
 static rb_dlink_list abort_list;
 
+static rb_dlink_list ban_prefix_table[BANCHECK_SIZE];
+static rb_dlink_list ban_suffix_table[BANCHECK_SIZE];
+static rb_patricia_tree_t *ban_ip4_tree;
+static rb_patricia_tree_t *ban_ip6_tree;
+
+/* a batch holding more bans of one kind than this is applied with
+ * a single pass over all clients
+ */
+#define BAN_BATCH_SCAN	16
+
+static rb_dlink_list pending_klines;
+static rb_dlink_list pending_dlines;
+static int ban_batch_depth;
+
 /*
  * init_client
  *
@@ -114,6 +129,10 @@ init_client(void)
 	pclient_heap = rb_bh_create(sizeof(struct PreClient), PCLIENT_HEAP_SIZE, "pclient_heap");
 	user_heap = rb_bh_create(sizeof(struct User), USER_HEAP_SIZE, "user_heap");
 	away_heap = rb_bh_create(AWAYLEN, AWAY_HEAP_SIZE, "away_heap");
+	ban_entry_heap = rb_bh_create(sizeof(struct ban_check_entry), LCLIENT_HEAP_SIZE, "ban_entry_heap");
+
+	ban_ip4_tree = rb_new_patricia(PATRICIA_BITS);
+	ban_ip6_tree = rb_new_patricia(PATRICIA_BITS);
 
 	rb_event_addish("check_pings", check_pings, NULL, 30);
 	rb_event_addish("free_exited_clients", &free_exited_clients, NULL, 4);
@@ -152,6 +171,32 @@ connid_get(struct Client *client_p)
 	return current_connid;
 }
 
+/*
+ * connid_claim - take a specific connid
+ *
+ * inputs       - client, connid it had in the ircd we were upgraded from
+ * outputs      - true if the connid was free and is now the client's
+ * side effects - the association of the connid to the client is committed.
+ */
+bool
+connid_claim(struct Client *client_p, uint32_t id)
+{
+	s_assert(MyConnect(client_p));
+	if (!MyConnect(client_p) || id == 0)
+		return false;
+
+	if (find_cli_connid_hash(id) != NULL)
+		return false;
+
+	add_to_cli_connid_hash(client_p, id);
+	rb_dlinkAddAlloc(RB_UINT_TO_POINTER(id), &client_p->localClient->connids);
+
+	if (id > current_connid)
+		current_connid = id;
+
+	return true;
+}
+
 /*
  * connid_put - free a connid
  *
@@ -306,6 +351,7 @@ free_local_client(struct Client *client_p)
 		ssld_decrement_clicount(client_p->localClient->ssl_ctl);
 
 	rb_free(client_p->localClient->cipher_string);
+	recvq_free(&client_p->localClient->recvq);
 
 	rb_bh_free(lclient_heap, client_p->localClient);
 	client_p->localClient = NULL;
@@ -536,6 +582,329 @@ check_banned_lines(void)
 	check_xlines();
 }
 
+/* ban_check_link()
+ *
+ * links one field of a client into a ban check table, unless an
+ * earlier field already put the client in the same bucket
+ */
+static void
+ban_check_link(struct Client *client_p, rb_dlink_list *table, rb_dlink_node *nodes,
+		unsigned int *buckets, int field, unsigned int hashv)
+{
+	int i;
+
+	for(i = 0; i < field; i++)
+	{
+		if(nodes[i].data != NULL && buckets[i] == hashv)
+			return;
+	}
+
+	buckets[field] = hashv;
+	rb_dlinkAdd(client_p, &nodes[field], &table[hashv]);
+}
+
+/* ban_check_link_ip()
+ *
+ * files a client under one of its addresses in the ban check trees
+ */
+static void
+ban_check_link_ip(struct Client *client_p, int slot, struct sockaddr *addr)
+{
+	struct ban_check_entry *entry = client_p->localClient->ban_entry;
+	rb_patricia_node_t *pnode;
+
+	if(addr->sa_family == AF_INET6)
+		pnode = make_and_lookup_ip(ban_ip6_tree, addr, 128);
+	else
+		pnode = make_and_lookup_ip(ban_ip4_tree, addr, 32);
+
+	if(pnode == NULL)
+		return;
+
+	if(pnode->data == NULL)
+		pnode->data = rb_malloc(sizeof(rb_dlink_list));
+
+	entry->ipnode[slot] = pnode;
+	rb_dlinkAdd(client_p, &entry->iplink[slot], pnode->data);
+}
+
+/* add_to_ban_check_index()
+ *
+ * adds a local person to the ban check index: its address, and the
+ * first BANCHECK_PREFIXLEN and last BANCHECK_SUFFIXLEN characters of
+ * its username, orighost and sockhost, which are what a K-line is
+ * matched against.
+ */
+void
+add_to_ban_check_index(struct Client *client_p)
+{
+	struct ban_check_entry *entry;
+	struct sockaddr_in ip4;
+	const char *fields[BANCHECK_FIELDS];
+	size_t len;
+	int i;
+
+	if(!MyConnect(client_p) || client_p->localClient->ban_entry != NULL)
+		return;
+
+	entry = rb_bh_alloc(ban_entry_heap);
+	client_p->localClient->ban_entry = entry;
+
+	fields[0] = client_p->username;
+	fields[1] = client_p->orighost;
+	fields[2] = client_p->sockhost;
+
+	for(i = 0; i < BANCHECK_FIELDS; i++)
+	{
+		len = strlen(fields[i]);
+
+		if(len >= BANCHECK_PREFIXLEN)
+			ban_check_link(client_p, ban_prefix_table, entry->prefix,
+					entry->prefix_bucket, i,
+					fnv_hash_upper_len((const unsigned char *) fields[i],
+						BANCHECK_BITS, BANCHECK_PREFIXLEN));
+
+		if(len >= BANCHECK_SUFFIXLEN)
+			ban_check_link(client_p, ban_suffix_table, entry->suffix,
+					entry->suffix_bucket, i,
+					fnv_hash_upper_len((const unsigned char *) fields[i] + len - BANCHECK_SUFFIXLEN,
+						BANCHECK_BITS, BANCHECK_SUFFIXLEN));
+	}
+
+	switch(GET_SS_FAMILY(&client_p->localClient->ip))
+	{
+	case AF_INET6:
+		ban_check_link_ip(client_p, 0, (struct sockaddr *)&client_p->localClient->ip);
+		/* IPv4 bans also cover the address inside 6to4 and teredo */
+		if(rb_ipv4_from_ipv6((struct sockaddr_in6 *)&client_p->localClient->ip, &ip4))
+			ban_check_link_ip(client_p, 1, (struct sockaddr *)&ip4);
+		break;
+	case AF_INET:
+		ban_check_link_ip(client_p, 0, (struct sockaddr *)&client_p->localClient->ip);
+		break;
+	}
+}
+
+/* del_from_ban_check_index()
+ *
+ * removes a local person from the ban check index, if they are in it
+ */
+void
+del_from_ban_check_index(struct Client *client_p)
+{
+	struct ban_check_entry *entry;
+	rb_patricia_node_t *pnode;
+	rb_dlink_list *list;
+	int i;
+
+	if(!MyConnect(client_p) || (entry = client_p->localClient->ban_entry) == NULL)
+		return;
+
+	for(i = 0; i < BANCHECK_FIELDS; i++)
+	{
+		if(entry->prefix[i].data != NULL)
+			rb_dlinkDelete(&entry->prefix[i], &ban_prefix_table[entry->prefix_bucket[i]]);
+		if(entry->suffix[i].data != NULL)
+			rb_dlinkDelete(&entry->suffix[i], &ban_suffix_table[entry->suffix_bucket[i]]);
+	}
+
+	for(i = 0; i < 2; i++)
+	{
+		if((pnode = entry->ipnode[i]) == NULL)
+			continue;
+
+		list = pnode->data;
+		rb_dlinkDelete(&entry->iplink[i], list);
+		if(rb_dlink_list_length(list) == 0)
+		{
+			rb_free(list);
+			rb_patricia_remove(pnode->prefix->family == AF_INET6 ?
+					ban_ip6_tree : ban_ip4_tree, pnode);
+		}
+	}
+
+	rb_bh_free(ban_entry_heap, entry);
+	client_p->localClient->ban_entry = NULL;
+}
+
+/* update_ban_check_index()
+ *
+ * refiles a local person whose username or orighost changed.
+ * clients that are not (yet) in the index are left alone.
+ */
+void
+update_ban_check_index(struct Client *client_p)
+{
+	if(!MyConnect(client_p) || client_p->localClient->ban_entry == NULL)
+		return;
+
+	del_from_ban_check_index(client_p);
+	add_to_ban_check_index(client_p);
+}
+
+/* ban_check_add()
+ *
+ * adds a client to a candidate list, unless it is already on it.
+ * candidates are marked until they are taken off the list again.
+ */
+static void
+ban_check_add(rb_dlink_list *list, struct Client *client_p)
+{
+	if(IsMarked(client_p))
+		return;
+
+	SetMark(client_p);
+	rb_dlinkAddTailAlloc(client_p, list);
+}
+
+/* ban_check_ip()
+ *
+ * inputs	- candidate list, address and prefix length of a ban
+ * output	-
+ * side effects - every indexed person whose address lies within the
+ *		  ban is added to the list
+ */
+static void
+ban_check_ip(rb_dlink_list *list, struct sockaddr *addr, int bits)
+{
+	rb_patricia_node_t *node, *pnode;
+	rb_dlink_node *ptr;
+	unsigned char *want;
+
+	if(addr->sa_family == AF_INET6)
+	{
+		node = ban_ip6_tree->head;
+		want = (unsigned char *)&((struct sockaddr_in6 *)(void *)addr)->sin6_addr;
+	}
+	else
+	{
+		node = ban_ip4_tree->head;
+		want = (unsigned char *)&((struct sockaddr_in *)(void *)addr)->sin_addr;
+	}
+
+	/* find the top of the subtree holding the ban's prefix */
+	while(node != NULL && node->bit < (unsigned int)bits)
+	{
+		if(BIT_TEST(want[node->bit >> 3], 0x80 >> (node->bit & 0x07)))
+			node = node->r;
+		else
+			node = node->l;
+	}
+
+	if(node == NULL)
+		return;
+
+	RB_PATRICIA_WALK(node, pnode)
+	{
+		if(pnode->data != NULL &&
+				comp_with_mask(rb_prefix_touchar(pnode->prefix), want, bits))
+		{
+			RB_DLINK_FOREACH(ptr, ((rb_dlink_list *)pnode->data)->head)
+				ban_check_add(list, ptr->data);
+		}
+	}
+	RB_PATRICIA_WALK_END;
+}
+
+/* ban_check_bucket()
+ *
+ * inputs	- mask, smallest bucket found so far or NULL
+ * output	- the ban check bucket holding every person with a field
+ *		  starting or ending with the literal text at either end
+ *		  of mask, if smaller than best
+ */
+static rb_dlink_list *
+ban_check_bucket(const char *mask, rb_dlink_list *best)
+{
+	rb_dlink_list *bucket;
+	size_t len, plen, slen;
+
+	len = strlen(mask);
+	plen = strcspn(mask, "*?");
+	for(slen = 0; slen < len; slen++)
+	{
+		if(mask[len - slen - 1] == '*' || mask[len - slen - 1] == '?')
+			break;
+	}
+
+	if(plen >= BANCHECK_PREFIXLEN)
+	{
+		bucket = &ban_prefix_table[fnv_hash_upper_len((const unsigned char *) mask,
+				BANCHECK_BITS, BANCHECK_PREFIXLEN)];
+		if(best == NULL || rb_dlink_list_length(bucket) < rb_dlink_list_length(best))
+			best = bucket;
+	}
+
+	if(slen >= BANCHECK_SUFFIXLEN)
+	{
+		bucket = &ban_suffix_table[fnv_hash_upper_len((const unsigned char *) mask + len - BANCHECK_SUFFIXLEN,
+				BANCHECK_BITS, BANCHECK_SUFFIXLEN)];
+		if(best == NULL || rb_dlink_list_length(bucket) < rb_dlink_list_length(best))
+			best = bucket;
+	}
+
+	return best;
+}
+
+/* ban_check_candidates()
+ *
+ * inputs	- candidate list, user and host of a ban, and the
+ *		  parse_netmask() result for the host
+ * output	- 0 if the index cannot narrow the ban down enough to be
+ *		  worth using, else 1
+ * side effects - the local persons the ban could match are added to
+ *		  the list
+ */
+static int
+ban_check_candidates(rb_dlink_list *list, const char *user, const char *host,
+		int masktype, struct rb_sockaddr_storage *addr, int bits)
+{
+	rb_dlink_list *bucket;
+	rb_dlink_node *ptr;
+
+	if(masktype == HM_IPV4 || masktype == HM_IPV6)
+	{
+		ban_check_ip(list, (struct sockaddr *)addr, bits);
+		return 1;
+	}
+
+	bucket = ban_check_bucket(host, NULL);
+	if(user != NULL)
+		bucket = ban_check_bucket(user, bucket);
+
+	if(bucket == NULL || rb_dlink_list_length(bucket) > rb_dlink_list_length(&lclient_list) / 4)
+		return 0;
+
+	RB_DLINK_FOREACH(ptr, bucket->head)
+		ban_check_add(list, ptr->data);
+	return 1;
+}
+
+/* kline_client()
+ *
+ * inputs	- client matching a kline, the kline
+ * output	-
+ * side effects - the client is exited unless it is kline_exempt
+ */
+static void
+kline_client(struct Client *client_p, struct ConfItem *aconf)
+{
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				     "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
+				     get_client_name(client_p, HIDE_IP),
+				     aconf->user, aconf->host);
+		return;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+			     "Disconnecting K-Lined user %s (%s@%s)",
+			     get_client_name(client_p, HIDE_IP), aconf->user, aconf->host);
+
+	notify_banned_client(client_p, aconf, K_LINED);
+}
+
 /* check_klines
  *
  * inputs       -
@@ -558,108 +927,157 @@ check_klines(void)
 			continue;
 
 		if((aconf = find_kline(client_p)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						     "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
-						     get_client_name(client_p, HIDE_IP),
-						     aconf->user, aconf->host);
-				continue;
-			}
-
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Disconnecting K-Lined user %s (%s@%s)",
-					     get_client_name(client_p, HIDE_IP), aconf->user, aconf->host);
-
-			notify_banned_client(client_p, aconf, K_LINED);
-			continue;
-		}
+			kline_client(client_p, aconf);
 	}
 }
 
-
-/* check_one_kline()
+/* kline_matches_client()
  *
  * This process needs to be kept in sync with find_kline() aka find_conf_by_address().
  *
- * inputs       - pointer to kline to check
+ * inputs       - kline, client, and the parse_netmask() result for the kline
+ * outputs      - 1 if the kline matches the client, else 0
+ * side effects -
+ */
+static int
+kline_matches_client(struct ConfItem *kline, struct Client *client_p, int masktype,
+		struct rb_sockaddr_storage *sockaddr, int bits)
+{
+	struct sockaddr_in ip4;
+
+	if(!match(kline->user, client_p->username))
+		return 0;
+
+	switch (masktype) {
+	case HM_IPV4:
+	case HM_IPV6:
+		if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
+				IsConfKlineSpoof(client_p->localClient->att_conf))
+			return 0;
+		if (client_p->localClient->ip.ss_family == AF_INET6 && sockaddr->ss_family == AF_INET &&
+				rb_ipv4_from_ipv6((struct sockaddr_in6 *)&client_p->localClient->ip, &ip4)
+					&& comp_with_mask_sock((struct sockaddr *)&ip4, (struct sockaddr *)sockaddr, bits))
+			return 1;
+		if (client_p->localClient->ip.ss_family == sockaddr->ss_family &&
+				comp_with_mask_sock((struct sockaddr *)&client_p->localClient->ip,
+					(struct sockaddr *)sockaddr, bits))
+			return 1;
+		return 0;
+	case HM_HOST:
+		if (match(kline->host, client_p->orighost))
+			return 1;
+		if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
+				IsConfKlineSpoof(client_p->localClient->att_conf))
+			return 0;
+		if (match(kline->host, client_p->sockhost))
+			return 1;
+		return 0;
+	}
+
+	return 0;
+}
+
+/* apply_one_kline()
+ *
+ * inputs       - pointer to kline to apply
  * outputs      -
- * side effects - all clients will be checked against given kline
+ * side effects - the clients the ban check index picks out, or all
+ *		  clients if it cannot narrow the kline down, will be
+ *		  checked against the given kline
  */
-void
-check_one_kline(struct ConfItem *kline)
+static void
+apply_one_kline(struct ConfItem *kline)
 {
 	struct Client *client_p;
+	rb_dlink_list candidates = { NULL, NULL, 0 };
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	int masktype;
 	int bits;
 	struct rb_sockaddr_storage sockaddr;
-	struct sockaddr_in ip4;
 
 	masktype = parse_netmask(kline->host, (struct sockaddr_storage *)&sockaddr, &bits);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+	if(!ban_check_candidates(&candidates, kline->user, kline->host, masktype, &sockaddr, bits))
 	{
-		int matched = 0;
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+		{
+			client_p = ptr->data;
+
+			if(IsMe(client_p) || !IsPerson(client_p))
+				continue;
 
+			if(kline_matches_client(kline, client_p, masktype, &sockaddr, bits))
+				kline_client(client_p, kline);
+		}
+		return;
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, candidates.head)
+	{
 		client_p = ptr->data;
+		ClearMark(client_p);
+		rb_dlinkDestroy(ptr, &candidates);
 
-		if(IsMe(client_p) || !IsPerson(client_p))
+		if(IsAnyDead(client_p) || !IsPerson(client_p))
 			continue;
 
-		if(!match(kline->user, client_p->username))
-			continue;
+		if(kline_matches_client(kline, client_p, masktype, &sockaddr, bits))
+			kline_client(client_p, kline);
+	}
+}
 
-		/* match one kline */
-		switch (masktype) {
-		case HM_IPV4:
-		case HM_IPV6:
-			if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
-					IsConfKlineSpoof(client_p->localClient->att_conf))
-				break;
-			if (client_p->localClient->ip.ss_family == AF_INET6 && sockaddr.ss_family == AF_INET &&
-					rb_ipv4_from_ipv6((struct sockaddr_in6 *)&client_p->localClient->ip, &ip4)
-						&& comp_with_mask_sock((struct sockaddr *)&ip4, (struct sockaddr *)&sockaddr, bits))
-				matched = 1;
-			else if (client_p->localClient->ip.ss_family == sockaddr.ss_family &&
-					comp_with_mask_sock((struct sockaddr *)&client_p->localClient->ip,
-						(struct sockaddr *)&sockaddr, bits))
-				matched = 1;
-			break;
-		case HM_HOST:
-			if (match(kline->host, client_p->orighost))
-				matched = 1;
-			if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
-					IsConfKlineSpoof(client_p->localClient->att_conf))
-				break;
-			if (match(kline->host, client_p->sockhost))
-				matched = 1;
-			break;
-		}
+/* check_one_kline()
+ *
+ * inputs       - pointer to kline to check
+ * outputs      -
+ * side effects - all clients will be checked against given kline,
+ *		  at the end of the current ban batch if there is one
+ */
+void
+check_one_kline(struct ConfItem *kline)
+{
+	if(ban_batch_depth == 0)
+	{
+		apply_one_kline(kline);
+		return;
+	}
 
-		if (!matched)
-			continue;
+	/* past BAN_BATCH_SCAN the batch is applied with a full pass,
+	 * so duplicates no longer matter
+	 */
+	if(rb_dlink_list_length(&pending_klines) <= BAN_BATCH_SCAN &&
+			rb_dlinkFind(kline, &pending_klines) != NULL)
+		return;
 
-		if(IsExemptKline(client_p))
-		{
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						 "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
-						 get_client_name(client_p, HIDE_IP),
-						 kline->user, kline->host);
-			continue;
-		}
+	kline->clients++;
+	rb_dlinkAddTailAlloc(kline, &pending_klines);
+}
 
+/* dline_client()
+ *
+ * inputs	- client, whether it is a registered user
+ * output	-
+ * side effects - the client is exited if it is dlined and
+ *		  not exempt
+ */
+static void
+dline_client(struct Client *client_p, int registered)
+{
+	struct ConfItem *aconf;
+
+	aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip));
+	if(aconf == NULL || aconf->status & CONF_EXEMPTDLINE)
+		return;
+
+	if(registered)
 		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					 "Disconnecting K-Lined user %s (%s@%s)",
-					 get_client_name(client_p, HIDE_IP), kline->user, kline->host);
+				     "Disconnecting D-Lined user %s (%s)",
+				     get_client_name(client_p, HIDE_IP), aconf->host);
 
-		notify_banned_client(client_p, kline, K_LINED);
-	}
+	notify_banned_client(client_p, aconf, D_LINED);
 }
 
-
 /* check_dlines()
  *
  * inputs       -
@@ -670,7 +1088,6 @@ void
 check_dlines(void)
 {
 	struct Client *client_p;
-	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
@@ -681,33 +1098,148 @@ check_dlines(void)
 		if(IsMe(client_p))
 			continue;
 
-		if((aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip))) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
+		dline_client(client_p, 1);
+	}
 
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Disconnecting D-Lined user %s (%s)",
-					     get_client_name(client_p, HIDE_IP), aconf->host);
+	/* dlines need to be checked against unknowns too */
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
+	{
+		dline_client(ptr->data, 0);
+	}
+}
+
+/* apply_one_dline()
+ *
+ * inputs       - pointer to dline to apply
+ * outputs      -
+ * side effects - users within the dline, and all unknowns, will be
+ *		  checked for dlines
+ */
+static void
+apply_one_dline(struct ConfItem *dline)
+{
+	struct Client *client_p;
+	rb_dlink_list candidates = { NULL, NULL, 0 };
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+	struct rb_sockaddr_storage sockaddr;
+	int masktype;
+	int bits;
+
+	masktype = parse_netmask(dline->host, (struct sockaddr_storage *)&sockaddr, &bits);
+	if(masktype != HM_IPV4 && masktype != HM_IPV6)
+	{
+		check_dlines();
+		return;
+	}
 
-			notify_banned_client(client_p, aconf, D_LINED);
+	ban_check_ip(&candidates, (struct sockaddr *)&sockaddr, bits);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, candidates.head)
+	{
+		client_p = ptr->data;
+		ClearMark(client_p);
+		rb_dlinkDestroy(ptr, &candidates);
+
+		if(IsAnyDead(client_p) || !IsPerson(client_p))
 			continue;
-		}
+
+		dline_client(client_p, 1);
 	}
 
-	/* dlines need to be checked against unknowns too */
+	/* unknowns are not indexed, there are never many of them */
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
 	{
-		client_p = ptr->data;
+		dline_client(ptr->data, 0);
+	}
+}
 
-		if((aconf = find_dline((struct sockaddr *)&client_p->localClient->ip, GET_SS_FAMILY(&client_p->localClient->ip))) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
+/* check_one_dline()
+ *
+ * inputs       - pointer to dline to check
+ * outputs      -
+ * side effects - all clients the dline could affect will be checked
+ *		  for dlines, at the end of the current ban batch if
+ *		  there is one
+ */
+void
+check_one_dline(struct ConfItem *dline)
+{
+	if(ban_batch_depth == 0)
+	{
+		apply_one_dline(dline);
+		return;
+	}
 
-			notify_banned_client(client_p, aconf, D_LINED);
-		}
+	if(rb_dlink_list_length(&pending_dlines) <= BAN_BATCH_SCAN &&
+			rb_dlinkFind(dline, &pending_dlines) != NULL)
+		return;
+
+	dline->clients++;
+	rb_dlinkAddTailAlloc(dline, &pending_dlines);
+}
+
+/* start_ban_batch()
+ *
+ * inputs       -
+ * outputs      -
+ * side effects - K-lines and D-lines passed to check_one_kline() and
+ *		  check_one_dline() are held until the matching
+ *		  end_ban_batch(), so that a burst of bans from services
+ *		  costs one pass over the clients rather than one each
+ */
+void
+start_ban_batch(void)
+{
+	ban_batch_depth++;
+}
+
+/* end_ban_batch()
+ *
+ * inputs       -
+ * outputs      -
+ * side effects - when the outermost batch ends, the held bans are
+ *		  applied, one at a time through the ban check index if
+ *		  there are few of them, else with a single pass over
+ *		  all clients.  bans removed in the meantime are skipped.
+ */
+void
+end_ban_batch(void)
+{
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+	int scan;
+
+	s_assert(ban_batch_depth > 0);
+	if(ban_batch_depth <= 0 || --ban_batch_depth > 0)
+		return;
+
+	scan = rb_dlink_list_length(&pending_dlines) > BAN_BATCH_SCAN;
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, pending_dlines.head)
+	{
+		aconf = ptr->data;
+		rb_dlinkDestroy(ptr, &pending_dlines);
+
+		if(!scan && !IsIllegal(aconf))
+			apply_one_dline(aconf);
+		deref_conf(aconf);
+	}
+	if(scan)
+		check_dlines();
+
+	scan = rb_dlink_list_length(&pending_klines) > BAN_BATCH_SCAN;
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, pending_klines.head)
+	{
+		aconf = ptr->data;
+		rb_dlinkDestroy(ptr, &pending_klines);
+
+		if(!scan && !IsIllegal(aconf))
+			apply_one_kline(aconf);
+		deref_conf(aconf);
 	}
+	if(scan)
+		check_klines();
 }
 
 /* check_xlines
@@ -824,6 +1356,7 @@ resv_nick_fnc(const char *mask, const char *reason, int temp_time)
 			del_from_client_hash(client_p->name, client_p);
 			rb_strlcpy(client_p->name, nick, sizeof(client_p->name));
 			add_to_client_hash(nick, client_p);
+			update_who_index(client_p);
 
 			monitor_signon(client_p);
 
@@ -919,6 +1452,7 @@ remove_client_from_list(struct Client *client_p)
 	if(client_p->node.prev == NULL && client_p->node.next == NULL)
 		return;
 
+	burst_forget_client(client_p);
 	rb_dlinkDelete(&client_p->node, &global_client_list);
 
 	update_client_exit_stats(client_p);
@@ -1401,6 +1935,7 @@ exit_generic_client(struct Client *client_p, struct Client *source_p, struct Cli
 		del_from_id_hash(source_p->id, source_p);
 
 	del_from_hostname_hash(source_p->orighost, source_p);
+	del_from_who_index(source_p);
 	del_from_client_hash(source_p->name, source_p);
 	remove_client_from_list(source_p);
 }
@@ -1566,6 +2101,9 @@ exit_local_server(struct Client *client_p, struct Client *source_p, struct Clien
 	rb_dlinkDelete(&source_p->localClient->tnode, &serv_list);
 	rb_dlinkFindDestroy(source_p, &global_serv_list);
 
+	/* anything still held behind the burst goes with it */
+	free_server_burst(source_p);
+
 	sendk = source_p->localClient->sendK;
 	recvk = source_p->localClient->receiveK;
 
@@ -1644,6 +2182,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 
 	s_assert(IsPerson(source_p));
 	rb_dlinkDelete(&source_p->localClient->tnode, &lclient_list);
+	del_from_ban_check_index(source_p);
 	rb_dlinkDelete(&source_p->lnode, &me.serv->users);
 
 	if(IsOper(source_p))
@@ -1976,7 +2515,7 @@ free_user(struct User *user, struct Client *client_p)
 	if(--user->refcnt <= 0)
 	{
 		if(user->away)
-			rb_free((char *) user->away);
+			rb_bh_free(away_heap, user->away);
 		rb_free(user->opername);
 		if (user->privset)
 			privilegeset_unref(user->privset);
@@ -2080,6 +2619,41 @@ out:
 	return current_uid;
 }
 
+/* uid_order - position of a UID character in generate_uid()'s sequence */
+static int
+uid_order(char c)
+{
+	return IsDigit(c) ? 26 + (c - '0') : c - 'A';
+}
+
+/*
+ * claim_uid
+ *
+ * inputs	- a UID of ours that is in use
+ * outputs	- none
+ * side effects	- generate_uid() will continue after it, so UIDs restored
+ *		  over an upgrade are not handed out again
+ */
+void
+claim_uid(const char *id)
+{
+	int i;
+
+	if(strlen(id) != 9 || strncmp(id, current_uid, 3))
+		return;
+
+	for(i = 3; i < 9; i++)
+	{
+		if(uid_order(id[i]) > uid_order(current_uid[i]))
+			break;
+		if(uid_order(id[i]) < uid_order(current_uid[i]))
+			return;
+	}
+
+	if(i < 9)
+		rb_strlcpy(current_uid, id, sizeof(current_uid));
+}
+
 /*
  * close_connection
  *        Close the physical connection. This function must make
@@ -2147,7 +2721,8 @@ close_connection(struct Client *client_p)
 	}
 
 	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
-	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	/* the line being parsed may still be in use, so only empty it */
+	recvq_clear(&client_p->localClient->recvq);
 	detach_conf(client_p);
 
 	/* XXX shouldnt really be done here. */
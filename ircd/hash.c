@@ -47,6 +47,10 @@ rb_radixtree *channel_tree = NULL;
 rb_radixtree *resv_tree = NULL;
 rb_radixtree *hostname_tree = NULL;
 
+static rb_dlink_list who_prefix_table[WHO_INDEX_SIZE];
+static rb_dlink_list who_suffix_table[WHO_INDEX_SIZE];
+static rb_bh *who_entry_heap;
+
 /*
  * look in whowas.c for the missing ...[WW_MAX]; entry
  */
@@ -66,6 +70,8 @@ init_hash(void)
 	resv_tree = rb_radixtree_create("resv", irccasecanon);
 
 	hostname_tree = rb_radixtree_create("hostname", irccasecanon);
+
+	who_entry_heap = rb_bh_create(sizeof(struct who_entry), USER_HEAP_SIZE, "who_entry_heap");
 }
 
 uint32_t
@@ -379,6 +385,137 @@ find_hostname(const char *hostname)
 	return hlist->head;
 }
 
+/* who_index_link()
+ *
+ * links one field of a client into a WHO index table, unless an
+ * earlier field already put the client in the same bucket
+ */
+static void
+who_index_link(struct Client *client_p, rb_dlink_list *table, rb_dlink_node *nodes,
+		unsigned int *buckets, int field, unsigned int hashv)
+{
+	int i;
+
+	for(i = 0; i < field; i++)
+	{
+		if(nodes[i].data != NULL && buckets[i] == hashv)
+			return;
+	}
+
+	buckets[field] = hashv;
+	rb_dlinkAdd(client_p, &nodes[field], &table[hashv]);
+}
+
+/* add_to_who_index()
+ *
+ * adds a person to the WHO index.  every field WHO matches against
+ * that is long enough is hashed on its first WHO_INDEX_PREFIXLEN and
+ * last WHO_INDEX_SUFFIXLEN characters; shorter fields can never match
+ * a mask with that much literal text at either end, so they are left out.
+ */
+void
+add_to_who_index(struct Client *client_p)
+{
+	struct who_entry *entry;
+	const char *fields[WHO_INDEX_FIELDS];
+	size_t len;
+	int i;
+
+	if(client_p->user == NULL || client_p->user->who_entry != NULL)
+		return;
+
+	entry = rb_bh_alloc(who_entry_heap);
+	client_p->user->who_entry = entry;
+
+	fields[0] = client_p->name;
+	fields[1] = client_p->username;
+	fields[2] = client_p->host;
+	fields[3] = client_p->orighost;
+	fields[4] = client_p->info;
+
+	for(i = 0; i < WHO_INDEX_FIELDS; i++)
+	{
+		len = strlen(fields[i]);
+
+		if(len >= WHO_INDEX_PREFIXLEN)
+			who_index_link(client_p, who_prefix_table, entry->prefix,
+					entry->prefix_bucket, i,
+					fnv_hash_upper_len((const unsigned char *) fields[i],
+						WHO_INDEX_BITS, WHO_INDEX_PREFIXLEN));
+
+		if(len >= WHO_INDEX_SUFFIXLEN)
+			who_index_link(client_p, who_suffix_table, entry->suffix,
+					entry->suffix_bucket, i,
+					fnv_hash_upper_len((const unsigned char *) fields[i] + len - WHO_INDEX_SUFFIXLEN,
+						WHO_INDEX_BITS, WHO_INDEX_SUFFIXLEN));
+	}
+}
+
+/* del_from_who_index()
+ *
+ * removes a person from the WHO index, if they are in it
+ */
+void
+del_from_who_index(struct Client *client_p)
+{
+	struct who_entry *entry;
+	int i;
+
+	if(client_p->user == NULL || (entry = client_p->user->who_entry) == NULL)
+		return;
+
+	for(i = 0; i < WHO_INDEX_FIELDS; i++)
+	{
+		if(entry->prefix[i].data != NULL)
+			rb_dlinkDelete(&entry->prefix[i], &who_prefix_table[entry->prefix_bucket[i]]);
+		if(entry->suffix[i].data != NULL)
+			rb_dlinkDelete(&entry->suffix[i], &who_suffix_table[entry->suffix_bucket[i]]);
+	}
+
+	rb_bh_free(who_entry_heap, entry);
+	client_p->user->who_entry = NULL;
+}
+
+/* update_who_index()
+ *
+ * rehashes a person whose nick, username, host or realname changed.
+ * clients that are not (yet) in the index are left alone.
+ */
+void
+update_who_index(struct Client *client_p)
+{
+	if(client_p->user == NULL || client_p->user->who_entry == NULL)
+		return;
+
+	del_from_who_index(client_p);
+	add_to_who_index(client_p);
+}
+
+/* find_who_prefix()
+ *
+ * returns the WHO index bucket for the first WHO_INDEX_PREFIXLEN
+ * characters of key.  the bucket holds every person with a field
+ * starting with those characters, as well as some that do not.
+ */
+rb_dlink_list *
+find_who_prefix(const char *key)
+{
+	return &who_prefix_table[fnv_hash_upper_len((const unsigned char *) key,
+			WHO_INDEX_BITS, WHO_INDEX_PREFIXLEN)];
+}
+
+/* find_who_suffix()
+ *
+ * as find_who_prefix(), for fields ending with the
+ * WHO_INDEX_SUFFIXLEN characters at key
+ */
+rb_dlink_list *
+find_who_suffix(const char *key)
+{
+	return &who_suffix_table[fnv_hash_upper_len((const unsigned char *) key,
+			WHO_INDEX_BITS, WHO_INDEX_SUFFIXLEN)];
+}
+
 /* find_channel()
  *
  * finds a channel from the channel hash table
@@ -31,6 +31,7 @@
 #include "numeric.h"
 #include "send.h"
 #include "match.h"
+#include "rb_radixtree.h"
 
 static unsigned long hash_ipv6(struct sockaddr *, int);
 static unsigned long hash_ipv4(struct sockaddr *, int);
@@ -129,10 +130,36 @@ int parse_netmask_strict(const char *mask, struct rb_sockaddr_storage *addr, int
 /* Hashtable stuff...now external as its used in m_stats.c */
 struct AddressRec *atable[ATABLE_SIZE];
 
+/*
+ * atable holds every record, and is what STATS and the exact lookups walk.
+ * find_conf_by_address() instead uses an index: IP masks sit in a patricia
+ * tree per address family, one bucket per distinct prefix, so a lookup
+ * visits only the prefixes containing the address.  Host masks are keyed by
+ * the literal domain after their last wildcard (see get_mask_key()), which
+ * any host they match must end with, and looked up once per label of the
+ * host; masks with no such domain go in a single list.  Every bucket is kept
+ * sorted by precedence, so a lookup stops at the first usable record.
+ */
+struct AddressBucket
+{
+	struct AddressRec *head;
+	rb_patricia_node_t *pnode;	/* IP buckets */
+	char *key;			/* host buckets */
+};
+
+static rb_patricia_tree_t *addr_tree4;
+static rb_patricia_tree_t *addr_tree6;
+static rb_radixtree *host_tree;
+static struct AddressBucket wild_bucket;
+
 void
 init_host_hash(void)
 {
 	memset(&atable, 0, sizeof(atable));
+
+	addr_tree4 = rb_new_patricia(PATRICIA_BITS);
+	addr_tree6 = rb_new_patricia(PATRICIA_BITS);
+	host_tree = rb_radixtree_create("address conf hosts", irccasecanon);
 }
 
 /* unsigned long hash_ipv4(struct rb_sockaddr_storage*)
@@ -201,6 +228,26 @@ hash_text(const char *start)
 	return (h & (ATABLE_SIZE - 1));
 }
 
+/* const char *get_mask_key(const char *)
+ * Input: A hostmask.
+ * Output: The part of the mask right of the first '.' past the last
+ *         wildcard, the whole mask if it has no wildcards, or an empty
+ *         string if there is no '.' past the last wildcard.
+ * Side-effects: None.
+ */
+static const char *
+get_mask_key(const char *text)
+{
+	const char *hp = "", *p;
+
+	for (p = text + strlen(text) - 1; p >= text; p--)
+		if(*p == '*' || *p == '?')
+			return hp;
+		else if(*p == '.')
+			hp = p + 1;
+	return text;
+}
+
 /* unsigned long get_hash_mask(const char *)
  * Input: The text to hash.
  * Output: The hash of the string right of the first '.' past the last
@@ -210,14 +257,182 @@ hash_text(const char *start)
 static unsigned long
 get_mask_hash(const char *text)
 {
-	const char *hp = "", *p;
+	return hash_text(get_mask_key(text));
+}
 
-	for (p = text + strlen(text) - 1; p >= text; p--)
-		if(*p == '*' || *p == '?')
-			return hash_text(hp);
-		else if(*p == '.')
-			hp = p + 1;
-	return hash_text(text);
+/* void index_address_rec(struct AddressRec *)
+ * Input: A record that has just been added to atable.
+ * Output: None
+ * Side-effects: Files the record in its lookup bucket, behind any
+ *               records of higher precedence.
+ */
+static void
+index_address_rec(struct AddressRec *arec)
+{
+	struct AddressBucket *bucket;
+	struct AddressRec **prev;
+	rb_patricia_node_t *pnode;
+	const char *key;
+
+	if(arec->masktype == HM_IPV4 || arec->masktype == HM_IPV6)
+	{
+		pnode = make_and_lookup_ip(arec->masktype == HM_IPV6 ? addr_tree6 : addr_tree4,
+				(struct sockaddr *)&arec->Mask.ipa.addr, arec->Mask.ipa.bits);
+		if(pnode == NULL)
+			return;
+
+		if((bucket = pnode->data) == NULL)
+		{
+			bucket = rb_malloc(sizeof(struct AddressBucket));
+			bucket->pnode = pnode;
+			pnode->data = bucket;
+		}
+	}
+	else if(*(key = get_mask_key(arec->Mask.hostname)) == '\0')
+		bucket = &wild_bucket;
+	else if((bucket = rb_radixtree_retrieve(host_tree, key)) == NULL)
+	{
+		bucket = rb_malloc(sizeof(struct AddressBucket));
+		bucket->key = rb_strdup(key);
+		rb_radixtree_add(host_tree, bucket->key, bucket);
+	}
+
+	for (prev = &bucket->head; *prev != NULL; prev = &(*prev)->bnext)
+		if((*prev)->precedence < arec->precedence)
+			break;
+
+	arec->bnext = *prev;
+	*prev = arec;
+	arec->bucket = bucket;
+}
+
+/* void unindex_address_rec(struct AddressRec *)
+ * Input: A record that is being removed from atable.
+ * Output: None
+ * Side-effects: Takes the record out of its lookup bucket, and frees
+ *               the bucket if that was the last record in it.
+ */
+static void
+unindex_address_rec(struct AddressRec *arec)
+{
+	struct AddressBucket *bucket = arec->bucket;
+	struct AddressRec **prev;
+
+	if(bucket == NULL)
+		return;
+
+	for (prev = &bucket->head; *prev != NULL; prev = &(*prev)->bnext)
+		if(*prev == arec)
+		{
+			*prev = arec->bnext;
+			break;
+		}
+
+	arec->bucket = NULL;
+	if(bucket->head != NULL || bucket == &wild_bucket)
+		return;
+
+	if(bucket->pnode != NULL)
+		rb_patricia_remove(arec->masktype == HM_IPV6 ? addr_tree6 : addr_tree4,
+				bucket->pnode);
+	else
+	{
+		rb_radixtree_delete(host_tree, bucket->key);
+		rb_free(bucket->key);
+	}
+	rb_free(bucket);
+}
+
+/* void find_in_bucket(...)
+ * Input: A lookup bucket, the host to match host masks against and the
+ *        sockhost to also try (both NULL for IP buckets, which only hold
+ *        masks containing the address), and find_conf_by_address()'s
+ *        type, username, auth_user and best match so far.
+ * Output: None
+ * Side-effects: Updates the best match if the bucket has a better one.
+ */
+static void
+find_in_bucket(struct AddressBucket *bucket, const char *host, const char *sockhost,
+		int type, const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	struct AddressRec *arec;
+
+	for (arec = bucket->head; arec != NULL && arec->precedence > *hprecv; arec = arec->bnext)
+	{
+		if(arec->type == (type & ~0x1) &&
+		   (host == NULL || match(arec->Mask.hostname, host) ||
+		    (sockhost && match(arec->Mask.hostname, sockhost))) &&
+		   (type != CONF_CLIENT || !arec->auth_user ||
+		    (auth_user && match(arec->auth_user, auth_user))) &&
+		   (type & 0x1 || match(arec->username, username)))
+		{
+			*hprecv = arec->precedence;
+			*hprec = arec->aconf;
+			return;
+		}
+	}
+}
+
+/* void find_in_tree(...)
+ * Input: An address tree, the address and its length in bits, and
+ *        find_conf_by_address()'s type, username, auth_user and best
+ *        match so far.
+ * Output: None
+ * Side-effects: Updates the best match from the buckets of every prefix
+ *               in the tree that contains the address.
+ */
+static void
+find_in_tree(rb_patricia_tree_t *tree, const unsigned char *ip, unsigned int maxbits,
+		int type, const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	rb_patricia_node_t *node = tree->head;
+
+	while(node != NULL)
+	{
+		if(node->prefix != NULL && node->data != NULL &&
+		   comp_with_mask(rb_prefix_touchar(node->prefix), (void *)ip, node->prefix->bitlen))
+			find_in_bucket(node->data, NULL, NULL, type, username, auth_user, hprecv, hprec);
+
+		if(node->bit >= maxbits)
+			break;
+
+		if(BIT_TEST(ip[node->bit >> 3], 0x80 >> (node->bit & 0x07)))
+			node = node->r;
+		else
+			node = node->l;
+	}
+}
+
+/* void find_by_host(...)
+ * Input: A hostname, the sockhost to also try against masks with no
+ *        literal domain, and find_conf_by_address()'s type, username,
+ *        auth_user and best match so far.
+ * Output: None
+ * Side-effects: Updates the best match from the buckets keyed by each
+ *               domain suffix of the host, and from the wildcard list.
+ */
+static void
+find_by_host(const char *host, const char *sockhost, int type,
+		const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	struct AddressBucket *bucket;
+	const char *p;
+
+	for (p = host; p != NULL;)
+	{
+		if(*p != '\0' && (bucket = rb_radixtree_retrieve(host_tree, p)) != NULL)
+			find_in_bucket(bucket, host, NULL, type, username, auth_user, hprecv, hprec);
+		p = strchr(p, '.');
+		if(p != NULL)
+			p++;
+		else
+			break;
+	}
+
+	find_in_bucket(&wild_bucket, host, sockhost, type, username, auth_user, hprecv, hprec);
 }
 
 /* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
@@ -239,10 +454,8 @@ find_conf_by_address(const char *name, const char *sockhost,
 {
 	unsigned long hprecv = 0;
 	struct ConfItem *hprec = NULL;
-	struct AddressRec *arec;
 	struct sockaddr_in ip4;
 	struct sockaddr *pip4 = NULL;
-	int b;
 
 	if(username == NULL)
 		username = "";
@@ -257,128 +470,22 @@ find_conf_by_address(const char *name, const char *sockhost,
 			if (type == CONF_KILL && rb_ipv4_from_ipv6((struct sockaddr_in6 *)addr, &ip4))
 				pip4 = (struct sockaddr *)&ip4;
 
-			for (b = 128; b >= 0; b -= 16)
-			{
-				for (arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-					if(arec->type == (type & ~0x1) &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr, (struct sockaddr *)&arec->Mask.ipa.addr,
-						arec->Mask.ipa.bits) &&
-						(type & 0x1 || match(arec-> username, username)) &&
-						(type != CONF_CLIENT || !arec->auth_user ||
-						(auth_user && match(arec->auth_user, auth_user))) &&
-						arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-			}
+			find_in_tree(addr_tree6, ((struct sockaddr_in6 *)(void *)addr)->sin6_addr.s6_addr,
+					128, type, username, auth_user, &hprecv, &hprec);
 		}
 
 		if (pip4 != NULL)
-		{
-			for (b = 32; b >= 0; b -= 8)
-			{
-				for (arec = atable[hash_ipv4(pip4, b)]; arec; arec = arec->next)
-					if(arec->type == (type & ~0x1) &&
-					   arec->masktype == HM_IPV4 &&
-					   comp_with_mask_sock(pip4, (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) &&
-						(type & 0x1 || match(arec->username, username)) &&
-						(type != CONF_CLIENT || !arec->auth_user ||
-						(auth_user && match(arec->auth_user, auth_user))) &&
-						arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-			}
-		}
+			find_in_tree(addr_tree4, (unsigned char *)&((struct sockaddr_in *)(void *)pip4)->sin_addr,
+					32, type, username, auth_user, &hprecv, &hprec);
 	}
 
 	if(orighost != NULL)
-	{
-		const char *p;
+		find_by_host(orighost, sockhost, type, username, auth_user, &hprecv, &hprec);
 
-		for (p = orighost; p != NULL;)
-		{
-			for (arec = atable[hash_text(p)]; arec; arec = arec->next)
-
-				if((arec->type == (type & ~0x1)) &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, orighost) &&
-				   (type != CONF_CLIENT || !arec->auth_user ||
-				   (auth_user && match(arec->auth_user, auth_user))) &&
-				   (type & 0x1 || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for (arec = atable[0]; arec; arec = arec->next)
-		{
-			if(arec->type == (type & ~0x1) &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, orighost) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			    (type != CONF_CLIENT || !arec->auth_user ||
-			    (auth_user && match(arec->auth_user, auth_user))) &&
-			   (type & 0x1 || match(arec->username, username)))
-			{
-				hprecv = arec->precedence;
-				hprec = arec->aconf;
-			}
-		}
-	}
+	/* matching is case insensitive, so the same host again finds nothing new */
+	if(name != NULL && (orighost == NULL || irccmp(name, orighost)))
+		find_by_host(name, sockhost, type, username, auth_user, &hprecv, &hprec);
 
-	if(name != NULL)
-	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for (p = name; p != NULL;)
-		{
-			for (arec = atable[hash_text(p)]; arec; arec = arec->next)
-				if((arec->type == (type & ~0x1)) &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, name) &&
-				   (type != CONF_CLIENT || !arec->auth_user ||
-				   (auth_user && match(arec->auth_user, auth_user))) &&
-				   (type & 0x1 || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for (arec = atable[0]; arec; arec = arec->next)
-		{
-			if(arec->type == (type & ~0x1) &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			    (type != CONF_CLIENT || !arec->auth_user ||
-			    (auth_user && match(arec->auth_user, auth_user))) &&
-			   (type & 0x1 || match(arec->username, username)))
-			{
-				hprecv = arec->precedence;
-				hprec = arec->aconf;
-			}
-		}
-	}
 	return hprec;
 }
 
@@ -584,6 +691,7 @@ add_conf_by_address(const char *address, int type, const char *username, const c
 	arec->aconf = aconf;
 	arec->precedence = prec_value--;
 	arec->type = type;
+	index_address_rec(arec);
 }
 
 /* void delete_one_address(const char*, struct ConfItem*)
@@ -622,6 +730,7 @@ delete_one_address_conf(const char *address, struct ConfItem *aconf)
 				arecl->next = arec->next;
 			else
 				atable[hv] = arec->next;
+			unindex_address_rec(arec);
 			aconf->status |= CONF_ILLEGAL;
 			if(!aconf->clients)
 				free_conf(aconf);
@@ -668,6 +777,7 @@ clear_out_address_conf(enum aconf_category clear_type)
 			}
 			else
 			{
+				unindex_address_rec(arec);
 				arec->aconf->status |= CONF_ILLEGAL;
 				if(!arec->aconf->clients)
 					free_conf(arec->aconf);
@@ -65,6 +65,7 @@
 #include "authproc.h"
 #include "operhash.h"
 #include "response.h"
+#include "upgrade.h"
 
 static void
 ircd_die_cb(const char *str) __noreturn;
@@ -535,6 +536,7 @@ int
 solanum_main(int argc, char * const argv[])
 {
 	int fd;
+	bool upgrading;
 
 	/* Check to see if the user is running us as root, which is a nono */
 	if(geteuid() == 0)
@@ -621,20 +623,26 @@ solanum_main(int argc, char * const argv[])
 	else if (fd == -1)
 		exit(1);
 
+	/* an upgrade execs us with the pidfile still ours and the old
+	 * process's descriptors open, some of which we are taking over
+	 */
+	upgrading = !testing_conf && upgrade_check();
+
 	/* Check if there is pidfile and daemon already running */
 	if(!testing_conf)
 	{
-		check_pidfile(pidFileName);
+		if(!upgrading)
+			check_pidfile(pidFileName);
 
 		inotice("starting %s ...", ircd_version);
 		inotice("%s", rb_lib_version());
 
-		if(!server_state_foreground)
+		if(!server_state_foreground && !upgrading)
 			make_daemon();
 	}
 
 	/* Init the event subsystem */
-	rb_lib_init(ircd_log_cb, ircd_restart_cb, ircd_die_cb, !server_state_foreground, maxconnections, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_lib_init(ircd_log_cb, ircd_restart_cb, ircd_die_cb, !server_state_foreground && !upgrading, maxconnections, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
 	rb_linebuf_init(LINEBUF_HEAP_SIZE);
 
 	rb_init_prng(NULL, RB_PRNG_DEFAULT);
@@ -674,6 +682,8 @@ solanum_main(int argc, char * const argv[])
 		fprintf(stderr, "\nBeginning config test\n");
 
 	load_all_modules(1);
+	if(upgrading)
+		upgrade_start();
 	read_conf_files(true);	/* cold start init conf files */
 
 	init_isupport();
@@ -747,6 +757,9 @@ solanum_main(int argc, char * const argv[])
 
 	configure_authd();
 
+	if(upgrading)
+		upgrade_finish();
+
 	ilog(L_MAIN, "Server Ready");
 
 	/* We want try_connections to be called as soon as possible now! -- adrian */
@@ -44,9 +44,9 @@
 #include "logger.h"
 
 static rb_dlink_list listener_list = {};
+static uint32_t listener_id;
 static int accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
 static void accept_callback(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
-static SSL_OPEN_CB accept_sslcallback;
 
 static struct Listener *
 make_listener(struct rb_sockaddr_storage *addr)
@@ -55,6 +55,7 @@ make_listener(struct rb_sockaddr_storage *addr)
 	s_assert(0 != listener);
 	listener->name = me.name;
 	listener->F = NULL;
+	listener->id = ++listener_id;
 
 	memcpy(&listener->addr, addr, sizeof(listener->addr));
 	return listener;
@@ -121,29 +122,11 @@ show_ports(struct Client *source_p)
 }
 
 /*
- * inetport - create a listener socket in the AF_INET or AF_INET6 domain,
- * bind it to the port given in 'port' and listen to it
- * returns true (1) if successful false (0) on error.
+ * set_listener_vhost - work out the name a listener is shown by
  */
-
-static int
-inetport(struct Listener *listener)
+static void
+set_listener_vhost(struct Listener *listener)
 {
-	rb_fde_t *F;
-	const char *errstr;
-	int ret;
-
-	if (listener->sctp) {
-#ifdef HAVE_LIBSCTP
-		/* only AF_INET6 sockets can have both AF_INET and AF_INET6 addresses */
-		F = rb_socket(AF_INET6, SOCK_STREAM, IPPROTO_SCTP, "Listener socket");
-#else
-		F = NULL;
-#endif
-	} else {
-		F = rb_socket(GET_SS_FAMILY(&listener->addr[0]), SOCK_STREAM, IPPROTO_TCP, "Listener socket");
-	}
-
 	memset(listener->vhost, 0, sizeof(listener->vhost));
 
 	if (GET_SS_FAMILY(&listener->addr[0]) == AF_INET6) {
@@ -167,6 +150,65 @@ inetport(struct Listener *listener)
 	if (listener->vhost[0] != '\0') {
 		listener->name = listener->vhost;
 	}
+}
+
+/*
+ * start_accepting - take connections on a listener.  TLS listeners are
+ * handed to ssld, which does the accept and handshake and passes us
+ * the connection once it is established, see add_ssld_connection()
+ */
+static void
+start_accepting(struct Listener *listener)
+{
+	if(listener->ssl)
+		ssld_add_listener(listener);
+	else
+		rb_accept_tcp(listener->F, accept_precallback, accept_callback, listener);
+}
+
+/*
+ * set_listener_ssl - switch an open listener between plaintext and TLS
+ */
+static void
+set_listener_ssl(struct Listener *listener, int ssl)
+{
+	if(listener->ssl == ssl)
+		return;
+
+	if(listener->ssl)
+		ssld_del_listener(listener);
+	else
+		rb_setselect(listener->F, RB_SELECT_ACCEPT, NULL, NULL);
+
+	listener->ssl = ssl;
+	start_accepting(listener);
+}
+
+/*
+ * inetport - create a listener socket in the AF_INET or AF_INET6 domain,
+ * bind it to the port given in 'port' and listen to it
+ * returns true (1) if successful false (0) on error.
+ */
+
+static int
+inetport(struct Listener *listener)
+{
+	rb_fde_t *F;
+	const char *errstr;
+	int ret;
+
+	if (listener->sctp) {
+#ifdef HAVE_LIBSCTP
+		/* only AF_INET6 sockets can have both AF_INET and AF_INET6 addresses */
+		F = rb_socket(AF_INET6, SOCK_STREAM, IPPROTO_SCTP, "Listener socket");
+#else
+		F = NULL;
+#endif
+	} else {
+		F = rb_socket(GET_SS_FAMILY(&listener->addr[0]), SOCK_STREAM, IPPROTO_TCP, "Listener socket");
+	}
+
+	set_listener_vhost(listener);
 
 	if (F == NULL) {
 		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
@@ -214,7 +256,7 @@ inetport(struct Listener *listener)
 
 	listener->F = F;
 
-	rb_accept_tcp(listener->F, accept_precallback, accept_callback, listener);
+	start_accepting(listener);
 	return 1;
 }
 
@@ -335,8 +377,11 @@ add_tcp_listener(int port, const char *vhost_ip, int family, int ssl, int defer_
 			break;
 	}
 	if ((listener = find_listener(vaddr, 0))) {
-		if (listener->F != NULL)
+		if (listener->F != NULL) {
+			set_listener_ssl(listener, ssl);
+			listener->active = 1;
 			return;
+		}
 	} else {
 		listener = make_listener(vaddr);
 		rb_dlinkAdd(listener, &listener->lnode, &listener_list);
@@ -404,8 +449,11 @@ add_sctp_listener(int port, const char *vhost_ip1, const char *vhost_ip2, int ss
 	SET_SS_PORT(&vaddr[1], htons(port));
 
 	if ((listener = find_listener(vaddr, 1))) {
-		if(listener->F != NULL)
+		if(listener->F != NULL) {
+			set_listener_ssl(listener, ssl);
+			listener->active = 1;
 			return;
+		}
 	} else {
 		listener = make_listener(vaddr);
 		rb_dlinkAdd(listener, &listener->lnode, &listener_list);
@@ -434,6 +482,8 @@ close_listener(struct Listener *listener)
 		return;
 	if(listener->F != NULL)
 	{
+		if(listener->ssl)
+			ssld_del_listener(listener);
 		rb_close(listener->F);
 		listener->F = NULL;
 	}
@@ -467,17 +517,106 @@ close_listeners(void)
 	rb_close_pending_fds();
 }
 
+/*
+ * mark_listeners_inactive - before the conf is reread.  the listeners it
+ * still has are marked active again and kept open, which matters for TLS
+ * listeners since ssld holds on to their sockets; the rest are closed by
+ * close_inactive_listeners() afterwards
+ */
+void
+mark_listeners_inactive(void)
+{
+	rb_dlink_node *n;
+
+	RB_DLINK_FOREACH(n, listener_list.head)
+	{
+		struct Listener *listener = n->data;
+
+		listener->active = 0;
+	}
+}
+
+/*
+ * listener_foreach - call func for every open listener
+ */
+void
+listener_foreach(void (*func)(void *data, struct Listener *listener), void *data)
+{
+	rb_dlink_node *n;
+
+	RB_DLINK_FOREACH(n, listener_list.head)
+	{
+		struct Listener *listener = n->data;
+
+		if(listener->F != NULL)
+			func(data, listener);
+	}
+}
+
+/*
+ * adopt_listener - take over a listening socket inherited across an
+ * upgrade.  it stays inactive until the conf asks for the same address,
+ * see close_inactive_listeners()
+ */
+struct Listener *
+adopt_listener(uint32_t id, int fd, uint8_t type, struct rb_sockaddr_storage *addr, int ssl, int defer_accept, bool sctp)
+{
+	struct Listener *listener;
+	rb_fde_t *F;
+
+	F = rb_open(fd, type, "Listener socket");
+	if(F == NULL)
+		return NULL;
+
+	rb_set_cloexec(F);
+
+	listener = make_listener(addr);
+	rb_dlinkAdd(listener, &listener->lnode, &listener_list);
+	listener->F = F;
+	listener->ssl = ssl;
+	listener->defer_accept = defer_accept;
+	listener->sctp = sctp;
+	listener->active = 0;
+	set_listener_vhost(listener);
+
+	/* the sslds we take over already know it by this id */
+	listener->id = id;
+	if(listener_id < id)
+		listener_id = id;
+
+	if(!listener->ssl)
+		rb_accept_tcp(listener->F, accept_precallback, accept_callback, listener);
+	return listener;
+}
+
+/*
+ * close_inactive_listeners - close inherited listeners the conf no
+ * longer has
+ */
+void
+close_inactive_listeners(void)
+{
+	rb_dlink_node *n, *tn;
+
+	RB_DLINK_FOREACH_SAFE(n, tn, listener_list.head)
+	{
+		struct Listener *listener = n->data;
+
+		if(listener->F != NULL && !listener->active)
+			close_listener(listener);
+	}
+}
+
 /*
  * add_connection - creates a client which has just connected to us on
  * the given fd. The sockhost field is initialized with the ip# of the host.
- * The client is sent to the auth module for verification, and not put in
- * any client list yet.
+ * The caller sends it to the auth module for verification; it is not
+ * put in any client list yet.
  */
-static void
+static struct Client *
 add_connection(struct Listener *listener, rb_fde_t *F, struct sockaddr *sai, struct sockaddr *lai)
 {
 	struct Client *new_client;
-	bool defer = false;
 	s_assert(NULL != listener);
 
 	/*
@@ -503,26 +642,11 @@ add_connection(struct Listener *listener, rb_fde_t *F, struct sockaddr *sai, str
 		SetSCTP(new_client);
 	}
 
+	/* ssld has already done the handshake, F is our end of the
+	 * plaintext socketpair it passed us
+	 */
 	if (listener->ssl)
 	{
-		rb_fde_t *xF[2];
-		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &xF[0], &xF[1], "Incoming ssld Connection") == -1)
-		{
-			SetIOError(new_client);
-			exit_client(new_client, new_client, new_client, "Fatal Error");
-			return;
-		}
-		new_client->localClient->ssl_callback = accept_sslcallback;
-		defer = true;
-		new_client->localClient->ssl_ctl = start_ssld_accept(F, xF[1], connid_get(new_client));        /* this will close F for us */
-		if(new_client->localClient->ssl_ctl == NULL)
-		{
-			SetIOError(new_client);
-			exit_client(new_client, new_client, new_client, "Service Unavailable");
-			return;
-		}
-		F = xF[0];
-		new_client->localClient->F = F;
 		SetSSL(new_client);
 		SetSecure(new_client);
 	}
@@ -539,14 +663,7 @@ add_connection(struct Listener *listener, rb_fde_t *F, struct sockaddr *sai, str
 
 	++listener->ref_count;
 
-	authd_initiate_client(new_client, defer);
-}
-
-static int
-accept_sslcallback(struct Client *client_p, int status)
-{
-	authd_deferred_client(client_p);
-	return 0; /* use default handler if status != RB_OK */
+	return new_client;
 }
 
 static int
@@ -561,21 +678,9 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 	static const char *allinuse = "ERROR :All connections in use\r\n";
 	static const char *toofast = "ERROR :Reconnecting too fast, throttled.\r\n";
 
-	static const unsigned char ssldeniederrcode[] = {
-		// SSLv3.0 Fatal Alert: Access Denied
-		0x15, 0x03, 0x00, 0x00, 0x02, 0x02, 0x31
-	};
-
-	static const unsigned char sslinternalerrcode[] = {
-		// SSLv3.0 Fatal Alert: Internal Error
-		0x15, 0x03, 0x00, 0x00, 0x02, 0x02, 0x50
-	};
-
-	if(listener->ssl && (!ircd_ssl_ok || !get_ssld_count()))
-	{
-		rb_close(F);
-		return 0;
-	}
+	/* for TLS listeners F is the plaintext end of an ssld connection,
+	 * so the errors below go out encrypted like any other line
+	 */
 
 	if((maxconnections - 10) < rb_get_fd(F)) /* XXX this is kinda bogus */
 	{
@@ -591,10 +696,7 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 			last_oper_notice = rb_current_time();
 		}
 
-		if(listener->ssl)
-			rb_write(F, sslinternalerrcode, sizeof(sslinternalerrcode));
-		else
-			rb_write(F, allinuse, strlen(allinuse));
+		rb_write(F, allinuse, strlen(allinuse));
 
 		rb_close(F);
 		return 0;
@@ -610,11 +712,7 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 	{
 		ServerStats.is_ref++;
 
-		if(listener->ssl)
-		{
-			rb_write(F, ssldeniederrcode, sizeof(ssldeniederrcode));
-		}
-		else if(ConfigFileEntry.dline_with_reason)
+		if(ConfigFileEntry.dline_with_reason)
 		{
 			len = snprintf(buf, sizeof(buf), "ERROR :*** Banned: %s\r\n", get_user_ban_reason(aconf));
 			if (len >= (int)(sizeof(buf)-1))
@@ -635,7 +733,7 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 		return 0;
 	}
 
-	if(check_reject(F, addr, listener->ssl)) {
+	if(check_reject(F, addr, false)) {
 		/* Reject the connection without closing the socket
 		 * because it is now on the delay_exit list. */
 		return 0;
@@ -643,10 +741,7 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 
 	if(throttle_add(addr))
 	{
-		if(listener->ssl)
-			rb_write(F, ssldeniederrcode, sizeof(ssldeniederrcode));
-		else
-			rb_write(F, toofast, strlen(toofast));
+		rb_write(F, toofast, strlen(toofast));
 
 		rb_close(F);
 		return 0;
@@ -671,5 +766,44 @@ accept_callback(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t add
 		return;
 	}
 
-	add_connection(listener, F, addr, (struct sockaddr *)&lip);
+	authd_initiate_client(add_connection(listener, F, addr, (struct sockaddr *)&lip), false);
+}
+
+/*
+ * add_ssld_connection - ssld has accepted a connection on one of our TLS
+ * listeners and completed the handshake.  F is the plaintext end of the
+ * connection, addr and lai the addresses of the TLS socket.  the same
+ * checks as for plaintext connections are applied; returns the new
+ * client, or NULL if the connection was refused and F closed
+ */
+struct Client *
+add_ssld_connection(uint32_t listener_id, rb_fde_t *F, struct sockaddr *addr, struct sockaddr *lai)
+{
+	struct Listener *listener = NULL;
+	rb_dlink_node *n;
+
+	RB_DLINK_FOREACH(n, listener_list.head)
+	{
+		struct Listener *l = n->data;
+
+		if(l->id == listener_id && l->F != NULL)
+		{
+			listener = l;
+			break;
+		}
+	}
+
+	/* ssld may not have caught up with a rehash yet */
+	if(listener == NULL || !listener->ssl)
+	{
+		rb_close(F);
+		return NULL;
+	}
+
+	ServerStats.is_ac++;
+
+	if(!accept_precallback(F, addr, GET_SS_LEN((struct rb_sockaddr_storage *)addr), listener))
+		return NULL;
+
+	return add_connection(listener, F, addr, lai);
 }
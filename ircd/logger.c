@@ -40,6 +40,9 @@
 #include "client.h"
 #include "s_serv.h"
 
+#include <pthread.h>
+#include <signal.h>
+
 static FILE *log_main;
 static FILE *log_user;
 static FILE *log_fuser;
@@ -71,6 +74,198 @@ static struct log_struct log_table[LAST_LOGFILE] =
 	{ &ConfigFileEntry.fname_ioerrorlog,	&log_ioerror	}
 };
 
+/*
+ * Once the server is up, ilog() doesn't write to the log files itself.
+ * Lines go into a ring buffer and a writer thread writes them out in
+ * batches, so a slow disk never holds up the event loop.  There is one
+ * producer (the main thread) and one consumer at a time: whoever holds
+ * log_file_lock, which is also needed to open or close a log file.  If
+ * the ring is full, the line is dropped and counted.
+ */
+#define LOG_RING_SIZE	(256 * 1024)	/* a power of two */
+#define LOG_RING_MASK	(LOG_RING_SIZE - 1)
+
+struct log_record
+{
+	uint16_t dest;
+	uint16_t len;
+};
+
+static char log_ring[LOG_RING_SIZE];
+static size_t log_head;		/* only advanced by ilog() */
+static size_t log_tail;		/* only advanced with log_file_lock held */
+
+static bool log_open[LAST_LOGFILE];	/* what ilog() thinks is open */
+static unsigned long long log_lines;
+static unsigned long long log_dropped;
+
+static pthread_t log_thread;
+static bool log_thread_running;
+static pthread_mutex_t log_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake = PTHREAD_COND_INITIALIZER;
+static bool log_wakeup;
+static bool log_stopping;
+static int log_flush_interval = 1;
+
+static void
+log_ring_copy_in(size_t pos, const void *data, size_t len)
+{
+	size_t off = pos & LOG_RING_MASK;
+	size_t first = LOG_RING_SIZE - off;
+
+	if(first > len)
+		first = len;
+	memcpy(&log_ring[off], data, first);
+	memcpy(log_ring, (const char *)data + first, len - first);
+}
+
+static void
+log_ring_copy_out(size_t pos, void *data, size_t len)
+{
+	size_t off = pos & LOG_RING_MASK;
+	size_t first = LOG_RING_SIZE - off;
+
+	if(first > len)
+		first = len;
+	memcpy(data, &log_ring[off], first);
+	memcpy((char *)data + first, log_ring, len - first);
+}
+
+/*
+ * log_drain - write out everything queued, then flush each file once.
+ * Must be called with log_file_lock held.
+ */
+static void
+log_drain(void)
+{
+	bool written[LAST_LOGFILE] = { false };
+	char buf[MAX_DATE_STRING + 1 + BUFSIZE + 1];
+	struct log_record rec;
+	size_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+	size_t tail = log_tail;
+	FILE *logfile;
+	int i;
+
+	while(tail != head)
+	{
+		log_ring_copy_out(tail, &rec, sizeof(rec));
+		log_ring_copy_out(tail + sizeof(rec), buf, rec.len);
+		tail += sizeof(rec) + rec.len;
+
+		if((logfile = *log_table[rec.dest].logfile) == NULL)
+			continue;
+
+		if(fwrite(buf, 1, rec.len, logfile) != rec.len)
+		{
+			fclose(logfile);
+			*log_table[rec.dest].logfile = NULL;
+			continue;
+		}
+		written[rec.dest] = true;
+	}
+
+	__atomic_store_n(&log_tail, tail, __ATOMIC_RELEASE);
+
+	for(i = 0; i < LAST_LOGFILE; i++)
+	{
+		if(!written[i] || (logfile = *log_table[i].logfile) == NULL)
+			continue;
+
+		if(fflush(logfile) != 0)
+		{
+			fclose(logfile);
+			*log_table[i].logfile = NULL;
+		}
+	}
+}
+
+static void *
+log_writer(void *unused)
+{
+	struct timespec deadline;
+	bool stopping;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&log_wake_lock);
+		if(!log_wakeup && !log_stopping)
+		{
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += log_flush_interval > 0 ? log_flush_interval : 1;
+			pthread_cond_timedwait(&log_wake, &log_wake_lock, &deadline);
+		}
+		log_wakeup = false;
+		stopping = log_stopping;
+		pthread_mutex_unlock(&log_wake_lock);
+
+		pthread_mutex_lock(&log_file_lock);
+		log_drain();
+		pthread_mutex_unlock(&log_file_lock);
+
+		if(stopping)
+			return NULL;
+	}
+}
+
+static void
+log_wake_writer(void)
+{
+	pthread_mutex_lock(&log_wake_lock);
+	log_wakeup = true;
+	pthread_cond_signal(&log_wake);
+	pthread_mutex_unlock(&log_wake_lock);
+}
+
+static void
+stop_log_writer(void)
+{
+	if(!log_thread_running)
+		return;
+
+	pthread_mutex_lock(&log_wake_lock);
+	log_stopping = true;
+	pthread_cond_signal(&log_wake);
+	pthread_mutex_unlock(&log_wake_lock);
+
+	pthread_join(log_thread, NULL);
+	log_thread_running = false;
+}
+
+static void
+start_log_writer(void)
+{
+	sigset_t all, old;
+
+	if(log_thread_running)
+		return;
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if(pthread_create(&log_thread, NULL, log_writer, NULL) == 0)
+	{
+		log_thread_running = true;
+		atexit(stop_log_writer);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void
+set_log_flush_interval(int interval)
+{
+	pthread_mutex_lock(&log_wake_lock);
+	log_flush_interval = interval;
+	pthread_mutex_unlock(&log_wake_lock);
+}
+
+void
+get_log_stats(unsigned long long *lines, unsigned long long *dropped)
+{
+	*lines = log_lines;
+	*dropped = log_dropped;
+}
+
 static void
 verify_logfile_access(const char *filename)
 {
@@ -110,7 +305,10 @@ init_main_logfile(void)
 	verify_logfile_access(logFileName);
 	if(log_main == NULL)
 	{
+		pthread_mutex_lock(&log_file_lock);
 		log_main = fopen(logFileName, "a");
+		pthread_mutex_unlock(&log_file_lock);
+		log_open[L_MAIN] = log_main != NULL;
 		if(log_main == NULL)
 		{
 			snprintf(buf, sizeof(buf), "WARNING: Access denied for logfile %s: %s", logFileName, strerror(errno));
@@ -137,7 +335,10 @@ open_logfiles(void)
 		if(!EmptyString(*log_table[i].name))
 		{
 			verify_logfile_access(*log_table[i].name);
+			pthread_mutex_lock(&log_file_lock);
 			*log_table[i].logfile = fopen(*log_table[i].name, "a");
+			pthread_mutex_unlock(&log_file_lock);
+			log_open[i] = *log_table[i].logfile != NULL;
 			if(*log_table[i].logfile == NULL)
 			{
 				snprintf(buf, sizeof(buf), "WARNING: Access denied for logfile %s: %s", *log_table[i].name, strerror(errno));
@@ -147,6 +348,8 @@ open_logfiles(void)
 			}
 		}
 	}
+
+	start_log_writer();
 }
 
 void
@@ -154,6 +357,10 @@ close_logfiles(void)
 {
 	int i;
 
+	/* anything still queued goes to the files it was meant for */
+	pthread_mutex_lock(&log_file_lock);
+	log_drain();
+
 	if(log_main != NULL)
 	{
 		fclose(log_main);
@@ -169,30 +376,72 @@ close_logfiles(void)
 			*log_table[i].logfile = NULL;
 		}
 	}
+	pthread_mutex_unlock(&log_file_lock);
+
+	for(i = 0; i < LAST_LOGFILE; i++)
+		log_open[i] = false;
 }
 
 void
 ilog(ilogfile dest, const char *format, ...)
 {
-	FILE *logfile = *log_table[dest].logfile;
+	FILE *logfile;
 	char buf[BUFSIZE];
 	char buf2[MAX_DATE_STRING + 1 + BUFSIZE + 1];
+	struct log_record rec;
+	size_t used;
 	va_list args;
+	int len;
 
-	if(logfile == NULL)
+	if(!log_open[dest])
 		return;
 
 	va_start(args, format);
 	vsnprintf(buf, sizeof(buf), format, args);
 	va_end(args);
 
-	snprintf(buf2, sizeof(buf2), "%s %s\n",
+	len = snprintf(buf2, sizeof(buf2), "%s %s\n",
 			smalldate(rb_current_time()), buf);
+	if(len < 0)
+		return;
+	if((size_t)len >= sizeof(buf2))
+		len = sizeof(buf2) - 1;
+
+	if(log_thread_running)
+	{
+		used = log_head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+		if(used + sizeof(rec) + len > LOG_RING_SIZE)
+		{
+			log_dropped++;
+			return;
+		}
+
+		rec.dest = dest;
+		rec.len = len;
+		log_ring_copy_in(log_head, &rec, sizeof(rec));
+		log_ring_copy_in(log_head + sizeof(rec), buf2, len);
+		__atomic_store_n(&log_head, log_head + sizeof(rec) + len, __ATOMIC_RELEASE);
+		log_lines++;
+
+		/* don't let it fill up before the next scheduled flush */
+		used += sizeof(rec) + len;
+		if(log_flush_interval == 0 || (used > LOG_RING_SIZE / 2 &&
+				used - sizeof(rec) - len <= LOG_RING_SIZE / 2))
+			log_wake_writer();
+		return;
+	}
+
+	/* not started yet, or shut down */
+	logfile = *log_table[dest].logfile;
+	if(logfile == NULL)
+		return;
 
+	log_lines++;
 	if(fputs(buf2, logfile) < 0)
 	{
 		fclose(logfile);
 		*log_table[dest].logfile = NULL;
+		log_open[dest] = false;
 		return;
 	}
 
@@ -0,0 +1,417 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  maskindex.c: Compiled X-line and nick RESV lookups.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * X-line and RESV masks are matched with match_esc(), and whatever a mask
+ * matches contains every run of plain characters in it: the run before the
+ * first wildcard starts the string, the run after the last one ends it,
+ * and the rest appear somewhere in between.  Each mask is filed under its
+ * longest run, and all the runs are compiled into one Aho-Corasick
+ * automaton, so a single pass over a name finds every mask whose run it
+ * contains at the right place, however many masks there are.  Masks with
+ * no plain characters at all ("*", "???", "#@*") go in a fallback list.
+ *
+ * Runs only select candidates; every candidate is still checked with
+ * match_esc(), and the first in list order wins, so the result is the
+ * same as walking the list.
+ *
+ * The index is rebuilt whenever the list's serial has moved on, which is
+ * bumped by every change to the list.
+ */
+
+#include "stdinc.h"
+#include "client.h"
+#include "match.h"
+#include "s_conf.h"
+#include "s_newconf.h"
+#include "s_assert.h"
+
+/* lists shorter than this are walked directly */
+#define MASK_INDEX_MIN	16
+
+#define ANCHOR_START	0x1
+#define ANCHOR_END	0x2
+
+struct mask_entry
+{
+	struct ConfItem *aconf;
+	unsigned int pos;		/* position in the list, head is 0 */
+	unsigned int len;		/* length of the run it is filed under */
+	unsigned int anchor;
+	struct mask_entry *next;	/* node or fallback chain, in list order */
+};
+
+struct mask_node
+{
+	unsigned int child;		/* first child, 0 for none */
+	unsigned int sibling;		/* next child of the same parent */
+	unsigned int fail;		/* longest proper suffix in the trie */
+	unsigned int out;		/* nearest node on the fail chain with entries */
+	unsigned char c;
+	struct mask_entry *entries;
+	struct mask_entry *entries_last;
+};
+
+struct mask_index
+{
+	unsigned long serial;		/* list serial this was built for */
+	unsigned int count;
+	struct mask_entry *entries;
+
+	/* node 0 is the root; its children are also in root[] */
+	struct mask_node *nodes;
+	unsigned int node_count;
+	unsigned int node_size;
+	unsigned int root[256];
+
+	struct mask_entry *fallback;	/* in list order */
+};
+
+static inline int
+is_plain(const char *p)
+{
+	return *p != '\0' && *p != '*' && *p != '?' && *p != '@' &&
+		*p != '#' && *p != '\\';
+}
+
+/* mask_index_key()
+ *
+ * input	- mask
+ * output	- length of its longest run of plain characters, with the
+ *                run's start and whether it is anchored at either end
+ * side effects -
+ */
+static unsigned int
+mask_index_key(const char *mask, const char **key, unsigned int *anchor)
+{
+	const char *p = mask, *run;
+	unsigned int len, best = 0, flags;
+
+	*anchor = 0;
+
+	for(;;)
+	{
+		run = p;
+		while(is_plain(p))
+			p++;
+
+		len = p - run;
+		flags = (run == mask ? ANCHOR_START : 0) | (*p == '\0' ? ANCHOR_END : 0);
+		if(len > best || (len == best && len > 0 && flags > *anchor))
+		{
+			best = len;
+			*key = run;
+			*anchor = flags;
+		}
+
+		if(*p == '\0')
+			break;
+
+		/* an escaped character is neither plain nor a wildcard,
+		 * '\s' for one is a space; just skip over it
+		 */
+		if(*p == '\\' && p[1] != '\0')
+			p++;
+		p++;
+	}
+
+	return best;
+}
+
+static unsigned int
+mask_index_child(struct mask_index *idx, unsigned int node, unsigned char c)
+{
+	unsigned int n;
+
+	if(node == 0)
+		return idx->root[c];
+
+	for(n = idx->nodes[node].child; n != 0; n = idx->nodes[n].sibling)
+		if(idx->nodes[n].c == c)
+			return n;
+
+	return 0;
+}
+
+static unsigned int
+mask_index_new_node(struct mask_index *idx, unsigned int parent, unsigned char c)
+{
+	struct mask_node *node;
+	unsigned int n;
+
+	if(idx->node_count == idx->node_size)
+	{
+		idx->node_size *= 2;
+		idx->nodes = rb_realloc(idx->nodes, sizeof(struct mask_node) * idx->node_size);
+	}
+
+	n = idx->node_count++;
+	node = &idx->nodes[n];
+	memset(node, 0, sizeof(struct mask_node));
+	node->c = c;
+
+	if(parent == 0)
+		idx->root[c] = n;
+	else
+	{
+		node->sibling = idx->nodes[parent].child;
+		idx->nodes[parent].child = n;
+	}
+
+	return n;
+}
+
+/* mask_index_add()
+ *
+ * input	- index, entry
+ * output	- 1 if the entry was filed under a run, 0 if it needs
+ *                to go on the fallback list
+ * side effects - the run is added to the trie
+ */
+static int
+mask_index_add(struct mask_index *idx, struct mask_entry *entry)
+{
+	const char *key = NULL;
+	unsigned int node = 0, next, i;
+	unsigned char c;
+
+	entry->len = mask_index_key(entry->aconf->host, &key, &entry->anchor);
+	if(entry->len == 0)
+		return 0;
+
+	for(i = 0; i < entry->len; i++)
+	{
+		c = irctolower(key[i]);
+		if((next = mask_index_child(idx, node, c)) == 0)
+			next = mask_index_new_node(idx, node, c);
+		node = next;
+	}
+
+	if(idx->nodes[node].entries_last != NULL)
+		idx->nodes[node].entries_last->next = entry;
+	else
+		idx->nodes[node].entries = entry;
+	idx->nodes[node].entries_last = entry;
+	return 1;
+}
+
+/* mask_index_link()
+ *
+ * input	- index with its trie built
+ * output	-
+ * side effects - fail and output links are set, breadth first
+ */
+static void
+mask_index_link(struct mask_index *idx)
+{
+	unsigned int *queue = rb_malloc(sizeof(unsigned int) * idx->node_count);
+	unsigned int head = 0, tail = 0;
+	unsigned int n, child, f;
+	int c;
+
+	for(c = 0; c < 256; c++)
+		if(idx->root[c] != 0)
+			queue[tail++] = idx->root[c];
+
+	while(head < tail)
+	{
+		n = queue[head++];
+
+		for(child = idx->nodes[n].child; child != 0; child = idx->nodes[child].sibling)
+		{
+			c = idx->nodes[child].c;
+
+			for(f = idx->nodes[n].fail; f != 0 && mask_index_child(idx, f, c) == 0;)
+				f = idx->nodes[f].fail;
+			f = mask_index_child(idx, f, c);
+
+			idx->nodes[child].fail = f;
+			idx->nodes[child].out = idx->nodes[f].entries != NULL ? f : idx->nodes[f].out;
+			queue[tail++] = child;
+		}
+	}
+
+	rb_free(queue);
+}
+
+/* mask_index_build()
+ *
+ * input	- X-line or RESV list, its current serial
+ * output	- compiled index for the list
+ * side effects -
+ */
+static struct mask_index *
+mask_index_build(rb_dlink_list *list, unsigned long serial)
+{
+	struct mask_index *idx;
+	struct mask_entry **fallback_tail;
+	rb_dlink_node *ptr;
+	unsigned int pos = 0;
+
+	idx = rb_malloc(sizeof(struct mask_index));
+	idx->serial = serial;
+	idx->count = rb_dlink_list_length(list);
+	idx->entries = rb_malloc(sizeof(struct mask_entry) * idx->count);
+
+	idx->node_size = 64;
+	idx->nodes = rb_malloc(sizeof(struct mask_node) * idx->node_size);
+	idx->node_count = 1;
+
+	fallback_tail = &idx->fallback;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		struct mask_entry *entry = &idx->entries[pos];
+
+		entry->aconf = ptr->data;
+		entry->pos = pos++;
+
+		if(!mask_index_add(idx, entry))
+		{
+			*fallback_tail = entry;
+			fallback_tail = &entry->next;
+		}
+	}
+
+	mask_index_link(idx);
+	return idx;
+}
+
+/* free_mask_index()
+ *
+ * input	- pointer to a list's index
+ * output	-
+ * side effects - index is freed and the pointer cleared
+ */
+void
+free_mask_index(struct mask_index **idxp)
+{
+	struct mask_index *idx = *idxp;
+
+	if(idx == NULL)
+		return;
+
+	rb_free(idx->nodes);
+	rb_free(idx->entries);
+	rb_free(idx);
+	*idxp = NULL;
+}
+
+static inline void
+mask_index_try(struct mask_entry *entry, struct mask_entry **best, const char *name)
+{
+	if(*best != NULL && (*best)->pos <= entry->pos)
+		return;
+
+	if(match_esc(entry->aconf->host, name))
+		*best = entry;
+}
+
+/* mask_index_match()
+ *
+ * input	- index, name
+ * output	- first mask in list order matching the name, or NULL
+ * side effects -
+ */
+static struct mask_entry *
+mask_index_match(struct mask_index *idx, const char *name)
+{
+	struct mask_entry *best = NULL;
+	struct mask_entry *entry;
+	unsigned int node = 0, next, out;
+	size_t i, len = strlen(name);
+	unsigned char c;
+
+	for(i = 0; i < len; i++)
+	{
+		c = irctolower(name[i]);
+
+		while((next = mask_index_child(idx, node, c)) == 0 && node != 0)
+			node = idx->nodes[node].fail;
+		node = next;
+
+		out = idx->nodes[node].entries != NULL ? node : idx->nodes[node].out;
+		for(; out != 0; out = idx->nodes[out].out)
+		{
+			for(entry = idx->nodes[out].entries; entry != NULL; entry = entry->next)
+			{
+				if(best != NULL && best->pos < entry->pos)
+					break;
+				if(entry->anchor & ANCHOR_START && i + 1 != entry->len)
+					continue;
+				if(entry->anchor & ANCHOR_END && i + 1 != len)
+					continue;
+				mask_index_try(entry, &best, name);
+			}
+		}
+	}
+
+	for(entry = idx->fallback; entry != NULL; entry = entry->next)
+	{
+		if(best != NULL && best->pos < entry->pos)
+			break;
+		mask_index_try(entry, &best, name);
+	}
+
+	return best;
+}
+
+/* find_mask_conf()
+ *
+ * input	- X-line or RESV list, the list's index, its current serial,
+ *                name to check
+ * output	- first entry in the list whose mask matches the name, or NULL
+ * side effects - the index is built, rebuilt or freed to match the list
+ */
+struct ConfItem *
+find_mask_conf(rb_dlink_list *list, struct mask_index **idxp,
+		unsigned long serial, const char *name)
+{
+	struct mask_entry *entry;
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr;
+
+	if(rb_dlink_list_length(list) >= MASK_INDEX_MIN)
+	{
+		if(*idxp != NULL && ((*idxp)->serial != serial ||
+				(*idxp)->count != rb_dlink_list_length(list)))
+		{
+			/* the count check is a backstop for a missed serial++ */
+			s_assert((*idxp)->serial != serial);
+			free_mask_index(idxp);
+		}
+		if(*idxp == NULL)
+			*idxp = mask_index_build(list, serial);
+
+		entry = mask_index_match(*idxp, name);
+		return entry != NULL ? entry->aconf : NULL;
+	}
+
+	free_mask_index(idxp);
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		aconf = ptr->data;
+		if(match_esc(aconf->host, name))
+			return aconf;
+	}
+
+	return NULL;
+}
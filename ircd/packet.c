@@ -34,15 +34,322 @@
 #include "s_assert.h"
 #include "s_newconf.h"
 
+/* the smallest ring a connection is given */
+#define RECVQ_MIN	4096
+
+#define IsEOL(c)	((c) == '\r' || (c) == '\n')
+
+/* reads for a connection with nothing queued go here, and are parsed in
+ * place; only what is left over afterwards is moved to its own ring.
+ * readbuf_user is the queue currently borrowing it.
+ */
 static char readBuf[READBUF_SIZE];
+static struct recvq *readbuf_user;
+
 static void client_dopacket(struct Client *client_p, char *buffer, size_t length);
 
+/*
+ * recvq_resize - move the queued data to the start of a new ring of
+ * the given size
+ */
+static void
+recvq_resize(struct recvq *rq, unsigned int size)
+{
+	char *buf = rb_malloc(size);
+	unsigned int first;
+
+	if(rq->len > 0)
+	{
+		first = rq->size - rq->head;
+		if(first > rq->len)
+			first = rq->len;
+		memcpy(buf, rq->buf + rq->head, first);
+		memcpy(buf + first, rq->buf, rq->len - first);
+	}
+
+	if(rq->buf == readBuf)
+		readbuf_user = NULL;
+	else
+		rb_free(rq->buf);
+
+	rq->buf = buf;
+	rq->size = size;
+	rq->head = 0;
+}
+
+/*
+ * recvq_settle - after parsing, give back the read buffer or an empty
+ * ring.  whatever is left is moved to a ring of its own.
+ */
+static void
+recvq_settle(struct recvq *rq)
+{
+	unsigned int size;
+
+	if(rq->len == 0)
+	{
+		recvq_free(rq);
+		return;
+	}
+
+	if(rq->buf != readBuf)
+		return;
+
+	for(size = RECVQ_MIN; size < rq->len * 2; size <<= 1)
+		;
+	recvq_resize(rq, size);
+}
+
+/*
+ * recvq_reserve - find room to read into, growing the ring if it is
+ * full.  returns where to read to and sets *space to how much.
+ */
+static char *
+recvq_reserve(struct recvq *rq, int *space)
+{
+	unsigned int tail, n;
+
+	if(rq->len == rq->size)
+		recvq_resize(rq, rq->size > 0 ? rq->size * 2 : RECVQ_MIN);
+
+	tail = (rq->head + rq->len) & (rq->size - 1);
+	if(rq->len > 0 && tail <= rq->head)
+		n = rq->head - tail;
+	else
+		n = rq->size - tail;
+
+	*space = n > READBUF_SIZE ? READBUF_SIZE : n;
+	return rq->buf + tail;
+}
+
+static inline char
+recvq_byte(const struct recvq *rq, unsigned int ofs)
+{
+	return rq->buf[(rq->head + ofs) & (rq->size - 1)];
+}
+
+/*
+ * recvq_find_eol - offset from head of the first CR or LF between
+ * from and to, or -1 if there is none
+ */
+static int
+recvq_find_eol(const struct recvq *rq, unsigned int from, unsigned int to)
+{
+	const char *p, *cr, *lf;
+	unsigned int pos, n;
+
+	while(from < to)
+	{
+		pos = (rq->head + from) & (rq->size - 1);
+		n = rq->size - pos;
+		if(n > to - from)
+			n = to - from;
+
+		p = rq->buf + pos;
+		lf = memchr(p, '\n', n);
+		cr = memchr(p, '\r', lf != NULL ? (size_t)(lf - p) : n);
+
+		if(cr != NULL)
+			return from + (cr - p);
+		if(lf != NULL)
+			return from + (lf - p);
+
+		from += n;
+	}
+
+	return -1;
+}
+
+static void
+recvq_consume(struct recvq *rq, unsigned int len)
+{
+	rq->head = (rq->head + len) & (rq->size - 1);
+	rq->len -= len;
+	rq->scanned = 0;
+
+	/* keep as much room as possible in one piece */
+	if(rq->len == 0)
+		rq->head = 0;
+}
+
+/*
+ * recvq_get_line - take the next line off the queue, skipping blank
+ * ones.  *line is pointed at it, NUL terminated, and its length is
+ * returned, or -1 if there is no complete line yet.
+ *
+ * lines are terminated in place wherever they are in one piece, so
+ * *line stays valid until the queue is read into again.  a line that
+ * wraps around the end of the ring is copied out.  like the linebuf
+ * code, anything longer than LINEBUF_SIZE is split.
+ */
+static int
+recvq_get_line(struct recvq *rq, char **line)
+{
+	static char wrapped[LINEBUF_SIZE + 1];
+	unsigned int limit, len, first;
+	int eol;
+
+	if(rq->len == 0)
+		return -1;
+
+	/* the rest of the last line end, or blank lines */
+	while(rq->len > 0 && IsEOL(rq->buf[rq->head]))
+		recvq_consume(rq, 1);
+
+	if(rq->len == 0)
+		return -1;
+
+	limit = rq->len < LINEBUF_SIZE ? rq->len : LINEBUF_SIZE;
+	eol = recvq_find_eol(rq, rq->scanned, limit);
+
+	if(eol < 0)
+	{
+		if(rq->len < LINEBUF_SIZE)
+		{
+			rq->scanned = limit;
+			return -1;
+		}
+		len = LINEBUF_SIZE;
+	}
+	else
+	{
+		len = eol;
+
+		if(rq->head + len < rq->size)
+		{
+			*line = rq->buf + rq->head;
+			(*line)[len] = '\0';
+			recvq_consume(rq, len + 1);
+			return len;
+		}
+	}
+
+	first = rq->size - rq->head;
+	if(first > len)
+		first = len;
+	memcpy(wrapped, rq->buf + rq->head, first);
+	memcpy(wrapped + first, rq->buf, len - first);
+	wrapped[len] = '\0';
+
+	*line = wrapped;
+	recvq_consume(rq, len);
+	return len;
+}
+
+/*
+ * recvq_count_lines - how many lines are queued, counting a partial one,
+ * stopping once there are more than max
+ */
+static int
+recvq_count_lines(const struct recvq *rq, int max)
+{
+	unsigned int from = 0, limit;
+	int count = 0, eol;
+
+	while(count <= max)
+	{
+		while(from < rq->len && IsEOL(recvq_byte(rq, from)))
+			from++;
+
+		if(from >= rq->len)
+			break;
+
+		limit = rq->len - from < LINEBUF_SIZE ? rq->len : from + LINEBUF_SIZE;
+		eol = recvq_find_eol(rq, from, limit);
+		from = eol < 0 ? limit : (unsigned int)eol;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * recvq_append - queue data as if it had been read
+ */
+void
+recvq_append(struct recvq *rq, const char *data, size_t len)
+{
+	unsigned int size, tail, first;
+
+	for(size = rq->size > 0 ? rq->size : RECVQ_MIN; size - rq->len < len; size <<= 1)
+		;
+	if(size != rq->size || rq->buf == readBuf)
+		recvq_resize(rq, size);
+
+	tail = (rq->head + rq->len) & (rq->size - 1);
+	first = rq->size - tail;
+	if(first > len)
+		first = len;
+	memcpy(rq->buf + tail, data, first);
+	memcpy(rq->buf, data + first, len - first);
+	rq->len += len;
+}
+
+/*
+ * recvq_foreach - call func for each line queued, oldest first, and
+ * then for any partial line
+ */
+void
+recvq_foreach(struct recvq *rq, void (*func)(const char *data, int len, int terminated, void *arg), void *arg)
+{
+	char line[LINEBUF_SIZE + 1];
+	unsigned int from = 0, limit, len, i;
+	int eol;
+
+	for(;;)
+	{
+		while(from < rq->len && IsEOL(recvq_byte(rq, from)))
+			from++;
+
+		if(from >= rq->len)
+			break;
+
+		limit = rq->len - from < LINEBUF_SIZE ? rq->len : from + LINEBUF_SIZE;
+		eol = recvq_find_eol(rq, from, limit);
+		len = (eol < 0 ? limit : (unsigned int)eol) - from;
+
+		for(i = 0; i < len; i++)
+			line[i] = recvq_byte(rq, from + i);
+		line[len] = '\0';
+
+		func(line, len, eol >= 0 || len == LINEBUF_SIZE, arg);
+		from += len;
+	}
+}
+
+/*
+ * recvq_clear - discard everything queued.  the memory is kept until
+ * recvq_free(), as the line being parsed may be in it.
+ */
+void
+recvq_clear(struct recvq *rq)
+{
+	rq->head = 0;
+	rq->len = 0;
+	rq->scanned = 0;
+}
+
+void
+recvq_free(struct recvq *rq)
+{
+	if(rq->buf == readBuf)
+		readbuf_user = NULL;
+	else
+		rb_free(rq->buf);
+
+	rq->buf = NULL;
+	rq->size = 0;
+	recvq_clear(rq);
+}
+
 /*
  * parse_client_queued - parse client queued messages
  */
 static void
 parse_client_queued(struct Client *client_p)
 {
+	struct recvq *rq = &client_p->localClient->recvq;
+	char *line;
 	int dolen = 0;
 	int allow_read;
 
@@ -57,14 +364,12 @@ parse_client_queued(struct Client *client_p)
 			if(client_p->localClient->sent_parsed >= allow_read)
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->
-					    buf_recvq, readBuf, READBUF_SIZE,
-					    LINEBUF_COMPLETE, LINEBUF_PARSED);
+			dolen = recvq_get_line(rq, &line);
 
-			if(dolen <= 0 || IsDead(client_p))
+			if(dolen < 0 || IsDead(client_p))
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 			client_p->localClient->sent_parsed++;
 
 			/* He's dead cap'n */
@@ -92,12 +397,13 @@ parse_client_queued(struct Client *client_p)
 
 	if(IsAnyServer(client_p) || IsExemptFlood(client_p))
 	{
-		while (!IsAnyDead(client_p) && (dolen = rb_linebuf_get(&client_p->localClient->buf_recvq,
-					   readBuf, READBUF_SIZE, LINEBUF_COMPLETE,
-					   LINEBUF_PARSED)) > 0)
+		/* services may send many bans at once */
+		start_ban_batch();
+		while (!IsAnyDead(client_p) && (dolen = recvq_get_line(rq, &line)) >= 0)
 		{
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 		}
+		end_ban_batch();
 	}
 	else if(IsClient(client_p))
 	{
@@ -140,14 +446,12 @@ parse_client_queued(struct Client *client_p)
 			if (rb_current_time() < client_p->localClient->firsttime + ConfigFileEntry.post_registration_delay)
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->
-					    buf_recvq, readBuf, READBUF_SIZE,
-					    LINEBUF_COMPLETE, LINEBUF_PARSED);
+			dolen = recvq_get_line(rq, &line);
 
-			if(!dolen)
+			if(dolen < 0)
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 			if(IsAnyDead(client_p))
 				return;
 
@@ -209,6 +513,7 @@ flood_recalc(void *unused)
 			client_p->localClient->sent_parsed = 0;
 
 		parse_client_queued(client_p);
+		recvq_settle(&client_p->localClient->recvq);
 
 		if(rb_unlikely(IsAnyDead(client_p)))
 			continue;
@@ -228,6 +533,7 @@ flood_recalc(void *unused)
 			client_p->localClient->sent_parsed = 0;
 
 		parse_client_queued(client_p);
+		recvq_settle(&client_p->localClient->recvq);
 	}
 }
 
@@ -238,8 +544,10 @@ void
 read_packet(rb_fde_t * F, void *data)
 {
 	struct Client *client_p = data;
+	struct recvq *rq;
+	char *buf;
 	int length = 0;
-	int binary = 0;
+	int space;
 
 	while(1)
 	{
@@ -247,11 +555,22 @@ read_packet(rb_fde_t * F, void *data)
 			return;
 
 		/*
-		 * Read some data. We *used to* do anti-flood protection here, but
+		 * Read some data, straight into the connection's ring if it
+		 * has a partial line or lines held back for flood control.
+		 * We *used to* do anti-flood protection here, but
 		 * I personally think it makes the code too hairy to make sane.
 		 *     -- adrian
 		 */
-		length = rb_read(client_p->localClient->F, readBuf, READBUF_SIZE);
+		rq = &client_p->localClient->recvq;
+		if(rq->buf == NULL && readbuf_user == NULL)
+		{
+			buf = readBuf;
+			space = READBUF_SIZE;
+		}
+		else
+			buf = recvq_reserve(rq, &space);
+
+		length = rb_read(client_p->localClient->F, buf, space);
 
 		if(length < 0)
 		{
@@ -290,27 +609,28 @@ read_packet(rb_fde_t * F, void *data)
 
 
 		/*
-		 * Before we even think of parsing what we just read, stick
-		 * it on the end of the receive queue and do it when its
-		 * turn comes around.
+		 * What we just read is now on the end of the receive queue,
+		 * to be parsed when its turn comes around.
 		 */
-		if(IsHandshake(client_p) || IsUnknown(client_p))
-			binary = 1;
-
-		(void) rb_linebuf_parse(&client_p->localClient->buf_recvq, readBuf, length, binary);
-
-		if(IsAnyDead(client_p))
-			return;
+		if(buf == readBuf)
+		{
+			readbuf_user = rq;
+			rq->buf = readBuf;
+			rq->size = READBUF_SIZE;
+			rq->head = 0;
+		}
+		rq->len += length;
 
 		/* Attempt to parse what we have */
 		parse_client_queued(client_p);
+		recvq_settle(rq);
 
 		if(IsAnyDead(client_p))
 			return;
 
 		/* Check to make sure we're not flooding */
 		if(!IsAnyServer(client_p) &&
-		   (rb_linebuf_alloclen(&client_p->localClient->buf_recvq) + client_p->localClient->pending_batch_lines > ConfigFileEntry.client_flood_max_lines))
+		   (recvq_count_lines(rq, ConfigFileEntry.client_flood_max_lines) + client_p->localClient->pending_batch_lines > ConfigFileEntry.client_flood_max_lines))
 		{
 			if(!(ConfigFileEntry.no_oper_flood && IsOperGeneral(client_p)))
 			{
@@ -320,7 +640,7 @@ read_packet(rb_fde_t * F, void *data)
 		}
 
 		/* bail if short read, but not for SCTP as it returns data in packets */
-		if (length < READBUF_SIZE && !(rb_get_type(client_p->localClient->F) & RB_FD_SCTP)) {
+		if (length < space && !(rb_get_type(client_p->localClient->F) & RB_FD_SCTP)) {
 			rb_setselect(client_p->localClient->F, RB_SELECT_READ, read_packet, client_p);
 			return;
 		}
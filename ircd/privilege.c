@@ -45,9 +45,90 @@
 #include "s_assert.h"
 #include "logger.h"
 #include "send.h"
+#include "rb_dictionary.h"
 
 static rb_dlink_list privilegeset_list = {NULL, NULL, 0};
 
+static rb_dictionary *privilege_dict = NULL;
+static PrivilegeId privilege_next_id = PRIV_BUILTIN_COUNT;
+
+static const char *privilege_builtin[PRIV_BUILTIN_COUNT] = {
+	[PRIV_OPER_KILL] = "oper:kill",
+	[PRIV_OPER_ROUTING] = "oper:routing",
+	[PRIV_OPER_UNKLINE] = "oper:unkline",
+	[PRIV_SNOMASK_NICK_CHANGES] = "snomask:nick_changes",
+	[PRIV_OPER_KLINE] = "oper:kline",
+	[PRIV_OPER_XLINE] = "oper:xline",
+	[PRIV_OPER_RESV] = "oper:resv",
+	[PRIV_OPER_DIE] = "oper:die",
+	[PRIV_OPER_REHASH] = "oper:rehash",
+	[PRIV_OPER_HIDDEN_ADMIN] = "oper:hidden_admin",
+	[PRIV_OPER_ADMIN] = "oper:admin",
+	[PRIV_OPER_OPERWALL] = "oper:operwall",
+	[PRIV_OPER_SPY] = "oper:spy",
+	[PRIV_OPER_HIDDEN] = "oper:hidden",
+	[PRIV_OPER_REMOTEBAN] = "oper:remoteban",
+	[PRIV_OPER_MASS_NOTICE] = "oper:mass_notice",
+	[PRIV_OPER_GENERAL] = "oper:general",
+	[PRIV_AUSPEX_OPER] = "auspex:oper",
+};
+
+static int
+privilege_cmp(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+static void
+privilege_init(void)
+{
+	PrivilegeId id;
+
+	privilege_dict = rb_dictionary_create("privileges", privilege_cmp);
+
+	for (id = PRIV_NONE + 1; id < PRIV_BUILTIN_COUNT; id++)
+		rb_dictionary_add(privilege_dict, privilege_builtin[id], (void *)(uintptr_t)id);
+}
+
+/* privilege_intern()
+ *
+ * input	- privilege name
+ * output	- its id, allocating a new one if the name was never seen
+ * side effects - ids are never released; there are only ever as many
+ *                as there are distinct privilege names
+ */
+PrivilegeId
+privilege_intern(const char *priv)
+{
+	void *id;
+	char *name;
+
+	if (privilege_dict == NULL)
+		privilege_init();
+
+	if ((id = rb_dictionary_retrieve(privilege_dict, priv)) != NULL)
+		return (PrivilegeId)(uintptr_t)id;
+
+	name = rb_strdup(priv);
+	rb_dictionary_add(privilege_dict, name, (void *)(uintptr_t)privilege_next_id);
+	return privilege_next_id++;
+}
+
+/* privilege_find()
+ *
+ * input	- privilege name
+ * output	- its id, or PRIV_NONE if no privset has ever granted it
+ * side effects -
+ */
+PrivilegeId
+privilege_find(const char *priv)
+{
+	if (privilege_dict == NULL)
+		privilege_init();
+
+	return (PrivilegeId)(uintptr_t)rb_dictionary_retrieve(privilege_dict, priv);
+}
+
 static struct PrivilegeSet *
 privilegeset_get_any(const char *name)
 {
@@ -73,6 +154,30 @@ privilegeset_cmp_priv(const void *a_, const void *b_)
 	return strcmp(*a, *b);
 }
 
+static void
+privilegeset_compile(struct PrivilegeSet *set)
+{
+	const char *const *p;
+	PrivilegeId id;
+	size_t len;
+
+	if (set->bits != NULL)
+		memset(set->bits, 0, sizeof *set->bits * set->bits_len);
+
+	for (p = set->privs; p != NULL && *p != NULL; p++)
+	{
+		id = privilege_intern(*p);
+		if (id / 32 >= set->bits_len)
+		{
+			len = privilege_next_id / 32 + 1;
+			set->bits = rb_realloc(set->bits, sizeof *set->bits * len);
+			memset(set->bits + set->bits_len, 0, sizeof *set->bits * (len - set->bits_len));
+			set->bits_len = len;
+		}
+		set->bits[id / 32] |= 1u << (id % 32);
+	}
+}
+
 static void
 privilegeset_index(struct PrivilegeSet *set)
 {
@@ -89,6 +194,8 @@ privilegeset_index(struct PrivilegeSet *set)
 		*p++ = s;
 	qsort(set->privs, set->size, sizeof *set->privs, privilegeset_cmp_priv);
 	set->privs[set->size] = NULL;
+
+	privilegeset_compile(set);
 }
 
 void
@@ -177,6 +284,8 @@ privilegeset_new_orphan(const char *name)
 		.size = 0,
 		.privs = NULL,
 		.priv_storage = NULL,
+		.bits = NULL,
+		.bits_len = 0,
 		.shadow = NULL,
 		.status = 0,
 		.refs = 0,
@@ -195,6 +304,7 @@ privilegeset_free(struct PrivilegeSet *set)
 	rb_free(set->name);
 	rb_free(set->privs);
 	rb_free(set->priv_storage);
+	rb_free(set->bits);
 	rb_free(set);
 }
 
@@ -209,12 +319,16 @@ privilegeset_shade(struct PrivilegeSet *set)
 	set->shadow->priv_storage = set->priv_storage;
 	set->shadow->stored_size = set->stored_size;
 	set->shadow->allocated_size = set->allocated_size;
+	set->shadow->bits = set->bits;
+	set->shadow->bits_len = set->bits_len;
 
 	set->privs = NULL;
 	set->size = 0;
 	set->priv_storage = NULL;
 	set->stored_size = 0;
 	set->allocated_size = 0;
+	set->bits = NULL;
+	set->bits_len = 0;
 }
 
 static void
@@ -224,16 +338,21 @@ privilegeset_clear(struct PrivilegeSet *set)
 	set->privs = NULL;
 	set->size = 0;
 	set->stored_size = 0;
+	if (set->bits != NULL)
+		memset(set->bits, 0, sizeof *set->bits * set->bits_len);
 }
 
+/* looking the name up costs more than the bit test; callers checking
+ * the same privilege repeatedly should use privilege_find() once and
+ * privilegeset_has()
+ */
 bool
 privilegeset_in_set(const struct PrivilegeSet *set, const char *priv)
 {
 	s_assert(set != NULL);
 	s_assert(priv != NULL);
 
-	const char **found = bsearch(&priv, set->privs, set->size, sizeof *set->privs, privilegeset_cmp_priv);
-	return found != NULL;
+	return privilegeset_has(set, privilege_find(priv));
 }
 
 const char *const *
@@ -391,6 +510,9 @@ privilegeset_diff(const struct PrivilegeSet *old, const struct PrivilegeSet *new
 	set_unchanged->size = res_unchanged - set_unchanged->privs;
 	set_added->size = res_added - set_added->privs;
 	set_removed->size = res_removed - set_removed->privs;
+	privilegeset_compile(set_unchanged);
+	privilegeset_compile(set_added);
+	privilegeset_compile(set_removed);
 
 	return (struct privset_diff){
 		.unchanged = set_unchanged,
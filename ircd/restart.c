@@ -57,6 +57,7 @@ server_reboot(void)
 	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "Restarting server...");
 
 	ilog(L_MAIN, "Restarting server...");
+	close_logfiles();
 
 	/*
 	 * XXX we used to call flush_connections() here. But since this routine
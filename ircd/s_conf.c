@@ -777,6 +777,8 @@ set_default_conf(void)
 	ConfigFileEntry.use_propagated_bans = true;
 	ConfigFileEntry.max_ratelimit_tokens = 30;
 	ConfigFileEntry.away_interval = 30;
+	ConfigFileEntry.io_event_budget = 0;
+	ConfigFileEntry.log_flush_interval = 1;
 	ConfigFileEntry.tls_ciphers_oper_only = false;
 	ConfigFileEntry.oper_secure_only = false;
 
@@ -929,6 +931,14 @@ validate_conf(void)
 	   (ConfigFileEntry.client_flood_max_lines > CLIENT_FLOOD_MAX))
 		ConfigFileEntry.client_flood_max_lines = CLIENT_FLOOD_MAX;
 
+	if(ConfigFileEntry.io_event_budget < 0)
+		ConfigFileEntry.io_event_budget = 0;
+	rb_set_io_budget(ConfigFileEntry.io_event_budget);
+
+	if(ConfigFileEntry.log_flush_interval < 0)
+		ConfigFileEntry.log_flush_interval = 0;
+	set_log_flush_interval(ConfigFileEntry.log_flush_interval);
+
 	if(!split_users || !split_servers ||
 	   (!ConfigChannel.no_create_on_split && !ConfigChannel.no_join_on_split))
 	{
@@ -1142,9 +1152,11 @@ deactivate_conf(struct ConfItem *aconf, time_t now)
 			break;
 		case CONF_XLINE:
 			rb_dlinkFindDestroy(aconf, &xline_conf_list);
+			xline_conf_serial++;
 			break;
 		case CONF_RESV_NICK:
 			rb_dlinkFindDestroy(aconf, &resv_conf_list);
+			resv_conf_serial++;
 			break;
 		case CONF_RESV_CHANNEL:
 			del_from_resv_hash(aconf->host, aconf);
@@ -1458,6 +1470,9 @@ read_conf_files(bool cold)
 	read_conf();
 	call_hook(h_conf_read_end, NULL);
 
+	if(!cold)
+		close_inactive_listeners();
+
 	fclose(conf_fbfile_in);
 }
 
@@ -1523,8 +1538,8 @@ clear_out_old_conf(void)
 	AdminInfo.description = NULL;
 
 	/* operator{} and class{} blocks are freed above */
-	/* clean out listeners */
-	close_listeners();
+	/* listeners the new conf no longer has are closed once it is read */
+	mark_listeners_inactive();
 
 	/* auth{}, quarantine{}, shared{}, connect{}, kill{}, deny{}, exempt{}
 	 * and gecos{} blocks are freed above too
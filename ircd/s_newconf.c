@@ -57,6 +57,8 @@ rb_dlink_list oper_conf_list;
 rb_dlink_list server_conf_list;
 rb_dlink_list xline_conf_list;
 rb_dlink_list resv_conf_list;	/* nicks only! */
+unsigned long xline_conf_serial;	/* bumped on every change to the list */
+unsigned long resv_conf_serial;
 rb_dlink_list nd_list;		/* nick delay */
 rb_dlink_list tgchange_list;
 
@@ -64,6 +66,9 @@ rb_patricia_tree_t *tgchange_tree;
 
 static rb_bh *nd_heap = NULL;
 
+static struct mask_index *xline_index;
+static struct mask_index *resv_index;
+
 static void expire_temp_rxlines(void *unused);
 static void expire_nd_entries(void *unused);
 
@@ -127,6 +132,7 @@ clear_s_newconf_bans(void)
 
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
+		xline_conf_serial++;
 	}
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
@@ -139,6 +145,7 @@ clear_s_newconf_bans(void)
 
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
+		resv_conf_serial++;
 	}
 
 	clear_resv_hash();
@@ -543,21 +550,12 @@ struct ConfItem *
 find_xline(const char *gecos, int counter)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
-	{
-		aconf = ptr->data;
+	aconf = find_mask_conf(&xline_conf_list, &xline_index, xline_conf_serial, gecos);
+	if(aconf != NULL && counter)
+		aconf->port++;
 
-		if(match_esc(aconf->host, gecos))
-		{
-			if(counter)
-				aconf->port++;
-			return aconf;
-		}
-	}
-
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -581,20 +579,12 @@ struct ConfItem *
 find_nick_resv(const char *name)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
-
-	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
-	{
-		aconf = ptr->data;
 
-		if(match_esc(aconf->host, name))
-		{
-			aconf->port++;
-			return aconf;
-		}
-	}
+	aconf = find_mask_conf(&resv_conf_list, &resv_index, resv_conf_serial, name);
+	if(aconf != NULL)
+		aconf->port++;
 
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -785,6 +775,7 @@ expire_temp_rxlines(void *unused)
 						aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &resv_conf_list);
+			resv_conf_serial++;
 		}
 	}
 
@@ -802,6 +793,7 @@ expire_temp_rxlines(void *unused)
 						aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
+			xline_conf_serial++;
 		}
 	}
 }
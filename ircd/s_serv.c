@@ -563,181 +563,409 @@ burst_modes_TS6(struct Client *client_p, struct Channel *chptr,
 	send_multiline_fini(client_p, NULL);
 }
 
-/*
- * burst_TS6
+/* burst_client_TS6()
  *
- * inputs	- client (server) to send nick towards
- * 		- client to send nick for
- * output	- NONE
- * side effects	- NICK message is sent towards given client_p
+ * input	- server to burst to, client to introduce
+ * output	- true if the client was sent
+ * side effects - the client and its state are sent to the server
  */
-static void
-burst_TS6(struct Client *client_p)
+static bool
+burst_client_TS6(struct Client *client_p, struct Client *target_p)
 {
 	char ubuf[BUFSIZE];
-	struct Client *target_p;
-	struct Channel *chptr;
-	struct membership *msptr;
 	hook_data_client hclientinfo;
+
+	if(!IsPerson(target_p) || target_p->from == client_p)
+		return false;
+
+	if(MyClient(target_p->from) && target_p->localClient->att_sconf != NULL && ServerConfNoExport(target_p->localClient->att_sconf))
+		return false;
+
+	send_umode(NULL, target_p, 0, ubuf);
+	if(!*ubuf)
+	{
+		ubuf[0] = '+';
+		ubuf[1] = '\0';
+	}
+
+	if (IsServerCapable(client_p, CAP_EUID))
+		sendto_one(client_p, ":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
+			   target_p->servptr->id, target_p->name,
+			   target_p->hopcount + 1,
+			   (long) target_p->tsinfo, ubuf,
+			   target_p->username, target_p->host,
+			   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id,
+			   IsDynSpoof(target_p) ? target_p->orighost : "*",
+			   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
+			   target_p->info);
+	else
+		sendto_one(client_p, ":%s UID %s %d %ld %s %s %s %s %s :%s",
+			   target_p->servptr->id, target_p->name,
+			   target_p->hopcount + 1,
+			   (long) target_p->tsinfo, ubuf,
+			   target_p->username, target_p->host,
+			   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
+			   target_p->id, target_p->info);
+
+	if(!EmptyString(target_p->certfp))
+		sendto_one(client_p, ":%s ENCAP * CERTFP :%s",
+				use_id(target_p), target_p->certfp);
+
+	if (!IsServerCapable(client_p, CAP_EUID))
+	{
+		if(IsDynSpoof(target_p))
+			sendto_one(client_p, ":%s ENCAP * REALHOST %s",
+					use_id(target_p), target_p->orighost);
+		if(!EmptyString(target_p->user->suser))
+			sendto_one(client_p, ":%s ENCAP * LOGIN %s",
+					use_id(target_p), target_p->user->suser);
+	}
+
+	if(ConfigFileEntry.burst_away && !EmptyString(target_p->user->away))
+		sendto_one(client_p, ":%s AWAY :%s",
+			   use_id(target_p),
+			   target_p->user->away);
+
+	if (IsOper(target_p) && target_p->user && target_p->user->opername)
+	{
+		if (target_p->user->privset)
+			sendto_one(client_p, ":%s OPER %s %s",
+					use_id(target_p),
+					target_p->user->opername,
+					target_p->user->privset->name);
+		else
+			sendto_one(client_p, ":%s OPER %s",
+					use_id(target_p),
+					target_p->user->opername);
+	}
+
+	hclientinfo.client = client_p;
+	hclientinfo.target = target_p;
+	call_hook(h_burst_client, &hclientinfo);
+	return true;
+}
+
+/* burst_channel_TS6()
+ *
+ * input	- server to burst to, channel to send
+ * output	- true if the channel was sent
+ * side effects - the channel's members, lists and topic are sent
+ */
+static bool
+burst_channel_TS6(struct Client *client_p, struct Channel *chptr)
+{
+	struct membership *msptr;
 	hook_data_channel hchaninfo;
-	rb_dlink_node *ptr;
 	rb_dlink_node *uptr;
 	char *t;
 	int tlen, mlen;
 	int cur_len = 0;
 
-	hclientinfo.client = hchaninfo.client = client_p;
+	if(*chptr->chname != '#')
+		return false;
 
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	cur_len = mlen = sprintf(buf, ":%s SJOIN %ld %s %s :", me.id,
+			(long) chptr->channelts, chptr->chname,
+			channel_modes(chptr, client_p));
+
+	t = buf + mlen;
+
+	RB_DLINK_FOREACH(uptr, chptr->members.head)
 	{
-		target_p = ptr->data;
+		msptr = uptr->data;
 
-		if(!IsPerson(target_p))
+		/* it told us about these itself after the burst began */
+		if(msptr->client_p->from == client_p)
 			continue;
 
-		if(MyClient(target_p->from) && target_p->localClient->att_sconf != NULL && ServerConfNoExport(target_p->localClient->att_sconf))
-			continue;
+		tlen = strlen(use_id(msptr->client_p)) + 1;
+		if(is_chanop(msptr))
+			tlen++;
+		if(is_voiced(msptr))
+			tlen++;
 
-		send_umode(NULL, target_p, 0, ubuf);
-		if(!*ubuf)
+		if(cur_len + tlen >= BUFSIZE - 3)
 		{
-			ubuf[0] = '+';
-			ubuf[1] = '\0';
+			*(t-1) = '\0';
+			sendto_one(client_p, "%s", buf);
+			cur_len = mlen;
+			t = buf + mlen;
 		}
 
-		if (IsServerCapable(client_p, CAP_EUID))
-			sendto_one(client_p, ":%s EUID %s %d %ld %s %s %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf,
-				   target_p->username, target_p->host,
-				   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id,
-				   IsDynSpoof(target_p) ? target_p->orighost : "*",
-				   EmptyString(target_p->user->suser) ? "*" : target_p->user->suser,
-				   target_p->info);
-		else
-			sendto_one(client_p, ":%s UID %s %d %ld %s %s %s %s %s :%s",
-				   target_p->servptr->id, target_p->name,
-				   target_p->hopcount + 1,
-				   (long) target_p->tsinfo, ubuf,
-				   target_p->username, target_p->host,
-				   IsIPSpoof(target_p) ? "0" : target_p->sockhost,
-				   target_p->id, target_p->info);
+		sprintf(t, "%s%s ", find_channel_status(msptr, 1),
+			   use_id(msptr->client_p));
 
-		if(!EmptyString(target_p->certfp))
-			sendto_one(client_p, ":%s ENCAP * CERTFP :%s",
-					use_id(target_p), target_p->certfp);
+		cur_len += tlen;
+		t += tlen;
+	}
 
-		if (!IsServerCapable(client_p, CAP_EUID))
-		{
-			if(IsDynSpoof(target_p))
-				sendto_one(client_p, ":%s ENCAP * REALHOST %s",
-						use_id(target_p), target_p->orighost);
-			if(!EmptyString(target_p->user->suser))
-				sendto_one(client_p, ":%s ENCAP * LOGIN %s",
-						use_id(target_p), target_p->user->suser);
-		}
+	if (cur_len > mlen)
+	{
+		/* remove trailing space */
+		*(t-1) = '\0';
+	}
+	sendto_one(client_p, "%s", buf);
+
+	if(rb_dlink_list_length(&chptr->banlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->banlist, 'b');
+
+	if (IsServerCapable(client_p, CAP_EX) &&
+	   rb_dlink_list_length(&chptr->exceptlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->exceptlist, 'e');
+
+	if (IsServerCapable(client_p, CAP_IE) &&
+	   rb_dlink_list_length(&chptr->invexlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->invexlist, 'I');
+
+	if(rb_dlink_list_length(&chptr->quietlist) > 0)
+		burst_modes_TS6(client_p, chptr, &chptr->quietlist, 'q');
+
+	if (IsServerCapable(client_p, CAP_TB) && chptr->topic != NULL)
+		sendto_one(client_p, ":%s TB %s %ld %s%s:%s",
+			   me.id, chptr->chname, (long) chptr->topic_time,
+			   ConfigChannel.burst_topicwho ? chptr->topic_info : "",
+			   ConfigChannel.burst_topicwho ? " " : "",
+			   chptr->topic);
+
+	if (IsServerCapable(client_p, CAP_MLOCK))
+		sendto_one(client_p, ":%s MLOCK %ld %s :%s",
+			   me.id, (long) chptr->channelts, chptr->chname,
+			   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
+
+	hchaninfo.client = client_p;
+	hchaninfo.chptr = chptr;
+	call_hook(h_burst_channel, &hchaninfo);
+	return true;
+}
 
-		if(ConfigFileEntry.burst_away && !EmptyString(target_p->user->away))
-			sendto_one(client_p, ":%s AWAY :%s",
-				   use_id(target_p),
-				   target_p->user->away);
+/*
+ * The burst walks global_client_list up to the client that was newest
+ * when it began, then global_channel_list from the channel that was
+ * newest.  Clients are appended to their list as they are introduced and
+ * channels prepended as they are created, so anything newer reaches the
+ * server through the normal propagation that is held behind the burst,
+ * and nothing is introduced twice.
+ */
+static rb_dlink_list burst_list;
 
-		if (IsOper(target_p) && target_p->user && target_p->user->opername)
-		{
-			if (target_p->user->privset)
-				sendto_one(client_p, ":%s OPER %s %s",
-						use_id(target_p),
-						target_p->user->opername,
-						target_p->user->privset->name);
-			else
-				sendto_one(client_p, ":%s OPER %s",
-						use_id(target_p),
-						target_p->user->opername);
-		}
+/* at most this many lines are queued per pass, so a large burst does not
+ * hold up everything else */
+#define BURST_PASS_LINES	2000
 
-		hclientinfo.target = target_p;
-		call_hook(h_burst_client, &hclientinfo);
-	}
+static bool
+burst_sendq_exceeded(struct Client *client_p)
+{
+	return rb_linebuf_len(&client_p->localClient->buf_sendq) > (get_sendq(client_p) / 2);
+}
 
-	RB_DLINK_FOREACH(ptr, global_channel_list.head)
-	{
-		chptr = ptr->data;
+static void
+burst_write_ready(rb_fde_t *F, void *data)
+{
+	struct Client *client_p = data;
 
-		if(*chptr->chname != '#')
-			continue;
+	ClearFlush(client_p);
+	send_queued(client_p);
+	continue_burst(client_p);
+}
 
-		cur_len = mlen = sprintf(buf, ":%s SJOIN %ld %s %s :", me.id,
-				(long) chptr->channelts, chptr->chname,
-				channel_modes(chptr, client_p));
+static void
+finish_burst(struct Client *client_p)
+{
+	struct server_burst *burst = client_p->localClient->burst;
+	hook_data_client hclientinfo;
+	struct timeval now;
 
-		t = buf + mlen;
+	hclientinfo.client = client_p;
+	hclientinfo.target = NULL;
+	call_hook(h_burst_finished, &hclientinfo);
 
-		RB_DLINK_FOREACH(uptr, chptr->members.head)
-		{
-			msptr = uptr->data;
+	/* Always send a PING after connect burst is done */
+	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
 
-			tlen = strlen(use_id(msptr->client_p)) + 1;
-			if(is_chanop(msptr))
-				tlen++;
-			if(is_voiced(msptr))
-				tlen++;
+	burst->phase = BURST_DONE;
+	rb_dlinkDelete(&burst->node, &burst_list);
 
-			if(cur_len + tlen >= BUFSIZE - 3)
-			{
-				*(t-1) = '\0';
-				sendto_one(client_p, "%s", buf);
-				cur_len = mlen;
-				t = buf + mlen;
-			}
+	rb_linebuf_attach(&client_p->localClient->buf_sendq, &burst->held);
+	rb_linebuf_donebuf(&burst->held);
+
+	rb_gettimeofday(&now, NULL);
+	burst->duration = (now.tv_sec - burst->start.tv_sec) * 1000 +
+		(now.tv_usec - burst->start.tv_usec) / 1000;
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			"Burst to %s complete: %lu users, %lu channels in %ld.%03ld seconds (%u passes)",
+			client_p->name, burst->users, burst->channels,
+			burst->duration / 1000, burst->duration % 1000, burst->passes);
+}
+
+/* start_burst()
+ *
+ * input	- server that has just been established
+ * output	-
+ * side effects - the netburst to the server begins, and its first part
+ *		  is queued
+ */
+void
+start_burst(struct Client *client_p)
+{
+	struct server_burst *burst;
+
+	s_assert(client_p->localClient->burst == NULL);
+
+	burst = rb_malloc(sizeof(struct server_burst));
+	burst->client_p = client_p;
+	burst->phase = BURST_USERS;
+	burst->next = global_client_list.head;
+	burst->last = global_client_list.tail;
+	rb_linebuf_newbuf(&burst->held);
+	rb_gettimeofday(&burst->start, NULL);
+	burst->total_users = Count.total;
+	burst->total_channels = rb_dlink_list_length(&global_channel_list);
+
+	client_p->localClient->burst = burst;
+	rb_dlinkAdd(burst, &burst->node, &burst_list);
+
+	continue_burst(client_p);
+}
+
+/* continue_burst()
+ *
+ * input	- server being burst to
+ * output	-
+ * side effects - more of the burst is queued, as far as the sendq and the
+ *		  per pass limit allow.  if some remains, we come back when
+ *		  the link can be written to again.
+ */
+void
+continue_burst(struct Client *client_p)
+{
+	struct server_burst *burst = client_p->localClient->burst;
+	rb_dlink_node *ptr;
+	uint32_t lines;
+
+	if(burst == NULL || burst->phase == BURST_DONE || burst->sending || IsAnyDead(client_p))
+		return;
 
-			sprintf(t, "%s%s ", find_channel_status(msptr, 1),
-				   use_id(msptr->client_p));
+	burst->sending = true;
+	burst->passes++;
+	lines = client_p->localClient->sendM;
 
-			cur_len += tlen;
-			t += tlen;
+	while(burst->phase != BURST_DONE)
+	{
+		if(IsAnyDead(client_p) || burst_sendq_exceeded(client_p) ||
+				client_p->localClient->sendM - lines >= BURST_PASS_LINES)
+			break;
+
+		if((ptr = burst->next) == NULL)
+		{
+			if(burst->phase == BURST_USERS)
+			{
+				burst->phase = BURST_CHANNELS;
+				burst->next = global_channel_list.head;
+				burst->last = NULL;
+			}
+			else
+				finish_burst(client_p);
+			continue;
 		}
 
-		if (rb_dlink_list_length(&chptr->members) > 0)
+		if(burst->phase == BURST_USERS)
 		{
-			/* remove trailing space */
-			*(t-1) = '\0';
+			burst->next = ptr == burst->last ? NULL : ptr->next;
+			if(burst_client_TS6(client_p, ptr->data))
+				burst->users++;
 		}
-		sendto_one(client_p, "%s", buf);
+		else
+		{
+			burst->next = ptr->next;
+			if(burst_channel_TS6(client_p, ptr->data))
+				burst->channels++;
+		}
+	}
 
-		if(rb_dlink_list_length(&chptr->banlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->banlist, 'b');
+	burst->sending = false;
 
-		if (IsServerCapable(client_p, CAP_EX) &&
-		   rb_dlink_list_length(&chptr->exceptlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->exceptlist, 'e');
+	if(burst->phase == BURST_DONE)
+		send_queued(client_p);
+	else if(!IsFlush(client_p) && !IsAnyDead(client_p) && client_p->localClient->F != NULL)
+	{
+		SetFlush(client_p);
+		rb_setselect(client_p->localClient->F, RB_SELECT_WRITE,
+				burst_write_ready, client_p);
+	}
+}
 
-		if (IsServerCapable(client_p, CAP_IE) &&
-		   rb_dlink_list_length(&chptr->invexlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->invexlist, 'I');
+/* free_server_burst()
+ *
+ * input	- server that is going away
+ * output	-
+ * side effects - any burst in progress is abandoned along with what was
+ *		  held behind it
+ */
+void
+free_server_burst(struct Client *client_p)
+{
+	struct server_burst *burst = client_p->localClient->burst;
+
+	if(burst == NULL)
+		return;
+
+	if(burst->phase != BURST_DONE)
+	{
+		rb_dlinkDelete(&burst->node, &burst_list);
+		rb_linebuf_donebuf(&burst->held);
+	}
+
+	rb_free(burst);
+	client_p->localClient->burst = NULL;
+}
 
-		if(rb_dlink_list_length(&chptr->quietlist) > 0)
-			burst_modes_TS6(client_p, chptr, &chptr->quietlist, 'q');
+/* burst_forget_client()
+ *
+ * input	- client about to leave (or move within) global_client_list
+ * output	-
+ * side effects - bursts in progress no longer point at it
+ */
+void
+burst_forget_client(struct Client *target_p)
+{
+	struct server_burst *burst;
+	rb_dlink_node *ptr;
 
-		if (IsServerCapable(client_p, CAP_TB) && chptr->topic != NULL)
-			sendto_one(client_p, ":%s TB %s %ld %s%s:%s",
-				   me.id, chptr->chname, (long) chptr->topic_time,
-				   ConfigChannel.burst_topicwho ? chptr->topic_info : "",
-				   ConfigChannel.burst_topicwho ? " " : "",
-				   chptr->topic);
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		burst = ptr->data;
 
-		if (IsServerCapable(client_p, CAP_MLOCK))
-			sendto_one(client_p, ":%s MLOCK %ld %s :%s",
-				   me.id, (long) chptr->channelts, chptr->chname,
-				   EmptyString(chptr->mode_lock) ? "" : chptr->mode_lock);
+		if(burst->phase != BURST_USERS)
+			continue;
 
-		hchaninfo.chptr = chptr;
-		call_hook(h_burst_channel, &hchaninfo);
+		if(burst->next == &target_p->node)
+			burst->next = burst->last == &target_p->node ? NULL : target_p->node.next;
+		if(burst->last == &target_p->node)
+			burst->last = target_p->node.prev;
 	}
+}
 
-	hclientinfo.target = NULL;
-	call_hook(h_burst_finished, &hclientinfo);
+/* burst_forget_channel()
+ *
+ * input	- channel about to leave global_channel_list
+ * output	-
+ * side effects - bursts in progress no longer point at it
+ */
+void
+burst_forget_channel(struct Channel *chptr)
+{
+	struct server_burst *burst;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, burst_list.head)
+	{
+		burst = ptr->data;
+
+		if(burst->phase == BURST_CHANNELS && burst->next == &chptr->node)
+			burst->next = chptr->node.next;
+	}
 }
 
 /*
@@ -973,10 +1201,10 @@ server_estab(struct Client *client_p)
 	if (IsServerCapable(client_p, CAP_BAN))
 		burst_ban(client_p);
 
-	burst_TS6(client_p);
-
-	/* Always send a PING after connect burst is done */
-	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
+	/* the rest of the burst, and a PING once it is done, follow
+	 * as the link drains
+	 */
+	start_burst(client_p);
 
 	free_pre_client(client_p);
 
@@ -669,6 +669,8 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 			source_p->info);
 
 	add_to_hostname_hash(source_p->orighost, source_p);
+	add_to_who_index(source_p);
+	add_to_ban_check_index(source_p);
 
 	/* Allocate a UID if it was not previously allocated.
 	 * If this already occured, it was probably during SASL auth...
@@ -689,6 +691,16 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 	rb_dlinkMoveNode(&source_p->localClient->tnode, &unknown_list, &lclient_list);
 	SetClient(source_p);
 
+	/* global_client_list is kept in the order clients were introduced,
+	 * which server bursts rely on
+	 */
+	if(source_p->node.next != NULL)
+	{
+		burst_forget_client(source_p);
+		rb_dlinkDelete(&source_p->node, &global_client_list);
+		rb_dlinkAddTail(source_p, &source_p->node, &global_client_list);
+	}
+
 	source_p->servptr = &me;
 	rb_dlinkAdd(source_p, &source_p->lnode, &source_p->servptr->serv->users);
 
@@ -1702,6 +1714,8 @@ change_nick_user_host(struct Client *target_p,	const char *nick, const char *use
 	del_from_client_hash(target_p->name, target_p);
 	rb_strlcpy(target_p->name, nick, NICKLEN);
 	add_to_client_hash(target_p->name, target_p);
+	update_who_index(target_p);
+	update_ban_check_index(target_p);
 
 	if(changed)
 	{
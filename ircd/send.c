@@ -57,6 +57,9 @@ struct Client *remote_rehash_oper_p;
 static int
 send_linebuf(struct Client *to, buf_head_t *linebuf)
 {
+	buf_head_t *queue;
+	unsigned int len;
+
 	if(IsMe(to))
 	{
 		sendto_realops_snomask(SNO_GENERAL, L_ALL, "Trying to send message to myself!");
@@ -66,7 +69,18 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 	if(!MyConnect(to) || IsIOError(to))
 		return 0;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > get_sendq(to))
+	queue = &to->localClient->buf_sendq;
+	len = rb_linebuf_len(queue);
+
+	/* while a netburst is being sent, everything else waits behind it */
+	if(IsBursting(to))
+	{
+		len += rb_linebuf_len(&to->localClient->burst->held);
+		if(!to->localClient->burst->sending)
+			queue = &to->localClient->burst->held;
+	}
+
+	if(len > get_sendq(to))
 	{
 		dead_link(to, 1);
 
@@ -74,14 +88,10 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 		{
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
 					     "Max SendQ limit exceeded for %s: %u > %lu",
-					     to->name,
-					     rb_linebuf_len(&to->localClient->buf_sendq),
-					     get_sendq(to));
+					     to->name, len, get_sendq(to));
 
 			ilog(L_SERVER, "Max SendQ limit exceeded for %s: %u > %lu",
-			     log_client_name(to, SHOW_IP),
-			     rb_linebuf_len(&to->localClient->buf_sendq),
-			     get_sendq(to));
+			     log_client_name(to, SHOW_IP), len, get_sendq(to));
 		}
 
 		return -1;
@@ -91,7 +101,7 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 		/* just attach the linebuf to the sendq instead of
 		 * generating a new one
 		 */
-		rb_linebuf_attach(&to->localClient->buf_sendq, linebuf);
+		rb_linebuf_attach(queue, linebuf);
 	}
 
 	/*
@@ -101,7 +111,7 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 	 */
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+	if(queue == &to->localClient->buf_sendq && rb_linebuf_len(queue) > 0)
 		send_queued(to);
 	return 0;
 }
@@ -212,6 +222,10 @@ send_queued_write(rb_fde_t *F, void *data)
 	struct Client *to = data;
 	ClearFlush(to);
 	send_queued(to);
+
+	/* the link has drained, so a netburst can go on */
+	if(IsBursting(to))
+		continue_burst(to);
 }
 
 /*
@@ -605,6 +619,7 @@ sendto_channel_flags_internal(struct Client *one, int type, struct Client *sourc
 	rb_dlink_node *next_ptr;
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
+	PrivilegeId priv_id = priv != NULL ? privilege_find(priv) : PRIV_NONE;
 
 	current_serial++;
 
@@ -624,7 +639,7 @@ sendto_channel_flags_internal(struct Client *one, int type, struct Client *sourc
 				&& !IsDeaf(source_p)
 				&& IsClientCapable(source_p, cli_cap)
 				&& NotClientCapable(source_p, cli_negcap)
-				&& (priv == NULL || HasPrivilege(source_p, priv));
+				&& (priv == NULL || HasPrivilegeId(source_p, priv_id));
 		}
 	}
 
@@ -666,7 +681,7 @@ sendto_channel_flags_internal(struct Client *one, int type, struct Client *sourc
 				target_p->from->serial = current_serial;
 			}
 		}
-		else if (IsClientCapable(target_p, cli_cap) && NotClientCapable(target_p, cli_negcap) && (priv == NULL || HasPrivilege(target_p, priv)))
+		else if (IsClientCapable(target_p, cli_cap) && NotClientCapable(target_p, cli_negcap) && (priv == NULL || HasPrivilegeId(target_p, priv_id)))
 		{
 			send_linebuf(target_p, msgbuf_cache_get(&msgbuf_cache, CLIENT_CAP_MASK(target_p), false));
 		}
@@ -880,6 +895,7 @@ sendto_channel_local_internal(struct Client *one, int type, struct Client *sourc
 	struct MsgBuf msgbuf;
 	struct MsgBuf_cache msgbuf_cache;
 	rb_strf_t strings = { .format = pattern, .format_args = args, .next = NULL };
+	PrivilegeId priv_id = priv != NULL ? privilege_find(priv) : PRIV_NONE;
 
 	rb_fsnprint(buf, sizeof(buf), &strings);
 
@@ -894,7 +910,7 @@ sendto_channel_local_internal(struct Client *one, int type, struct Client *sourc
 			&& (!type || (msptr->flags & type) != 0)
 			&& IsClientCapable(source_p, caps)
 			&& NotClientCapable(source_p, negcaps)
-			&& (priv == NULL || HasPrivilege(source_p, priv));
+			&& (priv == NULL || HasPrivilegeId(source_p, priv_id));
 	}
 
 	build_msgbuf(&msgbuf, source_p, NULL, chptr, receives_message, buf, n_tags, tags);
@@ -919,7 +935,7 @@ sendto_channel_local_internal(struct Client *one, int type, struct Client *sourc
 		if (!IsClientCapable(target_p, caps) || !NotClientCapable(target_p, negcaps))
 			continue;
 
-		if (priv != NULL && !HasPrivilege(target_p, priv))
+		if (priv != NULL && !HasPrivilegeId(target_p, priv_id))
 			continue;
 
 		send_linebuf(target_p, msgbuf_cache_get(&msgbuf_cache, CLIENT_CAP_MASK(target_p), false));
@@ -34,6 +34,7 @@
 #include "send.h"
 #include "packet.h"
 #include "certfp.h"
+#include "authproc.h"
 
 static void ssl_read_ctl(rb_fde_t * F, void *data);
 static int ssld_count;
@@ -65,15 +66,28 @@ struct _ssl_ctl
 	uint8_t shutdown;
 	uint8_t dead;
 	char version[256];
+	struct ssld_handshakes hs;
+	time_t hs_time;
 };
 
 static void ssld_update_config_one(ssl_ctl_t *ctl);
 static void send_new_ssl_certs_one(ssl_ctl_t * ctl);
 static void send_certfp_method(ssl_ctl_t *ctl);
+static void send_del_listeners(ssl_ctl_t *ctl);
+static void ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, size_t buflen);
 
 
 static rb_dlink_list ssl_daemons;
 
+/* every ssld gets the same session ticket key, so a client can resume
+ * its session whichever one it ends up on
+ */
+static uint8_t ssl_ticket_key[RB_SSL_TICKET_KEY_LEN];
+static bool ssl_ticket_key_set;
+
+#define SSLD_TICKET_KEY_LIFETIME	43200
+#define SSLD_STATS_INTERVAL		60
+
 static inline uint32_t
 buf_to_uint32(char *buf)
 {
@@ -166,6 +180,8 @@ restart_ssld(void)
 			rb_kill(ctl->pid, SIGKILL);
 			free_ssl_daemon(ctl);
 		}
+		else
+			send_del_listeners(ctl);
 	}
 
 	ssld_spin_count = 0;
@@ -439,28 +455,12 @@ ssl_process_cipher_string(ssl_ctl_t *ctl, ssl_ctl_buf_t *ctl_buf)
 
 
 static void
-ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+ssl_set_certfp(struct Client *client_p, uint32_t certfp_method, uint32_t len, const uint8_t *certfp)
 {
-	struct Client *client_p;
-	uint32_t fd;
-	uint32_t certfp_method;
-	uint32_t len;
-	uint8_t *certfp;
 	char *certfp_string;
 	const char *method_string;
 	int method_len;
 
-	if(ctl_buf->buflen > 13 + RB_SSL_CERTFP_LEN)
-		return;		/* bogus message..drop it.. XXX should warn here */
-
-	fd = buf_to_uint32(&ctl_buf->buf[1]);
-	certfp_method = buf_to_uint32(&ctl_buf->buf[5]);
-	len = buf_to_uint32(&ctl_buf->buf[9]);
-	certfp = (uint8_t *)&ctl_buf->buf[13];
-	client_p = find_cli_connid_hash(fd);
-	if(client_p == NULL)
-		return;
-
 	switch (certfp_method) {
 	case RB_SSL_CERTFP_METH_CERT_SHA1:
 		method_string = CERTFP_PREFIX_CERT_SHA1;
@@ -491,6 +491,116 @@ ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 	client_p->certfp = certfp_string;
 }
 
+static void
+ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	struct Client *client_p;
+	uint32_t fd;
+	uint32_t certfp_method;
+	uint32_t len;
+
+	if(ctl_buf->buflen > 13 + RB_SSL_CERTFP_LEN)
+		return;		/* bogus message..drop it.. XXX should warn here */
+
+	fd = buf_to_uint32(&ctl_buf->buf[1]);
+	certfp_method = buf_to_uint32(&ctl_buf->buf[5]);
+	len = buf_to_uint32(&ctl_buf->buf[9]);
+	client_p = find_cli_connid_hash(fd);
+	if(client_p == NULL)
+		return;
+
+	ssl_set_certfp(client_p, certfp_method, len, (uint8_t *)&ctl_buf->buf[13]);
+}
+
+/* the fixed part of an accepted connection message: command, listener,
+ * token, both addresses, certfp method and length
+ */
+#define SSL_ACCEPTED_LEN	(9 + 2 * sizeof(struct rb_sockaddr_storage) + 8)
+
+/*
+ * ssl_process_accepted - ssld has accepted a connection on one of our
+ * listeners and completed the TLS handshake; take the plaintext side
+ * and tell ssld the connid it goes by from now on
+ */
+static void
+ssl_process_accepted(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	struct rb_sockaddr_storage addr, lip;
+	struct Client *client_p;
+	rb_fde_t *F;
+	uint32_t listener_id, token, certfp_method, certfp_len;
+	const char *cipher;
+	char buf[9];
+
+	F = ctl_buf->F[0];
+	ctl_buf->F[0] = NULL;
+
+	if(F == NULL || ctl_buf->buflen <= SSL_ACCEPTED_LEN || ctl_buf->buf[ctl_buf->buflen - 1] != '\0')
+	{
+		rb_close(F);
+		return;
+	}
+
+	certfp_len = buf_to_uint32(&ctl_buf->buf[SSL_ACCEPTED_LEN - 4]);
+	if(certfp_len > RB_SSL_CERTFP_LEN || SSL_ACCEPTED_LEN + certfp_len >= ctl_buf->buflen)
+	{
+		rb_close(F);
+		return;
+	}
+
+	listener_id = buf_to_uint32(&ctl_buf->buf[1]);
+	token = buf_to_uint32(&ctl_buf->buf[5]);
+	memcpy(&addr, &ctl_buf->buf[9], sizeof(addr));
+	memcpy(&lip, &ctl_buf->buf[9 + sizeof(addr)], sizeof(lip));
+	certfp_method = buf_to_uint32(&ctl_buf->buf[SSL_ACCEPTED_LEN - 8]);
+	cipher = &ctl_buf->buf[SSL_ACCEPTED_LEN + certfp_len];
+
+	rb_set_type(F, RB_FD_SOCKET);
+
+	client_p = add_ssld_connection(listener_id, F, (struct sockaddr *)&addr, (struct sockaddr *)&lip);
+	if(client_p == NULL || IsAnyDead(client_p))
+		return;
+
+	client_p->localClient->ssl_ctl = ctl;
+	ctl->cli_count++;
+
+	buf[0] = 'B';
+	uint32_to_buf(&buf[1], token);
+	uint32_to_buf(&buf[5], connid_get(client_p));
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+
+	if(!EmptyString(cipher))
+		client_p->localClient->cipher_string = rb_strdup(cipher);
+	if(certfp_len > 0)
+		ssl_set_certfp(client_p, certfp_method, certfp_len, (uint8_t *)&ctl_buf->buf[SSL_ACCEPTED_LEN]);
+
+	authd_initiate_client(client_p, false);
+}
+
+static void
+ssl_process_handshakes(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	struct ssld_handshakes hs;
+	time_t elapsed;
+
+	if(ctl_buf->buflen < 2 || ctl_buf->buf[ctl_buf->buflen - 1] != '\0')
+		return;
+
+	memset(&hs, 0, sizeof(hs));
+	if(sscanf(&ctl_buf->buf[1], " %llu %llu %llu", &hs.full, &hs.resumed, &hs.failed) != 3)
+		return;
+
+	elapsed = rb_current_time() - ctl->hs_time;
+	if(ctl->hs_time != 0 && elapsed > 0 && hs.full >= ctl->hs.full && hs.resumed >= ctl->hs.resumed)
+	{
+		hs.full_rate = (hs.full - ctl->hs.full) * 60 / elapsed;
+		hs.resumed_rate = (hs.resumed - ctl->hs.resumed) * 60 / elapsed;
+	}
+
+	ctl->hs = hs;
+	ctl->hs_time = rb_current_time();
+}
+
 static void
 ssl_process_cmd_recv(ssl_ctl_t * ctl)
 {
@@ -511,6 +621,9 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 		case 'N':
 			ircd_ssl_ok = false;	/* ssld says it can't do ssl/tls */
 			break;
+		case 'a':
+			ssl_process_accepted(ctl, ctl_buf);
+			break;
 		case 'O':
 			ssl_process_open_fd(ctl, ctl_buf);
 			break;
@@ -535,6 +648,9 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "%s", no_ssl_or_zlib);
 			ssl_killall();
 			return;
+		case 'H':
+			ssl_process_handshakes(ctl, ctl_buf);
+			break;
 		case 'V':
 			len = ctl_buf->buflen - 1;
 			if (len > sizeof(ctl->version) - 1)
@@ -548,6 +664,9 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "Received invalid command from ssld");
 			break;
 		}
+		/* nothing else comes with descriptors */
+		for(int x = 0; x < ctl_buf->nfds; x++)
+			rb_close(ctl_buf->F[x]);
 		rb_dlinkDelete(ptr, &ctl->readq);
 		rb_free(ctl_buf->buf);
 		rb_free(ctl_buf);
@@ -569,7 +688,7 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 	{
 		ctl_buf = rb_malloc(sizeof(ssl_ctl_buf_t));
 		ctl_buf->buf = rb_malloc(READSIZE);
-		retlen = rb_recv_fd_buf(ctl->F, ctl_buf->buf, READSIZE, ctl_buf->F, 4);
+		retlen = rb_recv_fd_buf(ctl->F, ctl_buf->buf, READSIZE, ctl_buf->F, MAXPASSFD);
 		ctl_buf->buflen = retlen;
 		if(retlen <= 0)
 		{
@@ -577,7 +696,11 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 			rb_free(ctl_buf);
 		}
 		else
+		{
+			while(ctl_buf->nfds < MAXPASSFD && ctl_buf->F[ctl_buf->nfds] != NULL)
+				ctl_buf->nfds++;
 			rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
+		}
 	}
 	while(retlen > 0);
 
@@ -726,11 +849,110 @@ send_certfp_method(ssl_ctl_t *ctl)
 	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
 }
 
+static void
+send_ticket_key(ssl_ctl_t *ctl)
+{
+	char buf[RB_SSL_TICKET_KEY_LEN + 1];
+
+	if(!ssl_ticket_key_set)
+	{
+		if(!rb_get_random(ssl_ticket_key, sizeof(ssl_ticket_key)))
+			return;
+		ssl_ticket_key_set = true;
+	}
+
+	buf[0] = 'T';
+	memcpy(&buf[1], ssl_ticket_key, sizeof(ssl_ticket_key));
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+static void
+send_add_listener(ssl_ctl_t *ctl, struct Listener *listener)
+{
+	rb_fde_t *F;
+	char buf[5];
+	int fd;
+
+	if(ctl->dead || ctl->shutdown)
+		return;
+
+	/* the copy we send is closed once it has gone */
+	fd = dup(rb_get_fd(listener->F));
+	if(fd < 0)
+		return;
+
+	F = rb_open(fd, RB_FD_SOCKET, "ssld listener");
+	if(F == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	buf[0] = 'L';
+	uint32_to_buf(&buf[1], listener->id);
+	ssl_cmd_write_queue(ctl, &F, 1, buf, sizeof(buf));
+}
+
+static void
+send_del_listener(ssl_ctl_t *ctl, struct Listener *listener)
+{
+	char buf[5];
+
+	buf[0] = 'l';
+	uint32_to_buf(&buf[1], listener->id);
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+static void
+send_listener_cb(void *data, struct Listener *listener)
+{
+	if(listener->ssl)
+		send_add_listener(data, listener);
+}
+
+static void
+send_del_listener_cb(void *data, struct Listener *listener)
+{
+	if(listener->ssl)
+		send_del_listener(data, listener);
+}
+
+/* an ssld that is going away stops taking new connections */
+static void
+send_del_listeners(ssl_ctl_t *ctl)
+{
+	listener_foreach(send_del_listener_cb, ctl);
+}
+
 static void
 ssld_update_config_one(ssl_ctl_t *ctl)
 {
 	send_certfp_method(ctl);
 	send_new_ssl_certs_one(ctl);
+	send_ticket_key(ctl);
+	listener_foreach(send_listener_cb, ctl);
+}
+
+/*
+ * ssld_add_listener - have every ssld accept connections on a TLS
+ * listener.  they all share the one socket
+ */
+void
+ssld_add_listener(struct Listener *listener)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+		send_add_listener(ptr->data, listener);
+}
+
+void
+ssld_del_listener(struct Listener *listener)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+		send_del_listener(ptr->data, listener);
 }
 
 void
@@ -806,6 +1028,36 @@ ssld_decrement_clicount(ssl_ctl_t * ctl)
 	}
 }
 
+/* replace the ticket key now and then; tickets made with the old one
+ * just mean a full handshake next time
+ */
+static void
+rotate_ticket_key(void *unused)
+{
+	ssl_ticket_key_set = false;
+	ssld_update_config();
+}
+
+static void
+request_ssld_stats(void *unused)
+{
+	rb_dlink_node *ptr;
+	char buf[5];
+
+	buf[0] = 'S';
+	uint32_to_buf(&buf[1], 0);
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+
+		if(ctl->dead || ctl->shutdown)
+			continue;
+
+		ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+	}
+}
+
 static void
 cleanup_dead_ssl(void *unused)
 {
@@ -828,7 +1080,7 @@ get_ssld_count(void)
 }
 
 void
-ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version), void *data)
+ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version, const struct ssld_handshakes *hs), void *data)
 {
 	rb_dlink_node *ptr, *next;
 	ssl_ctl_t *ctl;
@@ -838,12 +1090,90 @@ ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_s
 		func(data, ctl->pid, ctl->cli_count,
 			ctl->dead ? SSLD_DEAD :
 				(ctl->shutdown ? SSLD_SHUTDOWN : SSLD_ACTIVE),
-			ctl->version);
+			ctl->version, &ctl->hs);
 	}
 }
 
+/* hand the helpers over to a new ircd binary, see upgrade.c.  whatever is
+ * still queued for them is sent now, as the new process won't have it
+ */
+void
+ssld_prepare_upgrade(void)
+{
+	rb_dlink_node *ptr;
+	ssl_ctl_t *ctl;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+
+		ssl_write_ctl(ctl->F, ctl);
+		rb_clear_cloexec(ctl->F);
+		rb_clear_cloexec(ctl->P);
+	}
+}
+
+void
+ssld_foreach_upgrade(void (*func)(void *data, ssl_ctl_t *ctl, int ctl_fd, int pipe_fd, pid_t pid, bool shutdown, const char *version), void *data)
+{
+	rb_dlink_node *ptr;
+	ssl_ctl_t *ctl;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+
+		func(data, ctl, rb_get_fd(ctl->F), rb_get_fd(ctl->P), ctl->pid, ctl->shutdown, ctl->version);
+	}
+}
+
+/* take over a helper started by the ircd binary we were exec'd from */
+ssl_ctl_t *
+ssld_adopt(int ctl_fd, int pipe_fd, pid_t pid, bool shutdown, const char *version)
+{
+	rb_fde_t *F, *P;
+	ssl_ctl_t *ctl;
+
+	F = rb_open(ctl_fd, RB_FD_SOCKET, "SSL/TLS handle passing socket");
+	P = rb_open(pipe_fd, RB_FD_PIPE, "SSL/TLS pipe");
+	if(F == NULL || P == NULL)
+	{
+		rb_close(F);
+		rb_close(P);
+		return NULL;
+	}
+
+	rb_set_cloexec(F);
+	rb_set_cloexec(P);
+
+	ctl = allocate_ssl_daemon(F, P, pid);
+	rb_strlcpy(ctl->version, version, sizeof(ctl->version));
+	if(shutdown)
+	{
+		ctl->shutdown = 1;
+		ssld_count--;
+	}
+
+	ssl_read_ctl(ctl->F, ctl);
+	ssl_do_pipe(P, ctl);
+	return ctl;
+}
+
+void
+ssld_increment_clicount(ssl_ctl_t *ctl)
+{
+	if(ctl != NULL)
+		ctl->cli_count++;
+}
+
 void
 init_ssld(void)
 {
 	rb_event_addish("cleanup_dead_ssld", cleanup_dead_ssl, NULL, 60);
+	rb_event_addish("rotate_ssld_ticket_key", rotate_ticket_key, NULL, SSLD_TICKET_KEY_LIFETIME);
+	rb_event_addish("request_ssld_stats", request_ssld_stats, NULL, SSLD_STATS_INTERVAL);
 }
@@ -0,0 +1,1166 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  upgrade.c: Restart into a new binary without dropping clients.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * An upgrade writes the local clients and channels to a temporary file,
+ * clears close-on-exec on that file, the listeners, the client sockets
+ * and the ssld control sockets, and execs the ircd binary again.  The new
+ * process finds the file through UPGRADE_ENV, takes over the listeners
+ * and ssld helpers before reading the conf, and everything else once the
+ * conf and modules are loaded.  TLS sessions carry on because ssld keeps
+ * running and only the plaintext side of its socket pairs is handed over.
+ *
+ * Server links are not carried over: they are squit before the state is
+ * written and relink to the new process.  Unregistered connections are
+ * dropped and asked to reconnect.
+ *
+ * The state file is text, one record per line, a type letter followed by
+ * space separated fields, the last of which runs to the end of the line:
+ *
+ *   SOLANUM-UPGRADE <version>
+ *   L <idx> <id> <fd> <fdtype> <ssl> <sctp> <defer> <addr|*> <port> <addr|*> <port>
+ *   S <idx> <ctlfd> <pipefd> <pid> <shutdown> <version>
+ *   -
+ *   C <fd> <fdtype> <listener|-1> <ssld|-1> <connid> <uid> <nick> <user>
+ *     <host> <orighost> <sockhost> <ip> <port> <ts> <firsttime> <lasttime>
+ *     <flags> <localflags> <umodes> <snomask> <realname>
+ *     followed by any of A (away), U (services account), O (oper),
+ *     F (certfp), Z (cipher), G (mangled host), N (auth user), P (caps),
+ *     M (monitored nick), Q/q (received line, complete/partial) and
+ *     W (queued line to send)
+ *   K <uid> <uid>
+ *   H <channel> <ts> <modes> <limit> <join_num> <join_time>
+ *     followed by any of Y (key), R (forward), T (topic), X (mode lock),
+ *     B (ban list entry) and J (member)
+ *   E
+ */
+
+#include "stdinc.h"
+#include "upgrade.h"
+#include "capability.h"
+#include "channel.h"
+#include "chmode.h"
+#include "client.h"
+#include "defaults.h"
+#include "hash.h"
+#include "hostmask.h"
+#include "ircd.h"
+#include "listener.h"
+#include "logger.h"
+#include "match.h"
+#include "monitor.h"
+#include "packet.h"
+#include "msg.h"
+#include "privilege.h"
+#include "s_conf.h"
+#include "s_newconf.h"
+#include "s_serv.h"
+#include "s_user.h"
+#include "send.h"
+#include "snomask.h"
+#include "sslproc.h"
+#include "s_assert.h"
+
+extern char * const *myargv;
+
+/* client flags that mean the same thing in the new process */
+#define UPGRADE_FLAGS	(FLAGS_PINGSENT | FLAGS_SENTUSER | FLAGS_PING_COOKIE | \
+			 FLAGS_GOTID | FLAGS_FLOODDONE | FLAGS_SERVICE | \
+			 FLAGS_TGCHANGE | FLAGS_DYNSPOOF | FLAGS_TGEXCESSIVE | \
+			 FLAGS_CLICAP_DATA | FLAGS_EXTENDCHANS | FLAGS_EXEMPTRESV | \
+			 FLAGS_EXEMPTKLINE | FLAGS_EXEMPTFLOOD | FLAGS_IP_SPOOFING | \
+			 FLAGS_EXEMPTSPAMBOT | FLAGS_EXEMPTSHIDE | FLAGS_EXEMPTJUPE | \
+			 FLAGS_IDENTIFIED)
+#define UPGRADE_LFLAGS	(LFLAGS_SSL | LFLAGS_SCTP | LFLAGS_SECURE)
+
+#define UPGRADE_MAXPARA	24
+
+/* listeners and ssld helpers are referred to by their position in the file */
+struct upgrade_table
+{
+	void **items;
+	int count;
+	int size;
+};
+
+static int upgrade_fd = -1;
+static FILE *upgrade_fp;
+static struct upgrade_table adopted_listeners;
+static struct upgrade_table adopted_sslds;
+
+static char recordbuf[LINEBUF_SIZE * 2 + BUFSIZE];
+
+static int
+table_add(struct upgrade_table *table, void *item)
+{
+	if(table->count == table->size)
+	{
+		table->size = table->size ? table->size * 2 : 8;
+		table->items = rb_realloc(table->items, table->size * sizeof(void *));
+	}
+	table->items[table->count] = item;
+	return table->count++;
+}
+
+static int
+table_find(struct upgrade_table *table, void *item)
+{
+	int i;
+
+	if(item == NULL)
+		return -1;
+
+	for(i = 0; i < table->count; i++)
+		if(table->items[i] == item)
+			return i;
+	return -1;
+}
+
+static void *
+table_get(struct upgrade_table *table, int idx)
+{
+	if(idx < 0 || idx >= table->count)
+		return NULL;
+	return table->items[idx];
+}
+
+static void
+table_free(struct upgrade_table *table)
+{
+	rb_free(table->items);
+	memset(table, 0, sizeof(*table));
+}
+
+/* split a record into at most n fields, the last one taking the rest */
+static int
+split_record(char *line, char **parv, int n)
+{
+	int parc = 0;
+	char *p;
+
+	while(parc < n - 1 && (p = strchr(line, ' ')) != NULL)
+	{
+		*p = '\0';
+		parv[parc++] = line;
+		line = p + 1;
+	}
+	parv[parc++] = line;
+	return parc;
+}
+
+static char *
+read_record(FILE *fp)
+{
+	char *p;
+
+	if(fgets(recordbuf, sizeof(recordbuf), fp) == NULL)
+		return NULL;
+
+	if((p = strchr(recordbuf, '\n')) != NULL)
+		*p = '\0';
+	return recordbuf;
+}
+
+/*
+ * saving
+ */
+
+struct upgrade_save
+{
+	FILE *fp;
+	struct upgrade_table listeners;
+	struct upgrade_table sslds;
+};
+
+static void
+save_address(FILE *fp, struct rb_sockaddr_storage *addr)
+{
+	char buf[HOSTIPLEN + 1];
+
+	if(GET_SS_FAMILY(addr) != AF_INET && GET_SS_FAMILY(addr) != AF_INET6)
+	{
+		fputs(" * 0", fp);
+		return;
+	}
+
+	rb_inet_ntop_sock((struct sockaddr *)addr, buf, sizeof(buf));
+	fprintf(fp, " %s %u", buf, ntohs(GET_SS_PORT(addr)));
+}
+
+static void
+save_listener(void *data, struct Listener *listener)
+{
+	struct upgrade_save *st = data;
+
+	fprintf(st->fp, "L %d %u %d %u %d %d %d",
+		table_add(&st->listeners, listener), listener->id,
+		rb_get_fd(listener->F), rb_get_type(listener->F),
+		listener->ssl, listener->sctp ? 1 : 0, listener->defer_accept);
+	save_address(st->fp, &listener->addr[0]);
+	save_address(st->fp, &listener->addr[1]);
+	fputc('\n', st->fp);
+}
+
+static void
+save_ssld(void *data, ssl_ctl_t *ctl, int ctl_fd, int pipe_fd, pid_t pid, bool shutdown, const char *version)
+{
+	struct upgrade_save *st = data;
+
+	fprintf(st->fp, "S %d %d %d %ld %d %s\n",
+		table_add(&st->sslds, ctl), ctl_fd, pipe_fd, (long)pid,
+		shutdown ? 1 : 0, EmptyString(version) ? "*" : version);
+}
+
+static void
+save_recvq_line(const char *data, int len, int terminated, void *arg)
+{
+	fprintf(arg, "%c %.*s\n", terminated ? 'Q' : 'q', len, data);
+}
+
+static void
+save_sendq_line(const char *data, int len, int terminated, void *arg)
+{
+	while(len > 0 && (data[len - 1] == '\r' || data[len - 1] == '\n'))
+		len--;
+
+	if(len > 0)
+		fprintf(arg, "W %.*s\n", len, data);
+}
+
+static void
+save_client(struct upgrade_save *st, struct Client *client_p)
+{
+	FILE *fp = st->fp;
+	struct LocalUser *lclient_p = client_p->localClient;
+	char ipbuf[HOSTIPLEN + 1];
+	char umodebuf[128];
+	char *m = umodebuf;
+	rb_dlink_node *ptr;
+	uint32_t connid = 0;
+	int i;
+
+	*m++ = '+';
+	for(i = 0; i < 128; i++)
+		if(user_modes[i] && (client_p->umodes & user_modes[i]))
+			*m++ = (char) i;
+	*m = '\0';
+
+	if(lclient_p->connids.head != NULL)
+		connid = RB_POINTER_TO_UINT(lclient_p->connids.head->data);
+
+	rb_inet_ntop_sock((struct sockaddr *)&lclient_p->ip, ipbuf, sizeof(ipbuf));
+
+	fprintf(fp, "C %d %u %d %d %u %s %s %s %s %s %s %s %u %ld %ld %ld %llx %x %s %s %s\n",
+		rb_get_fd(lclient_p->F), rb_get_type(lclient_p->F),
+		table_find(&st->listeners, lclient_p->listener),
+		IsSSL(client_p) ? table_find(&st->sslds, lclient_p->ssl_ctl) : -1,
+		connid, client_p->id, client_p->name, client_p->username,
+		client_p->host, client_p->orighost, client_p->sockhost,
+		ipbuf, ntohs(GET_SS_PORT(&lclient_p->ip)),
+		(long)client_p->tsinfo, (long)lclient_p->firsttime, (long)lclient_p->lasttime,
+		(unsigned long long)(client_p->flags & UPGRADE_FLAGS),
+		lclient_p->localflags & UPGRADE_LFLAGS,
+		umodebuf, construct_snobuf(client_p->snomask), client_p->info);
+
+	if(client_p->user->away != NULL)
+		fprintf(fp, "A %s\n", client_p->user->away);
+	if(!EmptyString(client_p->user->suser))
+		fprintf(fp, "U %s\n", client_p->user->suser);
+	if(client_p->user->opername != NULL && client_p->user->privset != NULL)
+		fprintf(fp, "O %s %s\n", client_p->user->opername, client_p->user->privset->name);
+	if(client_p->certfp != NULL)
+		fprintf(fp, "F %s\n", client_p->certfp);
+	if(lclient_p->cipher_string != NULL)
+		fprintf(fp, "Z %s\n", lclient_p->cipher_string);
+	if(lclient_p->mangledhost != NULL)
+		fprintf(fp, "G %s\n", lclient_p->mangledhost);
+	if(lclient_p->auth_user != NULL)
+		fprintf(fp, "N %s\n", lclient_p->auth_user);
+	if(lclient_p->client_caps != 0)
+		fprintf(fp, "P %s\n", capability_index_list(cli_capindex, lclient_p->client_caps));
+
+	RB_DLINK_FOREACH(ptr, lclient_p->monitor_list.head)
+	{
+		struct monitor *monptr = ptr->data;
+		fprintf(fp, "M %s\n", monptr->name);
+	}
+
+	recvq_foreach(&lclient_p->recvq, save_recvq_line, fp);
+	rb_linebuf_foreach(&lclient_p->buf_sendq, save_sendq_line, fp);
+}
+
+static void
+save_ban_list(FILE *fp, rb_dlink_list *list, char type)
+{
+	rb_dlink_node *ptr;
+
+	/* add_ban_id() adds at the head, so write them oldest first */
+	RB_DLINK_FOREACH_PREV(ptr, list->tail)
+	{
+		struct Ban *banptr = ptr->data;
+
+		fprintf(fp, "B %c %ld %s %s %s\n", type, (long)banptr->when,
+			banptr->who, EmptyString(banptr->forward) ? "*" : banptr->forward,
+			banptr->banstr);
+	}
+}
+
+static void
+save_channel(FILE *fp, struct Channel *chptr)
+{
+	char modebuf[128];
+	char *m = modebuf;
+	rb_dlink_node *ptr;
+	int i;
+
+	*m++ = '+';
+	for(i = 0; i < 128; i++)
+		if(chmode_flags[i] && (chptr->mode.mode & chmode_flags[i]))
+			*m++ = (char) i;
+	*m = '\0';
+
+	fprintf(fp, "H %s %ld %s %d %u %u\n", chptr->chname, (long)chptr->channelts,
+		modebuf, chptr->mode.limit, chptr->mode.join_num, chptr->mode.join_time);
+
+	if(*chptr->mode.key)
+		fprintf(fp, "Y %s\n", chptr->mode.key);
+	if(*chptr->mode.forward)
+		fprintf(fp, "R %s\n", chptr->mode.forward);
+	if(chptr->topic != NULL)
+		fprintf(fp, "T %ld %s %s\n", (long)chptr->topic_time,
+			EmptyString(chptr->topic_info) ? "*" : chptr->topic_info, chptr->topic);
+	if(chptr->mode_lock != NULL)
+		fprintf(fp, "X %s\n", chptr->mode_lock);
+
+	save_ban_list(fp, &chptr->banlist, 'b');
+	save_ban_list(fp, &chptr->exceptlist, 'e');
+	save_ban_list(fp, &chptr->invexlist, 'I');
+	save_ban_list(fp, &chptr->quietlist, 'q');
+
+	RB_DLINK_FOREACH(ptr, chptr->members.head)
+	{
+		struct membership *msptr = ptr->data;
+
+		if(!MyClient(msptr->client_p) || IsAnyDead(msptr->client_p))
+			continue;
+
+		fprintf(fp, "J %s %u\n", msptr->client_p->id,
+			msptr->flags & (CHFL_CHANOP | CHFL_VOICE));
+	}
+}
+
+/*
+ * upgrade_save
+ *
+ * inputs	- file to write to
+ * output	- true if everything was written
+ * side effects	- local clients and channels are written out as described
+ *		  at the top of this file
+ */
+bool
+upgrade_save(FILE *fp)
+{
+	struct upgrade_save st;
+	rb_dlink_node *ptr, *uptr;
+	struct Client *client_p;
+
+	memset(&st, 0, sizeof(st));
+	st.fp = fp;
+
+	fprintf(fp, "SOLANUM-UPGRADE %d\n", UPGRADE_VERSION);
+	listener_foreach(save_listener, &st);
+	ssld_foreach_upgrade(save_ssld, &st);
+	fputs("-\n", fp);
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+		if(IsAnyDead(client_p) || !IsPerson(client_p) || client_p->localClient->F == NULL)
+			continue;
+
+		save_client(&st, client_p);
+	}
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+		if(IsAnyDead(client_p) || !IsPerson(client_p) || client_p->localClient->F == NULL)
+			continue;
+
+		RB_DLINK_FOREACH(uptr, client_p->localClient->allow_list.head)
+		{
+			struct Client *target_p = uptr->data;
+
+			if(MyClient(target_p) && !IsAnyDead(target_p))
+				fprintf(fp, "K %s %s\n", client_p->id, target_p->id);
+		}
+	}
+
+	RB_DLINK_FOREACH(ptr, global_channel_list.head)
+		save_channel(fp, ptr->data);
+
+	fputs("E\n", fp);
+
+	table_free(&st.listeners);
+	table_free(&st.sslds);
+
+	return fflush(fp) == 0 && !ferror(fp);
+}
+
+static void
+keep_listener(void *data, struct Listener *listener)
+{
+	rb_clear_cloexec(listener->F);
+}
+
+static void
+set_cloexec_all(void)
+{
+	int fd;
+
+	for(fd = 3; fd < maxconnections; fd++)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * upgrade_server
+ *
+ * inputs	- client asking for the upgrade
+ * output	- none, unless the exec fails
+ * side effects	- server links and unregistered connections are closed,
+ *		  the state is written out and the ircd binary exec'd again
+ */
+void
+upgrade_server(struct Client *source_p)
+{
+	rb_dlink_node *ptr, *next;
+	struct Client *target_p;
+	char path[PATH_MAX+1];
+	char fdbuf[16];
+	FILE *fp;
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "Server UPGRADE by %s",
+			get_client_name(source_p, HIDE_IP));
+	ilog(L_MAIN, "Server UPGRADE by %s", get_client_name(source_p, HIDE_IP));
+
+	fp = tmpfile();
+	if(fp == NULL)
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				"Cannot upgrade, unable to create state file: %s", strerror(errno));
+		ilog(L_MAIN, "Cannot upgrade, unable to create state file: %s", strerror(errno));
+		return;
+	}
+
+	/* servers relink to the new process rather than being carried over */
+	RB_DLINK_FOREACH_SAFE(ptr, next, serv_list.head)
+	{
+		target_p = ptr->data;
+
+		sendto_one(target_p, ":%s ERROR :Upgrade by %s",
+			   me.name, get_client_name(source_p, HIDE_IP));
+		exit_client(target_p, target_p, &me, "Server upgrading");
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, unknown_list.head)
+	{
+		target_p = ptr->data;
+		exit_client(target_p, target_p, &me, "Server upgrading, please reconnect");
+	}
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		target_p = ptr->data;
+		if(!IsAnyDead(target_p))
+			send_queued(target_p);
+	}
+
+	if(!upgrade_save(fp) || fseek(fp, 0, SEEK_SET) != 0)
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				"Cannot upgrade, unable to write state file: %s", strerror(errno));
+		ilog(L_MAIN, "Cannot upgrade, unable to write state file: %s", strerror(errno));
+		fclose(fp);
+		return;
+	}
+
+	/* everything else goes away with the old image */
+	set_cloexec_all();
+	fcntl(fileno(fp), F_SETFD, 0);
+	listener_foreach(keep_listener, NULL);
+	ssld_prepare_upgrade();
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		target_p = ptr->data;
+		if(!IsAnyDead(target_p) && target_p->localClient->F != NULL)
+			rb_clear_cloexec(target_p->localClient->F);
+	}
+
+	snprintf(fdbuf, sizeof(fdbuf), "%d", fileno(fp));
+	rb_setenv(UPGRADE_ENV, fdbuf, 1);
+
+	ilog(L_MAIN, "Upgrading server...");
+	close_logfiles();
+
+	execv(ircd_paths[IRCD_PATH_IRCD_EXEC], (void *)myargv);
+
+	snprintf(path, sizeof(path), "%s/bin/ircd", ConfigFileEntry.dpath);
+	execv(path, (void *)myargv);
+
+	/* still here, carry on with what we have */
+	unsetenv(UPGRADE_ENV);
+	set_cloexec_all();
+	fclose(fp);
+	open_logfiles();
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "Upgrade failed, unable to execute %s: %s",
+			ircd_paths[IRCD_PATH_IRCD_EXEC], strerror(errno));
+	ilog(L_MAIN, "Upgrade failed, unable to execute %s: %s",
+			ircd_paths[IRCD_PATH_IRCD_EXEC], strerror(errno));
+}
+
+/*
+ * restoring
+ */
+
+static bool
+restore_address(const char *addr, const char *port, struct rb_sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+
+	if(!strcmp(addr, "*"))
+	{
+		SET_SS_FAMILY(ss, AF_UNSPEC);
+		SET_SS_LEN(ss, sizeof(struct sockaddr_storage));
+		return true;
+	}
+
+	if(rb_inet_pton_sock(addr, ss) <= 0)
+		return false;
+
+	SET_SS_PORT(ss, htons(atoi(port)));
+	return true;
+}
+
+static void
+restore_listener(char *line)
+{
+	struct rb_sockaddr_storage addr[2];
+	struct Listener *listener = NULL;
+	char *parv[UPGRADE_MAXPARA];
+
+	if(split_record(line, parv, 12) == 12 &&
+			restore_address(parv[8], parv[9], &addr[0]) &&
+			restore_address(parv[10], parv[11], &addr[1]))
+		listener = adopt_listener(strtoul(parv[2], NULL, 10), atoi(parv[3]), atoi(parv[4]),
+				addr, atoi(parv[5]), atoi(parv[7]), atoi(parv[6]) != 0);
+
+	if(listener == NULL)
+		ilog(L_MAIN, "upgrade: unable to take over listener %s", parv[1]);
+
+	/* keep the positions right even if this one failed */
+	table_add(&adopted_listeners, listener);
+}
+
+static void
+restore_ssld(char *line)
+{
+	char *parv[UPGRADE_MAXPARA];
+	ssl_ctl_t *ctl = NULL;
+
+	if(split_record(line, parv, 7) == 7)
+		ctl = ssld_adopt(atoi(parv[2]), atoi(parv[3]), atol(parv[4]),
+				atoi(parv[5]) != 0, strcmp(parv[6], "*") ? parv[6] : "");
+
+	if(ctl == NULL)
+		ilog(L_MAIN, "upgrade: unable to take over ssld %s", parv[1]);
+
+	table_add(&adopted_sslds, ctl);
+}
+
+/*
+ * upgrade_restore_early
+ *
+ * inputs	- state file
+ * output	- true if the file was one we understand
+ * side effects	- listeners and ssld helpers are taken over.  this runs
+ *		  before the conf is read, so the conf finds the listeners
+ *		  open and no new helpers are started
+ */
+bool
+upgrade_restore_early(FILE *fp)
+{
+	char *line, *parv[UPGRADE_MAXPARA];
+
+	line = read_record(fp);
+	if(line == NULL || split_record(line, parv, 2) != 2 ||
+			strcmp(parv[0], "SOLANUM-UPGRADE") || atoi(parv[1]) != UPGRADE_VERSION)
+	{
+		ilog(L_MAIN, "upgrade: state file is not version %d", UPGRADE_VERSION);
+		return false;
+	}
+
+	while((line = read_record(fp)) != NULL)
+	{
+		switch(*line)
+		{
+		case 'L':
+			restore_listener(line);
+			break;
+		case 'S':
+			restore_ssld(line);
+			break;
+		case '-':
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* clients and channels are finished off when the next record that isn't
+ * one of theirs comes along
+ */
+struct upgrade_restore
+{
+	struct Client *client_p;
+	struct Channel *chptr;
+	rb_dlink_list clients;
+	int exited;
+};
+
+/* exit a client that never made it into the hashes */
+static void
+drop_client(struct Client *client_p, const char *reason)
+{
+	*client_p->id = '\0';
+	*client_p->name = '\0';
+	clear_monitor(client_p);
+	exit_client(client_p, client_p, &me, reason);
+}
+
+static struct Client *
+find_restored(const char *id)
+{
+	struct Client *client_p = find_id(id);
+
+	if(client_p == NULL || !MyClient(client_p) || IsAnyDead(client_p))
+		return NULL;
+	return client_p;
+}
+
+static void
+restore_client(struct upgrade_restore *st, char *line)
+{
+	struct Client *client_p;
+	struct LocalUser *lclient_p;
+	struct Listener *listener;
+	ssl_ctl_t *ctl;
+	char *parv[UPGRADE_MAXPARA];
+	const char *p;
+	rb_fde_t *F;
+	uint32_t connid;
+
+	if(split_record(line, parv, 22) != 22)
+		return;
+
+	F = rb_open(atoi(parv[1]), atoi(parv[2]), "Incoming connection");
+	if(F == NULL)
+		return;
+	rb_set_cloexec(F);
+
+	client_p = make_client(NULL);
+	lclient_p = client_p->localClient;
+	lclient_p->F = F;
+	make_user(client_p);
+
+	listener = table_get(&adopted_listeners, atoi(parv[3]));
+	if(listener != NULL)
+	{
+		lclient_p->listener = listener;
+		++listener->ref_count;
+	}
+
+	rb_strlcpy(client_p->id, parv[6], sizeof(client_p->id));
+	rb_strlcpy(client_p->name, parv[7], sizeof(client_p->name));
+	rb_strlcpy(client_p->username, parv[8], sizeof(client_p->username));
+	rb_strlcpy(client_p->host, parv[9], sizeof(client_p->host));
+	rb_strlcpy(client_p->orighost, parv[10], sizeof(client_p->orighost));
+	rb_strlcpy(client_p->sockhost, parv[11], sizeof(client_p->sockhost));
+	if(rb_inet_pton_sock(parv[12], &lclient_p->ip) > 0)
+		SET_SS_PORT(&lclient_p->ip, htons(atoi(parv[13])));
+	client_p->tsinfo = atol(parv[14]);
+	lclient_p->firsttime = atol(parv[15]);
+	lclient_p->lasttime = atol(parv[16]);
+	client_p->flags |= strtoull(parv[17], NULL, 16) & UPGRADE_FLAGS;
+	lclient_p->localflags |= strtoul(parv[18], NULL, 16) & UPGRADE_LFLAGS;
+	for(p = parv[19]; *p != '\0'; p++)
+		client_p->umodes |= user_modes[(unsigned char) *p];
+	client_p->snomask = parse_snobuf_to_mask(0, parv[20]);
+	rb_strlcpy(client_p->info, parv[21], sizeof(client_p->info));
+
+	st->client_p = client_p;
+
+	ctl = table_get(&adopted_sslds, atoi(parv[4]));
+	if(IsSSL(client_p))
+	{
+		if(ctl == NULL)
+		{
+			drop_client(client_p, "Upgrade lost the TLS helper");
+			return;
+		}
+		lclient_p->ssl_ctl = ctl;
+		ssld_increment_clicount(ctl);
+	}
+
+	connid = strtoul(parv[5], NULL, 10);
+	if(connid != 0 && !connid_claim(client_p, connid))
+	{
+		drop_client(client_p, "Upgrade lost the connection id");
+		return;
+	}
+
+	rb_dlinkAddAlloc(client_p, &st->clients);
+}
+
+static void
+restore_client_caps(struct Client *client_p, char *caps)
+{
+	char *p, *next = NULL;
+
+	for(p = rb_strtok_r(caps, " ", &next); p != NULL; p = rb_strtok_r(NULL, " ", &next))
+		client_p->localClient->client_caps |= capability_get(cli_capindex, p, NULL);
+}
+
+static void
+restore_oper(struct Client *client_p, char *line)
+{
+	struct PrivilegeSet *privset;
+	char *parv[UPGRADE_MAXPARA];
+
+	if(split_record(line, parv, 3) != 3)
+		return;
+
+	privset = privilegeset_get(parv[2]);
+	if(privset == NULL)
+		return;
+
+	client_p->user->opername = rb_strdup(parv[1]);
+	client_p->user->privset = privilegeset_ref(privset);
+}
+
+static void
+restore_client_record(struct Client *client_p, char *line)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	char *data = line[1] == ' ' ? line + 2 : line + 1;
+	rb_strf_t strings = { .format = NULL, .format_args = NULL, .next = NULL };
+	struct monitor *monptr;
+
+	switch(*line)
+	{
+	case 'A':
+		allocate_away(client_p);
+		rb_strlcpy(client_p->user->away, data, AWAYLEN);
+		break;
+	case 'U':
+		rb_strlcpy(client_p->user->suser, data, sizeof(client_p->user->suser));
+		break;
+	case 'O':
+		restore_oper(client_p, line);
+		break;
+	case 'F':
+		rb_free(client_p->certfp);
+		client_p->certfp = rb_strdup(data);
+		break;
+	case 'Z':
+		rb_free(lclient_p->cipher_string);
+		lclient_p->cipher_string = rb_strdup(data);
+		break;
+	case 'G':
+		rb_free(lclient_p->mangledhost);
+		lclient_p->mangledhost = rb_strdup(data);
+		break;
+	case 'N':
+		rb_free(lclient_p->auth_user);
+		lclient_p->auth_user = rb_strdup(data);
+		break;
+	case 'P':
+		restore_client_caps(client_p, data);
+		break;
+	case 'M':
+		monptr = find_monitor(data, 1);
+		if(rb_dlinkFind(client_p, &monptr->users) == NULL)
+		{
+			rb_dlinkAddAlloc(client_p, &monptr->users);
+			rb_dlinkAddAlloc(monptr, &lclient_p->monitor_list);
+		}
+		break;
+	case 'Q':
+		recvq_append(&lclient_p->recvq, data, strlen(data));
+		recvq_append(&lclient_p->recvq, "\r\n", 2);
+		break;
+	case 'q':
+		recvq_append(&lclient_p->recvq, data, strlen(data));
+		break;
+	case 'W':
+		strings.format = data;
+		rb_linebuf_put(&lclient_p->buf_sendq, &strings);
+		break;
+	}
+}
+
+/* register the client the way register_local_user() would have */
+static void
+finish_client(struct upgrade_restore *st)
+{
+	struct Client *client_p = st->client_p;
+	struct ConfItem *aconf;
+	const char *notildeuser;
+
+	st->client_p = NULL;
+
+	if(client_p == NULL || IsAnyDead(client_p))
+		return;
+
+	if(find_named_client(client_p->name) != NULL || find_id(client_p->id) != NULL)
+	{
+		st->exited++;
+		drop_client(client_p, "Nick collision on upgrade");
+		return;
+	}
+
+	notildeuser = *client_p->username == '~' ? client_p->username + 1 : client_p->username;
+	aconf = find_address_conf(client_p->orighost, client_p->sockhost,
+			client_p->username, notildeuser,
+			(struct sockaddr *)&client_p->localClient->ip,
+			GET_SS_FAMILY(&client_p->localClient->ip),
+			client_p->localClient->auth_user);
+
+	if(aconf == NULL || !(aconf->status & CONF_CLIENT) || attach_conf(client_p, aconf) != 0)
+	{
+		st->exited++;
+		drop_client(client_p, "No longer authorised after upgrade");
+		return;
+	}
+
+	add_to_client_hash(client_p->name, client_p);
+	add_to_id_hash(client_p->id, client_p);
+	add_to_hostname_hash(client_p->orighost, client_p);
+	add_to_who_index(client_p);
+	add_to_ban_check_index(client_p);
+	claim_uid(client_p->id);
+
+	if(client_p->user->privset == NULL)
+		client_p->umodes &= ~(UMODE_OPER | UMODE_ADMIN);
+
+	if(IsOper(client_p))
+	{
+		Count.oper++;
+		rb_dlinkAddAlloc(client_p, &local_oper_list);
+		rb_dlinkAddAlloc(client_p, &oper_list);
+	}
+	else if(client_p->user->privset != NULL)
+	{
+		privilegeset_unref(client_p->user->privset);
+		client_p->user->privset = NULL;
+		rb_free(client_p->user->opername);
+		client_p->user->opername = NULL;
+	}
+
+	if(client_p->umodes & UMODE_INVISIBLE)
+		Count.invisi++;
+
+	rb_dlinkMoveNode(&client_p->localClient->tnode, &unknown_list, &lclient_list);
+	SetClient(client_p);
+	rb_dlinkAddTail(client_p, &client_p->node, &global_client_list);
+
+	client_p->servptr = &me;
+	rb_dlinkAdd(client_p, &client_p->lnode, &client_p->servptr->serv->users);
+
+	if(++Count.total > Count.max_tot)
+		Count.max_tot = Count.total;
+
+	if(rb_dlink_list_length(&lclient_list) > (unsigned long)Count.max_loc)
+		Count.max_loc = rb_dlink_list_length(&lclient_list);
+
+	client_p->localClient->targets_free = TGCHANGE_INITIAL;
+
+	free_pre_client(client_p);
+}
+
+static void
+restore_accept(char *line)
+{
+	struct Client *client_p, *target_p;
+	char *parv[UPGRADE_MAXPARA];
+
+	if(split_record(line, parv, 3) != 3)
+		return;
+
+	client_p = find_restored(parv[1]);
+	target_p = find_restored(parv[2]);
+	if(client_p == NULL || target_p == NULL)
+		return;
+
+	rb_dlinkAddAlloc(target_p, &client_p->localClient->allow_list);
+	rb_dlinkAddAlloc(client_p, &target_p->on_allow_list);
+}
+
+static void
+finish_channel(struct upgrade_restore *st)
+{
+	struct Channel *chptr = st->chptr;
+
+	st->chptr = NULL;
+
+	if(chptr != NULL && rb_dlink_list_length(&chptr->members) == 0 &&
+			!(chptr->mode.mode & MODE_PERMANENT))
+		destroy_channel(chptr);
+}
+
+static void
+restore_channel(struct upgrade_restore *st, char *line)
+{
+	struct Channel *chptr;
+	char *parv[UPGRADE_MAXPARA];
+	const char *p;
+
+	if(split_record(line, parv, 7) != 7)
+		return;
+
+	chptr = get_or_create_channel(&me, parv[1], NULL);
+	if(chptr == NULL)
+		return;
+
+	chptr->channelts = atol(parv[2]);
+	for(p = parv[3]; *p != '\0'; p++)
+		chptr->mode.mode |= chmode_flags[(unsigned char) *p];
+	chptr->mode.limit = atoi(parv[4]);
+	chptr->mode.join_num = strtoul(parv[5], NULL, 10);
+	chptr->mode.join_time = strtoul(parv[6], NULL, 10);
+	chptr->bants = rb_current_time();
+
+	st->chptr = chptr;
+}
+
+static void
+restore_ban(struct Channel *chptr, char *line)
+{
+	struct Ban *banptr;
+	rb_dlink_list *list;
+	char *parv[UPGRADE_MAXPARA];
+
+	if(split_record(line, parv, 6) != 6)
+		return;
+
+	switch(*parv[1])
+	{
+	case 'b':
+		list = &chptr->banlist;
+		break;
+	case 'e':
+		list = &chptr->exceptlist;
+		break;
+	case 'I':
+		list = &chptr->invexlist;
+		break;
+	case 'q':
+		list = &chptr->quietlist;
+		break;
+	default:
+		return;
+	}
+
+	banptr = allocate_ban(parv[5], parv[3], strcmp(parv[4], "*") ? parv[4] : NULL);
+	banptr->when = atol(parv[2]);
+	add_ban_id(chptr, list, banptr);
+}
+
+static void
+restore_channel_record(struct Channel *chptr, char *line)
+{
+	struct Client *client_p;
+	char *data = line[1] == ' ' ? line + 2 : line + 1;
+	char *parv[UPGRADE_MAXPARA];
+
+	switch(*line)
+	{
+	case 'Y':
+		rb_strlcpy(chptr->mode.key, data, sizeof(chptr->mode.key));
+		break;
+	case 'R':
+		rb_strlcpy(chptr->mode.forward, data, sizeof(chptr->mode.forward));
+		break;
+	case 'T':
+		if(split_record(line, parv, 4) == 4)
+			set_channel_topic(chptr, parv[3], parv[2], atol(parv[1]));
+		break;
+	case 'X':
+		rb_free(chptr->mode_lock);
+		chptr->mode_lock = rb_strdup(data);
+		break;
+	case 'B':
+		restore_ban(chptr, line);
+		break;
+	case 'J':
+		if(split_record(line, parv, 3) != 3)
+			break;
+		client_p = find_restored(parv[1]);
+		if(client_p != NULL && !IsMember(client_p, chptr))
+			add_user_to_channel(chptr, client_p, atoi(parv[2]) & (CHFL_CHANOP | CHFL_VOICE));
+		break;
+	}
+}
+
+/*
+ * upgrade_restore
+ *
+ * inputs	- state file, read up to the end of upgrade_restore_early()
+ * output	- number of clients carried over
+ * side effects	- clients, channels, accept and monitor lists are put
+ *		  back, and the clients start being read from again
+ */
+int
+upgrade_restore(FILE *fp)
+{
+	struct upgrade_restore st;
+	rb_dlink_node *ptr, *next;
+	struct Client *client_p;
+	char *line;
+	int count = 0;
+
+	memset(&st, 0, sizeof(st));
+
+	while((line = read_record(fp)) != NULL && *line != 'E')
+	{
+		switch(*line)
+		{
+		case 'C':
+			finish_client(&st);
+			restore_client(&st, line);
+			continue;
+		case 'K':
+			finish_client(&st);
+			restore_accept(line);
+			continue;
+		case 'H':
+			finish_client(&st);
+			finish_channel(&st);
+			restore_channel(&st, line);
+			continue;
+		}
+
+		if(st.client_p != NULL)
+		{
+			if(!IsAnyDead(st.client_p))
+				restore_client_record(st.client_p, line);
+		}
+		else if(st.chptr != NULL)
+			restore_channel_record(st.chptr, line);
+	}
+	finish_client(&st);
+	finish_channel(&st);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, st.clients.head)
+	{
+		client_p = ptr->data;
+		rb_free_rb_dlink_node(ptr);
+
+		if(IsAnyDead(client_p))
+			continue;
+
+		count++;
+		send_queued(client_p);
+		read_packet(client_p->localClient->F, client_p);
+	}
+
+	return count;
+}
+
+/*
+ * upgrade_check
+ *
+ * output	- true if we were exec'd by an upgrade
+ * side effects	- the state file descriptor is picked up from the
+ *		  environment, which is cleared so helpers don't see it.
+ *		  everything inherited is made close-on-exec again before
+ *		  any helper is started, or they would hold clients open
+ */
+bool
+upgrade_check(void)
+{
+	const char *env = getenv(UPGRADE_ENV);
+
+	if(env == NULL)
+		return false;
+
+	upgrade_fd = atoi(env);
+	unsetenv(UPGRADE_ENV);
+	set_cloexec_all();
+	return upgrade_fd > 2;
+}
+
+/*
+ * upgrade_start - take over listeners and ssld, before the conf is read
+ */
+void
+upgrade_start(void)
+{
+	if(upgrade_fd < 0)
+		return;
+
+	upgrade_fp = fdopen(upgrade_fd, "r");
+	if(upgrade_fp == NULL || !upgrade_restore_early(upgrade_fp))
+	{
+		ilog(L_MAIN, "upgrade: unable to read state, clients have been lost");
+		if(upgrade_fp != NULL)
+			fclose(upgrade_fp);
+		else
+			close(upgrade_fd);
+		upgrade_fp = NULL;
+	}
+}
+
+/*
+ * upgrade_finish - put clients and channels back, once the conf is loaded
+ */
+void
+upgrade_finish(void)
+{
+	int count;
+
+	if(upgrade_fp == NULL)
+		return;
+
+	count = upgrade_restore(upgrade_fp);
+	fclose(upgrade_fp);
+	upgrade_fp = NULL;
+	upgrade_fd = -1;
+
+	/* listeners the conf still has were marked active by it */
+	close_inactive_listeners();
+	table_free(&adopted_listeners);
+	table_free(&adopted_sslds);
+
+	ilog(L_MAIN, "Upgrade complete, %d clients carried over", count);
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+			"Upgrade complete, %d clients carried over", count);
+}
@@ -38,6 +38,7 @@
 #include "send.h"
 #include "logger.h"
 #include "scache.h"
+#include "rb_dictionary.h"
 #include "rb_radixtree.h"
 
 struct whowas_top
@@ -46,10 +47,73 @@ struct whowas_top
 	rb_dlink_list wwlist;
 };
 
+/* a string shared by every whowas entry that uses it */
+struct whowas_string
+{
+	unsigned int refcount;
+	unsigned short len;
+	char data[];
+};
+
 static rb_radixtree *whowas_tree = NULL;
-static rb_dlink_list whowas_list = {NULL, NULL, 0};
+static rb_dictionary *whowas_strings = NULL;
+static size_t whowas_strings_size = 0;
+
+/* entries are kept in a ring, whowas_next being the slot the next one
+ * goes into and so, once the ring has filled, also the oldest entry
+ */
+static struct Whowas *whowas_ring = NULL;
+static unsigned int whowas_ring_size = 0;
+static unsigned int whowas_next = 0;
+static unsigned int whowas_count = 0;
 static unsigned int whowas_list_length = NICKNAMEHISTORYLENGTH;
-static void whowas_trim(void *unused);
+
+static int
+whowas_string_cmp(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+static const char *
+whowas_intern(const char *str)
+{
+	struct whowas_string *ws;
+	size_t len;
+
+	if(EmptyString(str))
+		return "";
+
+	ws = rb_dictionary_retrieve(whowas_strings, str);
+	if(ws == NULL)
+	{
+		len = strlen(str);
+		ws = rb_malloc(sizeof(struct whowas_string) + len + 1);
+		ws->len = len;
+		memcpy(ws->data, str, len + 1);
+		rb_dictionary_add(whowas_strings, ws->data, ws);
+		whowas_strings_size += sizeof(struct whowas_string) + len + 1;
+	}
+
+	ws->refcount++;
+	return ws->data;
+}
+
+static void
+whowas_release(const char *str)
+{
+	struct whowas_string *ws;
+
+	if(EmptyString(str))
+		return;
+
+	ws = (struct whowas_string *)(void *)(str - offsetof(struct whowas_string, data));
+	if(--ws->refcount > 0)
+		return;
+
+	rb_dictionary_delete(whowas_strings, ws->data);
+	whowas_strings_size -= sizeof(struct whowas_string) + ws->len + 1;
+	rb_free(ws);
+}
 
 static void
 whowas_free_wtop(struct whowas_top *wtop)
@@ -78,6 +142,45 @@ whowas_get_top(const char *name)
 	return wtop;
 }
 
+static void
+whowas_unlink(struct Whowas *who)
+{
+	if(who->online != NULL)
+		rb_dlinkDelete(&who->cnode, &who->online->whowas_clist);
+	rb_dlinkDelete(&who->wnode, &who->wtop->wwlist);
+}
+
+static void
+whowas_link(struct Whowas *who)
+{
+	if(who->online != NULL)
+		rb_dlinkAdd(who, &who->cnode, &who->online->whowas_clist);
+	rb_dlinkAdd(who, &who->wnode, &who->wtop->wwlist);
+}
+
+/* empty a slot, leaving it free for reuse */
+static void
+whowas_free(struct Whowas *who)
+{
+	whowas_unlink(who);
+	whowas_free_wtop(who->wtop);
+
+	whowas_release(who->username);
+	whowas_release(who->hostname);
+	whowas_release(who->sockhost);
+	whowas_release(who->realname);
+	whowas_release(who->suser);
+
+	memset(who, 0, sizeof(struct Whowas));
+	whowas_count--;
+}
+
+static struct Whowas *
+whowas_oldest(void)
+{
+	return &whowas_ring[(whowas_next + whowas_ring_size - whowas_count) % whowas_ring_size];
+}
+
 rb_dlink_list *
 whowas_get_list(const char *name)
 {
@@ -91,28 +194,29 @@ whowas_get_list(const char *name)
 void
 whowas_add_history(struct Client *client_p, int online)
 {
-	struct whowas_top *wtop;
 	struct Whowas *who;
 	s_assert(NULL != client_p);
 
-	if(client_p == NULL)
+	if(client_p == NULL || whowas_ring_size == 0)
 		return;
 
-	/* trim some of the entries if we're getting well over our history length */
-	if(rb_dlink_list_length(&whowas_list) > whowas_list_length + 100)
-		whowas_trim(NULL);
+	/* the ring is full, so this overwrites the oldest entry */
+	who = &whowas_ring[whowas_next];
+	if(who->wtop != NULL)
+		whowas_free(who);
 
-	wtop = whowas_get_top(client_p->name);
-	who = rb_malloc(sizeof(struct Whowas));
-	who->wtop = wtop;
+	whowas_next = (whowas_next + 1) % whowas_ring_size;
+	whowas_count++;
+
+	who->wtop = whowas_get_top(client_p->name);
 	who->logoff = rb_current_time();
 
 	rb_strlcpy(who->name, client_p->name, sizeof(who->name));
-	rb_strlcpy(who->username, client_p->username, sizeof(who->username));
-	rb_strlcpy(who->hostname, client_p->host, sizeof(who->hostname));
-	rb_strlcpy(who->realname, client_p->info, sizeof(who->realname));
-	rb_strlcpy(who->sockhost, client_p->sockhost, sizeof(who->sockhost));
-	rb_strlcpy(who->suser, client_p->user->suser, sizeof(who->suser));
+	who->username = whowas_intern(client_p->username);
+	who->hostname = whowas_intern(client_p->host);
+	who->sockhost = whowas_intern(client_p->sockhost);
+	who->realname = whowas_intern(client_p->info);
+	who->suser = whowas_intern(client_p->user->suser);
 
 	who->flags = (IsIPSpoof(client_p) ? WHOWAS_IP_SPOOFING : 0) |
 		(IsDynSpoof(client_p) ? WHOWAS_DYNSPOOF : 0);
@@ -120,16 +224,8 @@ whowas_add_history(struct Client *client_p, int online)
 	/* this is safe do to with the servername cache */
 	who->servername = scache_get_name(client_p->servptr->serv->nameinfo);
 
-	if(online)
-	{
-		who->online = client_p;
-		rb_dlinkAdd(who, &who->cnode, &client_p->whowas_clist);
-	}
-	else
-		who->online = NULL;
-
-	rb_dlinkAdd(who, &who->wnode, &wtop->wwlist);
-	rb_dlinkAdd(who, &who->whowas_node, &whowas_list);
+	who->online = online ? client_p : NULL;
+	whowas_link(who);
 }
 
 
@@ -170,53 +266,63 @@ whowas_get_history(const char *nick, time_t timelimit)
 	return NULL;
 }
 
+/* (re)allocate the ring, keeping the newest entries that fit */
 static void
-whowas_trim(void *unused)
+whowas_resize(unsigned int len)
 {
-	long over;
+	struct Whowas *ring = NULL;
+	unsigned int i;
 
-	if(rb_dlink_list_length(&whowas_list) < whowas_list_length)
-		return;
-	over = rb_dlink_list_length(&whowas_list) - whowas_list_length;
+	while(whowas_count > len)
+		whowas_free(whowas_oldest());
+
+	if(len > 0)
+		ring = rb_malloc(sizeof(struct Whowas) * len);
 
-	/* remove whowas entries over the configured length */
-	for(long i = 0; i < over; i++)
+	/* the lists point into the old ring, so relink every entry as it
+	 * moves; going oldest first leaves the newest at the head again
+	 */
+	for(i = 0; i < whowas_count; i++)
 	{
-		if(whowas_list.tail != NULL && whowas_list.tail->data != NULL)
-		{
-			struct Whowas *twho = whowas_list.tail->data;
-			if(twho->online != NULL)
-				rb_dlinkDelete(&twho->cnode, &twho->online->whowas_clist);
-			rb_dlinkDelete(&twho->wnode, &twho->wtop->wwlist);
-			rb_dlinkDelete(&twho->whowas_node, &whowas_list);
-			whowas_free_wtop(twho->wtop);
-			rb_free(twho);
-		}
+		struct Whowas *who = &whowas_ring[(whowas_next + whowas_ring_size -
+				whowas_count + i) % whowas_ring_size];
+
+		whowas_unlink(who);
+		ring[i] = *who;
+		whowas_link(&ring[i]);
 	}
+
+	rb_free(whowas_ring);
+	whowas_ring = ring;
+	whowas_ring_size = len;
+	whowas_next = len > 0 ? whowas_count % len : 0;
 }
 
 void
 whowas_init(void)
 {
 	whowas_tree = rb_radixtree_create("whowas", irccasecanon);
+	whowas_strings = rb_dictionary_create("whowas strings", whowas_string_cmp);
 	if(whowas_list_length == 0)
 	{
 		whowas_list_length = NICKNAMEHISTORYLENGTH;
 	}
-	rb_event_add("whowas_trim", whowas_trim, NULL, 10);
+	whowas_resize(whowas_list_length);
 }
 
 void
 whowas_set_size(int len)
 {
 	whowas_list_length = len;
-	whowas_trim(NULL);
+	if(whowas_tree != NULL)
+		whowas_resize(whowas_list_length);
 }
 
 void
 whowas_memory_usage(size_t * count, size_t * memused)
 {
-	*count = rb_dlink_list_length(&whowas_list);
-	*memused += *count * sizeof(struct Whowas);
+	*count = whowas_count;
+	*memused += whowas_ring_size * sizeof(struct Whowas);
+	*memused += whowas_strings_size;
 	*memused += sizeof(struct whowas_top) * rb_radixtree_size(whowas_tree);
 }
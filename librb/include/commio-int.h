@@ -95,6 +95,8 @@ struct _fde
 	uint8_t flags;
 	uint8_t type;
 	int pflags;
+	unsigned int pready;	/* RB_SELECT_* directions that may be ready without a new edge */
+	rb_dlink_node ionode;	/* pending interest changes, see epoll.c and uring.c */
 	char *desc;
 	PF *read_handler;
 	void *read_data;
@@ -121,6 +123,8 @@ typedef struct timer_data
 #endif
 
 extern rb_dlink_list *rb_fd_table;
+extern struct rb_iostats rb_iostats;
+extern int rb_io_budget;
 
 static inline rb_fde_t *
 rb_find_fd(int fd)
@@ -167,6 +171,13 @@ void rb_epoll_unsched_event(struct ev_entry *event);
 int rb_epoll_supports_event(void);
 
 
+/* io_uring versions */
+void rb_setselect_uring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
+int rb_init_netio_uring(void);
+int rb_select_uring(long);
+int rb_setup_fd_uring(rb_fde_t *F);
+
+
 /* poll versions */
 void rb_setselect_poll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_poll(void);
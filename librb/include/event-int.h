@@ -25,11 +25,11 @@
 struct ev_entry
 {
 	rb_dlink_node node;
+	struct rb_timer timer;
 	EVH *func;
 	void *arg;
 	char *name;
 	time_t frequency;
-	time_t when;
 	time_t next;
 	void *data;
 	void *comm_ptr;
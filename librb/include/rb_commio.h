@@ -159,6 +159,17 @@ int rb_ignore_errno(int);
 void rb_setselect(rb_fde_t *, unsigned int type, PF * handler, void *client_data);
 void rb_init_netio(void);
 int rb_select(unsigned long);
+
+struct rb_iostats
+{
+	unsigned long long waits;	/* calls into the IO backend */
+	unsigned long long events;	/* fd events dispatched */
+	unsigned long long ctls;	/* interest changes made by syscall */
+};
+
+void rb_get_io_stats(struct rb_iostats *);
+void rb_set_io_budget(int);
+
 void rb_defer(void (*)(void *), void *);
 void rb_defer_once(void (*)(void *), void *);
 int rb_fd_ssl(rb_fde_t *F);
@@ -192,6 +203,11 @@ int rb_supports_ssl(void);
 unsigned int rb_ssl_handshake_count(rb_fde_t *F);
 void rb_ssl_clear_handshake_count(rb_fde_t *F);
 
+#define RB_SSL_TICKET_KEY_LEN	80
+
+int rb_ssl_set_ticket_key(const uint8_t *key, size_t len);
+int rb_ssl_session_reused(rb_fde_t *F);
+
 int rb_pass_fd_to_process(rb_fde_t *, pid_t, rb_fde_t *);
 rb_fde_t *rb_recv_fd(rb_fde_t *);
 
@@ -47,4 +47,29 @@ void rb_run_one_event(struct ev_entry *);
 void rb_run_one_event_for_tests(const char *name);
 time_t rb_event_next(void);
 
+/* a timer queued on an rb_timer_heap, ordered by when */
+struct rb_timer
+{
+	time_t when;
+	unsigned int index;	/* position in the heap, 0 when not queued */
+	void *data;
+};
+
+struct rb_timer_heap
+{
+	struct rb_timer **timers;	/* 1-based binary min-heap */
+	unsigned int count;
+	unsigned int alloc;
+};
+
+void rb_timer_heap_add(struct rb_timer_heap *heap, struct rb_timer *timer, time_t when);
+void rb_timer_heap_del(struct rb_timer_heap *heap, struct rb_timer *timer);
+void rb_timer_heap_free(struct rb_timer_heap *heap);
+
+static inline struct rb_timer *
+rb_timer_heap_first(struct rb_timer_heap *heap)
+{
+	return heap->count > 0 ? heap->timers[1] : NULL;
+}
+
 #endif /* INCLUDED_event_h */
@@ -44,18 +44,26 @@ struct _buf_head;
 #define LINEBUF_SIZE            (8191 + 510)
 #define CRLF_LEN                2
 
+/* lines are allocated from one of these size classes, the last of which
+ * always holds a full LINEBUF_SIZE line plus CRLF and terminator
+ */
+#define LINEBUF_CLASSES         4
+
 typedef struct _buf_line
 {
-	char buf[LINEBUF_SIZE + CRLF_LEN + 1];
 	uint8_t terminated;	/* Whether we've terminated the buffer */
 	uint8_t raw;		/* Whether this linebuf may hold 8-bit data */
+	uint8_t sclass;		/* Which size class this line came from */
 	int len;		/* How much data we've got */
 	int refcount;		/* how many linked lists are we in? */
+	char buf[];		/* sized by the size class */
 } buf_line_t;
 
 typedef struct _buf_head
 {
-	rb_dlink_list list;	/* the actual dlink list */
+	buf_line_t **lines;	/* ring of references to lines, oldest first */
+	unsigned int first;	/* slot holding the oldest line */
+	unsigned int size;	/* slots in the ring, 0 or a power of two */
 	int len;		/* length of all the data */
 	int alloclen;		/* Actual allocated data length */
 	int writeofs;		/* offset in the first line for the write */
@@ -74,7 +82,9 @@ int rb_linebuf_parse(buf_head_t *, char *, int, int);
 int rb_linebuf_get(buf_head_t *, char *, int, int, int);
 void rb_linebuf_put(buf_head_t *, const rb_strf_t *);
 void rb_linebuf_attach(buf_head_t *, buf_head_t *);
+void rb_linebuf_foreach(buf_head_t *, void (*)(const char *, int, int, void *), void *);
 void rb_count_rb_linebuf_memory(size_t *, size_t *);
+int rb_count_rb_linebuf_class_memory(int, size_t *, size_t *, size_t *);
 int rb_linebuf_flush(rb_fde_t *F, buf_head_t *);
 
 
@@ -57,17 +57,44 @@
 #include <librb_config.h>
 #include <rb_lib.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON)
+#define RB_BH_USE_MMAP
+#endif
+
 static void _rb_bh_fail(const char *reason, const char *file, int line) __noreturn;
 
 static uintptr_t offset_pad;
+static size_t bh_pagesize;
+
+/* a single block of elements, each of which is preceded by a pointer
+ * back to this block so rb_bh_free can find it
+ */
+struct rb_heap_block
+{
+	rb_dlink_node node;	/* in the heap's block_list or empty_list */
+	rb_bh *bh;		/* the heap we belong to */
+	void *elems;		/* the actual memory */
+	unsigned long free_count;	/* number of free elements */
+};
 
 /* information for the root node of the heap */
 struct rb_bh
 {
 	rb_dlink_node hlist;
 	size_t elemSize;	/* Size of each element to be stored */
+	size_t slotSize;	/* elemSize plus the block pointer and padding */
+	size_t blockSize;	/* Size of each block, a multiple of the page size */
 	unsigned long elemsPerBlock;	/* Number of elements per block */
 	rb_dlink_list block_list;
+	rb_dlink_list empty_list;	/* released blocks kept for reuse */
 	rb_dlink_list free_list;
 	char *desc;
 };
@@ -76,6 +103,10 @@ static rb_dlink_list *heap_lists;
 
 #define rb_bh_fail(x) _rb_bh_fail(x, __FILE__, __LINE__)
 
+#define rb_bh_slot(block, i)	((void *)((uintptr_t)(block)->elems + (i) * bh->slotSize))
+#define rb_bh_elem(slot)	((void *)((uintptr_t)(slot) + offset_pad))
+#define rb_bh_elem_block(elem)	(*(struct rb_heap_block **)((uintptr_t)(elem) - offset_pad))
+
 static void
 _rb_bh_fail(const char *reason, const char *file, int line)
 {
@@ -83,6 +114,32 @@ _rb_bh_fail(const char *reason, const char *file, int line)
 	abort();
 }
 
+static void *
+rb_bh_get_block(size_t size)
+{
+	void *ptr;
+#ifdef RB_BH_USE_MMAP
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if(ptr == MAP_FAILED)
+		ptr = NULL;
+#else
+	ptr = malloc(size);
+#endif
+	if(ptr == NULL)
+		rb_outofmemory();
+	return ptr;
+}
+
+static void
+rb_bh_free_block(void *ptr, size_t size)
+{
+#ifdef RB_BH_USE_MMAP
+	munmap(ptr, size);
+#else
+	free(ptr);
+#endif
+}
+
 /*
  * void rb_init_bh(void)
  *
@@ -94,6 +151,8 @@ _rb_bh_fail(const char *reason, const char *file, int line)
 void
 rb_init_bh(void)
 {
+	long pagesize;
+
 	heap_lists = rb_malloc(sizeof(rb_dlink_list));
 	offset_pad = sizeof(void *);
 	/* XXX if you get SIGBUS when trying to use a long long..here is where you need to
@@ -106,6 +165,80 @@ rb_init_bh(void)
 		offset_pad &= ~(__alignof__(long long) - 1);
 	}
 #endif
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if(pagesize <= 0)
+		pagesize = 4096;
+	bh_pagesize = pagesize;
+}
+
+/*
+ * rb_bh_newblock
+ *
+ * Adds a block of elements to the heap's free list, reusing a
+ * previously released block if there is one.
+ */
+static void
+rb_bh_newblock(rb_bh *bh)
+{
+	struct rb_heap_block *block;
+	void *slot, *elem;
+	unsigned long i;
+
+	if(bh->empty_list.head != NULL)
+	{
+		block = bh->empty_list.head->data;
+		rb_dlinkDelete(&block->node, &bh->empty_list);
+	}
+	else
+	{
+		block = rb_malloc(sizeof(struct rb_heap_block));
+		block->bh = bh;
+		block->elems = rb_bh_get_block(bh->blockSize);
+	}
+
+	/* thread the elements onto the free list, lowest address first */
+	for(i = bh->elemsPerBlock; i > 0; i--)
+	{
+		slot = rb_bh_slot(block, i - 1);
+		elem = rb_bh_elem(slot);
+		*(struct rb_heap_block **)slot = block;
+		rb_dlinkAdd(elem, elem, &bh->free_list);
+	}
+
+	block->free_count = bh->elemsPerBlock;
+	rb_dlinkAdd(block, &block->node, &bh->block_list);
+}
+
+/*
+ * rb_bh_releaseblock
+ *
+ * Takes a completely free block out of use.  Where possible the pages
+ * are handed back to the OS with madvise() and the block is kept around
+ * to be refilled later, otherwise it is freed outright.
+ */
+static void
+rb_bh_releaseblock(rb_bh *bh, struct rb_heap_block *block)
+{
+	unsigned long i;
+
+	lrb_assert(block->free_count == bh->elemsPerBlock);
+
+	for(i = 0; i < bh->elemsPerBlock; i++)
+		rb_dlinkDelete(rb_bh_elem(rb_bh_slot(block, i)), &bh->free_list);
+
+	rb_dlinkDelete(&block->node, &bh->block_list);
+
+#if defined(RB_BH_USE_MMAP) && defined(HAVE_MADVISE) && defined(MADV_DONTNEED)
+	if(madvise(block->elems, bh->blockSize, MADV_DONTNEED) == 0)
+	{
+		rb_dlinkAdd(block, &block->node, &bh->empty_list);
+		return;
+	}
+#endif
+
+	rb_bh_free_block(block->elems, bh->blockSize);
+	rb_free(block);
 }
 
 /* ************************************************************************ */
@@ -119,7 +252,8 @@ rb_init_bh(void)
 /*   elemsize (IN):  Size of the basic element to be stored                 */
 /*   elemsperblock (IN):  Number of elements to be stored in a single block */
 /*         of memory.  When the blockheap runs out of free memory, it will  */
-/*         allocate elemsize * elemsperblock more.                          */
+/*         allocate elemsize * elemsperblock more, rounded up to a whole    */
+/*         number of pages.                                                 */
 /* Returns:                                                                 */
 /*   Pointer to new rb_bh, or NULL if unsuccessful                      */
 /* ************************************************************************ */
@@ -141,15 +275,22 @@ rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
 
 	/* Allocate our new rb_bh */
 	bh = rb_malloc(sizeof(rb_bh));
-	bh->elemSize = elemsize;
-	bh->elemsPerBlock = elemsperblock;
-	if(desc != NULL)
-		bh->desc = rb_strdup(desc);
-
 	if(bh == NULL)
 	{
 		rb_bh_fail("bh == NULL when it shouldn't be");
 	}
+
+	bh->elemSize = elemsize;
+
+	/* keep the elements aligned, and use all of the last page */
+	bh->slotSize = (offset_pad + elemsize + offset_pad - 1) & ~(offset_pad - 1);
+	bh->blockSize = bh->slotSize * elemsperblock;
+	bh->blockSize = (bh->blockSize + bh_pagesize - 1) & ~(bh_pagesize - 1);
+	bh->elemsPerBlock = bh->blockSize / bh->slotSize;
+
+	if(desc != NULL)
+		bh->desc = rb_strdup(desc);
+
 	rb_dlinkAdd(bh, &bh->hlist, heap_lists);
 	return (bh);
 }
@@ -175,7 +316,25 @@ rb_bh_alloc(rb_bh *bh)
 		rb_bh_fail("Cannot allocate if bh == NULL");
 	}
 
+#ifdef NOBALLOC
 	return (rb_malloc(bh->elemSize));
+#else
+	rb_dlink_node *new_node;
+	struct rb_heap_block *block;
+
+	if(bh->free_list.head == NULL)
+		rb_bh_newblock(bh);
+
+	new_node = bh->free_list.head;
+	rb_dlinkDelete(new_node, &bh->free_list);
+
+	block = rb_bh_elem_block(new_node);
+	lrb_assert(block->bh == bh);
+	block->free_count--;
+
+	memset(new_node, 0, bh->elemSize);
+	return (new_node);
+#endif
 }
 
 
@@ -208,7 +367,25 @@ rb_bh_free(rb_bh *bh, void *ptr)
 		return (1);
 	}
 
+#ifdef NOBALLOC
 	rb_free(ptr);
+#else
+	struct rb_heap_block *block = rb_bh_elem_block(ptr);
+
+	if(rb_unlikely(block->bh != bh))
+		rb_bh_fail("rb_bh_free() ptr does not belong to this heap");
+
+	/* reuse recently freed elements first, they're likely to be in cache */
+	rb_dlinkAdd(ptr, ptr, &bh->free_list);
+	block->free_count++;
+
+	/* give back empty blocks, but keep one block's worth spare so
+	 * an alloc/free cycle at a block boundary doesn't thrash
+	 */
+	if(block->free_count == bh->elemsPerBlock &&
+	   rb_dlink_list_length(&bh->free_list) >= 2 * bh->elemsPerBlock)
+		rb_bh_releaseblock(bh, block);
+#endif
 	return (0);
 }
 
@@ -226,9 +403,26 @@ rb_bh_free(rb_bh *bh, void *ptr)
 int
 rb_bh_destroy(rb_bh *bh)
 {
+	rb_dlink_node *ptr, *next;
+	struct rb_heap_block *block;
+
 	if(bh == NULL)
 		return (1);
 
+	RB_DLINK_FOREACH_SAFE(ptr, next, bh->block_list.head)
+	{
+		block = ptr->data;
+		rb_bh_free_block(block->elems, bh->blockSize);
+		rb_free(block);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, bh->empty_list.head)
+	{
+		block = ptr->data;
+		rb_bh_free_block(block->elems, bh->blockSize);
+		rb_free(block);
+	}
+
 	rb_dlinkDelete(&bh->hlist, heap_lists);
 	rb_free(bh->desc);
 	rb_free(bh);
@@ -237,16 +431,21 @@ rb_bh_destroy(rb_bh *bh)
 }
 
 void
-rb_bh_usage(rb_bh *bh __attribute__((unused)), size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
+rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
 {
+	size_t used, freem;
+
+	freem = rb_dlink_list_length(&bh->free_list);
+	used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+
 	if(bused != NULL)
-		*bused = 0;
+		*bused = used;
 	if(bfree != NULL)
-		*bfree = 0;
+		*bfree = freem;
 	if(bmemusage != NULL)
-		*bmemusage = 0;
+		*bmemusage = used * bh->elemSize;
 	if(desc != NULL)
-		*desc = "no blockheap";
+		*desc = bh->desc;
 }
 
 void
@@ -267,9 +466,8 @@ rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
 		freem = rb_dlink_list_length(&bh->free_list);
 		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
 		memusage = used * bh->elemSize;
-		heapalloc = (freem + used) * bh->elemSize;
-		if(bh->desc != NULL)
-			desc = bh->desc;
+		heapalloc = rb_dlink_list_length(&bh->block_list) * bh->blockSize;
+		desc = bh->desc != NULL ? bh->desc : unnamed;
 		cb(used, freem, memusage, heapalloc, desc, data);
 	}
 	return;
@@ -288,7 +486,7 @@ rb_bh_total_usage(size_t *total_alloc, size_t *total_used)
 		freem = rb_dlink_list_length(&bh->free_list);
 		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
 		used_memory += used * bh->elemSize;
-		total_memory += (freem + used) * bh->elemSize;
+		total_memory += rb_dlink_list_length(&bh->block_list) * bh->blockSize;
 	}
 
 	if(total_alloc != NULL)
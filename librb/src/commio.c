@@ -39,8 +39,7 @@
 struct timeout_data
 {
 	rb_fde_t *F;
-	rb_dlink_node node;
-	time_t timeout;
+	struct rb_timer timer;
 	PF *timeout_handler;
 	void *timeout_data;
 };
@@ -48,7 +47,10 @@ struct timeout_data
 rb_dlink_list *rb_fd_table;
 static rb_bh *fd_heap;
 
-static rb_dlink_list timeout_list;
+struct rb_iostats rb_iostats;
+int rb_io_budget;
+
+static struct rb_timer_heap timeout_heap;
 static rb_dlink_list closed_list;
 
 struct defer
@@ -77,6 +79,38 @@ static PF rb_connect_timeout;
 static PF rb_connect_outcome;
 static void mangle_mapped_sockaddr(struct sockaddr *in);
 
+/*
+ * rb_note_drained
+ *
+ * Edge-triggered backends only report a direction again once new data
+ * (or buffer space) turns up, so they need to know when a read or write
+ * has used up what was there.  That is the case when the call would
+ * block, or when a stream came back short.
+ */
+static inline void
+rb_note_drained(rb_fde_t *F, unsigned int type, ssize_t ret, size_t count)
+{
+	if(ret < 0)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			F->pready &= ~type;
+	}
+	else if(ret > 0 && (size_t)ret < count && !(F->type & RB_FD_SCTP))
+		F->pready &= ~type;
+}
+
+#ifdef HAVE_SSL
+static inline ssize_t
+rb_note_ssl_drained(rb_fde_t *F, ssize_t ret)
+{
+	if(ret == RB_RW_SSL_NEED_READ)
+		F->pready &= ~RB_SELECT_READ;
+	else if(ret == RB_RW_SSL_NEED_WRITE)
+		F->pready &= ~RB_SELECT_WRITE;
+	return ret;
+}
+#endif
+
 static inline rb_fde_t *
 add_fd(int fd)
 {
@@ -281,10 +315,10 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 	{
 		if(td == NULL)
 			return;
-		rb_dlinkDelete(&td->node, &timeout_list);
+		rb_timer_heap_del(&timeout_heap, &td->timer);
 		rb_free(td);
 		F->timeout = NULL;
-		if(rb_dlink_list_length(&timeout_list) == 0)
+		if(timeout_heap.count == 0)
 		{
 			rb_event_delete(rb_timeout_ev);
 			rb_timeout_ev = NULL;
@@ -296,10 +330,10 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 		td = F->timeout = rb_malloc(sizeof(struct timeout_data));
 
 	td->F = F;
-	td->timeout = rb_current_time() + timeout;
+	td->timer.data = td;
 	td->timeout_handler = callback;
 	td->timeout_data = cbdata;
-	rb_dlinkAdd(td, &td->node, &timeout_list);
+	rb_timer_heap_add(&timeout_heap, &td->timer, rb_current_time() + timeout);
 	if(rb_timeout_ev == NULL)
 	{
 		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 5);
@@ -312,32 +346,30 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
  * All this routine does is call the given callback/cbdata, without closing
  * down the file descriptor. When close handlers have been implemented,
  * this will happen.
+ *
+ * Timeouts are kept in a heap, so only the expired ones are looked at.
  */
 void
 rb_checktimeouts(void *notused __attribute__((unused)))
 {
-	rb_dlink_node *ptr, *next;
+	struct rb_timer *timer;
 	struct timeout_data *td;
 	rb_fde_t *F;
 	PF *hdl;
 	void *data;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, timeout_list.head)
+	while((timer = rb_timer_heap_first(&timeout_heap)) != NULL &&
+			timer->when < rb_current_time())
 	{
-		td = ptr->data;
+		td = timer->data;
 		F = td->F;
-		if(F == NULL || !IsFDOpen(F))
-			continue;
-
-		if(td->timeout < rb_current_time())
-		{
-			hdl = td->timeout_handler;
-			data = td->timeout_data;
-			rb_dlinkDelete(&td->node, &timeout_list);
-			F->timeout = NULL;
-			rb_free(td);
-			hdl(F, data);
-		}
+		lrb_assert(IsFDOpen(F));
+		hdl = td->timeout_handler;
+		data = td->timeout_data;
+		rb_timer_heap_del(&timeout_heap, &td->timer);
+		F->timeout = NULL;
+		rb_free(td);
+		hdl(F, data);
 	}
 }
 
@@ -530,6 +562,7 @@ static void rb_accept_tryaccept(rb_fde_t *F, void *data __attribute__((unused)))
 		new_fd = accept(F->fd, (struct sockaddr *)&st, &addrlen);
 		if(new_fd < 0)
 		{
+			rb_note_drained(F, RB_SELECT_ACCEPT, -1, 0);
 			rb_setselect(F, RB_SELECT_ACCEPT, rb_accept_tryaccept, NULL);
 			return;
 		}
@@ -1229,18 +1262,21 @@ rb_read(rb_fde_t *F, void *buf, int count)
 #ifdef HAVE_SSL
 	if(F->type & RB_FD_SSL)
 	{
-		return rb_ssl_read(F, buf, count);
+		return rb_note_ssl_drained(F, rb_ssl_read(F, buf, count));
 	}
 #endif
 	if(F->type & RB_FD_SOCKET)
 	{
 		ret = recv(F->fd, buf, count, 0);
+		rb_note_drained(F, RB_SELECT_READ, ret, count);
 		return ret;
 	}
 
 
 	/* default case */
-	return read(F->fd, buf, count);
+	ret = read(F->fd, buf, count);
+	rb_note_drained(F, RB_SELECT_READ, ret, count);
+	return ret;
 }
 
 
@@ -1254,16 +1290,19 @@ rb_write(rb_fde_t *F, const void *buf, int count)
 #ifdef HAVE_SSL
 	if(F->type & RB_FD_SSL)
 	{
-		return rb_ssl_write(F, buf, count);
+		return rb_note_ssl_drained(F, rb_ssl_write(F, buf, count));
 	}
 #endif
 	if(F->type & RB_FD_SOCKET)
 	{
 		ret = send(F->fd, buf, count, MSG_NOSIGNAL);
+		rb_note_drained(F, RB_SELECT_WRITE, ret, count);
 		return ret;
 	}
 
-	return write(F->fd, buf, count);
+	ret = write(F->fd, buf, count);
+	rb_note_drained(F, RB_SELECT_WRITE, ret, count);
+	return ret;
 }
 
 #ifdef HAVE_SSL
@@ -1293,6 +1332,10 @@ rb_fake_writev(rb_fde_t *F, const struct rb_iovec *vp, size_t vpcount)
 ssize_t
 rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 {
+	ssize_t ret;
+	size_t len = 0;
+	int i;
+
 	if(F == NULL)
 	{
 		errno = EBADF;
@@ -1304,15 +1347,22 @@ rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 		return rb_fake_writev(F, vector, count);
 	}
 #endif /* HAVE_SSL */
+	for(i = 0; i < count; i++)
+		len += vector[i].iov_len;
+
 	if(F->type & RB_FD_SOCKET)
 	{
 		struct msghdr msg;
 		memset(&msg, 0, sizeof(msg));
 		msg.msg_iov = (struct iovec *)vector;
 		msg.msg_iovlen = count;
-		return sendmsg(F->fd, &msg, MSG_NOSIGNAL);
+		ret = sendmsg(F->fd, &msg, MSG_NOSIGNAL);
 	}
-	return writev(F->fd, (struct iovec *)vector, count);
+	else
+		ret = writev(F->fd, (struct iovec *)vector, count);
+
+	rb_note_drained(F, RB_SELECT_WRITE, ret, len);
+	return ret;
 
 }
 
@@ -1852,6 +1902,24 @@ try_epoll(void)
 	return -1;
 }
 
+static int
+try_uring(void)
+{
+	if(!rb_init_netio_uring())
+	{
+		setselect_handler = rb_setselect_uring;
+		select_handler = rb_select_uring;
+		setup_fd_handler = rb_setup_fd_uring;
+		io_sched_event = NULL;
+		io_unsched_event = NULL;
+		io_init_event = NULL;
+		io_supports_event = rb_unsupported_event;
+		rb_strlcpy(iotype, "io_uring", sizeof(iotype));
+		return 0;
+	}
+	return -1;
+}
+
 static int
 try_ports(void)
 {
@@ -1972,6 +2040,11 @@ rb_init_netio(void)
 			if(!try_epoll())
 				return;
 		}
+		else if(!strcmp("io_uring", ioenv))
+		{
+			if(!try_uring())
+				return;
+		}
 		else if(!strcmp("kqueue", ioenv))
 		{
 			if(!try_kqueue())
@@ -2049,8 +2122,11 @@ rb_defer_once(void (*fn)(void *), void *data)
 int
 rb_select(unsigned long timeout)
 {
-	int ret = select_handler(timeout);
+	int ret;
 	rb_dlink_node *ptr, *next;
+
+	rb_iostats.waits++;
+	ret = select_handler(timeout);
 	RB_DLINK_FOREACH_SAFE(ptr, next, defer_list.head)
 	{
 		struct defer *defer = ptr->data;
@@ -2062,6 +2138,31 @@ rb_select(unsigned long timeout)
 	return ret;
 }
 
+/*
+ * rb_get_io_stats
+ *
+ * Copy out the IO loop counters.  Only backends that make a syscall to
+ * change interest (epoll) count ctls.
+ */
+void
+rb_get_io_stats(struct rb_iostats *stats)
+{
+	*stats = rb_iostats;
+}
+
+/*
+ * rb_set_io_budget
+ *
+ * Limit how many fd events the backend hands out per rb_select() call,
+ * 0 for no limit.  Anything left over is reported on the next call, so
+ * a few busy fds cannot hold up the rest of the loop for long.
+ */
+void
+rb_set_io_budget(int budget)
+{
+	rb_io_budget = budget > 0 ? budget : 0;
+}
+
 int
 rb_setup_fd(rb_fde_t *F)
 {
@@ -2127,7 +2228,10 @@ rb_recv_fd_buf(rb_fde_t *F, void *data, size_t datasize, rb_fde_t **xF, int nfds
 	msg.msg_controllen = control_len;
 
 	if((len = recvmsg(rb_get_fd(F), &msg, 0)) <= 0)
+	{
+		rb_note_drained(F, RB_SELECT_READ, len, datasize);
 		return len;
+	}
 
 	if(msg.msg_controllen > 0 && msg.msg_control != NULL
 	   && (cmsg = CMSG_FIRSTHDR(&msg)) != NULL)
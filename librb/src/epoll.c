@@ -53,6 +53,7 @@ struct epoll_info
 	int ep;
 	struct epoll_event *pfd;
 	int pfd_size;
+	rb_dlink_list dirty;
 };
 
 static struct epoll_info *ep_info;
@@ -90,6 +91,94 @@ rb_setup_fd_epoll(rb_fde_t *F __attribute__((unused)))
 }
 
 
+/*
+ * Interest handling
+ *
+ * Everything is registered edge-triggered, and F->pflags caches what the
+ * kernel has for the fd.  That mask only ever grows while the fd has a
+ * handler: dropping a direction when a handler is not re-armed and
+ * adding it back later would cost two epoll_ctl calls for nothing, since
+ * an edge on a direction without a handler is simply remembered in
+ * F->pready.
+ *
+ * rb_setselect therefore never calls epoll_ctl itself unless the fd is
+ * losing both handlers (it may be about to be closed or passed to another
+ * process).  Fds needing a new direction, or re-armed on a direction that
+ * may still hold data we were told about, go on a dirty list that is
+ * flushed once before the next epoll_wait.  The MOD done then also makes
+ * the kernel report any readiness it already has.
+ */
+static void
+rb_epoll_ctl(rb_fde_t *F, int op, int events)
+{
+	struct epoll_event ep_event;
+
+	ep_event.events = events;
+	ep_event.data.ptr = F;
+	rb_iostats.ctls++;
+
+	if(epoll_ctl(ep_info->ep, op, F->fd, &ep_event) != 0)
+	{
+		rb_lib_log("rb_epoll_ctl(): epoll_ctl failed: %s", strerror(errno));
+		abort();
+	}
+}
+
+static inline int
+rb_epoll_dirty(rb_fde_t *F)
+{
+	return F->ionode.prev != NULL || ep_info->dirty.head == &F->ionode;
+}
+
+static inline int
+rb_epoll_want(rb_fde_t *F)
+{
+	int want = 0;
+
+	if(F->read_handler != NULL)
+		want |= EPOLLIN;
+	if(F->write_handler != NULL)
+		want |= EPOLLOUT;
+	return want;
+}
+
+static inline unsigned int
+rb_epoll_armed(rb_fde_t *F)
+{
+	unsigned int type = 0;
+
+	if(F->read_handler != NULL)
+		type |= RB_SELECT_READ;
+	if(F->write_handler != NULL)
+		type |= RB_SELECT_WRITE;
+	return type;
+}
+
+static void
+rb_epoll_flush(void)
+{
+	rb_dlink_node *ptr, *next;
+	rb_fde_t *F;
+	int want;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, ep_info->dirty.head)
+	{
+		F = ptr->data;
+		rb_dlinkDelete(ptr, &ep_info->dirty);
+
+		want = rb_epoll_want(F);
+		if(want == 0)
+			continue;
+		if((want & ~F->pflags) == 0 && (F->pready & rb_epoll_armed(F)) == 0)
+			continue;
+
+		rb_epoll_ctl(F, F->pflags == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+			     F->pflags | want | EPOLLET);
+		F->pflags |= want;
+		F->pready = 0;
+	}
+}
+
 /*
  * rb_setselect
  *
@@ -99,58 +188,44 @@ rb_setup_fd_epoll(rb_fde_t *F __attribute__((unused)))
 void
 rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data)
 {
-	struct epoll_event ep_event;
-	int old_flags = F->pflags;
-	int op = -1;
-
 	lrb_assert(IsFDOpen(F));
 
-	/* Update the list, even though we're not using it .. */
 	if(type & RB_SELECT_READ)
 	{
-		if(handler != NULL)
-			F->pflags |= EPOLLIN;
-		else
-			F->pflags &= ~EPOLLIN;
 		F->read_handler = handler;
 		F->read_data = client_data;
 	}
 
 	if(type & RB_SELECT_WRITE)
 	{
-		if(handler != NULL)
-			F->pflags |= EPOLLOUT;
-		else
-			F->pflags &= ~EPOLLOUT;
 		F->write_handler = handler;
 		F->write_data = client_data;
 	}
 
-	if(old_flags == 0 && F->pflags == 0)
-		return;
-	else if(F->pflags <= 0)
-		op = EPOLL_CTL_DEL;
-	else if(old_flags == 0 && F->pflags > 0)
-		op = EPOLL_CTL_ADD;
-	else if(F->pflags != old_flags)
-		op = EPOLL_CTL_MOD;
-
-	if(op == -1)
-		return;
-
-	ep_event.events = F->pflags;
-	ep_event.data.ptr = F;
+	if(handler == NULL)
+	{
+		if(F->read_handler != NULL || F->write_handler != NULL)
+		{
+			/* whatever was pending is still pending */
+			F->pready |= type;
+			return;
+		}
 
-	if(op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD)
-		ep_event.events |= EPOLLET;
+		if(rb_epoll_dirty(F))
+			rb_dlinkDelete(&F->ionode, &ep_info->dirty);
 
-	if(epoll_ctl(ep_info->ep, op, F->fd, &ep_event) != 0)
-	{
-		rb_lib_log("rb_setselect_epoll(): epoll_ctl failed: %s", strerror(errno));
-		abort();
+		if(F->pflags != 0)
+			rb_epoll_ctl(F, EPOLL_CTL_DEL, 0);
+		F->pflags = 0;
+		F->pready = 0;
+		return;
 	}
 
+	if(rb_epoll_dirty(F))
+		return;
 
+	if((rb_epoll_want(F) & ~F->pflags) != 0 || (F->pready & type) != 0)
+		rb_dlinkAddTail(F, &F->ionode, &ep_info->dirty);
 }
 
 /*
@@ -165,12 +240,17 @@ rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_da
 int
 rb_select_epoll(long delay)
 {
-	int num, i, flags, old_flags, op;
-	struct epoll_event ep_event;
+	int num, i, max;
 	int o_errno;
 	void *data;
 
-	num = epoll_wait(ep_info->ep, ep_info->pfd, ep_info->pfd_size, delay);
+	rb_epoll_flush();
+
+	max = ep_info->pfd_size;
+	if(rb_io_budget > 0 && rb_io_budget < max)
+		max = rb_io_budget;
+
+	num = epoll_wait(ep_info->ep, ep_info->pfd, max, delay);
 
 	/* save errno as rb_set_time() will likely clobber it */
 	o_errno = errno;
@@ -183,13 +263,19 @@ rb_select_epoll(long delay)
 	if(num <= 0)
 		return RB_OK;
 
+	rb_iostats.events += num;
+
 	for(i = 0; i < num; i++)
 	{
 		PF *hdl;
 		rb_fde_t *F = ep_info->pfd[i].data.ptr;
-		old_flags = F->pflags;
+
+		/* an edge is only reported once, so note it until
+		 * a read or write says it has been used up
+		 */
 		if(ep_info->pfd[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
 		{
+			F->pready |= RB_SELECT_READ;
 			hdl = F->read_handler;
 			data = F->read_data;
 			F->read_handler = NULL;
@@ -204,6 +290,7 @@ rb_select_epoll(long delay)
 			continue;
 		if(ep_info->pfd[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
 		{
+			F->pready |= RB_SELECT_WRITE;
 			hdl = F->write_handler;
 			data = F->write_data;
 			F->write_handler = NULL;
@@ -214,35 +301,6 @@ rb_select_epoll(long delay)
 				hdl(F, data);
 			}
 		}
-
-		if(!IsFDOpen(F))
-			continue;
-
-		flags = 0;
-
-		if(F->read_handler != NULL)
-			flags |= EPOLLIN;
-		if(F->write_handler != NULL)
-			flags |= EPOLLOUT;
-
-		if(old_flags != flags)
-		{
-			if(flags == 0)
-				op = EPOLL_CTL_DEL;
-			else
-				op = EPOLL_CTL_MOD;
-			F->pflags = ep_event.events = flags;
-			ep_event.data.ptr = F;
-			if(op == EPOLL_CTL_MOD || op == EPOLL_CTL_ADD)
-				ep_event.events |= EPOLLET;
-
-			if(epoll_ctl(ep_info->ep, op, F->fd, &ep_event) != 0)
-			{
-				rb_lib_log("rb_select_epoll(): epoll_ctl failed: %s",
-					   strerror(errno));
-			}
-		}
-
 	}
 	return RB_OK;
 }
@@ -352,6 +410,7 @@ signalfd_handler(rb_fde_t *F, void *data __attribute__((unused)))
 
 		if(ret < 0)
 		{
+			F->pready &= ~RB_SELECT_READ;
 			rb_setselect(F, RB_SELECT_READ, signalfd_handler, NULL);
 			return;
 		}
@@ -454,6 +513,8 @@ rb_read_timerfd(rb_fde_t *F, void *data)
 			   strerror(errno));
 		return;
 	}
+	/* one read always collects every expiry */
+	F->pready &= ~RB_SELECT_READ;
 	rb_setselect(F, RB_SELECT_READ, rb_read_timerfd, event);
 	rb_run_one_event(event);
 }
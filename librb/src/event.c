@@ -49,8 +49,132 @@
 #define EV_NAME_LEN 33
 static char last_event_ran[EV_NAME_LEN];
 static rb_dlink_list event_list;
+static struct rb_timer_heap event_heap;
+static struct ev_entry *event_running;
 
-static time_t event_time_min = -1;
+#define RB_TIMER_HEAP_MIN 16
+
+static void
+rb_timer_heap_set(struct rb_timer_heap *heap, unsigned int i, struct rb_timer *timer)
+{
+	heap->timers[i] = timer;
+	timer->index = i;
+}
+
+static void
+rb_timer_heap_up(struct rb_timer_heap *heap, unsigned int i)
+{
+	struct rb_timer *timer = heap->timers[i];
+
+	while(i > 1 && heap->timers[i / 2]->when > timer->when)
+	{
+		rb_timer_heap_set(heap, i, heap->timers[i / 2]);
+		i /= 2;
+	}
+	rb_timer_heap_set(heap, i, timer);
+}
+
+static void
+rb_timer_heap_down(struct rb_timer_heap *heap, unsigned int i)
+{
+	struct rb_timer *timer = heap->timers[i];
+	unsigned int child;
+
+	while((child = i * 2) <= heap->count)
+	{
+		if(child < heap->count && heap->timers[child + 1]->when < heap->timers[child]->when)
+			child++;
+		if(heap->timers[child]->when >= timer->when)
+			break;
+		rb_timer_heap_set(heap, i, heap->timers[child]);
+		i = child;
+	}
+	rb_timer_heap_set(heap, i, timer);
+}
+
+/*
+ * void rb_timer_heap_add(struct rb_timer_heap *heap, struct rb_timer *timer, time_t when)
+ *
+ * Input: heap, timer and the time it should fire
+ * Output: None
+ * Side Effects: Queues the timer, or moves it if it was already queued.
+ *		 O(log n) either way.
+ */
+void
+rb_timer_heap_add(struct rb_timer_heap *heap, struct rb_timer *timer, time_t when)
+{
+	time_t old = timer->when;
+
+	timer->when = when;
+
+	if(timer->index != 0)
+	{
+		if(when < old)
+			rb_timer_heap_up(heap, timer->index);
+		else
+			rb_timer_heap_down(heap, timer->index);
+		return;
+	}
+
+	if(heap->count + 1 >= heap->alloc)
+	{
+		heap->alloc = heap->alloc ? heap->alloc * 2 : RB_TIMER_HEAP_MIN;
+		heap->timers = rb_realloc(heap->timers, sizeof(struct rb_timer *) * heap->alloc);
+	}
+
+	heap->timers[++heap->count] = timer;
+	rb_timer_heap_up(heap, heap->count);
+}
+
+/*
+ * void rb_timer_heap_del(struct rb_timer_heap *heap, struct rb_timer *timer)
+ *
+ * Input: heap and timer
+ * Output: None
+ * Side Effects: Removes the timer from the heap if it is queued.
+ */
+void
+rb_timer_heap_del(struct rb_timer_heap *heap, struct rb_timer *timer)
+{
+	unsigned int i = timer->index;
+	struct rb_timer *last;
+
+	if(i == 0)
+		return;
+
+	lrb_assert(heap->timers[i] == timer);
+	timer->index = 0;
+
+	last = heap->timers[heap->count--];
+	if(last != timer)
+	{
+		rb_timer_heap_set(heap, i, last);
+		if(i > 1 && heap->timers[i / 2]->when > last->when)
+			rb_timer_heap_up(heap, i);
+		else
+			rb_timer_heap_down(heap, i);
+	}
+
+	/* give memory back after a burst of timers has drained */
+	if(heap->alloc > RB_TIMER_HEAP_MIN && heap->count < heap->alloc / 4)
+	{
+		heap->alloc /= 2;
+		heap->timers = rb_realloc(heap->timers, sizeof(struct rb_timer *) * heap->alloc);
+	}
+}
+
+void
+rb_timer_heap_free(struct rb_timer_heap *heap)
+{
+	unsigned int i;
+
+	for(i = 1; i <= heap->count; i++)
+		heap->timers[i]->index = 0;
+
+	rb_free(heap->timers);
+	heap->timers = NULL;
+	heap->count = heap->alloc = 0;
+}
 
 /*
  * struct ev_entry *
@@ -84,14 +208,12 @@ rb_event_add_common(const char *name, EVH * func, void *arg, time_t when, time_t
 	ev->func = func;
 	ev->name = rb_strndup(name, EV_NAME_LEN);
 	ev->arg = arg;
-	ev->when = rb_current_time() + when;
+	ev->timer.data = ev;
 	ev->next = when;
 	ev->frequency = frequency;
 	ev->dead = 0;
 
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
-
+	rb_timer_heap_add(&event_heap, &ev->timer, rb_current_time() + when);
 	rb_dlinkAdd(ev, &ev->node, &event_list);
 	rb_io_sched_event(ev, when);
 	return ev;
@@ -130,22 +252,35 @@ rb_event_addonce(const char *name, EVH * func, void *arg, time_t when)
 	return rb_event_add_common(name, func, arg, when, 0);
 }
 
+static void
+rb_event_free(struct ev_entry *ev)
+{
+	rb_dlinkDelete(&ev->node, &event_list);
+	rb_free(ev->name);
+	rb_free(ev);
+}
+
 /*
  * void rb_event_delete(struct ev_entry *ev)
  *
  * Input: pointer to ev_entry for the event
  * Output: None
- * Side Effects: Removes the event from the event list
+ * Side Effects: Removes the event from the event list.  An event
+ *		 deleting itself while it runs is freed once it returns.
  */
 void
 rb_event_delete(struct ev_entry *ev)
 {
-	if(ev == NULL)
+	if(ev == NULL || ev->dead)
 		return;
 
 	ev->dead = 1;
 
 	rb_io_unsched_event(ev);
+	rb_timer_heap_del(&event_heap, &ev->timer);
+
+	if(ev != event_running)
+		rb_event_free(ev);
 }
 
 /*
@@ -197,15 +332,26 @@ void
 rb_run_one_event(struct ev_entry *ev)
 {
 	rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+
+	event_running = ev;
 	ev->func(ev->arg);
+	event_running = NULL;
+
+	if(ev->dead)
+	{
+		rb_event_free(ev);
+		return;
+	}
+
+	/* event is only scheduled once */
 	if(!ev->frequency)
 	{
 		rb_event_delete(ev);
 		return;
 	}
-	ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+
+	rb_timer_heap_add(&event_heap, &ev->timer,
+			rb_current_time() + rb_event_frequency(ev->frequency));
 }
 
 void
@@ -217,7 +363,7 @@ rb_run_one_event_for_tests(const char *name)
 	RB_DLINK_FOREACH(ptr, event_list.head)
 	{
 		ev = ptr->data;
-		if (!strcmp(ev->name, name))
+		if (!ev->dead && !strcmp(ev->name, name))
 		{
 			rb_run_one_event(ev);
 			return;
@@ -230,53 +376,20 @@ rb_run_one_event_for_tests(const char *name)
  *
  * Input: None
  * Output: None
- * Side Effects: Runs pending events in the event list
+ * Side Effects: Runs pending events, earliest first.  Only the due
+ *		 events are looked at.
  */
 void
 rb_event_run(void)
 {
-	rb_dlink_node *ptr, *next;
-	struct ev_entry *ev;
+	struct rb_timer *timer;
 
 	if(rb_io_supports_event())
 		return;
 
-	event_time_min = -1;
-	RB_DLINK_FOREACH_SAFE(ptr, next, event_list.head)
-	{
-		ev = ptr->data;
-		if (ev->dead)
-		{
-			rb_dlinkDelete(&ev->node, &event_list);
-			rb_free(ev->name);
-			rb_free(ev);
-			continue;
-		}
-		if(ev->when <= rb_current_time())
-		{
-			rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
-			ev->func(ev->arg);
-
-			/* event is scheduled more than once */
-			if(ev->frequency)
-			{
-				ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-				if((ev->when < event_time_min) || (event_time_min == -1))
-					event_time_min = ev->when;
-			}
-			else
-			{
-				rb_dlinkDelete(&ev->node, &event_list);
-				rb_free(ev->name);
-				rb_free(ev);
-			}
-		}
-		else
-		{
-			if((ev->when < event_time_min) || (event_time_min == -1))
-				event_time_min = ev->when;
-		}
-	}
+	while((timer = rb_timer_heap_first(&event_heap)) != NULL &&
+			timer->when <= rb_current_time())
+		rb_run_one_event(timer->data);
 }
 
 void
@@ -324,8 +437,10 @@ rb_dump_events(void (*func) (char *, void *), void *ptr)
 	RB_DLINK_FOREACH(dptr, event_list.head)
 	{
 		ev = dptr->data;
+		if(ev->dead)
+			continue;
 		snprintf(buf, sizeof buf, "%-28s %-4lld seconds (frequency=%d)", ev->name,
-			    (long long)(ev->when - rb_current_time()), (int)ev->frequency);
+			    (long long)(ev->timer.when - rb_current_time()), (int)ev->frequency);
 		func(buf, ptr);
 	}
 }
@@ -341,13 +456,17 @@ rb_set_back_events(time_t by)
 {
 	rb_dlink_node *ptr;
 	struct ev_entry *ev;
+
+	/* moving every event back by the same amount, clamped at 0,
+	 * keeps the heap ordered
+	 */
 	RB_DLINK_FOREACH(ptr, event_list.head)
 	{
 		ev = ptr->data;
-		if(ev->when > by)
-			ev->when -= by;
+		if(ev->timer.when > by)
+			ev->timer.when -= by;
 		else
-			ev->when = 0;
+			ev->timer.when = 0;
 	}
 }
 
@@ -363,13 +482,15 @@ rb_event_update(struct ev_entry *ev, time_t freq)
 	 * than the new frequency
 	 */
 	time_t next = rb_event_frequency(freq);
-	if((rb_current_time() + next) < ev->when)
-		ev->when = rb_current_time() + next;
+	if((rb_current_time() + next) < ev->timer.when && ev->timer.index != 0)
+		rb_timer_heap_add(&event_heap, &ev->timer, rb_current_time() + next);
 	return;
 }
 
 time_t
 rb_event_next(void)
 {
-	return event_time_min;
+	struct rb_timer *timer = rb_timer_heap_first(&event_heap);
+
+	return timer != NULL ? timer->when : -1;
 }
@@ -27,10 +27,90 @@
 #include <rb_lib.h>
 #include <commio-int.h>
 
-static rb_bh *rb_linebuf_heap;
+/* usable buffer size of each line size class, smallest first */
+static const int rb_linebuf_class_size[LINEBUF_CLASSES] = {
+	128, 512, 2048, LINEBUF_SIZE + CRLF_LEN + 1
+};
+
+static rb_bh *rb_linebuf_heap[LINEBUF_CLASSES];
+static size_t rb_linebuf_class_count[LINEBUF_CLASSES];
 
 static int bufline_count = 0;
 
+/* rings are never smaller than this, and are given back once they
+ * drain if they grew larger than LINEBUF_RING_KEEP
+ */
+#define LINEBUF_RING_MIN	4
+#define LINEBUF_RING_KEEP	16
+
+static inline buf_line_t **
+rb_linebuf_slot(buf_head_t * bufhead, int n)
+{
+	return &bufhead->lines[(bufhead->first + n) & (bufhead->size - 1)];
+}
+
+static inline buf_line_t *
+rb_linebuf_head(buf_head_t * bufhead)
+{
+	if(bufhead->numlines == 0)
+		return NULL;
+	return bufhead->lines[bufhead->first];
+}
+
+static inline buf_line_t *
+rb_linebuf_tail(buf_head_t * bufhead)
+{
+	if(bufhead->numlines == 0)
+		return NULL;
+	return *rb_linebuf_slot(bufhead, bufhead->numlines - 1);
+}
+
+/*
+ * rb_linebuf_reserve
+ *
+ * Make sure the ring has room for count more lines, unwrapping it
+ * into a larger allocation if not.
+ */
+static void
+rb_linebuf_reserve(buf_head_t * bufhead, int count)
+{
+	buf_line_t **lines;
+	unsigned int size;
+	int i;
+
+	if(bufhead->numlines + count <= (int)bufhead->size)
+		return;
+
+	size = bufhead->size ? bufhead->size : LINEBUF_RING_MIN;
+	while((int)size < bufhead->numlines + count)
+		size <<= 1;
+
+	lines = rb_malloc(sizeof(buf_line_t *) * size);
+	for(i = 0; i < bufhead->numlines; i++)
+		lines[i] = *rb_linebuf_slot(bufhead, i);
+
+	rb_free(bufhead->lines);
+	bufhead->lines = lines;
+	bufhead->first = 0;
+	bufhead->size = size;
+}
+
+/*
+ * rb_linebuf_push
+ *
+ * Add a reference to a line at the end of the ring, which must already
+ * have room for it.
+ */
+static inline void
+rb_linebuf_push(buf_head_t * bufhead, buf_line_t * bufline)
+{
+	*rb_linebuf_slot(bufhead, bufhead->numlines) = bufline;
+	bufline->refcount++;
+
+	bufhead->alloclen++;
+	bufhead->numlines++;
+}
+
 /*
  * rb_linebuf_init
  *
@@ -40,14 +120,53 @@ static int bufline_count = 0;
 void
 rb_linebuf_init(size_t heap_size)
 {
-	rb_linebuf_heap = rb_bh_create(sizeof(buf_line_t), heap_size, "librb_linebuf_heap");
+	static const char *desc[LINEBUF_CLASSES] = {
+		"librb_linebuf_heap_128", "librb_linebuf_heap_512",
+		"librb_linebuf_heap_2048", "librb_linebuf_heap"
+	};
+	size_t perblock;
+	int i;
+
+	for(i = 0; i < LINEBUF_CLASSES; i++)
+	{
+		/* larger classes get proportionally fewer lines per block */
+		perblock = heap_size >> (2 * i);
+		if(perblock == 0)
+			perblock = 1;
+
+		rb_linebuf_heap[i] = rb_bh_create(sizeof(buf_line_t) + rb_linebuf_class_size[i],
+						  perblock, desc[i]);
+	}
 }
 
+/*
+ * rb_linebuf_allocate
+ *
+ * Allocate a line from the smallest size class that can hold
+ * size bytes, including the terminator.
+ */
 static buf_line_t *
-rb_linebuf_allocate(void)
+rb_linebuf_allocate(int size)
 {
 	buf_line_t *t;
-	t = rb_bh_alloc(rb_linebuf_heap);
+	int i;
+
+	for(i = 0; i < LINEBUF_CLASSES - 1; i++)
+	{
+		if(size <= rb_linebuf_class_size[i])
+			break;
+	}
+
+	t = rb_bh_alloc(rb_linebuf_heap[i]);
+	if(t == NULL)
+		return NULL;
+
+	t->terminated = 0;
+	t->raw = 0;
+	t->sclass = i;
+	t->len = 0;
+	t->refcount = 0;
+	rb_linebuf_class_count[i]++;
 	return (t);
 
 }
@@ -55,47 +174,82 @@ rb_linebuf_allocate(void)
 static void
 rb_linebuf_free(buf_line_t * p)
 {
-	rb_bh_free(rb_linebuf_heap, p);
+	rb_linebuf_class_count[p->sclass]--;
+	rb_bh_free(rb_linebuf_heap[p->sclass], p);
 }
 
 /*
  * rb_linebuf_new_line
  *
- * Create a new line, and link it to the given linebuf.
- * It will be initially empty.
+ * Create a new line big enough for size bytes, and link it to the
+ * given linebuf.  It will be initially empty.
  */
 static buf_line_t *
-rb_linebuf_new_line(buf_head_t * bufhead)
+rb_linebuf_new_line(buf_head_t * bufhead, int size)
 {
 	buf_line_t *bufline;
 
-	bufline = rb_linebuf_allocate();
+	bufline = rb_linebuf_allocate(size);
 	if(bufline == NULL)
 		return NULL;
 	++bufline_count;
 
-	/* Stick it at the end of the buf list */
-	rb_dlinkAddTailAlloc(bufline, &bufhead->list);
-	bufline->refcount++;
-
-	/* And finally, update the allocated size */
-	bufhead->alloclen++;
-	bufhead->numlines++;
+	/* Stick it at the end of the ring */
+	rb_linebuf_reserve(bufhead, 1);
+	rb_linebuf_push(bufhead, bufline);
 
 	return bufline;
 }
 
+/*
+ * rb_linebuf_grow_line
+ *
+ * Move a partial line into a larger size class so it can hold
+ * size bytes.  Only lines owned solely by this linebuf (i.e. ones
+ * being built by rb_linebuf_parse) may be grown.
+ */
+static buf_line_t *
+rb_linebuf_grow_line(buf_line_t **slot, int size)
+{
+	buf_line_t *bufline = *slot;
+	buf_line_t *newline;
+
+	if(size <= rb_linebuf_class_size[bufline->sclass])
+		return bufline;
+
+	lrb_assert(bufline->refcount == 1);
+
+	newline = rb_linebuf_allocate(size);
+	if(newline == NULL)
+		return NULL;
+
+	memcpy(newline->buf, bufline->buf, bufline->len);
+	newline->terminated = bufline->terminated;
+	newline->raw = bufline->raw;
+	newline->len = bufline->len;
+	newline->refcount = bufline->refcount;
+
+	*slot = newline;
+	rb_linebuf_free(bufline);
+	return newline;
+}
+
 
 /*
  * rb_linebuf_done_line
  *
- * We've finished with the given line, so deallocate it
+ * We've finished with the first line, so drop our reference to it
+ * and deallocate it if nobody else holds one
  */
 static void
-rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *node)
+rb_linebuf_done_line(buf_head_t * bufhead)
 {
-	/* Remove it from the linked list */
-	rb_dlinkDestroy(node, &bufhead->list);
+	buf_line_t *bufline = rb_linebuf_head(bufhead);
+
+	lrb_assert(bufline != NULL);
+
+	/* Remove it from the ring */
+	bufhead->first = (bufhead->first + 1) & (bufhead->size - 1);
 
 	/* Update the allocated size */
 	bufhead->alloclen--;
@@ -103,6 +257,17 @@ rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *
 	lrb_assert(bufhead->len >= 0);
 	bufhead->numlines--;
 
+	if(bufhead->numlines == 0)
+	{
+		bufhead->first = 0;
+		if(bufhead->size > LINEBUF_RING_KEEP)
+		{
+			rb_free(bufhead->lines);
+			bufhead->lines = NULL;
+			bufhead->size = 0;
+		}
+	}
+
 	bufline->refcount--;
 	lrb_assert(bufline->refcount >= 0);
 
@@ -144,6 +309,18 @@ rb_linebuf_skip_crlf(char *ch, int len)
 }
 
 
+/*
+ * how big a line needs to be to append linelen bytes to one already
+ * holding curlen bytes, bearing in mind the copy functions truncate
+ * at LINEBUF_SIZE and always add a terminator.
+ */
+static inline int
+rb_linebuf_line_size(int curlen, int linelen)
+{
+	if(linelen > LINEBUF_SIZE - curlen)
+		return LINEBUF_SIZE + 1;
+	return curlen + linelen + 1;
+}
 
 /*
  * rb_linebuf_newbuf
@@ -165,11 +342,12 @@ rb_linebuf_newbuf(buf_head_t * bufhead)
 void
 rb_linebuf_donebuf(buf_head_t * bufhead)
 {
-	while(bufhead->list.head != NULL)
-	{
-		rb_linebuf_done_line(bufhead, (buf_line_t *) bufhead->list.head->data,
-				     bufhead->list.head);
-	}
+	while(bufhead->numlines > 0)
+		rb_linebuf_done_line(bufhead);
+
+	rb_free(bufhead->lines);
+	bufhead->lines = NULL;
+	bufhead->size = 0;
 }
 
 /*
@@ -191,6 +369,9 @@ rb_linebuf_donebuf(buf_head_t * bufhead)
  * This still sucks in my opinion, but it seems to work.
  *
  * -Aaron
+ *
+ * len must already be bounded to the end of the first line (see
+ * rb_linebuf_skip_crlf), and the line must be big enough to hold it.
  */
 static int
 rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
@@ -208,9 +389,7 @@ rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
 	if(bufline->terminated == 1)
 		return 0;
 
-	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
-	if(clen == -1)
-		return -1;
+	clen = cpylen = len;
 
 	/* This is the ~overflow case..This doesn't happen often.. */
 	if(cpylen > (LINEBUF_SIZE - bufline->len))
@@ -265,6 +444,8 @@ rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
  * Copy as much data as possible directly into a linebuf,
  * splitting at \r\n, but without altering any data.
  *
+ * As with rb_linebuf_copy_line, len must already be bounded to the
+ * end of the first line.
  */
 static int
 rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
@@ -282,9 +463,7 @@ rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
 	if(bufline->terminated == 1)
 		return 0;
 
-	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
-	if(clen == -1)
-		return -1;
+	clen = cpylen = len;
 
 	/* This is the overflow case..This doesn't happen often.. */
 	if(cpylen > (LINEBUF_SIZE - bufline->len))
@@ -341,18 +520,30 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 {
 	buf_line_t *bufline;
 	int cpylen;
+	int linelen;
 	int linecnt = 0;
 
 	/* First, if we have a partial buffer, try to squeze data into it */
-	if(bufhead->list.tail != NULL)
+	if(bufhead->numlines > 0)
 	{
 		/* Check we're doing the partial buffer thing */
-		bufline = bufhead->list.tail->data;
+		bufline = rb_linebuf_tail(bufhead);
+		linelen = rb_linebuf_skip_crlf(data, len);
+
+		/* make room for what we're about to add */
+		if(!bufline->terminated)
+		{
+			bufline = rb_linebuf_grow_line(rb_linebuf_slot(bufhead, bufhead->numlines - 1),
+					rb_linebuf_line_size(bufline->len, linelen));
+			if(bufline == NULL)
+				return -1;
+		}
+
 		/* just try, the worst it could do is *reject* us .. */
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, linelen);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, linelen);
 
 		if(cpylen == -1)
 			return -1;
@@ -371,14 +562,18 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 	/* Next, the loop */
 	while(len > 0)
 	{
+		linelen = rb_linebuf_skip_crlf(data, len);
+
 		/* We obviously need a new buffer, so .. */
-		bufline = rb_linebuf_new_line(bufhead);
+		bufline = rb_linebuf_new_line(bufhead, rb_linebuf_line_size(0, linelen));
+		if(bufline == NULL)
+			return -1;
 
 		/* And parse */
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, linelen);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, linelen);
 
 		if(cpylen == -1)
 			return -1;
@@ -406,11 +601,10 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	char *start, *ch;
 
 	/* make sure we have a line */
-	if(bufhead->list.head == NULL)
+	bufline = rb_linebuf_head(bufhead);
+	if(bufline == NULL)
 		return 0;	/* Obviously not.. hrm. */
 
-	bufline = bufhead->list.head->data;
-
 	/* make sure that the buffer was actually *terminated */
 	if(!(partial || bufline->terminated))
 		return 0;	/* Wait for more data! */
@@ -452,7 +646,7 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	lrb_assert(cpylen >= 0);
 
 	/* Deallocate the line */
-	rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+	rb_linebuf_done_line(bufhead);
 
 	/* return how much we copied */
 	return cpylen;
@@ -462,25 +656,44 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
  * rb_linebuf_attach
  *
  * attach the lines in a buf_head_t to another buf_head_t
- * without copying the data (using refcounts).
+ * without copying the data (using refcounts).  this is how a
+ * message is fanned out, so it costs a pointer per line.
  */
 void
 rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 {
-	rb_dlink_node *ptr;
 	buf_line_t *line;
+	int i;
 
-	RB_DLINK_FOREACH(ptr, new->list.head)
-	{
-		line = ptr->data;
-		rb_dlinkAddTailAlloc(line, &bufhead->list);
+	rb_linebuf_reserve(bufhead, new->numlines);
 
-		/* Update the allocated size */
-		bufhead->alloclen++;
+	for(i = 0; i < new->numlines; i++)
+	{
+		line = *rb_linebuf_slot(new, i);
+		rb_linebuf_push(bufhead, line);
 		bufhead->len += line->len;
-		bufhead->numlines++;
+	}
+}
+
+/*
+ * rb_linebuf_foreach
+ *
+ * call func for each line still queued, oldest first.  the first line
+ * starts after whatever of it rb_linebuf_flush() has already written.
+ */
+void
+rb_linebuf_foreach(buf_head_t * bufhead, void (*func)(const char *data, int len, int terminated, void *arg), void *arg)
+{
+	buf_line_t *line;
+	int i, ofs;
 
-		line->refcount++;
+	for(i = 0; i < bufhead->numlines; i++)
+	{
+		line = *rb_linebuf_slot(bufhead, i);
+		ofs = i == 0 ? bufhead->writeofs : 0;
+		if(ofs > line->len)
+			ofs = line->len;
+		func(line->buf + ofs, line->len - ofs, line->terminated, arg);
 	}
 }
 
@@ -492,20 +705,18 @@ rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 void
 rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 {
+	static char putbuf[LINEBUF_SIZE + CRLF_LEN + 1];
 	buf_line_t *bufline;
 	size_t len = 0;
 	int ret;
 
 	/* make sure the previous line is terminated */
-	if (bufhead->list.tail) {
-		bufline = bufhead->list.tail->data;
+	if (bufhead->numlines > 0) {
+		bufline = rb_linebuf_tail(bufhead);
 		lrb_assert(bufline->terminated);
 	}
 
-	/* create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
-
-	ret = rb_fsnprint(bufline->buf, LINEBUF_SIZE + 1, strings);
+	ret = rb_fsnprint(putbuf, LINEBUF_SIZE + 1, strings);
 	if (ret > 0)
 		len += ret;
 
@@ -513,9 +724,13 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 		len = LINEBUF_SIZE;
 
 	/* add trailing CRLF */
-	bufline->buf[len++] = '\r';
-	bufline->buf[len++] = '\n';
-	bufline->buf[len] = '\0';
+	putbuf[len++] = '\r';
+	putbuf[len++] = '\n';
+	putbuf[len] = '\0';
+
+	/* create a new line only as big as the formatted data */
+	bufline = rb_linebuf_new_line(bufhead, len + 1);
+	memcpy(bufline->buf, putbuf, len + 1);
 
 	bufline->terminated = 1;
 
@@ -547,71 +762,45 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
  */
 	if(!rb_fd_ssl(F))
 	{
-		rb_dlink_node *ptr;
 		int x = 0, y;
 		int xret;
 		static struct rb_iovec vec[RB_UIO_MAXIOV];
 
-		memset(vec, 0, sizeof(vec));
 		/* Check we actually have a first buffer */
-		if(bufhead->list.head == NULL)
+		bufline = rb_linebuf_head(bufhead);
+		if(bufline == NULL || !bufline->terminated)
 		{
 			/* nope, so we return none .. */
 			errno = EWOULDBLOCK;
 			return -1;
 		}
 
-		ptr = bufhead->list.head;
-
-		bufline = ptr->data;
-		if(!bufline->terminated)
-		{
-			errno = EWOULDBLOCK;
-			return -1;
-
-		}
-
 		vec[x].iov_base = bufline->buf + bufhead->writeofs;
 		vec[x++].iov_len = bufline->len - bufhead->writeofs;
-		ptr = ptr->next;
 
-		do
+		/* gather as many complete lines as we can from the ring */
+		for(; x < RB_UIO_MAXIOV && x < bufhead->numlines; x++)
 		{
-			if(ptr == NULL)
-				break;
-
-			bufline = ptr->data;
+			bufline = *rb_linebuf_slot(bufhead, x);
 			if(!bufline->terminated)
 				break;
 
 			vec[x].iov_base = bufline->buf;
 			vec[x].iov_len = bufline->len;
-			ptr = ptr->next;
-
-		}
-		while(++x < RB_UIO_MAXIOV);
-
-		if(x == 0)
-		{
-			errno = EWOULDBLOCK;
-			return -1;
 		}
 
 		xret = retval = rb_writev(F, vec, x);
 		if(retval <= 0)
 			return retval;
 
-		ptr = bufhead->list.head;
-
 		for(y = 0; y < x; y++)
 		{
-			bufline = ptr->data;
+			bufline = rb_linebuf_head(bufhead);
 
 			if(xret >= bufline->len - bufhead->writeofs)
 			{
 				xret -= bufline->len - bufhead->writeofs;
-				ptr = ptr->next;
-				rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+				rb_linebuf_done_line(bufhead);
 				bufhead->writeofs = 0;
 			}
 			else
@@ -627,15 +816,14 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	/* this is the non-writev case */
 
 	/* Check we actually have a first buffer */
-	if(bufhead->list.head == NULL)
+	bufline = rb_linebuf_head(bufhead);
+	if(bufline == NULL)
 	{
 		/* nope, so we return none .. */
 		errno = EWOULDBLOCK;
 		return -1;
 	}
 
-	bufline = bufhead->list.head->data;
-
 	/* And that its actually full .. */
 	if(!bufline->terminated)
 	{
@@ -658,7 +846,7 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	{
 		bufhead->writeofs = 0;
 		lrb_assert(bufhead->len >= 0);
-		rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+		rb_linebuf_done_line(bufhead);
 	}
 
 	/* Return line length */
@@ -674,5 +862,37 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 void
 rb_count_rb_linebuf_memory(size_t *count, size_t *rb_linebuf_memory_used)
 {
-	rb_bh_usage(rb_linebuf_heap, count, NULL, rb_linebuf_memory_used, NULL);
+	size_t c, mem;
+	int i;
+
+	*count = 0;
+	*rb_linebuf_memory_used = 0;
+
+	for(i = 0; i < LINEBUF_CLASSES; i++)
+	{
+		rb_count_rb_linebuf_class_memory(i, NULL, &c, &mem);
+		*count += c;
+		*rb_linebuf_memory_used += mem;
+	}
+}
+
+/*
+ * count linebufs in a single size class, returns -1 if there is no
+ * such class
+ */
+int
+rb_count_rb_linebuf_class_memory(int sclass, size_t *linesize, size_t *count,
+				 size_t *rb_linebuf_memory_used)
+{
+	if(sclass < 0 || sclass >= LINEBUF_CLASSES)
+		return -1;
+
+	if(linesize != NULL)
+		*linesize = rb_linebuf_class_size[sclass];
+	if(count != NULL)
+		*count = rb_linebuf_class_count[sclass];
+	if(rb_linebuf_memory_used != NULL)
+		*rb_linebuf_memory_used = rb_linebuf_class_count[sclass] *
+			(sizeof(buf_line_t) + rb_linebuf_class_size[sclass]);
+	return 0;
 }
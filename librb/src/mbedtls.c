@@ -822,6 +822,19 @@ rb_ssl_clear_handshake_count(rb_fde_t *const F)
 	F->handshake_count = 0;
 }
 
+int
+rb_ssl_set_ticket_key(const uint8_t *const key __attribute__((unused)), const size_t len __attribute__((unused)))
+{
+	/* session resumption is not implemented for this backend */
+	return 0;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *const F __attribute__((unused)))
+{
+	return 0;
+}
+
 void
 rb_ssl_start_accepted(rb_fde_t *const F, ACCB *const cb, void *const data, const int timeout)
 {
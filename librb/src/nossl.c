@@ -167,6 +167,19 @@ rb_ssl_clear_handshake_count(rb_fde_t *F __attribute__((unused)))
 	return;
 }
 
+int
+rb_ssl_set_ticket_key(const uint8_t *key __attribute__((unused)), size_t len __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return 0;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *F __attribute__((unused)))
+{
+	return 0;
+}
+
 void
 rb_get_ssl_info(char *buf __attribute__((unused)), size_t len __attribute__((unused)))
 {
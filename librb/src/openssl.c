@@ -45,6 +45,13 @@ typedef enum
 
 static SSL_CTX *ssl_ctx = NULL;
 
+/* shared by every ssld, so a client can resume on any of them */
+static uint8_t ssl_ticket_key[RB_SSL_TICKET_KEY_LEN];
+static int ssl_have_ticket_key = 0;
+
+#define RB_SSL_SESSION_CACHE_SIZE	20000
+#define RB_SSL_SESSION_TIMEOUT		7200
+
 struct ssl_connect
 {
 	CNCB *callback;
@@ -190,6 +197,39 @@ rb_ssl_strerror(const unsigned long err)
 	return errbuf;
 }
 
+/*
+ * Session resumption is only turned on once we have been given a ticket
+ * key, so that tickets issued by one process can be redeemed by another.
+ * The server-side session cache is per process and mostly helps clients
+ * that do not do tickets and happen to come back to the same ssld.
+ */
+static void
+rb_ssl_setup_resumption(SSL_CTX *const ctx)
+{
+	if(!ssl_have_ticket_key)
+		return;
+
+	const long keylen = SSL_CTX_get_tlsext_ticket_keys(ctx, NULL, 0);
+
+	if(keylen <= 0 || (size_t) keylen > sizeof ssl_ticket_key ||
+	   SSL_CTX_set_tlsext_ticket_keys(ctx, ssl_ticket_key, keylen) != 1)
+	{
+		rb_lib_log("%s: could not set session ticket keys: %s", __func__,
+		           rb_ssl_strerror(rb_ssl_last_err()));
+		return;
+	}
+
+	/* resuming with SSL_VERIFY_PEER fails without an id context */
+	(void) SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "librb", 5);
+	(void) SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	(void) SSL_CTX_sess_set_cache_size(ctx, RB_SSL_SESSION_CACHE_SIZE);
+	(void) SSL_CTX_set_timeout(ctx, RB_SSL_SESSION_TIMEOUT);
+
+	#ifdef SSL_OP_NO_TICKET
+	(void) SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+	#endif
+}
+
 static int
 verify_accept_all_cb(const int preverify_ok __attribute__((unused)), X509_STORE_CTX *const x509_ctx __attribute__((unused)))
 {
@@ -517,6 +557,7 @@ rb_setup_ssl_server(const char *const certfile, const char *keyfile,
 	#  endif
 	#endif
 
+	rb_ssl_setup_resumption(ssl_ctx_new);
 
 	if(ssl_ctx)
 		SSL_CTX_free(ssl_ctx);
@@ -743,6 +784,30 @@ rb_ssl_clear_handshake_count(rb_fde_t *const F)
 	F->handshake_count = 0;
 }
 
+int
+rb_ssl_set_ticket_key(const uint8_t *const key, const size_t len)
+{
+	if(key == NULL || len != sizeof ssl_ticket_key)
+		return 0;
+
+	(void) memcpy(ssl_ticket_key, key, sizeof ssl_ticket_key);
+	ssl_have_ticket_key = 1;
+
+	if(ssl_ctx != NULL)
+		rb_ssl_setup_resumption(ssl_ctx);
+
+	return 1;
+}
+
+int
+rb_ssl_session_reused(rb_fde_t *const F)
+{
+	if(F == NULL || F->ssl == NULL)
+		return 0;
+
+	return SSL_session_reused(SSL_P(F)) ? 1 : 0;
+}
+
 void
 rb_ssl_start_accepted(rb_fde_t *const F, ACCB *const cb, void *const data, const int timeout)
 {
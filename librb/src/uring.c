@@ -0,0 +1,531 @@
+/*
+ *  Solanum: a slightly advanced ircd
+ *  uring.c: Linux io_uring network routines.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#include <librb_config.h>
+#include <rb_lib.h>
+#include <commio-int.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USING_URING
+
+/*
+ * This backend keeps librb's readiness model: every fd with a handler
+ * has a one-shot IORING_OP_POLL_ADD outstanding, and the handlers do
+ * their own reads and writes as with any other backend.  What it saves
+ * is syscalls: arming, re-arming and cancelling polls only queue
+ * submission entries, and everything queued during a pass of the loop
+ * goes to the kernel in the same io_uring_enter that waits for the next
+ * completions.
+ *
+ * A poll's user_data is the fd number plus a per-fd generation, bumped
+ * whenever a new poll is queued, so completions for polls that have
+ * since been cancelled or replaced (or whose fd has been closed and
+ * reused) are recognised and dropped.
+ */
+
+#define URING_ENTRIES		4096
+#define URING_UD_IGNORE		0
+#define URING_UD_TIMEOUT	1
+
+struct uring_info
+{
+	int fd;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail;
+	unsigned int to_submit;
+	struct io_uring_sqe *sqes;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+
+	uint32_t *gens;		/* generation of the poll queued for each fd */
+	int gens_size;
+
+	rb_dlink_list dirty;
+};
+
+static struct uring_info *ur_info;
+static struct __kernel_timespec uring_ts;
+
+static int
+uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, ur_info->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void
+uring_submit(void)
+{
+	int ret;
+
+	while(ur_info->to_submit > 0)
+	{
+		ret = uring_enter(ur_info->to_submit, 0, 0);
+		rb_iostats.ctls++;
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			rb_lib_log("uring_submit(): io_uring_enter failed: %s", strerror(errno));
+			abort();
+		}
+		ur_info->to_submit -= ret;
+	}
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, idx;
+
+	head = __atomic_load_n(ur_info->sq_head, __ATOMIC_ACQUIRE);
+	if(ur_info->sq_local_tail - head >= ur_info->sq_entries)
+	{
+		/* the ring is full, hand what we have to the kernel now */
+		uring_submit();
+		head = __atomic_load_n(ur_info->sq_head, __ATOMIC_ACQUIRE);
+		lrb_assert(ur_info->sq_local_tail - head < ur_info->sq_entries);
+	}
+
+	idx = ur_info->sq_local_tail & *ur_info->sq_mask;
+	sqe = &ur_info->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ur_info->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void
+uring_queue_sqe(void)
+{
+	ur_info->sq_local_tail++;
+	ur_info->to_submit++;
+	__atomic_store_n(ur_info->sq_tail, ur_info->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+uring_user_data(int fd)
+{
+	return ((uint64_t)ur_info->gens[fd] << 32) | (uint32_t)fd;
+}
+
+static void
+uring_grow_gens(int fd)
+{
+	int old = ur_info->gens_size;
+
+	if(rb_likely(fd < old))
+		return;
+
+	while(ur_info->gens_size <= fd)
+		ur_info->gens_size += 1024;
+	ur_info->gens = rb_realloc(ur_info->gens, ur_info->gens_size * sizeof(uint32_t));
+	memset(&ur_info->gens[old], 0, (ur_info->gens_size - old) * sizeof(uint32_t));
+}
+
+static void
+uring_poll_remove(rb_fde_t *F)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_user_data(F->fd);
+	sqe->user_data = URING_UD_IGNORE;
+	uring_queue_sqe();
+
+	/* anything still on its way back for the old poll is stale now */
+	ur_info->gens[F->fd]++;
+	F->pflags = 0;
+}
+
+static void
+uring_poll_add(rb_fde_t *F, int events)
+{
+	struct io_uring_sqe *sqe;
+
+	uring_grow_gens(F->fd);
+	if(++ur_info->gens[F->fd] == 0)
+		ur_info->gens[F->fd] = 1;
+
+	sqe = uring_get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = F->fd;
+	sqe->poll_events = events;
+	sqe->user_data = uring_user_data(F->fd);
+	uring_queue_sqe();
+
+	F->pflags = events;
+}
+
+static inline int
+uring_want(rb_fde_t *F)
+{
+	int want = 0;
+
+	if(F->read_handler != NULL)
+		want |= POLLIN;
+	if(F->write_handler != NULL)
+		want |= POLLOUT;
+	return want;
+}
+
+static inline int
+uring_dirty(rb_fde_t *F)
+{
+	return F->ionode.prev != NULL || ur_info->dirty.head == &F->ionode;
+}
+
+static void
+uring_flush(void)
+{
+	rb_dlink_node *ptr, *next;
+	rb_fde_t *F;
+	int want;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, ur_info->dirty.head)
+	{
+		F = ptr->data;
+		rb_dlinkDelete(ptr, &ur_info->dirty);
+
+		want = uring_want(F);
+		if(want == 0 || (want & ~F->pflags) == 0)
+			continue;
+
+		if(F->pflags != 0)
+			uring_poll_remove(F);
+		uring_poll_add(F, want);
+	}
+}
+
+/*
+ * rb_init_netio
+ *
+ * This is a needed exported function which will be called to initialise
+ * the network loop code.
+ */
+int
+rb_init_netio_uring(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if(fd < 0)
+		return -1;
+
+	/* without NODROP a burst of completions could overflow the CQ ring
+	 * and lose wakeups, so leave older kernels to epoll
+	 */
+	if(!(p.features & IORING_FEAT_NODROP))
+	{
+		close(fd);
+		return -1;
+	}
+
+	ur_info = rb_malloc(sizeof(struct uring_info));
+	ur_info->fd = fd;
+	ur_info->sq_entries = p.sq_entries;
+
+	ur_info->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur_info->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur_info->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ur_info->cq_size > ur_info->sq_size)
+			ur_info->sq_size = ur_info->cq_size;
+		ur_info->cq_size = ur_info->sq_size;
+	}
+
+	ur_info->sq_ptr = mmap(NULL, ur_info->sq_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ur_info->sq_ptr == MAP_FAILED)
+		goto fail;
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		ur_info->cq_ptr = ur_info->sq_ptr;
+	else
+	{
+		ur_info->cq_ptr = mmap(NULL, ur_info->cq_size, PROT_READ | PROT_WRITE,
+				       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(ur_info->cq_ptr == MAP_FAILED)
+			goto fail;
+	}
+
+	ur_info->sqes = mmap(NULL, ur_info->sqes_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(ur_info->sqes == MAP_FAILED)
+		goto fail;
+
+	ur_info->sq_head = (unsigned int *)((char *)ur_info->sq_ptr + p.sq_off.head);
+	ur_info->sq_tail = (unsigned int *)((char *)ur_info->sq_ptr + p.sq_off.tail);
+	ur_info->sq_mask = (unsigned int *)((char *)ur_info->sq_ptr + p.sq_off.ring_mask);
+	ur_info->sq_array = (unsigned int *)((char *)ur_info->sq_ptr + p.sq_off.array);
+	ur_info->sq_local_tail = *ur_info->sq_tail;
+
+	ur_info->cq_head = (unsigned int *)((char *)ur_info->cq_ptr + p.cq_off.head);
+	ur_info->cq_tail = (unsigned int *)((char *)ur_info->cq_ptr + p.cq_off.tail);
+	ur_info->cq_mask = (unsigned int *)((char *)ur_info->cq_ptr + p.cq_off.ring_mask);
+	ur_info->cqes = (struct io_uring_cqe *)((char *)ur_info->cq_ptr + p.cq_off.cqes);
+
+	uring_grow_gens(rb_getmaxconnect());
+
+	rb_open(fd, RB_FD_UNKNOWN, "io_uring file descriptor");
+	return 0;
+
+fail:
+	if(ur_info->sq_ptr != NULL && ur_info->sq_ptr != MAP_FAILED)
+		munmap(ur_info->sq_ptr, ur_info->sq_size);
+	if(ur_info->cq_ptr != NULL && ur_info->cq_ptr != MAP_FAILED &&
+	   ur_info->cq_ptr != ur_info->sq_ptr)
+		munmap(ur_info->cq_ptr, ur_info->cq_size);
+	close(fd);
+	rb_free(ur_info);
+	ur_info = NULL;
+	return -1;
+}
+
+int
+rb_setup_fd_uring(rb_fde_t *F __attribute__((unused)))
+{
+	return 0;
+}
+
+/*
+ * rb_setselect
+ *
+ * This is a needed exported function which will be called to register
+ * and deregister interest in a pending IO state for a given FD.
+ */
+void
+rb_setselect_uring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data)
+{
+	lrb_assert(IsFDOpen(F));
+
+	if(type & RB_SELECT_READ)
+	{
+		F->read_handler = handler;
+		F->read_data = client_data;
+	}
+
+	if(type & RB_SELECT_WRITE)
+	{
+		F->write_handler = handler;
+		F->write_data = client_data;
+	}
+
+	if(uring_want(F) == 0)
+	{
+		/* the fd may be about to be closed or handed to another
+		 * process, so don't leave a poll on it
+		 */
+		if(uring_dirty(F))
+			rb_dlinkDelete(&F->ionode, &ur_info->dirty);
+		if(F->pflags != 0)
+			uring_poll_remove(F);
+		return;
+	}
+
+	/* a poll already queued for a wider set of events will do */
+	if((uring_want(F) & ~F->pflags) != 0 && !uring_dirty(F))
+		rb_dlinkAddTail(F, &F->ionode, &ur_info->dirty);
+}
+
+static void
+uring_dispatch(struct io_uring_cqe *cqe)
+{
+	rb_fde_t *F;
+	PF *hdl;
+	void *data;
+	uint32_t gen = cqe->user_data >> 32;
+	int fd = (int)(cqe->user_data & 0xffffffff);
+	int revents;
+
+	if(cqe->user_data == URING_UD_IGNORE || cqe->user_data == URING_UD_TIMEOUT)
+		return;
+
+	if(fd >= ur_info->gens_size || ur_info->gens[fd] != gen)
+		return;
+
+	F = rb_find_fd(fd);
+	if(F == NULL || !IsFDOpen(F))
+		return;
+
+	/* the poll is one-shot, so it is gone now */
+	F->pflags = 0;
+	revents = cqe->res < 0 ? POLLERR : cqe->res;
+	rb_iostats.events++;
+
+	if(revents & (POLLIN | POLLHUP | POLLERR))
+	{
+		hdl = F->read_handler;
+		data = F->read_data;
+		F->read_handler = NULL;
+		F->read_data = NULL;
+		if(hdl)
+			hdl(F, data);
+	}
+
+	if(IsFDOpen(F) && (revents & (POLLOUT | POLLHUP | POLLERR)))
+	{
+		hdl = F->write_handler;
+		data = F->write_data;
+		F->write_handler = NULL;
+		F->write_data = NULL;
+		if(hdl)
+			hdl(F, data);
+	}
+
+	/* a handler that was not fired, or re-armed itself, needs a new poll */
+	if(IsFDOpen(F) && uring_want(F) != 0 && !uring_dirty(F))
+		rb_dlinkAddTail(F, &F->ionode, &ur_info->dirty);
+}
+
+/*
+ * rb_select
+ *
+ * Called to do the new-style IO, courtesy of squid (like most of this
+ * new IO code). This routine handles the stuff we've hidden in
+ * rb_setselect and fd_table[] and calls callbacks for IO ready
+ * events.
+ */
+int
+rb_select_uring(long delay)
+{
+	struct io_uring_cqe cqe;
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, wait = 0;
+	int ret, o_errno, count = 0;
+
+	uring_flush();
+
+	head = *ur_info->cq_head;
+	tail = __atomic_load_n(ur_info->cq_tail, __ATOMIC_ACQUIRE);
+
+	/* only block if nothing is already waiting for us */
+	if(head == tail && delay != 0)
+	{
+		if(delay > 0)
+		{
+			uring_ts.tv_sec = delay / 1000;
+			uring_ts.tv_nsec = (delay % 1000) * 1000000;
+
+			sqe = uring_get_sqe();
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t)&uring_ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = URING_UD_TIMEOUT;
+			uring_queue_sqe();
+		}
+		wait = 1;
+	}
+
+	if(ur_info->to_submit > 0 || wait)
+	{
+		ret = uring_enter(ur_info->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+
+		/* save errno as rb_set_time() will likely clobber it */
+		o_errno = errno;
+		rb_set_time();
+		errno = o_errno;
+
+		if(ret < 0 && !rb_ignore_errno(o_errno) && o_errno != ETIME && o_errno != EBUSY)
+			return RB_ERROR;
+		if(ret > 0)
+			ur_info->to_submit -= ret;
+	}
+	else
+		rb_set_time();
+
+	head = *ur_info->cq_head;
+	tail = __atomic_load_n(ur_info->cq_tail, __ATOMIC_ACQUIRE);
+
+	while(head != tail)
+	{
+		if(rb_io_budget > 0 && count >= rb_io_budget)
+			break;
+
+		/* copy it out first, handlers may queue more work */
+		cqe = ur_info->cqes[head & *ur_info->cq_mask];
+		head++;
+		__atomic_store_n(ur_info->cq_head, head, __ATOMIC_RELEASE);
+
+		if(cqe.user_data != URING_UD_IGNORE && cqe.user_data != URING_UD_TIMEOUT)
+			count++;
+		uring_dispatch(&cqe);
+
+		if(head == tail)
+			tail = __atomic_load_n(ur_info->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	return RB_OK;
+}
+
+#else /* io_uring not supported here */
+int
+rb_init_netio_uring(void)
+{
+	return ENOSYS;
+}
+
+void
+rb_setselect_uring(rb_fde_t *F __attribute__((unused)), unsigned int type __attribute__((unused)), PF * handler __attribute__((unused)), void *client_data __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return;
+}
+
+int
+rb_select_uring(long delay __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+rb_setup_fd_uring(rb_fde_t *F __attribute__((unused)))
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
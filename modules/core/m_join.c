@@ -1340,6 +1340,7 @@ remove_ban_list(struct Channel *chptr, struct Client *source_p,
 	*(pbuf - 1) = '\0';
 	sendto_channel_local(source_p, mems, chptr, "%s %s", lmodebuf, lparabuf);
 
+	clear_ban_hash(chptr, list);
 	list->head = list->tail = NULL;
 	list->length = 0;
 }
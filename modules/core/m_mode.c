@@ -237,27 +237,23 @@ possibly_remove_lower_forward(struct Client *fakesource_p, int mems,
 		const char *mask, const char *forward)
 {
 	struct Ban *actualBan;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, banlist->head)
-	{
-		actualBan = ptr->data;
-		if(!irccmp(actualBan->banstr, mask) &&
-				(actualBan->forward == NULL ||
-				 irccmp(actualBan->forward, forward) < 0))
-		{
-			sendto_channel_local(fakesource_p, mems, chptr, ":%s MODE %s -%c %s%s%s",
-					fakesource_p->name,
-					chptr->chname,
-					mchar,
-					actualBan->banstr,
-					actualBan->forward ? "$" : "",
-					actualBan->forward ? actualBan->forward : "");
-			rb_dlinkDelete(&actualBan->node, banlist);
-			free_ban(actualBan);
-			return;
-		}
-	}
+	actualBan = find_ban_id(chptr, banlist, mask);
+	if(actualBan == NULL ||
+			(actualBan->forward != NULL &&
+			 irccmp(actualBan->forward, forward) >= 0))
+		return;
+
+	sendto_channel_local(fakesource_p, mems, chptr, ":%s MODE %s -%c %s%s%s",
+			fakesource_p->name,
+			chptr->chname,
+			mchar,
+			actualBan->banstr,
+			actualBan->forward ? "$" : "",
+			actualBan->forward ? actualBan->forward : "");
+	del_ban_id(chptr, banlist, actualBan);
+	free_ban(actualBan);
+	chptr->bants++;
 }
 
 static void
@@ -695,6 +695,7 @@ change_local_nick(struct Client *client_p, struct Client *source_p,
 	del_from_client_hash(source_p->name, source_p);
 	rb_strlcpy(source_p->name, nick, sizeof(source_p->name));
 	add_to_client_hash(nick, source_p);
+	update_who_index(source_p);
 
 	if(!samenick)
 		monitor_signon(source_p);
@@ -756,6 +757,7 @@ change_remote_nick(struct Client *client_p, struct Client *source_p,
 
 	rb_strlcpy(source_p->name, nick, sizeof(source_p->name));
 	add_to_client_hash(nick, source_p);
+	update_who_index(source_p);
 
 	if(!samenick)
 		monitor_signon(source_p);
@@ -1081,6 +1083,7 @@ register_client(struct Client *client_p, struct Client *server,
 
 	add_to_client_hash(nick, source_p);
 	add_to_hostname_hash(source_p->orighost, source_p);
+	add_to_who_index(source_p);
 	monitor_signon(source_p);
 
 	m = &parv[4][1];
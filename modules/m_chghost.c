@@ -105,6 +105,8 @@ me_realhost(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sou
 	else
 		ClearDynSpoof(source_p);
 	add_to_hostname_hash(source_p->orighost, source_p);
+	update_who_index(source_p);
+	update_ban_check_index(source_p);
 }
 
 static bool
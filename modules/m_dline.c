@@ -142,8 +142,6 @@ mo_dline(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 	}
 
 	apply_dline(source_p, dlhost, tdline_time, reason);
-
-	check_dlines();
 }
 
 /* mo_undline()
@@ -196,8 +194,6 @@ me_dline(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 		return;
 
 	apply_dline(source_p, parv[2], tdline_time, LOCAL_COPY(parv[3]));
-
-	check_dlines();
 }
 
 static void
@@ -350,6 +346,8 @@ apply_dline(struct Client *source_p, const char *dlhost, int tdline_time, char *
 			     aconf->host, reason, oper_reason);
 		}
 	}
+
+	check_one_dline(aconf);
 }
 
 static void
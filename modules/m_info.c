@@ -531,6 +531,16 @@ static struct InfoStruct info_table[] = {
 		"The minimum time between aways",
 		INFO_DECIMAL(&ConfigFileEntry.away_interval),
 	},
+	{
+		"io_event_budget",
+		"Maximum number of fd events handled per pass of the IO loop",
+		INFO_DECIMAL(&ConfigFileEntry.io_event_budget),
+	},
+	{
+		"log_flush_interval",
+		"How often queued log lines are written out",
+		INFO_DECIMAL(&ConfigFileEntry.log_flush_interval),
+	},
 	{
 		"tls_ciphers_oper_only",
 		"TLS cipher strings are hidden in whois for non-opers",
@@ -224,6 +224,7 @@ rehash_txlines(struct Client *source_p)
 
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
+		xline_conf_serial++;
 	}
 }
 
@@ -265,6 +266,7 @@ rehash_tresvs(struct Client *source_p)
 
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
+		resv_conf_serial++;
 	}
 }
 
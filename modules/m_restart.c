@@ -1,6 +1,6 @@
 /*
  *  ircd-ratbox: A slightly useful ircd.
- *  m_restart.c: Exits and re-runs ircd.
+ *  m_restart.c: Exits and re-runs ircd, or upgrades it in place.
  *
  *  Copyright (C) 1990 Jarkko Oikarinen and University of Oulu, Co Center
  *  Copyright (C) 1996-2002 Hybrid Development Team
@@ -36,19 +36,28 @@
 #include "parse.h"
 #include "modules.h"
 #include "hash.h"
+#include "upgrade.h"
 
-static const char restart_desc[] = "Provides the RESTART command to restart the server";
+static const char restart_desc[] = "Provides the RESTART and UPGRADE commands to restart the server";
 
 static void mo_restart(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 static void me_restart(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 static void do_restart(struct Client *source_p, const char *servername);
+static void mo_upgrade(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
+static void me_upgrade(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
+static void do_upgrade(struct Client *source_p, const char *servername);
 
 struct Message restart_msgtab = {
 	"RESTART", 0, 0, 0, 0,
 	{mg_unreg, mg_not_oper, mg_ignore, mg_ignore, {me_restart, 1}, {mo_restart, 0}}
 };
 
-mapi_clist_av1 restart_clist[] = { &restart_msgtab, NULL };
+struct Message upgrade_msgtab = {
+	"UPGRADE", 0, 0, 0, 0,
+	{mg_unreg, mg_not_oper, mg_ignore, mg_ignore, {me_upgrade, 1}, {mo_upgrade, 0}}
+};
+
+mapi_clist_av1 restart_clist[] = { &restart_msgtab, &upgrade_msgtab, NULL };
 
 DECLARE_MODULE_AV2(restart, NULL, NULL, restart_clist, NULL, NULL, NULL, NULL, restart_desc);
 
@@ -128,3 +137,64 @@ do_restart(struct Client *source_p, const char *servername)
 	sprintf(buf, "Server RESTART by %s", get_client_name(source_p, HIDE_IP));
 	restart(buf);
 }
+
+/*
+ * mo_upgrade
+ */
+static void
+mo_upgrade(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
+{
+	if(!IsOperDie(source_p))
+	{
+		sendto_one(source_p, form_str(ERR_NOPRIVS),
+			   me.name, source_p->name, "die");
+		return;
+	}
+
+	if(parc < 2 || EmptyString(parv[1]))
+	{
+		sendto_one_notice(source_p, ":Need server name /upgrade %s", me.name);
+		return;
+	}
+
+	if(parc > 2)
+	{
+		/* Remote upgrade. Pass it along. */
+		struct Client *server_p = find_server(NULL, parv[2]);
+		if (!server_p)
+		{
+			sendto_one_numeric(source_p, ERR_NOSUCHSERVER, form_str(ERR_NOSUCHSERVER), parv[2]);
+			return;
+		}
+
+		if (!IsMe(server_p))
+		{
+			sendto_one(server_p, ":%s ENCAP %s UPGRADE %s", source_p->name, parv[2], parv[1]);
+			return;
+		}
+	}
+
+	do_upgrade(source_p, parv[1]);
+}
+
+static void
+me_upgrade(struct MsgBuf *msgbuf_p __unused, struct Client *client_p __unused, struct Client *source_p, int parc, const char *parv[])
+{
+	do_upgrade(source_p, parv[1]);
+}
+
+static void
+do_upgrade(struct Client *source_p, const char *servername)
+{
+	if(irccmp(servername, me.name))
+	{
+		sendto_one_notice(source_p, ":Mismatch on /upgrade %s", me.name);
+		return;
+	}
+
+	/* only returns if the new binary could not be run */
+	upgrade_server(source_p);
+
+	if(MyClient(source_p))
+		sendto_one_notice(source_p, ":Upgrade failed, see the server log");
+}
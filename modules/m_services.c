@@ -292,6 +292,7 @@ doit:
 
 	rb_strlcpy(target_p->name, parv[2], NICKLEN);
 	add_to_client_hash(target_p->name, target_p);
+	update_who_index(target_p);
 
 	monitor_signon(target_p);
 
@@ -48,6 +48,7 @@
 #include "response.h"
 #include "sslproc.h"
 #include "s_assert.h"
+#include "logger.h"
 
 static const char stats_desc[] =
 	"Provides the STATS command to inspect various server/network information";
@@ -903,7 +904,7 @@ stats_secure(struct Client *source_p)
 }
 
 static void
-stats_ssld_foreach(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version)
+stats_ssld_foreach(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version, const struct ssld_handshakes *hs)
 {
 	struct Client *source_p = data;
 
@@ -913,6 +914,10 @@ stats_ssld_foreach(void *data, pid_t pid, int cli_count, enum ssld_status status
 			status == SSLD_DEAD ? 'D' : (status == SSLD_SHUTDOWN ? 'S' : 'A'),
 			cli_count,
 			version);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			"S :%ld handshakes full %llu resumed %llu failed %llu, %u/%u per minute",
+			(long)pid, hs->full, hs->resumed, hs->failed,
+			hs->full_rate, hs->resumed_rate);
 }
 
 static void
@@ -982,6 +987,9 @@ stats_tstats (struct Client *source_p)
 {
 	struct Client *target_p;
 	struct ServerStatistics sp;
+	struct rb_iostats io;
+	unsigned long long log_lines, log_dropped;
+	time_t uptime;
 	rb_dlink_node *ptr;
 
 	memcpy(&sp, &ServerStats, sizeof(struct ServerStatistics));
@@ -1065,6 +1073,23 @@ stats_tstats (struct Client *source_p)
 				sp.is_cib, sp.is_cibl);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 				"T :remote response batches %u", sp.is_rrb);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"T :who indexed %u scanned %u clients examined %llu",
+				sp.is_whoi, sp.is_whos, sp.is_whoc);
+
+	rb_get_io_stats(&io);
+	uptime = rb_current_time() - startup_time;
+	if(uptime <= 0)
+		uptime = 1;
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"T :io waits %llu events %llu ctl %llu (%llu/s)",
+				io.waits, io.events, io.ctls,
+				io.ctls / (unsigned long long)uptime);
+
+	get_log_stats(&log_lines, &log_dropped);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"T :log lines %llu dropped %llu",
+				log_lines, log_dropped);
 }
 
 static void
@@ -1094,6 +1119,7 @@ static void
 stats_servers (struct Client *source_p)
 {
 	struct Client *target_p;
+	struct server_burst *burst;
 	rb_dlink_node *ptr;
 	time_t seconds;
 	int days, hours, minutes;
@@ -1130,6 +1156,24 @@ stats_servers (struct Client *source_p)
 				   (int) rb_linebuf_len (&target_p->localClient->buf_sendq),
 				   days, (days == 1) ? "" : "s", hours, minutes,
 				   (int) seconds);
+
+		if((burst = target_p->localClient->burst) == NULL)
+			continue;
+
+		if(burst->phase != BURST_DONE)
+			sendto_one_numeric(source_p, RPL_STATSDEBUG,
+					   "V :  Bursting: %lu/%lu users, %lu/%lu channels, "
+					   "%u passes, %ld seconds so far",
+					   burst->users, burst->total_users,
+					   burst->channels, burst->total_channels,
+					   burst->passes,
+					   (long) (rb_current_time() - burst->start.tv_sec));
+		else
+			sendto_one_numeric(source_p, RPL_STATSDEBUG,
+					   "V :  Burst: %lu users, %lu channels, "
+					   "%u passes in %ld.%03ld seconds",
+					   burst->users, burst->channels, burst->passes,
+					   burst->duration / 1000, burst->duration % 1000);
 	}
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
@@ -1189,6 +1233,7 @@ stats_memory (struct Client *source_p)
 	struct Channel *chptr;
 	rb_dlink_node *rb_dlink;
 	rb_dlink_node *ptr;
+	int i;
 	int channel_count = 0;
 	int local_client_conf_count = 0;	/* local client conf links */
 	int users_counted = 0;	/* user structs */
@@ -1221,6 +1266,7 @@ stats_memory (struct Client *source_p)
 
 	size_t linebuf_count = 0;
 	size_t linebuf_memory_used = 0;
+	size_t linebuf_size = 0;
 
 	size_t total_channel_memory = 0;
 	size_t totww = 0;
@@ -1262,6 +1308,7 @@ stats_memory (struct Client *source_p)
 		chptr = ptr->data;
 		channel_count++;
 		channel_memory += (strlen(chptr->chname) + sizeof(struct Channel));
+		channel_memory += chptr->member_index_size * sizeof(struct membership *);
 
 		channel_users += rb_dlink_list_length(&chptr->members);
 		channel_invites += rb_dlink_list_length(&chptr->invites);
@@ -1364,6 +1411,14 @@ stats_memory (struct Client *source_p)
 			   "z :linebuf %zu(%zu)",
 			   linebuf_count, linebuf_memory_used);
 
+	for(i = 0; rb_count_rb_linebuf_class_memory(i, &linebuf_size,
+				&linebuf_count, &linebuf_memory_used) == 0; i++)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "z :linebuf class %zu %zu(%zu)",
+				   linebuf_size, linebuf_count, linebuf_memory_used);
+	}
+
 	count_scache(&number_servers_cached, &mem_servers_cached);
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
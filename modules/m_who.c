@@ -40,6 +40,7 @@
 #include "ratelimit.h"
 #include "response.h"
 #include "supported.h"
+#include "s_stats.h"
 
 #define FIELD_CHANNEL    0x0001
 #define FIELD_HOP        0x0002
@@ -343,6 +344,167 @@ who_common_channel(struct Client *source_p, struct Channel *chptr,
 	}
 }
 
+/*
+ * who_global_match
+ *
+ * inputs	- pointer to client requesting who
+ *		- pointer to client to check
+ *		- char * mask to match
+ *		- int if oper on a server or not
+ *		- int if operspy or not
+ *		- pointer to int maxmatches
+ *		- format options
+ * output	- NONE
+ * side effects - lists target_p if it is visible and matches,
+ *		  clears its mark if it is invisible
+ */
+static void
+who_global_match(struct Client *source_p, struct Client *target_p, const char *mask,
+		int server_oper, int operspy, int *maxmatches, struct who_format *fmt)
+{
+	ServerStats.is_whoc++;
+
+	if(IsInvisible(target_p) && !operspy)
+	{
+		ClearMark(target_p);
+		return;
+	}
+
+	if(server_oper && !SeesOper(target_p, source_p))
+		return;
+
+	if(*maxmatches > 0)
+	{
+		if(!mask ||
+				match(mask, target_p->name) || match(mask, target_p->username) ||
+				match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
+				(IsOperGeneral(source_p) && match(mask, target_p->orighost)) ||
+				match(mask, target_p->info))
+		{
+			do_who(source_p, target_p, NULL, fmt);
+			--(*maxmatches);
+		}
+	}
+}
+
+/*
+ * who_plan
+ *
+ * inputs	- char * mask to match
+ * output	- WHO index bucket holding every client whose fields
+ *		  could match the literal start or end of the mask,
+ *		  or NULL if the mask has too little literal text
+ * side effects - NONE
+ */
+static rb_dlink_list *
+who_plan(const char *mask)
+{
+	rb_dlink_list *prefix = NULL, *suffix = NULL;
+	size_t len, plen, slen;
+
+	len = strlen(mask);
+	plen = strcspn(mask, "*?");
+	for(slen = 0; slen < len; slen++)
+	{
+		if(mask[len - slen - 1] == '*' || mask[len - slen - 1] == '?')
+			break;
+	}
+
+	if(plen >= WHO_INDEX_PREFIXLEN)
+		prefix = find_who_prefix(mask);
+	if(slen >= WHO_INDEX_SUFFIXLEN)
+		suffix = find_who_suffix(mask + len - WHO_INDEX_SUFFIXLEN);
+
+	if(prefix == NULL ||
+			(suffix != NULL && rb_dlink_list_length(suffix) < rb_dlink_list_length(prefix)))
+		return suffix;
+	return prefix;
+}
+
+/*
+ * who_indexed
+ *
+ * inputs	- pointer to client requesting who
+ *		- char * mask to match
+ *		- WHO index bucket from who_plan()
+ *		- int if oper on a server or not
+ *		- int if operspy or not
+ *		- pointer to int maxmatches
+ *		- format options
+ * output	- 0 if the bucket is too large to be worth using, else 1
+ * side effects - lists matching clients from the bucket and from
+ *		  the user lists of servers whose name matches the mask
+ */
+static int
+who_indexed(struct Client *source_p, const char *mask, rb_dlink_list *bucket,
+		int server_oper, int operspy, int *maxmatches, struct who_format *fmt)
+{
+	struct membership *msptr, *member;
+	struct Client *server_p, *target_p;
+	rb_dlink_node *lp, *ptr;
+	unsigned long cost;
+
+	/* a server name match brings in all of its users, who are
+	 * not necessarily in the bucket
+	 */
+	cost = rb_dlink_list_length(bucket);
+	RB_DLINK_FOREACH(ptr, global_serv_list.head)
+	{
+		server_p = ptr->data;
+		if(match(mask, server_p->name))
+			cost += rb_dlink_list_length(&server_p->serv->users);
+	}
+
+	if(cost > rb_dlink_list_length(&global_client_list) / 4)
+		return 0;
+
+	RB_DLINK_FOREACH(ptr, global_serv_list.head)
+	{
+		server_p = ptr->data;
+		if(!match(mask, server_p->name))
+			continue;
+
+		SetMark(server_p);
+		RB_DLINK_FOREACH(lp, server_p->serv->users.head)
+		{
+			target_p = lp->data;
+			if(IsPerson(target_p))
+				who_global_match(source_p, target_p, mask, server_oper, operspy, maxmatches, fmt);
+		}
+	}
+
+	RB_DLINK_FOREACH(ptr, bucket->head)
+	{
+		target_p = ptr->data;
+		if(!IsMarked(target_p->servptr))
+			who_global_match(source_p, target_p, mask, server_oper, operspy, maxmatches, fmt);
+	}
+
+	RB_DLINK_FOREACH(ptr, global_serv_list.head)
+	{
+		server_p = ptr->data;
+		ClearMark(server_p);
+	}
+
+	/* invisible clients on common channels that were not in the
+	 * bucket still carry the mark from who_common_channel()
+	 */
+	if(!operspy)
+	{
+		RB_DLINK_FOREACH(lp, source_p->user->channel.head)
+		{
+			msptr = lp->data;
+			RB_DLINK_FOREACH(ptr, msptr->chptr->members.head)
+			{
+				member = ptr->data;
+				ClearMark(member->client_p);
+			}
+		}
+	}
+
+	return 1;
+}
+
 /*
  * who_global
  *
@@ -352,8 +514,9 @@ who_common_channel(struct Client *source_p, struct Channel *chptr,
  *		- int if operspy or not
  *		- format options
  * output	- NONE
- * side effects - do a global scan of all clients looking for match
- *		  this is slightly expensive on EFnet ...
+ * side effects - look up the clients that could match in the WHO
+ *		  index, or do a global scan of all clients if the
+ *		  mask is too wild for that
  *		  marks assumed cleared for all clients initially
  *		  and will be left cleared on return
  */
@@ -362,6 +525,7 @@ who_global(struct Client *source_p, const char *mask, int server_oper, int opers
 {
 	struct membership *msptr;
 	struct Client *target_p;
+	rb_dlink_list *bucket = NULL;
 	rb_dlink_node *lp, *ptr;
 	int maxmatches = 500;
 
@@ -388,32 +552,21 @@ who_global(struct Client *source_p, const char *mask, int server_oper, int opers
 	 * if this is an operspy who, list all matching clients, no need
 	 * to clear marks
 	 */
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
-	{
-		target_p = ptr->data;
-		if(!IsPerson(target_p))
-			continue;
-
-		if(IsInvisible(target_p) && !operspy)
-		{
-			ClearMark(target_p);
-			continue;
-		}
+	if(mask != NULL)
+		bucket = who_plan(mask);
 
-		if(server_oper && !SeesOper(target_p, source_p))
-			continue;
+	if(bucket != NULL &&
+			who_indexed(source_p, mask, bucket, server_oper, operspy, &maxmatches, fmt))
+		ServerStats.is_whoi++;
+	else
+	{
+		ServerStats.is_whos++;
 
-		if(maxmatches > 0)
+		RB_DLINK_FOREACH(ptr, global_client_list.head)
 		{
-			if(!mask ||
-					match(mask, target_p->name) || match(mask, target_p->username) ||
-					match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
-					(IsOperGeneral(source_p) && match(mask, target_p->orighost)) ||
-					match(mask, target_p->info))
-			{
-				do_who(source_p, target_p, NULL, fmt);
-				--maxmatches;
-			}
+			target_p = ptr->data;
+			if(IsPerson(target_p))
+				who_global_match(source_p, target_p, mask, server_oper, operspy, &maxmatches, fmt);
 		}
 	}
 
@@ -83,8 +83,22 @@ typedef struct _conn
 	uint64_t plain_out;
 	uint8_t flags;
 	void *stream;
+
+	/* for connections accepted on one of our listeners, until they
+	 * have been handed to the ircd
+	 */
+	uint32_t listener;
+	struct rb_sockaddr_storage *addr;
 } conn_t;
 
+/* a listening socket the ircd has given us to accept TLS clients on */
+typedef struct _listener
+{
+	rb_dlink_node node;
+	uint32_t id;
+	rb_fde_t *F;
+} listener_t;
+
 #define FLAG_SSL	0x01
 #define FLAG_ZIP	0x02
 #define FLAG_CORK	0x04
@@ -92,6 +106,7 @@ typedef struct _conn
 #define FLAG_SSL_W_WANTS_R 0x10	/* output needs to wait until input possible */
 #define FLAG_SSL_R_WANTS_W 0x20	/* input needs to wait until output possible */
 #define FLAG_ZIPSSL	0x40
+#define FLAG_PENDING	0x80	/* handed to the ircd, waiting for a connid */
 
 #define IsSSL(x) ((x)->flags & FLAG_SSL)
 #define IsZip(x) ((x)->flags & FLAG_ZIP)
@@ -100,6 +115,7 @@ typedef struct _conn
 #define IsSSLWWantsR(x) ((x)->flags & FLAG_SSL_W_WANTS_R)
 #define IsSSLRWantsW(x) ((x)->flags & FLAG_SSL_R_WANTS_W)
 #define IsZipSSL(x)	((x)->flags & FLAG_ZIPSSL)
+#define IsPending(x)	((x)->flags & FLAG_PENDING)
 
 #define SetSSL(x) ((x)->flags |= FLAG_SSL)
 #define SetZip(x) ((x)->flags |= FLAG_ZIP)
@@ -107,10 +123,12 @@ typedef struct _conn
 #define SetDead(x) ((x)->flags |= FLAG_DEAD)
 #define SetSSLWWantsR(x) ((x)->flags |= FLAG_SSL_W_WANTS_R)
 #define SetSSLRWantsW(x) ((x)->flags |= FLAG_SSL_R_WANTS_W)
+#define SetPending(x) ((x)->flags |= FLAG_PENDING)
 
 #define ClearCork(x) ((x)->flags &= ~FLAG_CORK)
 #define ClearSSLWWantsR(x) ((x)->flags &= ~FLAG_SSL_W_WANTS_R)
 #define ClearSSLRWantsW(x) ((x)->flags &= ~FLAG_SSL_R_WANTS_W)
+#define ClearPending(x) ((x)->flags &= ~FLAG_PENDING)
 
 #define NO_WAIT 0x0
 #define WAIT_PLAIN 0x1
@@ -119,11 +137,22 @@ typedef struct _conn
 #define HASH_WALK_END }
 #define CONN_HASH_SIZE 2000
 #define connid_hash(x)	(&connid_hash_table[(x % CONN_HASH_SIZE)])
+#define pending_hash(x)	(&pending_hash_table[(x % CONN_HASH_SIZE)])
 
 
 
 static rb_dlink_list connid_hash_table[CONN_HASH_SIZE];
+static rb_dlink_list pending_hash_table[CONN_HASH_SIZE];
 static rb_dlink_list dead_list;
+static rb_dlink_list listener_list;
+
+/* identifies an accepted connection to the ircd until it gives us a connid */
+static uint32_t accept_token;
+
+/* incoming handshakes, reported by process_stats */
+static unsigned long long hs_full;
+static unsigned long long hs_resumed;
+static unsigned long long hs_failed;
 
 static void conn_mod_read_cb(rb_fde_t *fd, void *data);
 static void conn_mod_write_sendq(rb_fde_t *, void *data);
@@ -132,6 +161,7 @@ static void mod_write_ctl(rb_fde_t *, void *data);
 static void conn_plain_read_cb(rb_fde_t *fd, void *data);
 static void conn_plain_read_shutdown_cb(rb_fde_t *fd, void *data);
 static void mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len);
+static void mod_cmd_write_queue_fds(mod_ctl_t * ctl, rb_fde_t **F, int nfds, const void *data, size_t len);
 static const char *remote_closed = "Remote host closed the connection";
 static bool ssld_ssl_ok;
 static int certfp_method = RB_SSL_CERTFP_METH_CERT_SHA1;
@@ -164,6 +194,7 @@ free_conn(conn_t * conn)
 {
 	rb_free_rawbuffer(conn->modbuf_out);
 	rb_free_rawbuffer(conn->plainbuf_out);
+	rb_free(conn->addr);
 	rb_free(conn);
 }
 
@@ -196,10 +227,15 @@ close_conn(conn_t * conn, int wait_plain, const char *fmt, ...)
 	rb_close(conn->mod_fd);
 	SetDead(conn);
 
-	if(!IsZipSSL(conn))
+	if(IsPending(conn))
+		rb_dlinkDelete(&conn->node, pending_hash(conn->id));
+	else if(!IsZipSSL(conn))
 		rb_dlinkDelete(&conn->node, connid_hash(conn->id));
 
-	if(!wait_plain || fmt == NULL)
+	/* the ircd doesn't know a pending connection by its id yet, it
+	 * will notice the plaintext side going away instead
+	 */
+	if(!wait_plain || fmt == NULL || IsPending(conn))
 	{
 		rb_close(conn->plain_fd);
 		rb_dlinkAdd(conn, &conn->node, &dead_list);
@@ -327,13 +363,22 @@ conn_plain_write(conn_t * conn, void *data, size_t len)
 
 static void
 mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len)
+{
+	mod_cmd_write_queue_fds(ctl, NULL, 0, data, len);
+}
+
+static void
+mod_cmd_write_queue_fds(mod_ctl_t * ctl, rb_fde_t **F, int nfds, const void *data, size_t len)
 {
 	mod_ctl_buf_t *ctl_buf;
+	int x;
 	ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t));
 	ctl_buf->buf = rb_malloc(len);
 	ctl_buf->buflen = len;
 	memcpy(ctl_buf->buf, data, len);
-	ctl_buf->nfds = 0;
+	for(x = 0; x < nfds && x < MAXPASSFD; x++)
+		ctl_buf->F[x] = F[x];
+	ctl_buf->nfds = x;
 	rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->writeq);
 	mod_write_ctl(ctl->F, ctl);
 }
@@ -584,6 +629,11 @@ ssl_process_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen
 
 	if(status == RB_OK)
 	{
+		if(rb_ssl_session_reused(F))
+			hs_resumed++;
+		else
+			hs_full++;
+
 		ssl_send_cipher(conn);
 		ssl_send_certfp(conn);
 		ssl_send_open(conn);
@@ -591,6 +641,7 @@ ssl_process_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen
 		conn_plain_read_cb(conn->plain_fd, conn);
 		return;
 	}
+	hs_failed++;
 	/* ircd doesn't care about the reason for this */
 	close_conn(conn, NO_WAIT, 0);
 	return;
@@ -617,6 +668,175 @@ ssl_process_connect_cb(rb_fde_t *F, int status, void *data)
 		close_conn(conn, WAIT_PLAIN, "SSL handshake failed");
 }
 
+/* tell the ircd about a connection we accepted and finished the
+ * handshake for, passing it the plaintext side
+ */
+static void
+ssl_send_accepted(conn_t *conn, rb_fde_t *plain_F)
+{
+	uint8_t buf[9 + 2 * sizeof(struct rb_sockaddr_storage) + 8 + RB_SSL_CERTFP_LEN + 256];
+	struct rb_sockaddr_storage lip;
+	rb_socklen_t locallen = sizeof(lip);
+	const char *cipher;
+	size_t len;
+	int certfp_len;
+
+	memset(&lip, 0, sizeof(lip));
+	getsockname(rb_get_fd(conn->mod_fd), (struct sockaddr *)&lip, &locallen);
+
+	buf[0] = 'a';
+	uint32_to_buf(&buf[1], conn->listener);
+	uint32_to_buf(&buf[5], conn->id);
+	memcpy(&buf[9], conn->addr, sizeof(struct rb_sockaddr_storage));
+	memcpy(&buf[9 + sizeof(struct rb_sockaddr_storage)], &lip, sizeof(lip));
+	len = 9 + 2 * sizeof(struct rb_sockaddr_storage);
+
+	certfp_len = rb_get_ssl_certfp(conn->mod_fd, &buf[len + 8], certfp_method);
+	uint32_to_buf(&buf[len], certfp_method);
+	uint32_to_buf(&buf[len + 4], certfp_len);
+	len += 8 + certfp_len;
+
+	cipher = rb_ssl_get_cipher(conn->mod_fd);
+	rb_strlcpy((char *) &buf[len], cipher != NULL ? cipher : "", 256);
+	len += strlen((char *) &buf[len]) + 1;
+
+	mod_cmd_write_queue_fds(conn->ctl, &plain_F, 1, buf, len);
+
+	rb_free(conn->addr);
+	conn->addr = NULL;
+}
+
+static void
+ssl_listener_handshake_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, void *data)
+{
+	conn_t *conn = data;
+	rb_fde_t *xF[2];
+
+	if(status != RB_OK)
+	{
+		hs_failed++;
+		rb_close(conn->mod_fd);
+		SetDead(conn);
+		rb_dlinkAdd(conn, &conn->node, &dead_list);
+		return;
+	}
+
+	if(rb_ssl_session_reused(F))
+		hs_resumed++;
+	else
+		hs_full++;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &xF[0], &xF[1], "Incoming ssld Connection") == -1)
+	{
+		rb_close(conn->mod_fd);
+		SetDead(conn);
+		rb_dlinkAdd(conn, &conn->node, &dead_list);
+		return;
+	}
+
+	conn->plain_fd = xF[0];
+	rb_set_nb(conn->plain_fd);
+
+	/* keep it apart from the connids until the ircd has given us one */
+	conn->id = ++accept_token;
+	SetPending(conn);
+	rb_dlinkAdd(conn, &conn->node, pending_hash(conn->id));
+
+	ssl_send_accepted(conn, xF[1]);
+	conn_mod_read_cb(conn->mod_fd, conn);
+	conn_plain_read_cb(conn->plain_fd, conn);
+}
+
+static void
+listener_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t addrlen, void *data)
+{
+	listener_t *listener = data;
+	conn_t *conn;
+
+	conn = make_conn(mod_ctl, F, NULL);
+	conn->listener = listener->id;
+	conn->addr = rb_malloc(sizeof(struct rb_sockaddr_storage));
+	memcpy(conn->addr, addr, addrlen);
+	SetSSL(conn);
+
+	rb_ssl_start_accepted(F, ssl_listener_handshake_cb, conn, 10);
+}
+
+static listener_t *
+find_listener(uint32_t id)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, listener_list.head)
+	{
+		listener_t *listener = ptr->data;
+		if(listener->id == id)
+			return listener;
+	}
+	return NULL;
+}
+
+static void
+ssl_add_listener(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	listener_t *listener;
+	uint32_t id;
+
+	id = buf_to_uint32(&ctlb->buf[1]);
+
+	/* the ircd sends all of them again when its config changes */
+	if(find_listener(id) != NULL)
+	{
+		rb_close(ctlb->F[0]);
+		return;
+	}
+
+	listener = rb_malloc(sizeof(listener_t));
+	listener->id = id;
+	listener->F = ctlb->F[0];
+	rb_set_nb(listener->F);
+	rb_dlinkAdd(listener, &listener->node, &listener_list);
+
+	rb_accept_tcp(listener->F, NULL, listener_accept_cb, listener);
+}
+
+static void
+ssl_del_listener(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	listener_t *listener;
+
+	listener = find_listener(buf_to_uint32(&ctlb->buf[1]));
+	if(listener == NULL)
+		return;
+
+	rb_close(listener->F);
+	rb_dlinkDelete(&listener->node, &listener_list);
+	rb_free(listener);
+}
+
+/* the ircd has taken an accepted connection and given it a connid */
+static void
+ssl_bind_accepted(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	rb_dlink_node *ptr;
+	conn_t *conn;
+	uint32_t token, id;
+
+	token = buf_to_uint32(&ctlb->buf[1]);
+	id = buf_to_uint32(&ctlb->buf[5]);
+
+	RB_DLINK_FOREACH(ptr, pending_hash(token)->head)
+	{
+		conn = ptr->data;
+		if(conn->id != token)
+			continue;
+
+		rb_dlinkDelete(&conn->node, pending_hash(token));
+		ClearPending(conn);
+		conn_add_id_hash(conn, id);
+		return;
+	}
+}
 
 static void
 cleanup_bad_message(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
@@ -686,6 +906,15 @@ process_stats(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 
 	id = buf_to_uint32(&ctlb->buf[1]);
 
+	/* id 0 asks about the daemon itself */
+	if(id == 0)
+	{
+		snprintf(outstat, sizeof(outstat), "H %llu %llu %llu",
+				hs_full, hs_resumed, hs_failed);
+		mod_cmd_write_queue(ctl, outstat, strlen(outstat) + 1);
+		return;
+	}
+
 	odata = &ctlb->buf[5];
 	conn = conn_find_by_id(id);
 
@@ -733,6 +962,12 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 	}
 }
 
+static void
+ssl_new_ticket_key(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
+{
+	(void) rb_ssl_set_ticket_key(&ctl_buf->buf[1], ctl_buf->buflen - 1);
+}
+
 static void
 send_nossl_support(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 {
@@ -825,6 +1060,16 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				ssl_process_connect(ctl, ctl_buf);
 				break;
 			}
+		case 'B':
+			{
+				if (ctl_buf->buflen != 9)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				ssl_bind_accepted(ctl, ctl_buf);
+				break;
+			}
 		case 'F':
 			{
 				if (ctl_buf->buflen != 5)
@@ -845,11 +1090,43 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				ssl_new_keys(ctl, ctl_buf);
 				break;
 			}
+		case 'L':
+			{
+				if (ctl_buf->nfds != 1 || ctl_buf->buflen != 5 || !ssld_ssl_ok)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				ssl_add_listener(ctl, ctl_buf);
+				break;
+			}
+		case 'l':
+			{
+				if (ctl_buf->buflen != 5)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				ssl_del_listener(ctl, ctl_buf);
+				break;
+			}
 		case 'S':
 			{
+				if (ctl_buf->buflen < 5)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
 				process_stats(ctl, ctl_buf);
 				break;
 			}
+		case 'T':
+			{
+				if(!ssld_ssl_ok)
+					break;
+				ssl_new_ticket_key(ctl, ctl_buf);
+				break;
+			}
 
 		case 'Z':
 			send_nozlib_support(ctl, ctl_buf);
@@ -0,0 +1,337 @@
+/*
+ *  banindex1.c: Test and benchmark compiled and hashed channel ban lists
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "chmode.h"
+#include "hash.h"
+#include "match.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_CLIENTS 64
+#define NUM_BANS 600
+#define CHECKS 100000
+#define NUM_MASKS 2000
+
+static struct Client *clients[NUM_CLIENTS];
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+make_clients(void)
+{
+	char nick[NICKLEN], user[USERLEN + 1], host[HOSTLEN + 1], ip[HOSTIPLEN + 1];
+	int i;
+
+	for(i = 0; i < NUM_CLIENTS; i++)
+	{
+		snprintf(nick, sizeof(nick), "Nick%d", i);
+		snprintf(user, sizeof(user), "%sident%d", i % 3 ? "" : "~", i);
+		if(i % 4 == 0)
+			snprintf(host, sizeof(host), "host%d.example.net", i);
+		else if(i % 4 == 1)
+			snprintf(host, sizeof(host), "a%d.b.dom%d.example", i, i % 7);
+		else
+			snprintf(host, sizeof(host), "user/%d", i);
+		if(i % 2)
+			snprintf(ip, sizeof(ip), "10.%d.%d.1", i % 5, i);
+		else
+			snprintf(ip, sizeof(ip), "2001:db8:%x::%x", i % 5, i);
+
+		clients[i] = make_local_person_full(nick, user, host, ip, TEST_REALNAME);
+	}
+}
+
+/* cycle through the mask forms, most aimed at the top half of the clients */
+static void
+make_ban(char *buf, size_t len, int i)
+{
+	int n = i / 12 + NUM_CLIENTS / 2;
+
+	switch(i % 12)
+	{
+	case 0: snprintf(buf, len, "*!*@HOST%d.example.net", n); break;
+	case 1: snprintf(buf, len, "*!*@*.dom%d.example", n % 9 + 5); break;
+	case 2: snprintf(buf, len, "nick%d!*@*", n); break;
+	case 3: snprintf(buf, len, "*!~ident%d@*", n); break;
+	case 4: snprintf(buf, len, "*!*@10.%d.%d.0/24", n % 6, n); break;
+	case 5: snprintf(buf, len, "*!*@2001:db8:%x::%x/126", n % 5, n & ~3); break;
+	case 6: snprintf(buf, len, "*!*ident%d*@*", n); break;
+	case 7: snprintf(buf, len, "*k%d!*@*", n); break;
+	case 8: snprintf(buf, len, "*!*@user/%d", n); break;
+	case 9: snprintf(buf, len, "nick%d!*@*.example.net", n); break;
+	case 10: snprintf(buf, len, "$a:account%d", n); break;
+	default: snprintf(buf, len, "*!*@*xample%d", n); break;
+	}
+}
+
+static struct Ban *
+linear_find(struct Channel *chptr, rb_dlink_list *list, struct Client *who, long mode_type)
+{
+	struct matchset ms;
+	rb_dlink_node *ptr;
+
+	matchset_for_client(who, &ms);
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		struct Ban *banptr = ptr->data;
+
+		if(matches_mask(&ms, banptr->banstr) ||
+				match_extban(banptr->banstr, who, chptr, mode_type))
+			return banptr;
+	}
+	return NULL;
+}
+
+static int
+check_all(struct Channel *chptr, int *matched)
+{
+	struct matchset ms;
+	int i, good = 1;
+
+	*matched = 0;
+	for(i = 0; i < NUM_CLIENTS; i++)
+	{
+		struct Ban *expect = linear_find(chptr, &chptr->banlist, clients[i], CHFL_BAN);
+		const char *forward = NULL;
+
+		matchset_for_client(clients[i], &ms);
+		if(find_ban(chptr, &chptr->banlist, &chptr->banlist_index,
+					clients[i], &ms, CHFL_BAN) != expect)
+		{
+			diag("client %d: expected %s", i, expect ? expect->banstr : "nothing");
+			good = 0;
+		}
+
+		if(is_banned(chptr, clients[i], NULL, NULL, &forward) != (expect ? CHFL_BAN : 0))
+			good = 0;
+		if(expect != NULL && forward != expect->forward)
+			good = 0;
+
+		*matched += expect != NULL;
+	}
+	return good;
+}
+
+static void
+banindex_compare1(void)
+{
+	struct Channel *chptr = get_or_create_channel(&me, "#banindex", NULL);
+	char ban[BANLEN], forward[CHANNELLEN];
+	int i, matched, count;
+
+	chptr->mode.mode |= MODE_PERMANENT;
+
+	/* small lists are walked */
+	for(i = 0; i < 10; i++)
+	{
+		make_ban(ban, sizeof(ban), i);
+		ok(add_id(&me, chptr, ban, NULL, &chptr->banlist, CHFL_BAN) != NULL, MSG);
+	}
+	ok(check_all(chptr, &matched), MSG);
+	ok(chptr->banlist_index == NULL, MSG);
+
+	for(count = i; i < NUM_BANS; i++)
+	{
+		make_ban(ban, sizeof(ban), i);
+		snprintf(forward, sizeof(forward), "#fwd%d", i);
+		if(add_id(&me, chptr, ban, i % 2 ? forward : NULL, &chptr->banlist, CHFL_BAN) != NULL)
+			count++;
+	}
+	is_int(count, rb_dlink_list_length(&chptr->banlist), MSG);
+	ok(count > NUM_BANS / 2, MSG);
+
+	ok(check_all(chptr, &matched), MSG);
+	ok(chptr->banlist_index != NULL, MSG);
+	ok(matched > 0 && matched < NUM_CLIENTS, "%d of %d clients banned", matched, NUM_CLIENTS);
+
+	/* the index follows changes to the list */
+	for(i = 0; i < NUM_BANS; i += 3)
+	{
+		make_ban(ban, sizeof(ban), i);
+		free_ban(del_id(chptr, ban, &chptr->banlist, CHFL_BAN));
+	}
+	ok(check_all(chptr, &matched), MSG);
+
+	for(i = 0; i < NUM_BANS; i += 3)
+	{
+		make_ban(ban, sizeof(ban), i);
+		add_id(&me, chptr, ban, NULL, &chptr->banlist, CHFL_BAN);
+	}
+	ok(check_all(chptr, &matched), MSG);
+
+	/* and goes away when the list gets small again */
+	while(rb_dlink_list_length(&chptr->banlist) > 5)
+	{
+		struct Ban *banptr = chptr->banlist.head->data;
+		free_ban(del_id(chptr, banptr->banstr, &chptr->banlist, CHFL_BAN));
+	}
+	ok(check_all(chptr, &matched), MSG);
+	ok(chptr->banlist_index == NULL, MSG);
+
+	destroy_channel(chptr);
+}
+
+static void
+banindex_bench1(void)
+{
+	struct Channel *chptr = get_or_create_channel(&me, "#banbench", NULL);
+	struct matchset ms[NUM_CLIENTS];
+	char ban[BANLEN];
+	volatile int found = 0;
+	double start, indexed, linear;
+	int i;
+
+	chptr->mode.mode |= MODE_PERMANENT;
+
+	for(i = 0; i < NUM_BANS; i++)
+	{
+		make_ban(ban, sizeof(ban), i);
+		add_id(&me, chptr, ban, NULL, &chptr->banlist, CHFL_BAN);
+	}
+	for(i = 0; i < NUM_CLIENTS; i++)
+		matchset_for_client(clients[i], &ms[i]);
+
+	start = now();
+	for(i = 0; i < CHECKS; i++)
+		found += find_ban(chptr, &chptr->banlist, &chptr->banlist_index,
+				clients[i % NUM_CLIENTS], &ms[i % NUM_CLIENTS], CHFL_BAN) != NULL;
+	indexed = now() - start;
+
+	start = now();
+	for(i = 0; i < CHECKS / 100; i++)
+		found += linear_find(chptr, &chptr->banlist, clients[i % NUM_CLIENTS], CHFL_BAN) != NULL;
+	linear = (now() - start) * 100;
+
+	ok(found > 0, MSG);
+	diag("%d bans: %.1f ns per check indexed, %.1f ns linear", NUM_BANS,
+			indexed * 1e9 / CHECKS, linear * 1e9 / CHECKS);
+
+	destroy_channel(chptr);
+}
+
+static void
+banhash1(void)
+{
+	struct Channel *chptr = get_or_create_channel(&me, "#banhash", NULL);
+	struct Ban *banptr;
+	char ban[BANLEN], upper[BANLEN];
+	double start, added;
+	int i, j, good;
+
+	chptr->mode.mode |= MODE_PERMANENT;
+
+	for(i = 0; i < NUM_MASKS; i++)
+	{
+		snprintf(ban, sizeof(ban), "*!*@host%d.example", i);
+		add_id(&me, chptr, ban, NULL, &chptr->quietlist, CHFL_QUIET);
+	}
+	is_int(NUM_MASKS, rb_dlink_list_length(&chptr->quietlist), MSG);
+	ok(chptr->quietlist_hash.table != NULL, MSG);
+
+	/* duplicates are found whatever their case */
+	for(i = 0, good = 1; i < NUM_MASKS; i++)
+	{
+		snprintf(upper, sizeof(upper), "*!*@HOST%d.Example", i);
+		if(add_id(&me, chptr, upper, NULL, &chptr->quietlist, CHFL_QUIET) != NULL)
+			good = 0;
+	}
+	ok(good, MSG);
+	is_int(NUM_MASKS, rb_dlink_list_length(&chptr->quietlist), MSG);
+
+	/* and so are entries to remove, while the rest stay findable */
+	for(i = 0, good = 1; i < NUM_MASKS; i += 2)
+	{
+		snprintf(upper, sizeof(upper), "*!*@HOST%d.EXAMPLE", i);
+		banptr = del_id(chptr, upper, &chptr->quietlist, CHFL_QUIET);
+		snprintf(ban, sizeof(ban), "*!*@host%d.example", i);
+		if(banptr == NULL || strcmp(banptr->banstr, ban))
+			good = 0;
+		if(banptr != NULL)
+			free_ban(banptr);
+		for(j = i + 1; j < NUM_MASKS; j += 97)
+		{
+			snprintf(ban, sizeof(ban), "*!*@host%d.example", j);
+			if(find_ban_id(chptr, &chptr->quietlist, ban) == NULL)
+				good = 0;
+		}
+	}
+	ok(good, MSG);
+	is_int(NUM_MASKS / 2, rb_dlink_list_length(&chptr->quietlist), MSG);
+	ok(del_id(chptr, "*!*@host0.example", &chptr->quietlist, CHFL_QUIET) == NULL, MSG);
+
+	/* the table goes away once the list is small */
+	while(rb_dlink_list_length(&chptr->quietlist) > 5)
+	{
+		banptr = chptr->quietlist.head->data;
+		free_ban(del_id(chptr, banptr->banstr, &chptr->quietlist, CHFL_QUIET));
+	}
+	ok(chptr->quietlist_hash.table == NULL, MSG);
+	ok(find_ban_id(chptr, &chptr->quietlist, "*!*@HOST1.example") != NULL, MSG);
+
+	/* a large burst goes in at a steady rate */
+	start = now();
+	for(i = 0; i < NUM_MASKS * 10; i++)
+	{
+		snprintf(ban, sizeof(ban), "*!*@burst%d.example", i);
+		add_id(&me, chptr, ban, NULL, &chptr->exceptlist, CHFL_EXCEPTION);
+	}
+	added = now() - start;
+	is_int(NUM_MASKS * 10, rb_dlink_list_length(&chptr->exceptlist), MSG);
+	diag("%d masks added in %.1f ms", NUM_MASKS * 10, added * 1e3);
+
+	destroy_channel(chptr);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	make_clients();
+
+	banindex_compare1();
+	banindex_bench1();
+	banhash1();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
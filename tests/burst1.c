@@ -0,0 +1,228 @@
+/*
+ *  burst1.c: Test netbursts sent in parts
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "class.h"
+#include "hash.h"
+#include "send.h"
+#include "s_serv.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_USERS 3000
+#define NUM_CHANNELS 300
+
+static struct Client *hub;
+static struct Client *users[NUM_USERS];
+static struct Channel *channels[NUM_CHANNELS];
+
+struct burst_result
+{
+	int uids;
+	int sjoins;
+	int bmasks;
+	int pings;
+	int lines_after_ping;
+	int passes;
+	bool saw_live;
+	bool live_before_ping;
+	bool saw_late_user;
+	bool saw_quit_after_ping;
+};
+
+static struct Client *
+make_hub_user(int i)
+{
+	char nick[NICKLEN], id[IDLEN];
+	struct Client *client_p;
+
+	snprintf(nick, sizeof(nick), "user%d", i);
+	snprintf(id, sizeof(id), "%s%06d", TEST_SERVER2_ID, i);
+	client_p = make_remote_person_full_id(hub, nick, TEST_USERNAME, TEST_HOSTNAME, TEST_IP, TEST_REALNAME, id);
+	rb_dlinkAddTail(client_p, &client_p->node, &global_client_list);
+	return client_p;
+}
+
+static void
+make_network(void)
+{
+	char name[CHANNELLEN];
+	int i, j;
+
+	hub = make_remote_server_full(&me, TEST_SERVER2_NAME, TEST_SERVER2_ID);
+
+	for(i = 0; i < NUM_USERS; i++)
+		users[i] = make_hub_user(i);
+
+	for(i = 0; i < NUM_CHANNELS; i++)
+	{
+		snprintf(name, sizeof(name), "#chan%d", i);
+		channels[i] = get_or_create_channel(&me, name, NULL);
+		for(j = i; j < NUM_USERS; j += NUM_CHANNELS / 3)
+			add_user_to_channel(channels[i], users[j], j == i ? CHFL_CHANOP : CHFL_PEON);
+		add_id(&me, channels[i], "*!*@banned.example", NULL, &channels[i]->banlist, CHFL_BAN);
+	}
+}
+
+static bool
+read_line(struct Client *client_p, char *line, size_t size)
+{
+	return rb_linebuf_get(&client_p->localClient->buf_sendq, line, size, 0, 1) > 0;
+}
+
+/* take everything queued for the server, prodding the burst along each
+ * time the queue is empty as the write callback would
+ */
+static void
+run_burst(struct Client *client_p, struct burst_result *res, const char *late_id)
+{
+	char line[EXT_BUFSIZE + sizeof(CRLF)];
+	int rounds = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	for(;;)
+	{
+		while(read_line(client_p, line, sizeof(line)))
+		{
+			if(strstr(line, " UID ") != NULL)
+			{
+				res->uids++;
+				if(strstr(line, late_id) != NULL)
+					res->saw_late_user = true;
+			}
+			else if(strstr(line, " SJOIN ") != NULL)
+				res->sjoins++;
+			else if(strstr(line, " BMASK ") != NULL)
+				res->bmasks++;
+			else if(!strncmp(line, "PING ", 5))
+				res->pings++;
+			else if(strstr(line, "NOTICE * :live") != NULL)
+			{
+				res->saw_live = true;
+				res->live_before_ping = res->pings == 0;
+			}
+			else if(strstr(line, " QUIT ") != NULL && res->pings > 0)
+				res->saw_quit_after_ping = true;
+
+			if(res->pings > 0)
+				res->lines_after_ping++;
+		}
+
+		if(!IsBursting(client_p) || ++rounds > 1000)
+			break;
+		continue_burst(client_p);
+	}
+
+	res->passes = client_p->localClient->burst->passes;
+}
+
+static void
+burst_parts1(void)
+{
+	struct Client *server = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+	struct Client *gone, *late;
+	struct burst_result res;
+
+	server->localClient->server_caps |= CAP_TS6;
+	gone = users[NUM_USERS - 1];
+
+	start_burst(server);
+	ok(IsBursting(server), MSG);
+	is_int(1, server->localClient->burst->passes, MSG);
+
+	/* everything else waits until the burst is done */
+	sendto_server(NULL, NULL, NOCAPS, NOCAPS, ":%s NOTICE * :live", me.id);
+
+	/* clients and channels can come and go meanwhile */
+	late = make_hub_user(NUM_USERS);
+	remove_remote_person(gone);
+	users[NUM_USERS - 1] = NULL;
+	destroy_channel(channels[0]);
+	channels[0] = NULL;
+
+	run_burst(server, &res, late->id);
+
+	ok(!IsBursting(server), MSG);
+	ok(res.passes > 1, "burst took %d passes", res.passes);
+	is_int(NUM_USERS - 1, res.uids, MSG);
+	is_int(NUM_CHANNELS - 1, res.sjoins, MSG);
+	is_int(NUM_CHANNELS - 1, res.bmasks, MSG);
+	is_int(1, res.pings, MSG);
+	ok(!res.saw_late_user, MSG);
+	ok(res.saw_live, MSG);
+	ok(!res.live_before_ping, MSG);
+	ok(res.saw_quit_after_ping, MSG);
+
+	/* and once it is, nothing is held back */
+	sendto_server(NULL, NULL, NOCAPS, NOCAPS, ":%s NOTICE * :live", me.id);
+	run_burst(server, &res, late->id);
+	ok(res.saw_live, MSG);
+
+	users[NUM_USERS - 1] = late;
+	remove_remote_server(server);
+}
+
+static void
+burst_sendq1(void)
+{
+	struct Client *server = make_remote_server_full(&me, TEST_SERVER3_NAME, TEST_SERVER3_ID);
+	struct burst_result res;
+
+	/* a small sendq stops each part at half of it */
+	start_burst(server);
+	ok(IsBursting(server), MSG);
+	ok(rb_linebuf_len(&server->localClient->buf_sendq) <= get_sendq(server) / 2 + BUFSIZE * 4,
+			"%u queued", rb_linebuf_len(&server->localClient->buf_sendq));
+
+	run_burst(server, &res, "none");
+
+	ok(!IsBursting(server), MSG);
+	ok(res.passes > 10, "burst took %d passes", res.passes);
+	is_int(NUM_USERS, res.uids, MSG);
+	is_int(NUM_CHANNELS - 1, res.sjoins, MSG);
+	is_int(1, res.pings, MSG);
+
+	remove_remote_server(server);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	make_network();
+
+	burst_parts1();
+	burst_sendq1();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -96,11 +96,14 @@ struct Client *make_local_person_full_id(const char *nick, const char *username,
 	rb_strlcpy(client->name, nick, sizeof(client->name));
 	rb_strlcpy(client->username, username, sizeof(client->username));
 	rb_strlcpy(client->host, hostname, sizeof(client->host));
+	rb_strlcpy(client->orighost, hostname, sizeof(client->orighost));
 	rb_inet_ntop_sock((struct sockaddr *)&client->localClient->ip, client->sockhost, sizeof(client->sockhost));
 	rb_strlcpy(client->info, realname, sizeof(client->info));
 
 	add_to_client_hash(client->name, client);
 	add_to_hostname_hash(client->host, client);
+	add_to_who_index(client);
+	add_to_ban_check_index(client);
 	if (strlen(id))
 		add_to_id_hash(client->id, client);
 
@@ -188,7 +191,7 @@ struct Client *make_remote_person_full_id(struct Client *server, const char *nic
 	SetRemoteClient(client);
 
 	client->servptr = server;
-	rb_dlinkAdd(server, &server->lnode, &server->servptr->serv->users);
+	rb_dlinkAdd(client, &client->lnode, &server->serv->users);
 
 	rb_inet_pton_sock(ip, &addr);
 	rb_strlcpy(client->id, id, sizeof(client->id));
@@ -200,6 +203,7 @@ struct Client *make_remote_person_full_id(struct Client *server, const char *nic
 
 	add_to_client_hash(nick, client);
 	add_to_hostname_hash(client->host, client);
+	add_to_who_index(client);
 	if (strlen(id))
 		add_to_id_hash(client->id, client);
 
@@ -1,5 +1,5 @@
 /*
- *  hostmask1.c: Test parse_netmask
+ *  hostmask1.c: Test parse_netmask and find_conf_by_address
  *  Copyright 2020 Ed Kellett
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -21,17 +21,25 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include "tap/basic.h"
 
 #include "stdinc.h"
 #include "ircd_defs.h"
 #include "client.h"
 #include "hostmask.h"
+#include "match.h"
+#include "s_conf.h"
 
 #define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
 
 struct Client me;
 
+#define NUM_BANS 6000
+#define NUM_LOOKUPS 20000
+
+static struct ConfItem bans[NUM_BANS];
+
 static void plain_hostmask(void)
 {
 	int ty;
@@ -192,6 +200,321 @@ static void invalid_ipv6_cidr(void)
 	is_int(HM_ERROR, ty, MSG);
 }
 
+/*
+ * find_conf_by_address() as it was before the lookup index, walking the
+ * atable hash buckets, to check the index against and to time it.
+ */
+static unsigned long
+old_hash_ipv4(struct sockaddr *saddr, int bits)
+{
+	struct sockaddr_in *addr = (struct sockaddr_in *)(void *)saddr;
+
+	if(bits != 0)
+	{
+		unsigned long av = ntohl(addr->sin_addr.s_addr) & ~((1 << (32 - bits)) - 1);
+		return (av ^ (av >> 12) ^ (av >> 24)) & (ATABLE_SIZE - 1);
+	}
+
+	return 0;
+}
+
+static unsigned long
+old_hash_ipv6(struct sockaddr *saddr, int bits)
+{
+	struct sockaddr_in6 *addr = (struct sockaddr_in6 *)(void *)saddr;
+	unsigned long v = 0, n;
+	for (n = 0; n < 16; n++)
+	{
+		if(bits >= 8)
+		{
+			v ^= addr->sin6_addr.s6_addr[n];
+			bits -= 8;
+		}
+		else if(bits)
+		{
+			v ^= addr->sin6_addr.s6_addr[n] & ~((1 << (8 - bits)) - 1);
+			return v & (ATABLE_SIZE - 1);
+		}
+		else
+			return v & (ATABLE_SIZE - 1);
+	}
+	return v & (ATABLE_SIZE - 1);
+}
+
+static int
+old_hash_text(const char *start)
+{
+	const char *p = start;
+	unsigned long h = 0;
+
+	while(*p)
+	{
+		h = (h << 4) - (h + (unsigned char) irctolower(*p++));
+	}
+
+	return (h & (ATABLE_SIZE - 1));
+}
+
+static int
+old_usable(struct AddressRec *arec, int type, const char *username,
+		const char *auth_user, unsigned long hprecv)
+{
+	return arec->type == (type & ~0x1) &&
+		arec->precedence > hprecv &&
+		(type & 0x1 || match(arec->username, username)) &&
+		(type != CONF_CLIENT || !arec->auth_user ||
+		(auth_user && match(arec->auth_user, auth_user)));
+}
+
+static void
+old_find_host(const char *host, const char *sockhost, int type,
+		const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	struct AddressRec *arec;
+	const char *p;
+
+	for (p = host; p != NULL;)
+	{
+		for (arec = atable[old_hash_text(p)]; arec; arec = arec->next)
+			if(arec->masktype == HM_HOST &&
+			   old_usable(arec, type, username, auth_user, *hprecv) &&
+			   match(arec->Mask.hostname, host))
+			{
+				*hprecv = arec->precedence;
+				*hprec = arec->aconf;
+			}
+		p = strchr(p, '.');
+		if(p != NULL)
+			p++;
+		else
+			break;
+	}
+	for (arec = atable[0]; arec; arec = arec->next)
+		if(arec->masktype == HM_HOST &&
+		   old_usable(arec, type, username, auth_user, *hprecv) &&
+		   (match(arec->Mask.hostname, host) ||
+		    (sockhost && match(arec->Mask.hostname, sockhost))))
+		{
+			*hprecv = arec->precedence;
+			*hprec = arec->aconf;
+		}
+}
+
+static struct ConfItem *
+old_find_conf_by_address(const char *name, const char *sockhost,
+			const char *orighost,
+			struct sockaddr *addr, int type, int fam,
+			const char *username, const char *auth_user)
+{
+	unsigned long hprecv = 0;
+	struct ConfItem *hprec = NULL;
+	struct AddressRec *arec;
+	struct sockaddr_in ip4;
+	struct sockaddr *pip4 = NULL;
+	int b;
+
+	if(username == NULL)
+		username = "";
+
+	if(addr)
+	{
+		if (fam == AF_INET)
+			pip4 = addr;
+
+		if (fam == AF_INET6)
+		{
+			if (type == CONF_KILL && rb_ipv4_from_ipv6((struct sockaddr_in6 *)addr, &ip4))
+				pip4 = (struct sockaddr *)&ip4;
+
+			for (b = 128; b >= 0; b -= 16)
+				for (arec = atable[old_hash_ipv6(addr, b)]; arec; arec = arec->next)
+					if(arec->masktype == HM_IPV6 &&
+					   old_usable(arec, type, username, auth_user, hprecv) &&
+					   comp_with_mask_sock(addr, (struct sockaddr *)&arec->Mask.ipa.addr,
+						arec->Mask.ipa.bits))
+					{
+						hprecv = arec->precedence;
+						hprec = arec->aconf;
+					}
+		}
+
+		if (pip4 != NULL)
+			for (b = 32; b >= 0; b -= 8)
+				for (arec = atable[old_hash_ipv4(pip4, b)]; arec; arec = arec->next)
+					if(arec->masktype == HM_IPV4 &&
+					   old_usable(arec, type, username, auth_user, hprecv) &&
+					   comp_with_mask_sock(pip4, (struct sockaddr *)&arec->Mask.ipa.addr,
+						arec->Mask.ipa.bits))
+					{
+						hprecv = arec->precedence;
+						hprec = arec->aconf;
+					}
+	}
+
+	if(orighost != NULL)
+		old_find_host(orighost, sockhost, type, username, auth_user, &hprecv, &hprec);
+
+	if(name != NULL)
+		old_find_host(name, sockhost, type, username, auth_user, &hprecv, &hprec);
+
+	return hprec;
+}
+
+/*
+ * Ban i is one of: a /24, /16 or single IPv4 address, an IPv6 /48 or /64,
+ * a domain, a single host, or (rarely) a mask with no literal domain;
+ * some are for one username only, and every seventh is a D-line.
+ */
+static void
+add_bans(void)
+{
+	char mask[HOSTLEN + USERLEN + 2];
+	const char *user;
+	int i, type;
+
+	for (i = 0; i < NUM_BANS; i++)
+	{
+		switch (i % 8)
+		{
+		case 0: snprintf(mask, sizeof mask, "10.%d.%d.0/24", i % 200, i / 200); break;
+		case 1: snprintf(mask, sizeof mask, "172.%d.0.0/16", i % 256); break;
+		case 2: snprintf(mask, sizeof mask, "192.168.%d.%d", i / 256 % 256, i % 256); break;
+		case 3: snprintf(mask, sizeof mask, "2001:db8:%x::/48", i); break;
+		case 4: snprintf(mask, sizeof mask, "2001:db8:%x:%x::/64", i % 16, i); break;
+		case 5: snprintf(mask, sizeof mask, "*.dom%d.example", i); break;
+		case 6: snprintf(mask, sizeof mask, "h%d.isp%d.example", i, i % 97); break;
+		default:
+			if (i % 200 == 7)
+				snprintf(mask, sizeof mask, "*isp%d*", i % 97);
+			else
+				snprintf(mask, sizeof mask, "h%d*.isp%d.example", i, i % 97);
+		}
+
+		type = i % 7 == 0 ? CONF_DLINE : CONF_KILL;
+		user = type == CONF_DLINE || i % 3 ? "*" : (i % 9 == 0 ? "u1*" : "u2");
+
+		bans[i].status = type;
+		bans[i].host = rb_strdup(mask);
+		add_conf_by_address(bans[i].host, type, type == CONF_DLINE ? NULL : rb_strdup(user),
+				NULL, &bans[i]);
+	}
+}
+
+struct lookup
+{
+	struct rb_sockaddr_storage addr;
+	char ip[HOSTIPLEN];
+	char host[HOSTLEN];
+	char user[USERLEN];
+};
+
+static void
+make_lookup(struct lookup *l, unsigned int n)
+{
+	switch (n % 6)
+	{
+	case 0: snprintf(l->ip, sizeof l->ip, "10.%u.%u.%u", n % 210, n / 7 % 40, n % 250); break;
+	case 1: snprintf(l->ip, sizeof l->ip, "172.%u.%u.1", n % 300, n % 256); break;
+	case 2: snprintf(l->ip, sizeof l->ip, "192.168.%u.%u", n / 5 % 30, n % 256); break;
+	case 3: snprintf(l->ip, sizeof l->ip, "2001:db8:%x:%x::1", n % 7000, n % 16); break;
+	case 4: snprintf(l->ip, sizeof l->ip, "2002:a%02x:%02x00::1", n % 200, n % 40); break;
+	default: snprintf(l->ip, sizeof l->ip, "198.51.100.%u", n % 256);
+	}
+	rb_inet_pton_sock(l->ip, &l->addr);
+
+	if (n % 4 == 0)
+		rb_strlcpy(l->host, l->ip, sizeof l->host);
+	else if (n % 4 == 1)
+		snprintf(l->host, sizeof l->host, "x%u.dom%u.example", n, n % 7000);
+	else
+		snprintf(l->host, sizeof l->host, "h%u%u.isp%u.example", n % 6000, n % 3, n % 97);
+
+	snprintf(l->user, sizeof l->user, "u%u", n % 25);
+}
+
+static long
+elapsed_us(struct timeval *start)
+{
+	struct timeval stop;
+
+	gettimeofday(&stop, NULL);
+	return (stop.tv_sec - start->tv_sec) * 1000000 + (stop.tv_usec - start->tv_usec);
+}
+
+static void
+find_conf_by_address1(void)
+{
+	static struct lookup lookups[NUM_LOOKUPS];
+	static struct ConfItem *want[NUM_LOOKUPS][2];
+	struct ConfItem *got;
+	struct timeval start;
+	struct lookup *l;
+	int i, matched = 0, wrong = 0;
+	long old_us, new_us;
+
+	init_host_hash();
+	add_bans();
+
+	for (i = 0; i < NUM_LOOKUPS; i++)
+		make_lookup(&lookups[i], i);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++)
+	{
+		l = &lookups[i];
+		want[i][0] = old_find_conf_by_address(l->host, l->ip, l->host, (struct sockaddr *)&l->addr,
+				CONF_KILL, GET_SS_FAMILY(&l->addr), l->user, NULL);
+		want[i][1] = old_find_conf_by_address(NULL, NULL, NULL, (struct sockaddr *)&l->addr,
+				CONF_DLINE | 1, GET_SS_FAMILY(&l->addr), NULL, NULL);
+	}
+	old_us = elapsed_us(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++)
+	{
+		l = &lookups[i];
+		got = find_conf_by_address(l->host, l->ip, l->host, (struct sockaddr *)&l->addr,
+				CONF_KILL, GET_SS_FAMILY(&l->addr), l->user, NULL);
+		if (got != want[i][0])
+			wrong++;
+		if (got != NULL)
+			matched++;
+
+		got = find_conf_by_address(NULL, NULL, NULL, (struct sockaddr *)&l->addr,
+				CONF_DLINE | 1, GET_SS_FAMILY(&l->addr), NULL, NULL);
+		if (got != want[i][1])
+			wrong++;
+		if (got != NULL)
+			matched++;
+	}
+	new_us = elapsed_us(&start);
+
+	diag("%d lookups against %d bans: %ld us hashed, %ld us indexed, %d matched",
+		NUM_LOOKUPS * 2, NUM_BANS, old_us, new_us, matched);
+	ok(matched > NUM_LOOKUPS / 10, MSG);
+	is_int(0, wrong, MSG);
+
+	/* removing bans leaves the index agreeing with what is left */
+	for (i = 0; i < NUM_BANS; i += 2)
+	{
+		bans[i].clients = 1;
+		delete_one_address_conf(bans[i].host, &bans[i]);
+	}
+
+	wrong = 0;
+	for (i = 0; i < NUM_LOOKUPS; i++)
+	{
+		l = &lookups[i];
+		if (find_conf_by_address(l->host, l->ip, l->host, (struct sockaddr *)&l->addr,
+				CONF_KILL, GET_SS_FAMILY(&l->addr), l->user, NULL) !=
+		    old_find_conf_by_address(l->host, l->ip, l->host, (struct sockaddr *)&l->addr,
+				CONF_KILL, GET_SS_FAMILY(&l->addr), l->user, NULL))
+			wrong++;
+	}
+	is_int(0, wrong, MSG);
+}
+
 int main(int argc, char *argv[])
 {
 	memset(&me, 0, sizeof(me));
@@ -214,5 +537,7 @@ int main(int argc, char *argv[])
 	valid_ipv6_cidr();
 	invalid_ipv6_cidr();
 
+	find_conf_by_address1();
+
 	return 0;
 }
@@ -0,0 +1,286 @@
+/*
+ *  kline1.c: Test applying new K-lines and D-lines through the ban check index
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "hostmask.h"
+#include "match.h"
+#include "operhash.h"
+#include "s_conf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_USERS 2000
+
+static struct Client *clients[NUM_USERS];
+static struct ConfItem auth_conf;
+
+/*
+ * Client i is u(i%50)@h(i).example.isp(i%13) on 10.0.(i/250).(i%250+1),
+ * every tenth one connecting over 6to4 from the same IPv4 address.
+ */
+static void
+make_clients(void)
+{
+	char nick[NICKLEN], username[USERLEN], host[HOSTLEN], ip[HOSTIPLEN];
+	int i;
+
+	for(i = 0; i < NUM_USERS; i++)
+	{
+		snprintf(nick, sizeof(nick), "k%d", i);
+		snprintf(username, sizeof(username), "u%d", i % 50);
+		snprintf(host, sizeof(host), "h%d.example.isp%d", i, i % 13);
+		if(i % 10 == 9)
+			snprintf(ip, sizeof(ip), "2002:a00:%02x%02x::1", i / 250, i % 250 + 1);
+		else
+			snprintf(ip, sizeof(ip), "10.0.%d.%d", i / 250, i % 250 + 1);
+
+		clients[i] = make_local_person_full(nick, username, host, ip, "Test");
+		clients[i]->localClient->att_conf = &auth_conf;
+		auth_conf.clients++;
+	}
+}
+
+static void
+remove_clients(void)
+{
+	int i;
+
+	for(i = 0; i < NUM_USERS; i++)
+	{
+		if(!IsAnyDead(clients[i]))
+			remove_local_person(clients[i]);
+	}
+}
+
+static struct ConfItem *
+make_ban(int status, const char *user, const char *host)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = status;
+	aconf->user = user != NULL ? rb_strdup(user) : NULL;
+	aconf->host = rb_strdup(host);
+	aconf->passwd = rb_strdup("test ban");
+	aconf->info.oper = operhash_add("test");
+	add_conf_by_address(aconf->host, status, aconf->user, NULL, aconf);
+	return aconf;
+}
+
+static void
+remove_ban(struct ConfItem *aconf)
+{
+	delete_one_address_conf(aconf->host, aconf);
+}
+
+/* every client picked out by want() has gone, and nobody else */
+static void
+check_exited(int (*want)(int), const char *what)
+{
+	int i, exited = 0, expected = 0, wrong = 0, marked = 0;
+
+	for(i = 0; i < NUM_USERS; i++)
+	{
+		if(want(i))
+			expected++;
+		if(IsAnyDead(clients[i]))
+			exited++;
+		if(!!want(i) != !!IsAnyDead(clients[i]))
+			wrong++;
+		if(IsMarked(clients[i]))
+			marked++;
+	}
+
+	diag("%s: %d of %d exited", what, exited, NUM_USERS);
+	ok(expected > 0, MSG);
+	is_int(expected, exited, MSG);
+	is_int(0, wrong, MSG);
+	is_int(0, marked, MSG);
+}
+
+static int want_cidr(int i) { return i / 250 == 3; }
+static int want_host(int i) { return i % 13 == 5; }
+static int want_user(int i) { return i % 50 == 7; }
+static int want_prefix(int i) { return i == 1234; }
+static int want_batch(int i) { return i % 50 == 7 || i % 13 == 5 || i / 250 == 6; }
+static int want_many(int i) { return i % 50 < 20; }
+static int want_dline(int i) { return i / 250 == 4; }
+
+static void
+kline_one(int status, const char *user, const char *host, int (*want)(int))
+{
+	struct ConfItem *aconf;
+
+	make_clients();
+	aconf = make_ban(status, user, host);
+	if(status == CONF_KILL)
+		check_one_kline(aconf);
+	else
+		check_one_dline(aconf);
+	check_exited(want, host);
+	remove_ban(aconf);
+	remove_clients();
+}
+
+static void
+kline_index1(void)
+{
+	/* through the address tree, 6to4 clients included */
+	kline_one(CONF_KILL, "*", "10.0.3.0/24", want_cidr);
+
+	/* through the host suffix table */
+	kline_one(CONF_KILL, "*", "*.example.isp5", want_host);
+
+	/* nothing to narrow this down, so every client is looked at */
+	kline_one(CONF_KILL, "u7", "*", want_user);
+
+	/* through the host prefix table */
+	kline_one(CONF_KILL, "*", "h1234*", want_prefix);
+
+	/* D-lines catch unregistered connections as well */
+	kline_one(CONF_DLINE, NULL, "10.0.4.0/24", want_dline);
+}
+
+static void
+kline_unknown1(void)
+{
+	struct Client *unknown;
+	struct ConfItem *aconf;
+
+	unknown = make_client(NULL);
+	rb_inet_pton_sock("10.0.4.200", &unknown->localClient->ip);
+
+	aconf = make_ban(CONF_DLINE, NULL, "10.0.4.0/24");
+	check_one_dline(aconf);
+	ok(IsAnyDead(unknown), MSG);
+	remove_ban(aconf);
+}
+
+static void
+kline_rehost1(void)
+{
+	struct ConfItem *aconf;
+
+	make_clients();
+
+	/* the index follows a username change */
+	rb_strlcpy(clients[0]->username, "changed", sizeof(clients[0]->username));
+	update_ban_check_index(clients[0]);
+
+	aconf = make_ban(CONF_KILL, "changed", "*");
+	check_one_kline(aconf);
+	ok(IsAnyDead(clients[0]), MSG);
+	ok(!IsAnyDead(clients[50]), MSG);
+	remove_ban(aconf);
+
+	remove_clients();
+}
+
+static void
+kline_batch1(void)
+{
+	struct ConfItem *aconf[3], *gone;
+	int i, exited = 0;
+
+	make_clients();
+
+	start_ban_batch();
+	aconf[0] = make_ban(CONF_KILL, "u7", "*");
+	aconf[1] = make_ban(CONF_KILL, "*", "*.example.isp5");
+	aconf[2] = make_ban(CONF_KILL, "*", "10.0.6.0/24");
+	for(i = 0; i < 3; i++)
+		check_one_kline(aconf[i]);
+	check_one_kline(aconf[1]);
+
+	/* a ban removed before the batch ends is not applied */
+	gone = make_ban(CONF_KILL, "*", "10.0.7.0/24");
+	check_one_kline(gone);
+	remove_ban(gone);
+
+	for(i = 0; i < NUM_USERS; i++)
+		if(IsAnyDead(clients[i]))
+			exited++;
+	is_int(0, exited, MSG);
+
+	end_ban_batch();
+	check_exited(want_batch, "small batch");
+
+	for(i = 0; i < 3; i++)
+	{
+		is_int(0, aconf[i]->clients, MSG);
+		remove_ban(aconf[i]);
+	}
+
+	remove_clients();
+}
+
+static void
+kline_batch2(void)
+{
+	struct ConfItem *aconf[20];
+	char user[USERLEN];
+	int i;
+
+	make_clients();
+
+	/* a large batch is applied with a single pass */
+	start_ban_batch();
+	start_ban_batch();
+	for(i = 0; i < 20; i++)
+	{
+		snprintf(user, sizeof(user), "u%d", i);
+		aconf[i] = make_ban(CONF_KILL, user, "*");
+		check_one_kline(aconf[i]);
+	}
+	end_ban_batch();
+	ok(!IsAnyDead(clients[0]), MSG);
+	end_ban_batch();
+	check_exited(want_many, "large batch");
+
+	for(i = 0; i < 20; i++)
+		remove_ban(aconf[i]);
+
+	remove_clients();
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	kline_index1();
+	kline_unknown1();
+	kline_rehost1();
+	kline_batch1();
+	kline_batch2();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ *  maskindex1.c: Test and benchmark compiled X-line and nick RESV lists
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+#include "match.h"
+#include "s_conf.h"
+#include "s_newconf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_MASKS 5000
+#define NUM_NAMES 20000
+
+struct Client me;
+
+static struct ConfItem confs[NUM_MASKS];
+static char names[NUM_NAMES][REALLEN + 1];
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the list as it was matched before it was compiled */
+static struct ConfItem *
+walk_list(rb_dlink_list *list, const char *name)
+{
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		aconf = ptr->data;
+		if(match_esc(aconf->host, name))
+			return aconf;
+	}
+
+	return NULL;
+}
+
+/*
+ * Mask i is anchored at the start, at the end, at both, floating in the
+ * middle, uses escapes or extended wildcards, or has no plain characters.
+ */
+static void
+make_masks(rb_dlink_list *list, int count)
+{
+	char mask[REALLEN + 1];
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		switch(i % 9)
+		{
+		case 0: snprintf(mask, sizeof(mask), "Spam%d*", i); break;
+		case 1: snprintf(mask, sizeof(mask), "*bot%d.example", i); break;
+		case 2: snprintf(mask, sizeof(mask), "Exact Name %d", i); break;
+		case 3: snprintf(mask, sizeof(mask), "*free [%d] stuff*", i); break;
+		case 4: snprintf(mask, sizeof(mask), "*\\*star%d\\s*", i); break;
+		case 5: snprintf(mask, sizeof(mask), "x#y@%d?z*", i); break;
+		case 6: snprintf(mask, sizeof(mask), "*sp?m*%d*", i); break;
+		case 7: snprintf(mask, sizeof(mask), "%d", i); break;
+		default:
+			if(i % 900 == 8)
+				snprintf(mask, sizeof(mask), "##%s", i % 1800 == 8 ? "*" : "?");
+			else
+				snprintf(mask, sizeof(mask), "*%d*bar", i);
+		}
+
+		confs[i].status = CONF_XLINE;
+		confs[i].host = rb_strdup(mask);
+		confs[i].port = 0;
+		rb_dlinkAddTailAlloc(&confs[i], list);
+	}
+}
+
+static void
+free_masks(rb_dlink_list *list)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
+	{
+		struct ConfItem *aconf = ptr->data;
+
+		rb_free(aconf->host);
+		aconf->host = NULL;
+		rb_dlinkDestroy(ptr, list);
+	}
+}
+
+static void
+make_names(void)
+{
+	unsigned int i, n;
+
+	for(i = 0; i < NUM_NAMES; i++)
+	{
+		n = (i * 2654435761U) % (NUM_MASKS * 2);
+		switch(i % 10)
+		{
+		case 0: snprintf(names[i], sizeof(names[i]), "spam%uand more", n); break;
+		case 1: snprintf(names[i], sizeof(names[i]), "my bot%u.EXAMPLE", n); break;
+		case 2: snprintf(names[i], sizeof(names[i]), "exact name %u", n); break;
+		case 3: snprintf(names[i], sizeof(names[i]), "get FREE {%u} STUFF now", n); break;
+		case 4: snprintf(names[i], sizeof(names[i]), "a *star%u b", n); break;
+		case 5: snprintf(names[i], sizeof(names[i]), "x1yq%u!z", n); break;
+		case 6: snprintf(names[i], sizeof(names[i]), "spam %u", n); break;
+		case 7: snprintf(names[i], sizeof(names[i]), "%u", n); break;
+		case 8: snprintf(names[i], sizeof(names[i]), "%u foo %ubar", n, n % 3); break;
+		default: snprintf(names[i], sizeof(names[i]), "Real Name"); break;
+		}
+	}
+}
+
+static void
+xline_index1(void)
+{
+	struct ConfItem *want[NUM_NAMES];
+	struct ConfItem *got;
+	double start, walked, indexed;
+	int i, matched = 0, wrong = 0;
+
+	make_masks(&xline_conf_list, NUM_MASKS);
+	xline_conf_serial++;
+	make_names();
+
+	start = now();
+	for(i = 0; i < NUM_NAMES; i++)
+		want[i] = walk_list(&xline_conf_list, names[i]);
+	walked = now() - start;
+
+	start = now();
+	for(i = 0; i < NUM_NAMES; i++)
+	{
+		got = find_xline(names[i], 0);
+		if(got != want[i])
+			wrong++;
+		if(got != NULL)
+			matched++;
+	}
+	indexed = now() - start;
+
+	diag("%d names against %d X-lines: %.1f ms walked, %.1f ms indexed, %d matched",
+		NUM_NAMES, NUM_MASKS, walked * 1e3, indexed * 1e3, matched);
+	ok(matched > NUM_NAMES / 4, MSG);
+	is_int(0, wrong, MSG);
+
+	/* the counter is only bumped when asked to */
+	got = find_xline("Exact Name 2", 1);
+	ok(got == &confs[2], MSG);
+	find_xline("exact name 2", 0);
+	is_int(1, confs[2].port, MSG);
+
+	/* entries removed and added are seen once the serial has moved on */
+	rb_dlinkFindDestroy(&confs[2], &xline_conf_list);
+	rb_dlinkAddAlloc(&confs[6], &xline_conf_list);
+	xline_conf_serial++;
+	ok(find_xline("exact name 2", 0) == NULL, MSG);
+	ok(find_xline("spam 6", 0) == &confs[6], MSG);
+
+	wrong = 0;
+	for(i = 0; i < NUM_NAMES; i++)
+		if(find_xline(names[i], 0) != walk_list(&xline_conf_list, names[i]))
+			wrong++;
+	is_int(0, wrong, MSG);
+
+	free_masks(&xline_conf_list);
+	xline_conf_serial++;
+	ok(find_xline("spam 6", 0) == NULL, MSG);
+}
+
+static void
+resv_index1(void)
+{
+	int i, wrong = 0;
+
+	/* short lists are walked, and the counter always goes up */
+	make_masks(&resv_conf_list, 10);
+	resv_conf_serial++;
+	ok(find_nick_resv("Spam0") == &confs[0], MSG);
+	ok(find_nick_resv("7") == &confs[7], MSG);
+	ok(find_nick_resv("spam") == NULL, MSG);
+	is_int(1, confs[0].port, MSG);
+	free_masks(&resv_conf_list);
+
+	make_masks(&resv_conf_list, 200);
+	resv_conf_serial++;
+	for(i = 0; i < NUM_NAMES; i++)
+		if(find_nick_resv(names[i]) != walk_list(&resv_conf_list, names[i]))
+			wrong++;
+	is_int(0, wrong, MSG);
+	free_masks(&resv_conf_list);
+	resv_conf_serial++;
+}
+
+int
+main(int argc, char *argv[])
+{
+	memset(&me, 0, sizeof(me));
+	strcpy(me.name, "me.name.");
+
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	xline_index1();
+	resv_index1();
+
+	return 0;
+}
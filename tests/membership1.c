@@ -0,0 +1,216 @@
+/*
+ *  membership1.c: Test and benchmark find_channel_membership
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "hash.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define MAX_MEMBERS 50000
+#define LOOKUPS 1000000
+
+static struct Client *server;
+static struct Client *clients[MAX_MEMBERS];
+static struct Client *outsider;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+make_clients(void)
+{
+	char nick[NICKLEN];
+	char id[IDLEN];
+	int i;
+
+	server = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+
+	for(i = 0; i < MAX_MEMBERS; i++)
+	{
+		snprintf(nick, sizeof(nick), "member%d", i);
+		snprintf(id, sizeof(id), "%sA%05d", TEST_SERVER_ID, i);
+		clients[i] = make_remote_person_full_id(server, nick, TEST_USERNAME,
+				TEST_HOSTNAME, TEST_IP, TEST_REALNAME, id);
+	}
+
+	outsider = make_remote_person_full_id(server, "outsider", TEST_USERNAME,
+			TEST_HOSTNAME, TEST_IP, TEST_REALNAME, TEST_SERVER_ID "B00000");
+}
+
+static int
+check_members(struct Channel *chptr, int from, int to)
+{
+	struct membership *msptr;
+	int i;
+
+	for(i = from; i < to; i++)
+	{
+		msptr = find_channel_membership(chptr, clients[i]);
+		if(msptr == NULL || msptr->client_p != clients[i] || msptr->chptr != chptr)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+check_non_members(struct Channel *chptr, int from, int to)
+{
+	int i;
+
+	for(i = from; i < to; i++)
+	{
+		if(find_channel_membership(chptr, clients[i]) != NULL)
+			return 0;
+	}
+	return find_channel_membership(chptr, outsider) == NULL;
+}
+
+static void
+membership_size(int count)
+{
+	char chname[CHANNELLEN];
+	struct Channel *chptr;
+	struct membership *msptr;
+	volatile int found = 0;
+	double start, elapsed;
+	int i;
+
+	snprintf(chname, sizeof(chname), "#members%d", count);
+	chptr = get_or_create_channel(&me, chname, NULL);
+	chptr->mode.mode |= MODE_PERMANENT;
+
+	for(i = 0; i < count; i++)
+		add_user_to_channel(chptr, clients[i], CHFL_PEON);
+
+	is_int(count, rb_dlink_list_length(&chptr->members), MSG);
+	ok(check_members(chptr, 0, count), "%d members: all found", count);
+	ok(check_non_members(chptr, count, MAX_MEMBERS < count * 2 ? MAX_MEMBERS : count * 2),
+			"%d members: non-members not found", count);
+
+	start = now();
+	for(i = 0; i < LOOKUPS; i++)
+		found += find_channel_membership(chptr, clients[(unsigned int) i * 7919 % count]) != NULL;
+	elapsed = now() - start;
+
+	is_int(LOOKUPS, found, MSG);
+	diag("%d members: %.1f ns per lookup", count, elapsed * 1e9 / LOOKUPS);
+
+	/* remove the odd members, then the rest */
+	for(i = 1; i < count; i += 2)
+	{
+		msptr = find_channel_membership(chptr, clients[i]);
+		remove_user_from_channel(msptr);
+	}
+
+	is_int((count + 1) / 2, rb_dlink_list_length(&chptr->members), MSG);
+	for(i = 0; i < count; i++)
+	{
+		msptr = find_channel_membership(chptr, clients[i]);
+		if((msptr != NULL) != (i % 2 == 0))
+			break;
+	}
+	is_int(count, i, "%d members: found after removals", count);
+
+	for(i = 0; i < count; i += 2)
+	{
+		msptr = find_channel_membership(chptr, clients[i]);
+		remove_user_from_channel(msptr);
+	}
+
+	is_int(0, rb_dlink_list_length(&chptr->members), MSG);
+	ok(chptr->member_index == NULL, MSG);
+	ok(check_non_members(chptr, 0, count), "%d members: none left", count);
+}
+
+static void
+membership_many_channels(void)
+{
+	struct Channel *chans[200];
+	char chname[CHANNELLEN];
+	int i, j, good = 1;
+
+	/* a services-style client in lots of channels, each with
+	 * enough members to be indexed
+	 */
+	for(i = 0; i < 200; i++)
+	{
+		snprintf(chname, sizeof(chname), "#many%d", i);
+		chans[i] = get_or_create_channel(&me, chname, NULL);
+		add_user_to_channel(chans[i], clients[0], CHFL_CHANOP);
+		for(j = 1; j < 100; j++)
+			add_user_to_channel(chans[i], clients[i * 100 + j], CHFL_PEON);
+	}
+
+	for(i = 0; i < 200; i++)
+	{
+		struct membership *msptr = find_channel_membership(chans[i], clients[0]);
+
+		if(msptr == NULL || msptr->chptr != chans[i] || !is_chanop(msptr))
+			good = 0;
+		if(find_channel_membership(chans[i], clients[(i + 1) % 200 * 100 + 1]) != NULL)
+			good = 0;
+	}
+	ok(good, MSG);
+
+	remove_user_from_channels(clients[0]);
+	for(i = 0; i < 200; i++)
+	{
+		if(find_channel_membership(chans[i], clients[0]) != NULL)
+			good = 0;
+		if(!check_members(chans[i], i * 100 + 1, i * 100 + 100))
+			good = 0;
+	}
+	ok(good, MSG);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	make_clients();
+
+	membership_size(10);
+	membership_size(1000);
+	membership_size(MAX_MEMBERS);
+	membership_many_channels();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
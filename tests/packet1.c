@@ -0,0 +1,193 @@
+/*
+ *  packet1.c: Test splitting what is read from a connection into lines
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "packet.h"
+#include "send.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static struct Client *client;
+static rb_fde_t *peer;
+
+/* all the replies, which may not fit in the socket buffer at once */
+static const char *
+read_peer(void)
+{
+	static char buf[BUFSIZE * 64];
+	ssize_t len, total = 0;
+
+	do
+	{
+		ClearFlush(client);
+		send_queued(client);
+		len = read(rb_get_fd(peer), buf + total, sizeof(buf) - total - 1);
+		if (len > 0)
+			total += len;
+	}
+	while (len > 0);
+
+	buf[total] = '\0';
+	return buf;
+}
+
+/* what the client sends arrives in one read */
+static const char *
+send_packet(const char *data)
+{
+	ok(write(rb_get_fd(peer), data, strlen(data)) == (ssize_t)strlen(data), MSG);
+	read_packet(client->localClient->F, client);
+	return read_peer();
+}
+
+static void
+whole_lines(void)
+{
+	is_string(":me.test PONG me.test :one" CRLF ":me.test PONG me.test :two" CRLF,
+		send_packet("PING :one\r\n\r\n\nPING :two\n"), MSG);
+	ok(client->localClient->recvq.buf == NULL, MSG);
+	is_int(0, client->localClient->recvq.len, MSG);
+}
+
+static void
+partial_lines(void)
+{
+	is_string("", send_packet("PING :thr"), MSG);
+	ok(client->localClient->recvq.buf != NULL, MSG);
+	is_int(9, client->localClient->recvq.len, MSG);
+
+	is_string("", send_packet("ee"), MSG);
+	is_string(":me.test PONG me.test :three" CRLF, send_packet("\r"), MSG);
+
+	/* the rest of the line end is dropped, and with it the ring */
+	is_string("", send_packet("\n"), MSG);
+	ok(client->localClient->recvq.buf == NULL, MSG);
+}
+
+/* enough to go round the ring a couple of times, so that some lines
+ * are split across its end
+ */
+static void
+wrapped_lines(void)
+{
+	char *sent = rb_malloc(400 * 16 + 16), *expect = rb_malloc(400 * 32 + 64);
+	size_t slen = 0, elen = 0;
+	int i;
+
+	is_string("", send_packet("PING :a"), MSG);
+
+	slen += sprintf(sent + slen, "\r\n");
+	elen += sprintf(expect + elen, ":me.test PONG me.test :a" CRLF);
+	for (i = 0; i < 400; i++)
+	{
+		slen += sprintf(sent + slen, "PING :%04d\r\n", i);
+		elen += sprintf(expect + elen, ":me.test PONG me.test :%04d" CRLF, i);
+	}
+
+	is_string(expect, send_packet(sent), MSG);
+	is_int(0, client->localClient->recvq.len, MSG);
+
+	rb_free(sent);
+	rb_free(expect);
+}
+
+/* lines longer than a linebuf are split, as they always were */
+static void
+long_lines(void)
+{
+	char *sent = rb_malloc(LINEBUF_SIZE + 64);
+	const char *reply;
+
+	memset(sent, 'x', LINEBUF_SIZE + 10);
+	memcpy(sent, "PING :", 6);
+	strcpy(sent + LINEBUF_SIZE, "UNKNOWN\r\n");
+
+	reply = send_packet(sent);
+	ok(strncmp(reply, ":me.test PONG me.test :xxx", 26) == 0, MSG);
+	ok(strstr(reply, " 421 " TEST_NICK " UNKNOWN ") != NULL, MSG);
+	is_int(0, client->localClient->recvq.len, MSG);
+	ok(!IsAnyDead(client), MSG);
+
+	rb_free(sent);
+}
+
+static void
+count_line(const char *data, int len, int terminated, void *arg)
+{
+	char *buf = arg;
+
+	rb_snprintf_append(buf, BUFSIZE, "%s%.*s|", terminated ? "" : "partial ", len, data);
+}
+
+/* as an upgrade saves and restores them */
+static void
+queued_lines(void)
+{
+	char buf[BUFSIZE] = "";
+
+	recvq_append(&client->localClient->recvq, "PING :q\r\n\r\nPING :r", 18);
+	recvq_foreach(&client->localClient->recvq, count_line, buf);
+	is_string("PING :q|partial PING :r|", buf, MSG);
+
+	is_string(":me.test PONG me.test :q" CRLF ":me.test PONG me.test :r" CRLF,
+		send_packet("\r\n"), MSG);
+	ok(client->localClient->recvq.buf == NULL, MSG);
+}
+
+int
+main(int argc, char *argv[])
+{
+	rb_fde_t *F[2];
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	client = make_local_person();
+	client->localClient->localflags &= ~LFLAGS_FAKE;
+	SetExemptFlood(client);
+
+	if (ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F[0], &F[1], "packet test") == 0, MSG))
+	{
+		client->localClient->F = F[0];
+		peer = F[1];
+
+		whole_lines();
+		partial_lines();
+		wrapped_lines();
+		long_lines();
+		queued_lines();
+
+		remove_local_person(client);
+		rb_close(peer);
+	}
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
@@ -159,6 +159,42 @@ static void test_privset_diff_rehash(void)
 	cleanup();
 }
 
+static void test_privset_ids(void)
+{
+	char privs[1024] = "", priv[32];
+	struct PrivilegeSet *set;
+	int i;
+
+	/* builtin privileges have fixed ids */
+	is_int(PRIV_OPER_KILL, privilege_find("oper:kill"), MSG);
+	is_int(PRIV_AUSPEX_OPER, privilege_intern("auspex:oper"), MSG);
+	is_int(PRIV_NONE, privilege_find("never:granted"), MSG);
+
+	/* enough names to need more than one word */
+	for (i = 0; i < 80; i++)
+	{
+		snprintf(priv, sizeof priv, "test:%d ", i);
+		rb_strlcat(privs, priv, sizeof privs);
+	}
+	set = privilegeset_set_new("test", privs, 0);
+
+	is_bool(true, privilegeset_has(set, privilege_find("test:0")), MSG);
+	is_bool(true, privilegeset_has(set, privilege_find("test:79")), MSG);
+	is_bool(true, privilege_find("test:79") >= 64, MSG);
+	is_bool(false, privilegeset_has(set, PRIV_OPER_KILL), MSG);
+	is_bool(false, privilegeset_has(set, PRIV_NONE), MSG);
+
+	/* ids interned later are beyond the set's bitset */
+	is_bool(false, privilegeset_has(set, privilege_intern("test:late")), MSG);
+
+	privilegeset_set_new("test", "oper:kill test:late", 0);
+	is_bool(true, privilegeset_has(set, PRIV_OPER_KILL), MSG);
+	is_bool(true, privilegeset_in_set(set, "test:late"), MSG);
+	is_bool(false, privilegeset_in_set(set, "test:0"), MSG);
+
+	cleanup();
+}
+
 int main(int argc, char *argv[])
 {
 	plan_lazy();
@@ -169,6 +205,7 @@ int main(int argc, char *argv[])
 	test_privset_persistence();
 	test_privset_diff();
 	test_privset_diff_rehash();
+	test_privset_ids();
 
 	return 0;
 }
@@ -0,0 +1,110 @@
+/*
+ *  rb_balloc1.c: Test rb_bh block allocator
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_ELEMS 10000
+
+struct test_elem
+{
+	char data[100];
+};
+
+static const struct test_elem zero_elem;
+
+static void alloc_free1(void)
+{
+	static struct test_elem *elems[NUM_ELEMS];
+	rb_bh *bh = rb_bh_create(sizeof(struct test_elem), 64, "test_heap");
+	size_t used, freem, mem;
+	const char *desc;
+	int i, zeroed = 1, distinct = 1;
+
+	for(i = 0; i < NUM_ELEMS; i++)
+	{
+		elems[i] = rb_bh_alloc(bh);
+		if(memcmp(elems[i], &zero_elem, sizeof(zero_elem)))
+			zeroed = 0;
+		memset(elems[i]->data, 'x', sizeof(elems[i]->data));
+		if(i > 0 && elems[i] == elems[i - 1])
+			distinct = 0;
+	}
+	ok(zeroed, MSG);
+	ok(distinct, MSG);
+
+	rb_bh_usage(bh, &used, &freem, &mem, &desc);
+	is_int(NUM_ELEMS, used, MSG);
+	is_int(NUM_ELEMS * sizeof(struct test_elem), mem, MSG);
+	is_string("test_heap", desc, MSG);
+
+	/* free every other element, then reallocate them */
+	for(i = 0; i < NUM_ELEMS; i += 2)
+		is_int(0, rb_bh_free(bh, elems[i]), MSG);
+
+	rb_bh_usage(bh, &used, &freem, NULL, NULL);
+	is_int(NUM_ELEMS / 2, used, MSG);
+	ok(freem >= NUM_ELEMS / 2, MSG);
+
+	zeroed = 1;
+	for(i = 0; i < NUM_ELEMS; i += 2)
+	{
+		elems[i] = rb_bh_alloc(bh);
+		if(memcmp(elems[i], &zero_elem, sizeof(zero_elem)))
+			zeroed = 0;
+	}
+	ok(zeroed, MSG);
+
+	/* freeing everything gives back all but a spare block */
+	for(i = 0; i < NUM_ELEMS; i++)
+		rb_bh_free(bh, elems[i]);
+
+	rb_bh_usage(bh, &used, &freem, NULL, NULL);
+	is_int(0, used, MSG);
+	ok(freem < NUM_ELEMS / 2, MSG);
+
+	/* and the heap is still usable afterwards */
+	for(i = 0; i < NUM_ELEMS; i++)
+		elems[i] = rb_bh_alloc(bh);
+
+	rb_bh_usage(bh, &used, NULL, NULL, NULL);
+	is_int(NUM_ELEMS, used, MSG);
+
+	is_int(0, rb_bh_destroy(bh), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	alloc_free1();
+
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ *  rb_epoll1.c: Test IO readiness dispatch and interest changes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define PAIRS 50
+
+static int calls;
+static int nread;
+static int read_size;
+static int rearm;
+
+static void
+read_cb(rb_fde_t *F, void *data)
+{
+	char buf[64];
+	int ret;
+
+	calls++;
+	ret = rb_read(F, buf, read_size);
+	if(ret > 0)
+		nread += ret;
+	if(rearm)
+		rb_setselect(F, RB_SELECT_READ, read_cb, data);
+}
+
+static void
+write_cb(rb_fde_t *F __attribute__((unused)), void *data __attribute__((unused)))
+{
+	calls++;
+}
+
+static int
+run_loops(int count)
+{
+	int before = calls;
+
+	while(count-- > 0)
+		rb_select(0);
+	return calls - before;
+}
+
+static unsigned long long
+ctls(void)
+{
+	struct rb_iostats io;
+
+	rb_get_io_stats(&io);
+	return io.ctls;
+}
+
+static void
+partial_read1(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "epoll test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	calls = nread = 0;
+	read_size = 4;
+	rearm = 1;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	is_int(0, run_loops(1), MSG);
+
+	/* each pass takes a little; the rest must keep being reported */
+	is_int(20, rb_write(F1, "0123456789abcdefghij", 20), MSG);
+	is_int(5, run_loops(5), MSG);
+	is_int(20, nread, MSG);
+
+	/* and once it is all gone, nothing more turns up */
+	is_int(0, run_loops(3), MSG);
+	is_int(20, nread, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+idle_rearm1(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "epoll test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	calls = nread = 0;
+	read_size = 4;
+	rearm = 0;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	rb_write(F1, "0123456789", 10);
+	is_int(1, run_loops(3), MSG);
+	is_int(4, nread, MSG);
+
+	/* data that arrives while nobody is listening is found on re-arm */
+	rb_write(F1, "0123456789", 10);
+	is_int(0, run_loops(2), MSG);
+
+	read_size = 64;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	is_int(1, run_loops(2), MSG);
+	is_int(20, nread, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+steady_state1(void)
+{
+	rb_fde_t *F1, *F2;
+	unsigned long long before;
+	int i;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "epoll test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	calls = nread = 0;
+	read_size = 64;
+	rearm = 1;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	rb_select(0);
+
+	before = ctls();
+	for(i = 0; i < 100; i++)
+	{
+		rb_write(F1, "PING :x\r\n", 9);
+		rb_select(0);
+	}
+	is_int(100, calls, MSG);
+	is_int(900, nread, MSG);
+
+	/* short reads re-arm without touching the kernel's interest set */
+	if(strcmp(rb_get_iotype(), "epoll") == 0)
+		is_int(0, ctls() - before, MSG);
+	else
+		skip("not using epoll");
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+write_ready1(void)
+{
+	rb_fde_t *F1, *F2;
+	char buf[4096];
+	int ret;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "epoll test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	memset(buf, 'w', sizeof(buf));
+	while(rb_write(F1, buf, sizeof(buf)) > 0)
+		;
+	ok(rb_ignore_errno(errno), MSG);
+
+	calls = 0;
+	rb_setselect(F1, RB_SELECT_WRITE, write_cb, NULL);
+	is_int(0, run_loops(2), MSG);
+
+	while((ret = rb_read(F2, buf, sizeof(buf))) > 0)
+		;
+	is_int(1, run_loops(2), MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+close_pending1(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "epoll test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+
+	/* interest set and dropped again before the loop runs */
+	calls = 0;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	rb_write(F1, "x", 1);
+	rb_close(F2);
+	is_int(0, run_loops(2), MSG);
+
+	rb_close(F1);
+}
+
+static void
+budget1(void)
+{
+	rb_fde_t *F1[PAIRS], *F2[PAIRS];
+	int i, n, passes = 0;
+
+	for(i = 0; i < PAIRS; i++)
+	{
+		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1[i], &F2[i], "epoll test") < 0)
+		{
+			skip("socketpair failed");
+			return;
+		}
+		rb_set_nb(F2[i]);
+	}
+
+	calls = nread = 0;
+	read_size = 64;
+	rearm = 1;
+	for(i = 0; i < PAIRS; i++)
+	{
+		rb_setselect(F2[i], RB_SELECT_READ, read_cb, NULL);
+		rb_write(F1[i], "hello", 5);
+	}
+
+	rb_set_io_budget(10);
+	while(calls < PAIRS && passes < PAIRS)
+	{
+		n = run_loops(1);
+		if(strcmp(rb_get_iotype(), "epoll") == 0 && n > 10)
+			break;
+		passes++;
+	}
+	rb_set_io_budget(0);
+
+	is_int(PAIRS, calls, MSG);
+	is_int(PAIRS * 5, nread, MSG);
+	if(strcmp(rb_get_iotype(), "epoll") == 0)
+		is_int(PAIRS / 10, passes, MSG);
+	else
+		skip("not using epoll");
+
+	for(i = 0; i < PAIRS; i++)
+	{
+		rb_close(F1[i]);
+		rb_close(F2[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	diag("using %s", rb_get_iotype());
+
+	partial_read1();
+	idle_rearm1();
+	steady_state1();
+	write_ready1();
+	close_pending1();
+	budget1();
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ *  rb_event1.c: Test rb_event and rb_settimeout scheduling
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_EVENTS 200
+#define NUM_PAIRS 100
+
+static time_t fake_now = 1500000000;
+
+int rb_gettimeofday(struct timeval *tv, void *tz)
+{
+	if (tv == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+	tv->tv_sec = fake_now;
+	tv->tv_usec = 0;
+	return 0;
+}
+
+static void advance(time_t seconds)
+{
+	fake_now += seconds;
+	rb_set_time();
+}
+
+static int ran;
+
+static void count_event(void *unused)
+{
+	ran++;
+}
+
+static struct ev_entry *self_ev;
+
+static void delete_self(void *unused)
+{
+	ran++;
+	rb_event_delete(self_ev);
+}
+
+static void event_order1(void)
+{
+	static struct ev_entry *evs[NUM_EVENTS];
+	time_t start = rb_current_time();
+	int i;
+
+	for(i = 0; i < NUM_EVENTS; i++)
+		evs[i] = rb_event_addonce("event_order1", count_event, NULL,
+				(unsigned int) i * 7919 % NUM_EVENTS + 10);
+
+	is_int(start + 10, rb_event_next(), MSG);
+
+	/* remove the earliest half, out of order */
+	for(i = 0; i < NUM_EVENTS; i++)
+	{
+		if((unsigned int) i * 7919 % NUM_EVENTS < NUM_EVENTS / 2)
+			rb_event_delete(evs[i]);
+	}
+	is_int(start + 10 + NUM_EVENTS / 2, rb_event_next(), MSG);
+
+	/* pushing one back to the front */
+	for(i = 0; i < NUM_EVENTS; i++)
+	{
+		if((unsigned int) i * 7919 % NUM_EVENTS == NUM_EVENTS - 1)
+			break;
+	}
+	rb_event_update(evs[i], 5);
+	is_int(start + 5, rb_event_next(), MSG);
+
+	for(i = 0; i < NUM_EVENTS; i++)
+	{
+		if((unsigned int) i * 7919 % NUM_EVENTS >= NUM_EVENTS / 2)
+			rb_event_delete(evs[i]);
+	}
+	is_int(-1, rb_event_next(), MSG);
+}
+
+static void event_self_delete1(void)
+{
+	ran = 0;
+	self_ev = rb_event_add("event_self_delete1", delete_self, NULL, 30);
+	is_int(rb_current_time() + 30, rb_event_next(), MSG);
+
+	rb_run_one_event_for_tests("event_self_delete1");
+	is_int(1, ran, MSG);
+	is_int(-1, rb_event_next(), MSG);
+
+	/* it is gone, so this does nothing */
+	rb_run_one_event_for_tests("event_self_delete1");
+	is_int(1, ran, MSG);
+}
+
+static void event_repeat1(void)
+{
+	struct ev_entry *ev;
+	time_t start = rb_current_time();
+
+	ran = 0;
+	ev = rb_event_add("event_repeat1", count_event, NULL, 60);
+	rb_event_addonce("event_once1", count_event, NULL, 90);
+
+	is_int(start + 60, rb_event_next(), MSG);
+
+	/* running it moves it behind the other one */
+	advance(60);
+	rb_run_one_event_for_tests("event_repeat1");
+	is_int(1, ran, MSG);
+	is_int(start + 90, rb_event_next(), MSG);
+
+	rb_run_one_event_for_tests("event_once1");
+	is_int(2, ran, MSG);
+	is_int(start + 120, rb_event_next(), MSG);
+
+	rb_event_delete(ev);
+	is_int(-1, rb_event_next(), MSG);
+}
+
+static int timeouts_fired;
+
+static void timeout_cb(rb_fde_t *F, void *data)
+{
+	timeouts_fired++;
+	ok(data == F, MSG);
+}
+
+static void timeouts1(void)
+{
+	static rb_fde_t *F[NUM_PAIRS * 2];
+	int i;
+
+	for(i = 0; i < NUM_PAIRS; i++)
+	{
+		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F[i * 2], &F[i * 2 + 1], "timeouts1") < 0)
+		{
+			skip("socketpair failed");
+			return;
+		}
+	}
+
+	for(i = 0; i < NUM_PAIRS * 2; i++)
+		rb_settimeout(F[i], i % 20 + 1, timeout_cb, F[i]);
+
+	/* re-arming replaces the earlier timeout */
+	for(i = 0; i < NUM_PAIRS * 2; i += 4)
+		rb_settimeout(F[i], 100, timeout_cb, F[i]);
+
+	/* and clearing removes it */
+	for(i = 1; i < NUM_PAIRS * 2; i += 4)
+		rb_settimeout(F[i], 0, NULL, NULL);
+
+	timeouts_fired = 0;
+	rb_checktimeouts(NULL);
+	is_int(0, timeouts_fired, MSG);
+
+	advance(11);
+	rb_checktimeouts(NULL);
+	is_int(40, timeouts_fired, MSG);
+
+	advance(10);
+	rb_checktimeouts(NULL);
+	is_int(100, timeouts_fired, MSG);
+
+	advance(100);
+	rb_checktimeouts(NULL);
+	is_int(150, timeouts_fired, MSG);
+
+	for(i = 0; i < NUM_PAIRS * 2; i++)
+		rb_close(F[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	event_order1();
+	event_self_delete1();
+	event_repeat1();
+	timeouts1();
+
+	return 0;
+}
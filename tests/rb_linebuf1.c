@@ -0,0 +1,294 @@
+/*
+ *  rb_linebuf1.c: Test rb_linebuf size classes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define FLUSH_LINES 1100
+
+static size_t class_count(int sclass)
+{
+	size_t count = 0;
+
+	rb_count_rb_linebuf_class_memory(sclass, NULL, &count, NULL);
+	return count;
+}
+
+static void put_small1(void)
+{
+	buf_head_t buf;
+	char out[LINEBUF_SIZE + 1];
+	rb_strf_t strings = { .format = "PRIVMSG #test :hello", .length = 0 };
+	size_t before = class_count(0);
+
+	rb_linebuf_newbuf(&buf);
+	rb_linebuf_put(&buf, &strings);
+
+	is_int(1, class_count(0) - before, MSG);
+	is_int(22, rb_linebuf_len(&buf), MSG);
+
+	is_int(22, rb_linebuf_get(&buf, out, sizeof(out), 0, 1), MSG);
+	ok(memcmp(out, "PRIVMSG #test :hello\r\n", 22) == 0, MSG);
+	is_int(0, class_count(0) - before, MSG);
+
+	rb_linebuf_donebuf(&buf);
+}
+
+static void put_large1(void)
+{
+	buf_head_t buf;
+	static char text[LINEBUF_SIZE + 100];
+	char out[LINEBUF_SIZE + 1];
+	rb_strf_t strings = { .format = text, .length = 0 };
+	size_t before = class_count(LINEBUF_CLASSES - 1);
+
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = '\0';
+
+	rb_linebuf_newbuf(&buf);
+	rb_linebuf_put(&buf, &strings);
+
+	is_int(1, class_count(LINEBUF_CLASSES - 1) - before, MSG);
+	is_int(LINEBUF_SIZE + CRLF_LEN, rb_linebuf_len(&buf), MSG);
+
+	is_int(LINEBUF_SIZE, rb_linebuf_get(&buf, out, sizeof(out), 0, 0), MSG);
+	is_int(LINEBUF_SIZE, strlen(out), MSG);
+
+	rb_linebuf_donebuf(&buf);
+}
+
+static void parse_grow1(void)
+{
+	buf_head_t buf;
+	char line[1000];
+	char out[LINEBUF_SIZE + 1];
+	size_t before0 = class_count(0);
+	size_t before2 = class_count(2);
+
+	memset(line, 'b', sizeof(line));
+
+	rb_linebuf_newbuf(&buf);
+
+	/* a short partial line starts in the smallest class */
+	is_int(1, rb_linebuf_parse(&buf, line, 10, 0), MSG);
+	is_int(1, class_count(0) - before0, MSG);
+	is_int(0, rb_linebuf_get(&buf, out, sizeof(out), 0, 0), MSG);
+
+	/* and moves to a larger one as more data arrives */
+	is_int(1, rb_linebuf_parse(&buf, line, sizeof(line), 0), MSG);
+	is_int(0, class_count(0) - before0, MSG);
+	is_int(1, class_count(2) - before2, MSG);
+
+	/* then terminating it and starting a new line */
+	is_int(2, rb_linebuf_parse(&buf, "\r\nPING :x\r\n", 11, 0), MSG);
+	is_int(1, class_count(0) - before0, MSG);
+
+	is_int(1010, rb_linebuf_get(&buf, out, sizeof(out), 0, 0), MSG);
+	is_int(1010, strlen(out), MSG);
+	is_int(0, class_count(2) - before2, MSG);
+
+	is_int(7, rb_linebuf_get(&buf, out, sizeof(out), 0, 0), MSG);
+	is_string("PING :x", out, MSG);
+	is_int(0, class_count(0) - before0, MSG);
+
+	rb_linebuf_donebuf(&buf);
+}
+
+static void parse_overflow1(void)
+{
+	buf_head_t buf;
+	static char text[LINEBUF_SIZE + 100];
+	char out[LINEBUF_SIZE + 1];
+
+	memset(text, 'c', sizeof(text));
+	text[sizeof(text) - 2] = '\r';
+	text[sizeof(text) - 1] = '\n';
+
+	rb_linebuf_newbuf(&buf);
+
+	is_int(1, rb_linebuf_parse(&buf, text, 100, 0), MSG);
+	is_int(1, rb_linebuf_parse(&buf, text + 100, sizeof(text) - 100, 0), MSG);
+
+	is_int(LINEBUF_SIZE, rb_linebuf_get(&buf, out, sizeof(out), 0, 0), MSG);
+	is_int(LINEBUF_SIZE, strlen(out), MSG);
+
+	rb_linebuf_donebuf(&buf);
+}
+
+static void attach_fanout1(void)
+{
+	static buf_head_t sendq[100];
+	buf_head_t msg;
+	char out[LINEBUF_SIZE + 1];
+	rb_strf_t strings = { .format = "PRIVMSG #big :hello everyone", .length = 0 };
+	size_t before = class_count(0);
+	int i, good = 1;
+
+	rb_linebuf_newbuf(&msg);
+	rb_linebuf_put(&msg, &strings);
+	rb_linebuf_put(&msg, &strings);
+
+	for(i = 0; i < 100; i++)
+	{
+		rb_linebuf_newbuf(&sendq[i]);
+		rb_linebuf_attach(&sendq[i], &msg);
+	}
+	rb_linebuf_donebuf(&msg);
+
+	/* every queue shares the same two lines */
+	is_int(2, class_count(0) - before, MSG);
+	is_int(2, rb_linebuf_numlines(&sendq[99]), MSG);
+	is_int(60, rb_linebuf_len(&sendq[99]), MSG);
+
+	for(i = 0; i < 100; i++)
+	{
+		if(rb_linebuf_get(&sendq[i], out, sizeof(out), 0, 0) != 30 ||
+				strcmp(out, "PRIVMSG #big :hello everyone\r\n"))
+			good = 0;
+	}
+	ok(good, MSG);
+
+	/* the first line went once the last queue was done with it */
+	is_int(1, class_count(0) - before, MSG);
+
+	for(i = 0; i < 100; i++)
+		rb_linebuf_donebuf(&sendq[i]);
+	is_int(0, class_count(0) - before, MSG);
+}
+
+static void ring_wrap1(void)
+{
+	buf_head_t buf;
+	char line[32], out[LINEBUF_SIZE + 1];
+	rb_strf_t strings = { .format = line, .length = 0 };
+	int i, next = 0, good = 1;
+
+	rb_linebuf_newbuf(&buf);
+
+	/* keep a few lines queued while the ring wraps around many times */
+	for(i = 0; i < 1000; i++)
+	{
+		snprintf(line, sizeof(line), "line %d", i);
+		rb_linebuf_put(&buf, &strings);
+
+		if(i % 3 != 2)
+			continue;
+
+		while(rb_linebuf_numlines(&buf) > 2)
+		{
+			snprintf(line, sizeof(line), "line %d\r\n", next++);
+			rb_linebuf_get(&buf, out, sizeof(out), 0, 0);
+			if(strcmp(out, line))
+				good = 0;
+		}
+	}
+	ok(good, MSG);
+	is_int(3, rb_linebuf_numlines(&buf), MSG);
+
+	/* a long backlog grows the ring, and draining it still works */
+	for(i = 0; i < 1000; i++)
+	{
+		snprintf(line, sizeof(line), "line %d", 1000 + i);
+		rb_linebuf_put(&buf, &strings);
+	}
+	is_int(1003, rb_linebuf_numlines(&buf), MSG);
+
+	while(rb_linebuf_get(&buf, out, sizeof(out), 0, 0) > 0)
+	{
+		snprintf(line, sizeof(line), "line %d\r\n", next++);
+		if(strcmp(out, line))
+			good = 0;
+	}
+	ok(good, MSG);
+	is_int(2000, next, MSG);
+	is_int(0, rb_linebuf_len(&buf), MSG);
+
+	rb_linebuf_donebuf(&buf);
+}
+
+static void flush1(void)
+{
+	buf_head_t buf;
+	rb_fde_t *F1, *F2;
+	char line[32], out[16384];
+	rb_strf_t strings = { .format = line, .length = 0 };
+	int i, total = 0, ret;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "linebuf test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+
+	rb_linebuf_newbuf(&buf);
+
+	/* more lines than fit in one writev on any platform */
+	for(i = 0; i < FLUSH_LINES; i++)
+	{
+		snprintf(line, sizeof(line), "L%04d", i);
+		rb_linebuf_put(&buf, &strings);
+	}
+	is_int(FLUSH_LINES * 7, rb_linebuf_len(&buf), MSG);
+
+	while(rb_linebuf_len(&buf) > 0)
+	{
+		ret = rb_linebuf_flush(F1, &buf);
+		if(ret <= 0)
+			break;
+		total += ret;
+	}
+	is_int(FLUSH_LINES * 7, total, MSG);
+	is_int(0, rb_linebuf_numlines(&buf), MSG);
+
+	ret = rb_read(F2, out, sizeof(out));
+	is_int(total, ret, MSG);
+	ok(memcmp(out, "L0000\r\nL0001\r\n", 14) == 0, MSG);
+	snprintf(line, sizeof(line), "L%04d\r\n", FLUSH_LINES - 1);
+	ok(ret >= 7 && memcmp(out + ret - 7, line, 7) == 0, MSG);
+
+	rb_linebuf_donebuf(&buf);
+	rb_close(F1);
+	rb_close(F2);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	put_small1();
+	put_large1();
+	parse_grow1();
+	parse_overflow1();
+	attach_fanout1();
+	ring_wrap1();
+	flush1();
+
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ *  rb_uring1.c: Test the io_uring IO backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define PAIRS 200
+
+static int calls;
+static int nread;
+static int read_size;
+static int rearm;
+
+static void
+read_cb(rb_fde_t *F, void *data)
+{
+	char buf[64];
+	int ret;
+
+	calls++;
+	ret = rb_read(F, buf, read_size);
+	if(ret > 0)
+		nread += ret;
+	if(rearm)
+		rb_setselect(F, RB_SELECT_READ, read_cb, data);
+}
+
+static void
+write_cb(rb_fde_t *F __attribute__((unused)), void *data __attribute__((unused)))
+{
+	calls++;
+}
+
+static int
+run_loops(int count)
+{
+	int before = calls;
+
+	while(count-- > 0)
+		rb_select(0);
+	return calls - before;
+}
+
+static struct rb_iostats
+io_stats(void)
+{
+	struct rb_iostats io;
+
+	rb_get_io_stats(&io);
+	return io;
+}
+
+static void
+read_rearm1(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "uring test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	calls = nread = 0;
+	read_size = 4;
+	rearm = 1;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	is_int(0, run_loops(2), MSG);
+
+	/* a one-shot poll re-armed on a readable fd fires again */
+	rb_write(F1, "0123456789abcdefghij", 20);
+	is_int(5, run_loops(10), MSG);
+	is_int(20, nread, MSG);
+
+	/* data arriving while nobody is listening is found on re-arm */
+	rearm = 0;
+	rb_write(F1, "0123456789", 10);
+	is_int(1, run_loops(3), MSG);
+	rb_write(F1, "0123456789", 10);
+	is_int(0, run_loops(2), MSG);
+	read_size = 64;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	is_int(1, run_loops(2), MSG);
+	is_int(40, nread, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+read_write1(void)
+{
+	rb_fde_t *F1, *F2;
+	char buf[4096];
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "uring test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F1);
+	rb_set_nb(F2);
+
+	memset(buf, 'w', sizeof(buf));
+	while(rb_write(F1, buf, sizeof(buf)) > 0)
+		;
+
+	/* widening a queued read poll to cover writes replaces it */
+	calls = nread = 0;
+	read_size = 64;
+	rearm = 0;
+	rb_setselect(F1, RB_SELECT_READ, read_cb, NULL);
+	is_int(0, run_loops(2), MSG);
+	rb_setselect(F1, RB_SELECT_WRITE, write_cb, NULL);
+	is_int(0, run_loops(2), MSG);
+
+	while(rb_read(F2, buf, sizeof(buf)) > 0)
+		;
+	is_int(1, run_loops(2), MSG);
+	is_int(0, nread, MSG);
+
+	/* and the read side is still being watched afterwards */
+	rb_write(F2, "x", 1);
+	is_int(1, run_loops(2), MSG);
+	is_int(1, nread, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+close_reuse1(void)
+{
+	rb_fde_t *F1, *F2;
+	int fd;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "uring test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	rb_set_nb(F2);
+
+	/* a poll queued for a closed fd must not fire for its successor */
+	calls = 0;
+	rb_setselect(F2, RB_SELECT_READ, read_cb, NULL);
+	run_loops(1);
+	fd = rb_get_fd(F2);
+	rb_close(F2);
+	run_loops(1);
+
+	rb_close(F1);
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "uring test") < 0)
+	{
+		skip("socketpair failed");
+		return;
+	}
+	diag("fd %d reused as %d/%d", fd, rb_get_fd(F1), rb_get_fd(F2));
+	rb_write(F1, "x", 1);
+	rb_write(F2, "x", 1);
+	is_int(0, run_loops(2), MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+many_fds1(void)
+{
+	static rb_fde_t *F1[PAIRS], *F2[PAIRS];
+	struct rb_iostats before, after;
+	int i, round;
+
+	for(i = 0; i < PAIRS; i++)
+	{
+		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1[i], &F2[i], "uring test") < 0)
+		{
+			skip("socketpair failed");
+			return;
+		}
+		rb_set_nb(F2[i]);
+	}
+
+	calls = nread = 0;
+	read_size = 64;
+	rearm = 1;
+	for(i = 0; i < PAIRS; i++)
+		rb_setselect(F2[i], RB_SELECT_READ, read_cb, NULL);
+	run_loops(1);
+
+	before = io_stats();
+	for(round = 0; round < 10; round++)
+	{
+		for(i = 0; i < PAIRS; i++)
+			rb_write(F1[i], "PING :x\r\n", 9);
+		rb_select(0);
+	}
+	after = io_stats();
+
+	is_int(PAIRS * 10, calls, MSG);
+	is_int(PAIRS * 90, nread, MSG);
+
+	/* every re-arm rides along with the next wait */
+	is_int(10, after.waits - before.waits, MSG);
+	is_int(0, after.ctls - before.ctls, MSG);
+	is_int(PAIRS * 10, after.events - before.events, MSG);
+
+	/* a budget leaves the rest for the next pass */
+	for(i = 0; i < PAIRS; i++)
+		rb_write(F1[i], "PING :x\r\n", 9);
+	calls = 0;
+	rb_set_io_budget(50);
+	is_int(50, run_loops(1), MSG);
+	is_int(PAIRS - 50, run_loops(PAIRS / 50), MSG);
+	rb_set_io_budget(0);
+
+	for(i = 0; i < PAIRS; i++)
+	{
+		rb_close(F1[i]);
+		rb_close(F2[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	setenv("LIBRB_USE_IOTYPE", "io_uring", 1);
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	if(strcmp(rb_get_iotype(), "io_uring") != 0)
+		skip_all("io_uring not available");
+
+	plan_lazy();
+
+	read_rearm1();
+	read_write1();
+	close_reuse1();
+	many_fds1();
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ *  res1.c: Load test for the authd resolver against a local stub server
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "authd/res.h"
+#include "authd/reslib.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define LOAD_QUERIES 5000
+#define LOAD_BATCH 100
+#define SLOW_QUERIES 20
+
+static rb_fde_t *stub_fd;
+static int stub_received;
+static char stub_dropped[SLOW_QUERIES];
+
+static struct DNSQuery queries[LOAD_QUERIES];
+static int answered;
+static int wrong;
+
+/*
+ * A tiny nameserver: hN.load.test is 10.0.N/256.N%256, sN.slow.test
+ * the same but only the second time it is asked, anything else is
+ * NXDOMAIN.
+ */
+static void
+stub_read(rb_fde_t *F, void *data)
+{
+	unsigned char buf[512];
+	struct rb_sockaddr_storage from;
+	socklen_t fromlen;
+	char name[IRCD_RES_HOSTLEN + 1];
+	unsigned char *p;
+	HEADER *header;
+	int len, n, qlen;
+	char kind;
+
+	for (;;)
+	{
+		fromlen = sizeof(from);
+		len = recvfrom(rb_get_fd(F), buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+		if (len <= (int)sizeof(HEADER))
+			break;
+
+		stub_received++;
+		header = (HEADER *)(void *)buf;
+		p = buf + sizeof(HEADER);
+		if ((n = irc_dn_expand(buf, buf + len, p, name, sizeof(name))) <= 0)
+			continue;
+		qlen = n + QFIXEDSZ;
+		if (p + qlen > buf + len || p + qlen + 16 > buf + sizeof(buf))
+			continue;
+
+		header->qr = 1;
+		header->ra = 1;
+		header->qdcount = htons(1);
+		header->ancount = 0;
+		header->nscount = 0;
+		header->arcount = 0;
+
+		if (sscanf(name, "%c%d.", &kind, &n) != 2 || n < 0 || n >= LOAD_QUERIES ||
+				(kind == 's' && n >= SLOW_QUERIES))
+		{
+			header->rcode = NXDOMAIN;
+			sendto(rb_get_fd(F), buf, sizeof(HEADER) + qlen, 0, (struct sockaddr *)&from, fromlen);
+			continue;
+		}
+
+		if (kind == 's' && !stub_dropped[n]++)
+			continue;
+
+		header->rcode = NO_ERRORS;
+		header->ancount = htons(1);
+		p += qlen;
+		*p++ = 0xc0;		/* pointer to the question name */
+		*p++ = sizeof(HEADER);
+		*p++ = 0; *p++ = T_A;
+		*p++ = 0; *p++ = C_IN;
+		*p++ = 0; *p++ = 0; *p++ = 0; *p++ = 60;
+		*p++ = 0; *p++ = 4;
+		*p++ = 10; *p++ = 0; *p++ = n / 256; *p++ = n % 256;
+
+		sendto(rb_get_fd(F), buf, p - buf, 0, (struct sockaddr *)&from, fromlen);
+	}
+
+	rb_setselect(F, RB_SELECT_READ, stub_read, NULL);
+}
+
+static void
+answer_cb(void *vptr, struct DNSReply *reply)
+{
+	int n = (int)(intptr_t)vptr;
+	struct sockaddr_in *v4;
+
+	answered++;
+	if (reply == NULL || GET_SS_FAMILY(&reply->addr) != AF_INET)
+	{
+		wrong++;
+		return;
+	}
+
+	v4 = (struct sockaddr_in *)&reply->addr;
+	if (ntohl(v4->sin_addr.s_addr) != (10U << 24 | (unsigned int)n))
+		wrong++;
+}
+
+static bool
+start_stub(void)
+{
+	struct sockaddr_in *v4 = (struct sockaddr_in *)&irc_nsaddr_list[0];
+	socklen_t len = sizeof(struct sockaddr_in);
+	int bufsize = 1024 * 1024;
+
+	/* the resolver's socket was made for the first nameserver's family */
+	if (GET_SS_FAMILY(&irc_nsaddr_list[0]) != AF_INET)
+		return false;
+
+	if ((stub_fd = rb_socket(AF_INET, SOCK_DGRAM, 0, "stub nameserver")) == NULL)
+		return false;
+
+	memset(v4, 0, sizeof(*v4));
+	SET_SS_FAMILY(&irc_nsaddr_list[0], AF_INET);
+	SET_SS_LEN(&irc_nsaddr_list[0], sizeof(struct sockaddr_in));
+	v4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(rb_get_fd(stub_fd), (struct sockaddr *)v4, len) < 0 ||
+			getsockname(rb_get_fd(stub_fd), (struct sockaddr *)v4, &len) < 0)
+		return false;
+	setsockopt(rb_get_fd(stub_fd), SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+	irc_nscount = 1;
+	rb_setselect(stub_fd, RB_SELECT_READ, stub_read, NULL);
+	return true;
+}
+
+static void
+run_until(int count, int seconds)
+{
+	time_t end = rb_current_time() + seconds;
+
+	while (answered < count && rb_current_time() < end)
+		rb_select(100);
+}
+
+static void
+load1(void)
+{
+	char name[IRCD_RES_HOSTLEN + 1];
+	struct timeval start, stop;
+	int i;
+
+	answered = wrong = stub_received = 0;
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < LOAD_QUERIES; i++)
+	{
+		queries[i].ptr = (void *)(intptr_t)i;
+		queries[i].callback = answer_cb;
+		snprintf(name, sizeof(name), "h%d.load.test", i);
+		gethost_byname_type(name, &queries[i], T_A);
+
+		if (i % LOAD_BATCH == LOAD_BATCH - 1)
+			rb_select(0);
+	}
+	run_until(LOAD_QUERIES, 10);
+
+	gettimeofday(&stop, NULL);
+	diag("%d queries in %ld ms", LOAD_QUERIES,
+		(long)((stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_usec - start.tv_usec) / 1000));
+
+	is_int(LOAD_QUERIES, answered, MSG);
+	is_int(0, wrong, MSG);
+	is_int(LOAD_QUERIES, stub_received, MSG);
+}
+
+static void
+timeout1(void)
+{
+	char name[IRCD_RES_HOSTLEN + 1];
+	int i;
+
+	answered = wrong = stub_received = 0;
+
+	/* every first query goes unanswered, so each has to time out and be resent */
+	for (i = 0; i < SLOW_QUERIES; i++)
+	{
+		queries[i].ptr = (void *)(intptr_t)i;
+		queries[i].callback = answer_cb;
+		snprintf(name, sizeof(name), "s%d.slow.test", i);
+		gethost_byname_type(name, &queries[i], T_A);
+	}
+	run_until(SLOW_QUERIES, 15);
+
+	is_int(SLOW_QUERIES, answered, MSG);
+	is_int(0, wrong, MSG);
+	is_int(SLOW_QUERIES * 2, stub_received, MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+	rb_set_time();
+
+	init_resolver();
+	if (!start_stub())
+		skip_all("cannot run a stub nameserver");
+
+	plan_lazy();
+
+	load1();
+	timeout1();
+
+	return 0;
+}
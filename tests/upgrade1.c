@@ -0,0 +1,241 @@
+/*
+ *  upgrade1.c: Test carrying clients and channels over an upgrade
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "hash.h"
+#include "monitor.h"
+#include "packet.h"
+#include "privilege.h"
+#include "send.h"
+#include "upgrade.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define ALICE_ID TEST_ME_ID "AAAAAB"
+#define BOB_ID TEST_ME_ID "AAAAAC"
+
+/* a local person with a real socket, the other end of which stands in
+ * for their irc client
+ */
+static struct Client *
+make_connected_person(const char *nick, const char *id, rb_fde_t **peer)
+{
+	struct Client *client;
+	rb_fde_t *F[2];
+
+	client = make_local_person_id(nick, id);
+	client->localClient->localflags &= ~LFLAGS_FAKE;
+
+	if (rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F[0], &F[1], "upgrade test") == -1)
+		return NULL;
+
+	client->localClient->F = F[0];
+	*peer = F[1];
+	return client;
+}
+
+static const char *
+read_peer(rb_fde_t *peer)
+{
+	static char buf[BUFSIZE * 4];
+	ssize_t len, total = 0;
+
+	while ((len = read(rb_get_fd(peer), buf + total, sizeof(buf) - total - 1)) > 0)
+		total += len;
+
+	buf[total] = '\0';
+	return buf;
+}
+
+static void
+write_peer(rb_fde_t *peer, const char *data)
+{
+	ok(write(rb_get_fd(peer), data, strlen(data)) == (ssize_t)strlen(data), MSG);
+}
+
+static void
+queue_sendq(struct Client *client, const char *line)
+{
+	rb_strf_t strings = { .format = line, .format_args = NULL, .next = NULL };
+
+	rb_linebuf_put(&client->localClient->buf_sendq, &strings);
+}
+
+static void
+upgrade_clients(void)
+{
+	struct Client *alice, *bob;
+	rb_fde_t *alice_peer, *bob_peer;
+	struct Channel *chptr;
+	struct membership *msptr;
+	struct Ban *banptr;
+	struct monitor *monptr;
+	int alice_fd, bob_fd, alice_dup, bob_dup;
+	FILE *fp;
+
+	alice = make_connected_person("alice", ALICE_ID, &alice_peer);
+	bob = make_connected_person("bob", BOB_ID, &bob_peer);
+	if (!ok(alice != NULL && bob != NULL, MSG))
+		return;
+
+	make_local_person_oper(alice);
+	alice->user->opername = rb_strdup("test");
+	alice->umodes |= UMODE_INVISIBLE;
+	allocate_away(alice);
+	rb_strlcpy(alice->user->away, "gone fishing", AWAYLEN);
+	rb_strlcpy(bob->user->suser, "bobaccount", sizeof(bob->user->suser));
+
+	monptr = find_monitor("carol", 1);
+	rb_dlinkAddAlloc(alice, &monptr->users);
+	rb_dlinkAddAlloc(monptr, &alice->localClient->monitor_list);
+
+	rb_dlinkAddAlloc(alice, &bob->localClient->allow_list);
+	rb_dlinkAddAlloc(bob, &alice->on_allow_list);
+
+	chptr = make_channel();
+	chptr->channelts = 1234567890;
+	chptr->mode.mode = MODE_TOPICLIMIT | MODE_NOPRIVMSGS;
+	rb_strlcpy(chptr->mode.key, "sekrit", sizeof(chptr->mode.key));
+	set_channel_topic(chptr, "before the upgrade", "alice!username@example.test", 1234567891);
+	add_user_to_channel(chptr, alice, CHFL_CHANOP);
+	add_user_to_channel(chptr, bob, CHFL_VOICE);
+	banptr = allocate_ban("*!*@first.test", "alice", NULL);
+	banptr->when = 1000;
+	add_ban_id(chptr, &chptr->banlist, banptr);
+	banptr = allocate_ban("*!*@second.test", "alice", "#elsewhere");
+	banptr->when = 2000;
+	add_ban_id(chptr, &chptr->banlist, banptr);
+
+	/* what the old process had not yet written or parsed */
+	queue_sendq(alice, ":me.test NOTICE alice :queued before upgrade");
+	recvq_append(&bob->localClient->recvq, "PING :queued\r\nPING :par", 23);
+
+	fp = tmpfile();
+	if (!ok(fp != NULL, MSG))
+		return;
+	ok(upgrade_save(fp), MSG);
+	rewind(fp);
+
+	/* the old process goes away, keeping only the sockets */
+	alice_fd = rb_get_fd(alice->localClient->F);
+	bob_fd = rb_get_fd(bob->localClient->F);
+	alice_dup = dup(alice_fd);
+	bob_dup = dup(bob_fd);
+
+	rb_linebuf_donebuf(&alice->localClient->buf_sendq);
+	rb_linebuf_newbuf(&alice->localClient->buf_sendq);
+	remove_local_person(alice);
+	remove_local_person(bob);
+	rb_close_pending_fds();
+
+	ok(dup2(alice_dup, alice_fd) == alice_fd, MSG);
+	ok(dup2(bob_dup, bob_fd) == bob_fd, MSG);
+	close(alice_dup);
+	close(bob_dup);
+
+	read_peer(alice_peer);
+	read_peer(bob_peer);
+	is_int(0, find_named_client("alice") != NULL, MSG);
+	is_int(0, find_channel(TEST_CHANNEL) != NULL, MSG);
+
+	/* and the new one takes over */
+	ok(upgrade_restore_early(fp), MSG);
+	is_int(2, upgrade_restore(fp), MSG);
+	fclose(fp);
+
+	alice = find_named_client("alice");
+	bob = find_named_client("bob");
+	if (!ok(alice != NULL && bob != NULL, MSG))
+		return;
+
+	ok(MyClient(alice) && IsClient(alice), MSG);
+	is_string(ALICE_ID, alice->id, MSG);
+	ok(find_id(BOB_ID) == bob, MSG);
+	ok(IsOper(alice), MSG);
+	ok(alice->umodes & UMODE_INVISIBLE, MSG);
+	ok(rb_dlinkFind(alice, &local_oper_list) != NULL, MSG);
+	is_string("test", alice->user->privset->name, MSG);
+	is_string("gone fishing", alice->user->away, MSG);
+	is_string("bobaccount", bob->user->suser, MSG);
+	ok(bob->localClient->att_conf != NULL, MSG);
+	is_int(1, rb_dlink_list_length(&alice->localClient->monitor_list), MSG);
+	ok(rb_dlinkFind(alice, &bob->localClient->allow_list) != NULL, MSG);
+	ok(rb_dlinkFind(bob, &alice->on_allow_list) != NULL, MSG);
+
+	chptr = find_channel(TEST_CHANNEL);
+	if (ok(chptr != NULL, MSG))
+	{
+		is_int(1234567890, chptr->channelts, MSG);
+		is_int(MODE_TOPICLIMIT | MODE_NOPRIVMSGS, chptr->mode.mode, MSG);
+		is_string("sekrit", chptr->mode.key, MSG);
+		is_string("before the upgrade", chptr->topic, MSG);
+		is_int(1234567891, chptr->topic_time, MSG);
+
+		msptr = find_channel_membership(chptr, alice);
+		ok(msptr != NULL && is_chanop(msptr), MSG);
+		msptr = find_channel_membership(chptr, bob);
+		ok(msptr != NULL && is_voiced(msptr) && !is_chanop(msptr), MSG);
+
+		is_int(2, rb_dlink_list_length(&chptr->banlist), MSG);
+		banptr = chptr->banlist.head->data;
+		is_string("*!*@second.test", banptr->banstr, MSG);
+		is_string("#elsewhere", banptr->forward, MSG);
+		is_int(2000, banptr->when, MSG);
+	}
+
+	/* new ids carry on after the ones that were restored */
+	is_string(TEST_ME_ID "AAAAAD", generate_uid(), MSG);
+
+	/* neither connection noticed */
+	is_string(":me.test NOTICE alice :queued before upgrade" CRLF, read_peer(alice_peer), MSG);
+
+	write_peer(bob_peer, "tial" CRLF);
+	read_packet(bob->localClient->F, bob);
+	is_string(":me.test PONG me.test :queued" CRLF ":me.test PONG me.test :partial" CRLF,
+		read_peer(bob_peer), MSG);
+
+	remove_local_person(alice);
+	remove_local_person(bob);
+	rb_close(alice_peer);
+	rb_close(bob_peer);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	upgrade_clients();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ *  who1.c: Test global WHO against the WHO index
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "hash.h"
+#include "match.h"
+#include "s_stats.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define NUM_USERS 2000
+#define NUM_USERS2 100
+
+static struct Client *user;
+static struct Client *server;
+static struct Client *server2;
+static struct Client *clients[NUM_USERS + NUM_USERS2];
+static struct Channel *channel;
+
+static const char *isps[] = {
+	"comcast", "verizon", "spectrum", "telstra", "bigpond", "virginmedia",
+	"orange", "freenet", "sympatico", "rogers", "shaw", "telus", "bell",
+};
+
+static void
+make_clients(void)
+{
+	char nick[NICKLEN], username[USERLEN], host[HOSTLEN], info[REALLEN];
+	int i;
+
+	server = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+	server2 = make_remote_server_full(&me, TEST_SERVER2_NAME, TEST_SERVER2_ID);
+
+	user = make_local_person();
+	SetOper(user);
+
+	channel = make_channel();
+	add_user_to_channel(channel, user, CHFL_PEON);
+
+	for(i = 0; i < NUM_USERS + NUM_USERS2; i++)
+	{
+		snprintf(nick, sizeof(nick), "%c%c%c%d", 'a' + i % 26, 'a' + i / 26 % 26,
+				'a' + i / 676 % 26, i);
+		snprintf(username, sizeof(username), "u%d", i % 50);
+		snprintf(host, sizeof(host), "host%d.%s.net", i, isps[i % 13]);
+		snprintf(info, sizeof(info), "Real-Name-%d", i);
+
+		clients[i] = make_remote_person_full(i < NUM_USERS ? server : server2,
+				nick, username, host, TEST_IP, info);
+		rb_strlcpy(clients[i]->orighost, i % 17 ? host : "hidden.orig.example.net",
+				sizeof(clients[i]->orighost));
+		update_who_index(clients[i]);
+		rb_dlinkAddTail(clients[i], &clients[i]->node, &global_client_list);
+
+		/* some invisible clients, a few of them sharing a channel */
+		if(i % 7 == 0)
+		{
+			SetInvisible(clients[i]);
+			if(i % 3 == 0)
+				add_user_to_channel(channel, clients[i], CHFL_PEON);
+		}
+	}
+}
+
+static int
+expected_matches(const char *mask)
+{
+	struct Client *target_p;
+	int i, count = 0;
+
+	for(i = 0; i < NUM_USERS + NUM_USERS2; i++)
+	{
+		target_p = clients[i];
+
+		if(IsInvisible(target_p) && find_channel_membership(channel, target_p) == NULL)
+			continue;
+
+		if(match(mask, target_p->name) || match(mask, target_p->username) ||
+				match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
+				match(mask, target_p->orighost) || match(mask, target_p->info))
+			count++;
+	}
+
+	return count;
+}
+
+static int
+who_matches(const char *mask)
+{
+	char command[BUFSIZE];
+	const char *line;
+	int count = 0;
+
+	snprintf(command, sizeof(command), "WHO %s", mask);
+	client_util_parse(user, command);
+
+	while(*(line = get_client_sendq(user)) != '\0')
+	{
+		if(strstr(line, " 352 ") != NULL)
+			count++;
+		else if(strstr(line, " 416 ") != NULL)
+			count = -1;
+	}
+
+	return count;
+}
+
+static void
+check_mask(const char *mask, int indexed)
+{
+	unsigned int whoi = ServerStats.is_whoi;
+	unsigned int whos = ServerStats.is_whos;
+	unsigned long long whoc = ServerStats.is_whoc;
+	int expected = expected_matches(mask);
+
+	ok(expected < 500, "%s: %d matches fit in one reply", mask, expected);
+	is_int(expected, who_matches(mask), "%s: matches", mask);
+	is_int(indexed, ServerStats.is_whoi - whoi, "%s: indexed", mask);
+	is_int(!indexed, ServerStats.is_whos - whos, "%s: scanned", mask);
+	diag("%s: %d matches, %llu clients examined", mask, expected, ServerStats.is_whoc - whoc);
+
+	/* marks from common channels must all be cleared again */
+	ok(!IsMarked(clients[0]) && !IsMarked(clients[21]) && !IsMarked(server2), "%s: marks cleared", mask);
+}
+
+static void
+who_index1(void)
+{
+	char mask[NICKLEN + 2];
+
+	snprintf(mask, sizeof(mask), "%.5s*", clients[123]->name);
+	check_mask(mask, 1);
+	snprintf(mask, sizeof(mask), "%.4s*", clients[1234]->name);
+	check_mask(mask, 1);
+	mask[0] = irctoupper(mask[0]);
+	check_mask(mask, 1);
+	check_mask("*.rogers.net", 1);
+	check_mask("HOST1*.VIRGINMEDIA.NET", 1);
+	check_mask("host2?.telstra.net", 1);
+	check_mask("Real-Name-42", 1);
+	check_mask("*name-1?3", 0);
+	check_mask("*.orig.example.net", 1);
+	check_mask(TEST_SERVER2_NAME, 1);
+	check_mask("*.shaw.net", 0);
+	check_mask("*zz*", 0);
+	check_mask("u?", 0);
+	check_mask("u4*", 0);
+}
+
+static int
+in_bucket(rb_dlink_list *bucket, struct Client *client_p)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, bucket->head)
+	{
+		if(ptr->data == client_p)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+who_index_update1(void)
+{
+	del_from_client_hash(clients[5]->name, clients[5]);
+	rb_strlcpy(clients[5]->name, "renamed5", sizeof(clients[5]->name));
+	add_to_client_hash(clients[5]->name, clients[5]);
+	update_who_index(clients[5]);
+
+	rb_strlcpy(clients[6]->host, "moved.elsewhere.test", sizeof(clients[6]->host));
+	update_who_index(clients[6]);
+
+	check_mask("rena*", 1);
+	check_mask("*.elsewhere.test", 1);
+	check_mask("host6.*", 0);
+	check_mask("*.orange.net", 1);
+
+	del_from_who_index(clients[5]);
+	ok(clients[5]->user->who_entry == NULL, MSG);
+	ok(!in_bucket(find_who_prefix("rena"), clients[5]), MSG);
+	add_to_who_index(clients[5]);
+	ok(in_bucket(find_who_prefix("rena"), clients[5]), MSG);
+	ok(in_bucket(find_who_suffix("where.test"), clients[6]), MSG);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	make_clients();
+
+	who_index1();
+	who_index_update1();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}
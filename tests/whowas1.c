@@ -0,0 +1,163 @@
+/*
+ *  whowas1.c: Test the WHOWAS ring
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "whowas.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+sign_off(const char *nick, const char *realname)
+{
+	struct Client *client = make_local_person_nick(nick);
+
+	rb_strlcpy(client->info, realname, sizeof(client->info));
+	remove_local_person(client);
+}
+
+static struct Whowas *
+newest(const char *nick)
+{
+	rb_dlink_list *list = whowas_get_list(nick);
+
+	if (list == NULL || list->head == NULL)
+		return NULL;
+	return list->head->data;
+}
+
+static size_t
+history_length(void)
+{
+	size_t count = 0, memused = 0;
+
+	whowas_memory_usage(&count, &memused);
+	return count;
+}
+
+static void
+ring_wraps(void)
+{
+	struct Whowas *beta, *gamma;
+
+	whowas_set_size(3);
+	is_int(0, history_length(), MSG);
+
+	sign_off("alpha", TEST_REALNAME);
+	sign_off("beta", TEST_REALNAME);
+	sign_off("gamma", TEST_REALNAME);
+	is_int(3, history_length(), MSG);
+
+	sign_off("delta", TEST_REALNAME);
+	is_int(3, history_length(), MSG);
+	ok(whowas_get_list("alpha") == NULL, MSG);
+
+	beta = newest("beta");
+	gamma = newest("gamma");
+	if (ok(beta != NULL && gamma != NULL, MSG))
+	{
+		is_string("beta", beta->name, MSG);
+		is_string(TEST_USERNAME, beta->username, MSG);
+		is_string(TEST_HOSTNAME, beta->hostname, MSG);
+		is_string(TEST_IP, beta->sockhost, MSG);
+		is_string(TEST_REALNAME, beta->realname, MSG);
+		is_string("", beta->suser, MSG);
+		is_string(me.name, beta->servername, MSG);
+
+		/* the same strings are only stored once */
+		ok(beta->hostname == gamma->hostname, MSG);
+		ok(beta->realname == gamma->realname, MSG);
+	}
+
+	/* a nick used again gets a second entry, newest first */
+	sign_off("gamma", "second");
+	ok(whowas_get_list("beta") == NULL, MSG);
+	is_int(2, rb_dlink_list_length(whowas_get_list("GAMMA")), MSG);
+	is_string("second", newest("gamma")->realname, MSG);
+}
+
+static void
+ring_resizes(void)
+{
+	size_t count = 0, memused = 0;
+
+	/* shrinking keeps the newest entries */
+	whowas_set_size(2);
+	is_int(2, history_length(), MSG);
+	is_int(1, rb_dlink_list_length(whowas_get_list("gamma")), MSG);
+	is_string("second", newest("gamma")->realname, MSG);
+	ok(newest("delta") != NULL, MSG);
+
+	/* growing keeps all of them */
+	whowas_set_size(5);
+	sign_off("epsilon", TEST_REALNAME);
+	is_int(3, history_length(), MSG);
+	ok(newest("delta") != NULL, MSG);
+	ok(newest("gamma") != NULL, MSG);
+	ok(newest("epsilon") != NULL, MSG);
+
+	whowas_memory_usage(&count, &memused);
+	ok(memused >= 5 * sizeof(struct Whowas), MSG);
+
+	whowas_set_size(0);
+	is_int(0, history_length(), MSG);
+	ok(whowas_get_list("gamma") == NULL, MSG);
+	sign_off("zeta", TEST_REALNAME);
+	is_int(0, history_length(), MSG);
+}
+
+static void
+nick_chasing(void)
+{
+	struct Client *client;
+
+	whowas_set_size(10);
+
+	client = make_local_person_nick("eta");
+	whowas_add_history(client, 1);
+	ok(whowas_get_history("eta", 60) == client, MSG);
+
+	remove_local_person(client);
+	ok(whowas_get_history("eta", 60) == NULL, MSG);
+	is_int(2, rb_dlink_list_length(whowas_get_list("eta")), MSG);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	ring_wraps();
+	ring_resizes();
+	nick_chasing();
+
+	client_util_free();
+	ircd_util_free();
+
+	return 0;
+}